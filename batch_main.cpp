@@ -0,0 +1,391 @@
+/*
+ * FILE:
+ *   batch_main.cpp
+ *
+ * PURPOSE:
+ *   Headless batch runner. Runs one or more scenario files (see
+ *   scenario.hpp) on the CPU solver, with no window, GUI or D3D, and
+ *   reports the stats and the throughput (cell updates per second)
+ *   of each run. Scenarios are run concurrently on a pool of threads.
+ *   Scenarios with a render_interval also write out frames, drawn by
+ *   the software renderer (soft_renderer.hpp).
+ *
+ *   Usage: shallow_water_batch [-j <threads>] <scenario file>...
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "brush_log.hpp"
+#include "cpu_solver.hpp"
+#include "initial_conditions.hpp"
+#include "mip_cache.hpp"
+#include "png_writer.hpp"
+#include "probe_set.hpp"
+#include "scenario.hpp"
+#include "settings.hpp"
+#include "soft_renderer.hpp"
+#include "terrain_heightfield.hpp"
+
+#include "coercri/timer/generic_timer.hpp"
+
+#include "boost/scoped_ptr.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    // g_settings and the terrain generator are global, so only one
+    // thread at a time may set up a run. Once the CpuSolver has been
+    // created it has its own copy of everything it needs.
+    std::mutex g_setup_mutex;
+
+    // serializes the output (so lines from different runs don't get mixed up)
+    std::mutex g_output_mutex;
+
+    // as in main.cpp
+    const int STEPS_BETWEEN_RESET = 10;
+
+    struct RunResult {
+        RunResult() : ok(false), nx(0), ny(0), steps(0), nsec(0), frames(0), render_nsec(0) { }
+        bool ok;
+        std::string error;
+        int nx, ny;
+        long long steps;
+        unsigned long long nsec;    // simulation only (not rendering)
+        int frames;
+        unsigned long long render_nsec;
+    };
+
+    // Textures for the renderer, shared by all runs (loaded once, by main)
+    struct RenderTextures {
+        MipChains grass, skybox;
+    };
+
+    void LoadRenderTextures(RenderTextures &textures)
+    {
+        // the same files (and caches) as ShallowWaterEngine::loadGraphics and loadSkybox
+        LoadMipChains(std::vector<std::string>(1, "Grass01.bmp"), "grass01.mips", textures.grass);
+
+        const char * filenames[] = {
+            "skybox_east.bmp", "skybox_west.bmp", "skybox_north.bmp", "skybox_south.bmp", "skybox_up.bmp"
+        };
+        LoadMipChains(std::vector<std::string>(filenames, filenames + 5), "skybox.mips", textures.skybox);
+    }
+
+    // Draws a frame and writes it out, as the scenario asks
+    void RenderFrame(const Scenario &scenario, SoftRenderer &renderer, const std::vector<TerrainEntry> &heightfield,
+                     const CpuSolver &solver, int frame)
+    {
+        SoftCamera camera;
+        camera.x = scenario.camera[0];
+        camera.y = scenario.camera[1];
+        camera.z = scenario.camera[2];
+        camera.yaw = scenario.camera[3];
+        camera.pitch = scenario.camera[4];
+        renderer.render(camera, &heightfield[0], solver.getState(), scenario.render_width, scenario.render_height);
+
+        const std::string prefix = scenario.render_output.empty() ? scenario.name : scenario.render_output;
+        const size_t num_bytes = size_t(renderer.getWidth()) * renderer.getHeight() * 4;
+
+        if (scenario.render_raw) {
+            const std::string filename = prefix + ".rgba";
+            std::ofstream str(filename.c_str(), std::ios::out | std::ios::binary | (frame == 0 ? std::ios::trunc : std::ios::app));
+            str.write(reinterpret_cast<const char*>(renderer.getPixels()), num_bytes);
+            if (!str) throw std::runtime_error("Could not write " + filename);
+        } else {
+            char number[16];
+            std::sprintf(number, "_%05d.png", frame);
+            WritePNG(prefix + number, renderer.getWidth(), renderer.getHeight(), renderer.getPixels());
+        }
+    }
+
+    void ReportStats(const Scenario &scenario, float time, const SimStats &stats)
+    {
+        std::lock_guard<std::mutex> lock(g_output_mutex);
+        std::printf("%s: t=%g mass=%g x_momentum=%g y_momentum=%g ke=%g pe=%g total_energy=%g "
+                    "max_speed=%g max_depth=%g max_froude_number=%g\n",
+                    scenario.name.c_str(), time, stats.mass, stats.x_momentum, stats.y_momentum,
+                    stats.kinetic_energy, stats.potential_energy,
+                    stats.kinetic_energy + stats.potential_energy,
+                    stats.max_speed, stats.max_depth, stats.max_froude_number);
+        std::fflush(stdout);
+    }
+
+    void ReportProbes(const Scenario &scenario, const ProbeSet &probes)
+    {
+        std::lock_guard<std::mutex> lock(g_output_mutex);
+        const ProbeSample *samples = probes.getResults();
+        for (int i = 0; i < probes.size(); ++i) {
+            std::printf("%s: t=%g probe=%d x=%g y=%g depth=%g u=%g v=%g surface=%g\n",
+                        scenario.name.c_str(), probes.getSampleTime(), i, probes.getX(i), probes.getY(i),
+                        samples[i].depth, samples[i].u, samples[i].v, samples[i].surface);
+        }
+        std::fflush(stdout);
+    }
+
+    void RunScenario(const Scenario &scenario, const RenderTextures *textures, int render_threads,
+                     Coercri::Timer &timer, RunResult &result)
+    {
+        boost::scoped_ptr<CpuSolver> solver;
+        BrushLog brush_log;
+        boost::scoped_ptr<SoftRenderer> renderer;
+        std::vector<TerrainEntry> heightfield;
+
+        {
+            std::lock_guard<std::mutex> lock(g_setup_mutex);
+
+            const ResetType reset_type = ApplyScenario(scenario);
+
+            SimSettings settings;
+            GetSimSettings(settings);
+            if (settings.nx < 4 || settings.ny < 4) {
+                throw std::runtime_error("mesh_size_x and mesh_size_y must be at least 4");
+            }
+
+            UpdateTerrainHeightfield();
+
+            std::vector<float> ic((settings.nx + 4) * (settings.ny + 4) * 4);
+            ComputeInitialConditions(reset_type, &ic[0]);
+
+            solver.reset(new CpuSolver(settings, &g_bottom[0], g_inlet_x, &ic[0]));
+
+            if (scenario.render_interval > 0) {
+                RenderSettings render_settings;
+                GetRenderSettings(render_settings);
+                renderer.reset(new SoftRenderer(render_settings, textures->grass, textures->skybox, render_threads));
+                heightfield.assign(&g_terrain_heightfield[0], &g_terrain_heightfield[0] + ic.size() / 4);
+            }
+
+            if (!scenario.brush_log.empty()) {
+                LoadBrushLog(scenario.brush_log, brush_log);
+                if (brush_log.nx != settings.nx || brush_log.ny != settings.ny
+                    || brush_log.W != settings.W || brush_log.L != settings.L) {
+                    throw std::runtime_error("brush log was recorded with different mesh settings: " + scenario.brush_log);
+                }
+            }
+        }
+
+        result.nx = solver->getNX();
+        result.ny = solver->getNY();
+
+        // brush strokes due by the start of each step are applied together
+        BrushReplay brush_replay(brush_log);
+        boost::scoped_ptr<BrushBatch> brush_batch;
+        if (!brush_log.events.empty()) {
+            brush_batch.reset(new BrushBatch(result.nx, result.ny, brush_log.W, brush_log.L));
+        }
+
+        ProbeSet probes;
+        for (size_t i = 0; i < scenario.probes.size(); ++i) {
+            probes.add(scenario.probes[i].first, scenario.probes[i].second);
+        }
+
+        const float duration = scenario.duration;
+        const float interval = scenario.output_interval > 0 ? scenario.output_interval : duration;
+        float next_output = std::min(interval, duration);
+
+        // frames are due at 0, render_interval, 2 * render_interval, ... (up to the duration)
+        float next_frame = renderer ? 0 : duration + 1;
+        if (renderer) {
+            const unsigned long long render_start = timer.getNsec();
+            RenderFrame(scenario, *renderer, heightfield, *solver, result.frames++);
+            result.render_nsec += timer.getNsec() - render_start;
+            next_frame = scenario.render_interval;
+        }
+
+        SimStats stats;
+        solver->resetTimestep(std::min(next_output, next_frame), stats);
+        ReportStats(scenario, 0, stats);
+        if (!probes.empty()) {
+            solver->sampleProbes(probes);
+            ReportProbes(scenario, probes);
+        }
+
+        const unsigned long long first_frame_nsec = result.render_nsec;
+        const unsigned long long start_time = timer.getNsec();
+
+        while (solver->getTotalTime() < duration) {
+
+            const float next_stop = std::min(next_output, next_frame);
+            for (int i = 0; i < STEPS_BETWEEN_RESET && solver->getTotalTime() < next_stop; ++i) {
+                // don't step past the next output (or frame) time
+                if (solver->getTotalTime() + solver->getTimestep() > next_stop) {
+                    solver->resetTimestep(next_stop - solver->getTotalTime(), stats);
+                }
+                if (brush_batch && brush_replay.collect(solver->getTotalTime(), *brush_batch) > 0) {
+                    solver->applyBrushBatch(*brush_batch);
+                    brush_batch->clear();
+                }
+                solver->timestep();
+                ++result.steps;
+            }
+
+            const bool output_due = solver->getTotalTime() >= next_output;
+            if (output_due) next_output = std::min(next_output + interval, duration);
+
+            if (solver->getTotalTime() >= next_frame) {
+                const unsigned long long render_start = timer.getNsec();
+                RenderFrame(scenario, *renderer, heightfield, *solver, result.frames++);
+                result.render_nsec += timer.getNsec() - render_start;
+                next_frame += scenario.render_interval;
+                if (next_frame > duration) next_frame = duration + 1;   // (no more frames)
+            }
+
+            solver->resetTimestep(std::max(std::min(next_output, next_frame) - solver->getTotalTime(), 0.0f), stats);
+
+            if (!(stats.mass == stats.mass) || !(stats.max_depth == stats.max_depth)) {   // NaN check
+                throw std::runtime_error("simulation became unstable");
+            }
+            if (solver->getTimestep() <= 0 && solver->getTotalTime() < duration) {
+                throw std::runtime_error("timestep became zero");
+            }
+
+            if (output_due) {
+                ReportStats(scenario, solver->getTotalTime(), stats);
+                if (!probes.empty()) {
+                    solver->sampleProbes(probes);
+                    ReportProbes(scenario, probes);
+                }
+            }
+        }
+
+        result.nsec = timer.getNsec() - start_time - (result.render_nsec - first_frame_nsec);
+        result.ok = true;
+    }
+
+    // (at least 1 ns, so that rates are never divided by zero)
+    double Seconds(unsigned long long nsec)
+    {
+        return double(std::max(nsec, 1ull)) * 1.0e-9;
+    }
+
+    void Usage()
+    {
+        std::fprintf(stderr, "Usage: shallow_water_batch [-j <threads>] <scenario file>...\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int num_threads = int(std::thread::hardware_concurrency());
+    std::vector<std::string> filenames;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            num_threads = std::atoi(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            Usage();
+            return 1;
+        } else {
+            filenames.push_back(argv[i]);
+        }
+    }
+
+    if (filenames.empty()) {
+        Usage();
+        return 1;
+    }
+
+    // Load all scenarios up front, so that errors in the files are reported straight away
+    std::vector<Scenario> scenarios(filenames.size());
+    try {
+        for (size_t i = 0; i < filenames.size(); ++i) {
+            LoadScenarioFile(filenames[i], scenarios[i]);
+        }
+    } catch (std::exception &e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    num_threads = std::max(1, std::min(num_threads, int(scenarios.size())));
+
+    // The renderer's threads are shared out between the concurrent runs
+    const int render_threads = std::max(1, int(std::thread::hardware_concurrency()) / num_threads);
+
+    RenderTextures textures;
+    bool any_render = false;
+    for (size_t i = 0; i < scenarios.size(); ++i) {
+        if (scenarios[i].render_interval > 0) any_render = true;
+    }
+    if (any_render) {
+        try {
+            LoadRenderTextures(textures);
+        } catch (std::exception &e) {
+            std::fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+    }
+
+    Coercri::GenericTimer timer;
+    std::vector<RunResult> results(scenarios.size());
+    std::atomic<int> next_scenario(0);
+
+    const unsigned long long start_time = timer.getNsec();
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; ++t) {
+        threads.push_back(std::thread([&]() {
+            for (int i = next_scenario++; i < int(scenarios.size()); i = next_scenario++) {
+                try {
+                    RunScenario(scenarios[i], &textures, render_threads, timer, results[i]);
+                } catch (std::exception &e) {
+                    results[i].error = e.what();
+                }
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); ++t) threads[t].join();
+
+    const double total_seconds = Seconds(timer.getNsec() - start_time);
+
+    // Summary
+    std::printf("\n%-30s %10s %10s %10s %16s\n", "scenario", "cells", "steps", "seconds", "cell-updates/s");
+
+    int num_failed = 0;
+    double total_cell_updates = 0;
+    for (size_t i = 0; i < scenarios.size(); ++i) {
+        const RunResult &r = results[i];
+        if (!r.ok) {
+            std::printf("%-30s FAILED: %s\n", scenarios[i].name.c_str(), r.error.c_str());
+            ++num_failed;
+            continue;
+        }
+        const double cell_updates = double(r.nx) * double(r.ny) * double(r.steps);
+        const double seconds = Seconds(r.nsec);
+        total_cell_updates += cell_updates;
+        std::printf("%-30s %10d %10lld %10.6f %16.4g\n",
+                    scenarios[i].name.c_str(), r.nx * r.ny, r.steps, seconds, cell_updates / seconds);
+    }
+
+    if (any_render) {
+        std::printf("\n%-30s %10s %10s %10s\n", "scenario", "frames", "seconds", "frames/s");
+        for (size_t i = 0; i < scenarios.size(); ++i) {
+            const RunResult &r = results[i];
+            if (!r.ok || r.frames == 0) continue;
+            std::printf("%-30s %10d %10.6f %10.3g\n", scenarios[i].name.c_str(), r.frames, Seconds(r.render_nsec),
+                        r.frames / Seconds(r.render_nsec));
+        }
+    }
+
+    std::printf("\nTotal: %d run(s) on %d thread(s) in %.6f s, %.4g cell-updates/s overall\n",
+                int(scenarios.size()), num_threads, total_seconds, total_cell_updates / total_seconds);
+
+    return num_failed == 0 ? 0 : 1;
+}
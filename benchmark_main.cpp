@@ -0,0 +1,424 @@
+/*
+ * FILE:
+ *   benchmark_main.cpp
+ *
+ * PURPOSE:
+ *   Benchmark for the simulation. Times each stage of the CPU solver
+ *   (Pass1 reconstruct, Pass2 flux, Pass3 update, boundaries,
+ *   GetStats), the terrain build, the patch lod errors and the full
+ *   timestep, over a range of grid sizes and the standard initial
+ *   conditions, and the software renderer (a 1280x720 frame, in
+ *   frames and pixels per second rather than cell updates).
+ *   Also reports the vertex cache miss ratio (ACMR) of the mesh
+ *   index data.
+ *   Results (mean, median, 99th percentile and worst time per
+ *   iteration) are written as JSON, so they can be compared between
+ *   releases.
+ *
+ *   Usage: shallow_water_benchmark [-o <output.json>] [-t <min seconds per test>]
+ *                                  [-s <size>[,<size>...]]
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "cpu_solver.hpp"
+#include "initial_conditions.hpp"
+#include "latency_histogram.hpp"
+#include "mesh.hpp"
+#include "mip_cache.hpp"
+#include "patch_quadtree.hpp"
+#include "presets.hpp"
+#include "settings.hpp"
+#include "soft_renderer.hpp"
+#include "terrain_heightfield.hpp"
+
+#include "coercri/timer/generic_timer.hpp"
+
+#include "boost/scoped_ptr.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <vector>
+
+namespace {
+
+    const int DEFAULT_SIZES[] = { 64, 128, 256, 512, 1024, 1200, 1600, 2048 };
+
+    // size of the software renderer's frames
+    const int RENDER_WIDTH = 1280, RENDER_HEIGHT = 720;
+
+    struct InitialCondition {
+        const char *name;
+        const char *preset;
+    };
+
+    const InitialCondition INITIAL_CONDITIONS[] = {
+        { "valley", "valley" },   // R_VALLEY
+        { "sea", "sea" },         // R_SEA
+        { "square", "flat" }      // R_SQUARE
+    };
+
+    struct Result {
+        std::string initial_condition;
+        std::string stage;
+        int nx, ny;
+        int iterations;
+        double seconds;            // mean per iteration
+        double p50_seconds, p99_seconds, max_seconds;
+        double bytes_per_cell;
+        int frame_width, frame_height;   // for rendering stages (one frame per iteration); 0 otherwise
+    };
+
+    class Benchmark {
+    public:
+        Benchmark(Coercri::Timer &timer_, double min_seconds_)
+            : timer(timer_), min_seconds(min_seconds_) { }
+
+        // Calls f() repeatedly until at least min_seconds have elapsed (and at least
+        // twice, the first call being a warm-up). Each call (but the warm-up) is
+        // timed into the histogram, which is cleared first.
+        template<class F>
+        void run(F f, LatencyHistogram &times)
+        {
+            f();   // warm up
+
+            times.clear();
+            const unsigned long long start = timer.getNsec();
+            unsigned long long now = start;
+            do {
+                f();
+                const unsigned long long prev = now;
+                now = timer.getNsec();
+                times.record(now - prev);
+            } while (double(now - start) < min_seconds * 1.0e9 || times.getCount() < 2);
+        }
+
+    private:
+        Coercri::Timer &timer;
+        double min_seconds;
+    };
+
+    // function objects for the things being timed
+    struct RunStage {
+        RunStage(CpuSolver &s, CpuSolver::Stage st) : solver(s), stage(st) { }
+        void operator()() { solver.runStage(stage); }
+        CpuSolver &solver;
+        CpuSolver::Stage stage;
+    };
+
+    struct RunTimestep {
+        explicit RunTimestep(CpuSolver &s) : solver(s) { }
+        void operator()() { solver.timestep(); }
+        CpuSolver &solver;
+    };
+
+    struct RunSoftRender {
+        RunSoftRender(SoftRenderer &r, const CpuSolver &s) : renderer(r), solver(s)
+        {
+            // the GUI's starting view of the valley
+            camera.x = -90;
+            camera.y = 280;
+            camera.z = 40;
+            camera.yaw = 2.7f;
+            camera.pitch = -0.2f;
+        }
+        void operator()() { renderer.render(camera, &g_terrain_heightfield[0], solver.getState(), RENDER_WIDTH, RENDER_HEIGHT); }
+        SoftRenderer &renderer;
+        const CpuSolver &solver;
+        SoftCamera camera;
+    };
+
+    struct RunTerrainBuild {
+        void operator()() { UpdateTerrainHeightfield(); }
+    };
+
+    struct RunPatchTerrain {
+        explicit RunPatchTerrain(PatchQuadtree &q) : quadtree(q) { }
+        void operator()() { quadtree.updateTerrain(&g_terrain_heightfield[0]); }
+        PatchQuadtree &quadtree;
+    };
+
+    // post-transform cache sizes for the ACMR figures
+    const int ACMR_CACHE_SIZES[] = { 16, 32 };
+
+    struct AcmrResult {
+        int lod;
+        int cache_size;
+        float row_major;
+        float optimized;
+    };
+
+    const char * STAGE_NAMES[CpuSolver::NUM_STAGES] = {
+        "pass1_reconstruct",
+        "pass2_flux",
+        "pass3_update",
+        "boundaries",
+        "get_stats"
+    };
+
+    Result MakeResult(const char *ic, const char *stage, int nx, int ny, const LatencyHistogram &times)
+    {
+        Result r;
+        r.initial_condition = ic;
+        r.stage = stage;
+        r.nx = nx;
+        r.ny = ny;
+        r.iterations = int(times.getCount());
+        r.seconds = times.getMean() / 1.0e9;
+        r.p50_seconds = times.getPercentile(0.5) / 1.0e9;
+        r.p99_seconds = times.getPercentile(0.99) / 1.0e9;
+        r.max_seconds = times.getMax() / 1.0e9;
+        r.bytes_per_cell = 0;
+        r.frame_width = r.frame_height = 0;
+        return r;
+    }
+
+    void AddResult(std::vector<Result> &results, const char *ic, const char *stage,
+                   int nx, int ny, const LatencyHistogram &times, double bytes_per_cell)
+    {
+        Result r = MakeResult(ic, stage, nx, ny, times);
+        r.bytes_per_cell = bytes_per_cell;
+        results.push_back(r);
+
+        const double cells = double(nx) * double(ny);
+        const double seconds = r.seconds;
+        std::fprintf(stderr, "%-8s %5dx%-5d %-18s %12.4g cell-updates/s %8.1f bytes/cell %10.4g GB/s"
+                     "  p50 %.4g ms p99 %.4g ms\n",
+                     ic, nx, ny, stage, cells / seconds, bytes_per_cell,
+                     cells * bytes_per_cell / seconds / 1.0e9,
+                     r.p50_seconds * 1.0e3, r.p99_seconds * 1.0e3);
+    }
+
+    // As AddResult, for a stage that renders one w * h frame per iteration
+    // (which is measured in frames, not cells, whatever the grid size).
+    void AddRenderResult(std::vector<Result> &results, const char *ic, const char *stage,
+                         int nx, int ny, const LatencyHistogram &times, int w, int h)
+    {
+        Result r = MakeResult(ic, stage, nx, ny, times);
+        r.frame_width = w;
+        r.frame_height = h;
+        results.push_back(r);
+
+        std::fprintf(stderr, "%-8s %5dx%-5d %-18s %12.4g frames/s (%dx%d) %10.4g pixels/s"
+                     "  p50 %.4g ms p99 %.4g ms\n",
+                     ic, nx, ny, stage, 1.0 / r.seconds, w, h, double(w) * double(h) / r.seconds,
+                     r.p50_seconds * 1.0e3, r.p99_seconds * 1.0e3);
+    }
+
+    // grass and skybox are null if the textures could not be loaded (then the renderer is skipped)
+    void RunBenchmarks(Benchmark &bm, const InitialCondition &ic, int n, const MipChains *grass,
+                       const MipChains *skybox, std::vector<Result> &results)
+    {
+        ResetType reset_type = R_VALLEY;
+        ResetSettings();
+        ApplyPreset(ic.preset, reset_type);
+        SetSetting(SH_MESH_SIZE_X, float(n));
+        SetSetting(SH_MESH_SIZE_Y, float(n));
+
+        SimSettings settings;
+        GetSimSettings(settings);
+        const double cells = double(n) * double(n);
+        LatencyHistogram times;
+
+        // terrain build
+        bm.run(RunTerrainBuild(), times);
+        AddResult(results, ic.name, "terrain_build", n, n, times,
+                  (double(n+4) * double(n+4) * (sizeof(TerrainEntry) + sizeof(BottomEntry))) / cells);
+
+        // patch bounds and lod errors (all patches, as after a terrain change)
+        PatchQuadtree quadtree;
+        quadtree.resize(n, n, GetSetting(SH_VALLEY_WIDTH), GetSetting(SH_VALLEY_LENGTH));
+        bm.run(RunPatchTerrain(quadtree), times);
+        AddResult(results, ic.name, "patch_terrain", n, n, times,
+                  double(n) * double(n) * sizeof(TerrainEntry) / cells);
+
+        // set up the solver (run a few timesteps first so that the water is moving)
+        std::vector<float> initial_state((n+4) * (n+4) * 4);
+        ComputeInitialConditions(reset_type, &initial_state[0]);
+        CpuSolver solver(settings, &g_bottom[0], g_inlet_x, &initial_state[0]);
+        std::vector<float>().swap(initial_state);
+
+        SimStats stats;
+        solver.resetTimestep(1.0f, stats);
+        for (int i = 0; i < 10; ++i) solver.timestep();
+        solver.resetTimestep(1.0f, stats);
+
+        // individual stages
+        double step_bytes = 0;
+        for (int s = 0; s < CpuSolver::NUM_STAGES; ++s) {
+            const CpuSolver::Stage stage = CpuSolver::Stage(s);
+            bm.run(RunStage(solver, stage), times);
+            const double bytes = solver.getStageBytes(stage);
+            if (stage != CpuSolver::STAGE_STATS) step_bytes += bytes;
+            AddResult(results, ic.name, STAGE_NAMES[s], n, n, times, bytes / cells);
+        }
+
+        // full timestep
+        bm.run(RunTimestep(solver), times);
+        AddResult(results, ic.name, "full_step", n, n, times, step_bytes / cells);
+
+        // software renderer (all threads)
+        if (grass && skybox) {
+            RenderSettings render_settings;
+            GetRenderSettings(render_settings);
+            SoftRenderer renderer(render_settings, *grass, *skybox);
+            bm.run(RunSoftRender(renderer, solver), times);
+            AddRenderResult(results, ic.name, "soft_render", n, n, times, RENDER_WIDTH, RENDER_HEIGHT);
+        }
+    }
+
+    // Vertex cache miss ratio of the (unstitched) patch index data at each lod,
+    // in plain row-major order and as actually used. The mesh has no other
+    // geometry, and this is the same for every mesh size, so it is only done once.
+    void MeasureACMR(std::vector<AcmrResult> &acmr)
+    {
+        std::vector<PatchIndex> row_major, optimized;
+        std::vector<PatchIndexRange> ranges;
+        BuildPatchIndices(row_major, ranges, false);
+        BuildPatchIndices(optimized, ranges, true);
+        std::fprintf(stderr, "mesh index data: %d bytes\n", int(optimized.size() * sizeof(PatchIndex)));
+
+        for (int lod = 0; lod < NUM_PATCH_LODS; ++lod) {
+            const PatchIndexRange &range = ranges[lod * NUM_STITCH_MASKS];
+            for (size_t c = 0; c < sizeof(ACMR_CACHE_SIZES)/sizeof(ACMR_CACHE_SIZES[0]); ++c) {
+                AcmrResult r;
+                r.lod = lod;
+                r.cache_size = ACMR_CACHE_SIZES[c];
+                r.row_major = ComputeACMR(&row_major[range.start], range.count, r.cache_size);
+                r.optimized = ComputeACMR(&optimized[range.start], range.count, r.cache_size);
+                acmr.push_back(r);
+
+                std::fprintf(stderr, "mesh lod %d  cache %2d  %8.3f acmr row-major %8.3f acmr optimised\n",
+                             r.lod, r.cache_size, r.row_major, r.optimized);
+            }
+        }
+    }
+
+    void WriteJSON(std::FILE *fp, const std::vector<Result> &results, const std::vector<AcmrResult> &acmr)
+    {
+        std::fprintf(fp, "{\n  \"benchmark\": \"shallow_water\",\n  \"results\": [\n");
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Result &r = results[i];
+            const double cells = double(r.nx) * double(r.ny);
+            std::fprintf(fp,
+                         "    { \"initial_condition\": \"%s\", \"stage\": \"%s\", \"nx\": %d, \"ny\": %d, "
+                         "\"iterations\": %d, \"seconds_per_iteration\": %.9g, "
+                         "\"p50_seconds\": %.9g, \"p99_seconds\": %.9g, \"max_seconds\": %.9g, ",
+                         r.initial_condition.c_str(), r.stage.c_str(), r.nx, r.ny,
+                         r.iterations, r.seconds, r.p50_seconds, r.p99_seconds, r.max_seconds);
+            if (r.frame_width > 0) {
+                std::fprintf(fp,
+                             "\"frame_width\": %d, \"frame_height\": %d, "
+                             "\"frames_per_second\": %.6g, \"pixels_per_second\": %.6g }%s\n",
+                             r.frame_width, r.frame_height, 1.0 / r.seconds,
+                             double(r.frame_width) * double(r.frame_height) / r.seconds,
+                             i + 1 < results.size() ? "," : "");
+            } else {
+                std::fprintf(fp,
+                             "\"cell_updates_per_second\": %.6g, \"bytes_per_cell\": %.6g, "
+                             "\"bandwidth_bytes_per_second\": %.6g }%s\n",
+                             cells / r.seconds, r.bytes_per_cell,
+                             cells * r.bytes_per_cell / r.seconds,
+                             i + 1 < results.size() ? "," : "");
+            }
+        }
+        std::fprintf(fp, "  ],\n  \"mesh_acmr\": [\n");
+        for (size_t i = 0; i < acmr.size(); ++i) {
+            const AcmrResult &r = acmr[i];
+            std::fprintf(fp, "    { \"lod\": %d, \"cache_size\": %d, \"row_major\": %.4f, \"optimized\": %.4f }%s\n",
+                         r.lod, r.cache_size, r.row_major, r.optimized,
+                         i + 1 < acmr.size() ? "," : "");
+        }
+        std::fprintf(fp, "  ]\n}\n");
+    }
+
+    void Usage()
+    {
+        std::fprintf(stderr, "Usage: shallow_water_benchmark [-o <output.json>] [-t <min seconds per test>] "
+                     "[-s <size>[,<size>...]]\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::string output_filename;
+    double min_seconds = 0.5;
+    std::vector<int> sizes(DEFAULT_SIZES, DEFAULT_SIZES + sizeof(DEFAULT_SIZES)/sizeof(DEFAULT_SIZES[0]));
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output_filename = argv[++i];
+        } else if (std::strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            min_seconds = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            sizes.clear();
+            for (const char *p = argv[++i]; *p; ) {
+                char *end;
+                const long n = std::strtol(p, &end, 10);
+                if (end == p || n < 4) {
+                    Usage();
+                    return 1;
+                }
+                sizes.push_back(int(n));
+                p = (*end == ',') ? end + 1 : end;
+            }
+        } else {
+            Usage();
+            return 1;
+        }
+    }
+
+    Coercri::GenericTimer timer;
+    Benchmark bm(timer, min_seconds);
+    std::vector<Result> results;
+    std::vector<AcmrResult> acmr;
+
+    // textures for the software renderer (as ShallowWaterEngine::loadGraphics and loadSkybox)
+    MipChains grass, skybox;
+    bool have_textures = true;
+    try {
+        LoadMipChains(std::vector<std::string>(1, "Grass01.bmp"), "grass01.mips", grass);
+        const char * skybox_filenames[] = {
+            "skybox_east.bmp", "skybox_west.bmp", "skybox_north.bmp", "skybox_south.bmp", "skybox_up.bmp"
+        };
+        LoadMipChains(std::vector<std::string>(skybox_filenames, skybox_filenames + 5), "skybox.mips", skybox);
+    } catch (std::exception &e) {
+        std::fprintf(stderr, "%s (skipping soft_render)\n", e.what());
+        have_textures = false;
+    }
+
+    try {
+        MeasureACMR(acmr);
+        for (size_t i = 0; i < sizes.size(); ++i) {
+            for (size_t j = 0; j < sizeof(INITIAL_CONDITIONS)/sizeof(INITIAL_CONDITIONS[0]); ++j) {
+                RunBenchmarks(bm, INITIAL_CONDITIONS[j], sizes[i], have_textures ? &grass : 0,
+                              have_textures ? &skybox : 0, results);
+            }
+        }
+    } catch (std::exception &e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+
+    if (output_filename.empty()) {
+        WriteJSON(stdout, results, acmr);
+    } else {
+        std::FILE *fp = std::fopen(output_filename.c_str(), "w");
+        if (!fp) {
+            std::fprintf(stderr, "Could not open %s for writing\n", output_filename.c_str());
+            return 1;
+        }
+        WriteJSON(fp, results, acmr);
+        std::fclose(fp);
+    }
+
+    return 0;
+}
@@ -0,0 +1,232 @@
+/*
+ * FILE:
+ *   brush_log.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "brush_log.hpp"
+#include "settings.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+    const float PI = 4.0f * std::atan(1.0f);
+
+    // ShallowWaterEngine draws the water brush as a fan of this many triangles
+    // (MOUSE_PICK_NUM_TRIANGLES in engine.cpp)
+    const int WATER_BRUSH_SEGMENTS = 12;
+
+    const char * ACTION_NAMES[] = {
+        "add_water", "remove_water", "stir_water", "raise_terrain", "lower_terrain"
+    };
+    const int NUM_ACTIONS = sizeof(ACTION_NAMES) / sizeof(ACTION_NAMES[0]);
+
+    // The "radius" attribute that LeftMouseVertexShader interpolates across the
+    // triangle fan: 0 at the centre, 1 on the edge of the polygon. (ux, uy) is
+    // the position relative to the brush centre, in units of the brush radius.
+    float FanRadius(float ux, float uy)
+    {
+        const float d_theta = 2 * PI / WATER_BRUSH_SEGMENTS;
+        float theta = std::atan2(uy, ux);
+        if (theta < 0) theta += 2 * PI;
+        const float theta_mid = (std::floor(theta / d_theta) + 0.5f) * d_theta;
+        return std::sqrt(ux*ux + uy*uy) * std::cos(theta - theta_mid) / std::cos(d_theta / 2);
+    }
+
+    void LogError(const std::string &filename, int line_num, const std::string &msg)
+    {
+        std::ostringstream str;
+        str << filename << ":" << line_num << ": " << msg;
+        throw std::runtime_error(str.str());
+    }
+}
+
+void SaveBrushLog(const std::string &filename, const BrushLog &log)
+{
+    std::ofstream str(filename.c_str());
+    if (!str) throw std::runtime_error("Could not open brush log for writing: " + filename);
+
+    str.precision(9);
+    str << "# shallow water brush log\n";
+    str << "# time action x y radius strength dt\n";
+    str << "mesh " << log.nx << " " << log.ny << " " << log.W << " " << log.L << "\n";
+
+    for (size_t i = 0; i < log.events.size(); ++i) {
+        const BrushEvent &ev = log.events[i];
+        str << ev.time << " " << ACTION_NAMES[ev.action] << " " << ev.x << " " << ev.y << " "
+            << ev.radius << " " << ev.strength << " " << ev.dt << "\n";
+    }
+
+    if (!str) throw std::runtime_error("Error writing brush log: " + filename);
+}
+
+void LoadBrushLog(const std::string &filename, BrushLog &log)
+{
+    std::ifstream str(filename.c_str());
+    if (!str) throw std::runtime_error("Could not open brush log: " + filename);
+
+    log = BrushLog();
+
+    std::string line;
+    int line_num = 0;
+    while (std::getline(str, line)) {
+        ++line_num;
+        if (line.empty() || line[0] == '#' || line[0] == '\r') continue;
+
+        std::istringstream ls(line);
+        if (line.compare(0, 5, "mesh ") == 0) {
+            std::string word;
+            if (!(ls >> word >> log.nx >> log.ny >> log.W >> log.L)) LogError(filename, line_num, "expected 'mesh nx ny W L'");
+            continue;
+        }
+
+        BrushEvent ev;
+        std::string action;
+        if (!(ls >> ev.time >> action >> ev.x >> ev.y >> ev.radius >> ev.strength >> ev.dt)) {
+            LogError(filename, line_num, "expected 'time action x y radius strength dt'");
+        }
+        ev.action = int(std::find(ACTION_NAMES, ACTION_NAMES + NUM_ACTIONS, action) - ACTION_NAMES);
+        if (ev.action == NUM_ACTIONS) LogError(filename, line_num, "unknown action '" + action + "'");
+        if (!log.events.empty() && ev.time < log.events.back().time) LogError(filename, line_num, "events out of order");
+
+        log.events.push_back(ev);
+    }
+
+    if (log.nx == 0) throw std::runtime_error("Missing 'mesh' line in brush log: " + filename);
+}
+
+void BrushRecorder::start(float total_time, int nx, int ny, float W, float L)
+{
+    recording = true;
+    start_time = total_time;
+    log = BrushLog();
+    log.nx = nx;
+    log.ny = ny;
+    log.W = W;
+    log.L = L;
+}
+
+void BrushRecorder::record(const BrushEvent &ev)
+{
+    if (!recording) return;
+    log.events.push_back(ev);
+    log.events.back().time -= start_time;
+}
+
+BrushBatch::BrushBatch(int nx_, int ny_, float W_, float L_)
+    : nx(nx_), ny(ny_), W(W_), L(L_),
+      ix_min(0), ix_max(0), iy_min(0), iy_max(0)
+{
+    const BottomEntry zero = { 0, 0, 0 };
+    bottom_delta.assign((nx+4) * (ny+4), zero);
+    depth_delta.assign((nx+4) * (ny+4), 0.0f);
+    water_mask.assign((nx+4) * (ny+4), 0);
+}
+
+void BrushBatch::clear()
+{
+    // only the touched box needs clearing
+    const BottomEntry zero = { 0, 0, 0 };
+    for (int iy = iy_min; iy < iy_max; ++iy) {
+        const int row = iy * (nx+4);
+        std::fill(&bottom_delta[row + ix_min], &bottom_delta[row + ix_max], zero);
+        std::fill(&depth_delta[row + ix_min], &depth_delta[row + ix_max], 0.0f);
+        std::fill(&water_mask[row + ix_min], &water_mask[row + ix_max], 0);
+    }
+    ix_min = ix_max = iy_min = iy_max = 0;
+}
+
+void BrushBatch::extendBox(int x0, int x1, int y0, int y1)
+{
+    if (x0 >= x1 || y0 >= y1) return;
+    if (empty()) {
+        ix_min = x0; ix_max = x1;
+        iy_min = y0; iy_max = y1;
+    } else {
+        ix_min = std::min(ix_min, x0);
+        ix_max = std::max(ix_max, x1);
+        iy_min = std::min(iy_min, y0);
+        iy_max = std::max(iy_max, y1);
+    }
+}
+
+void BrushBatch::add(const BrushEvent &ev)
+{
+    if (ev.action == LM_RAISE_TERRAIN || ev.action == LM_LOWER_TERRAIN) {
+        // as ShallowWaterEngine::raiseLowerTerrain
+        terrain_brush.setup(ev.radius * 2, nx, ny, W, L);
+        const float displacement = (ev.action == LM_LOWER_TERRAIN ? -ev.strength : ev.strength) * ev.dt;
+
+        int cx, cy;
+        terrain_brush.locate(ev.x, ev.y, cx, cy);
+        terrain_brush.applyToBottom(&bottom_delta[0], cx, cy, displacement);
+
+        int x0, x1, y0, y1;
+        terrain_brush.getBox(cx, cy, x0, x1, y0, y1);
+        extendBox(x0, x1, y0, y1);
+    } else {
+        addWater(ev);
+    }
+}
+
+// CPU version of ShallowWaterEngine::applyMouseShader (the water part,
+// i.e. the LeftMouse shaders) -- but only accumulates the depth change.
+void BrushBatch::addWater(const BrushEvent &ev)
+{
+    const float strength = ev.strength * ev.dt;
+    float disp_A, disp_B;
+    switch (ev.action) {
+    case LM_ADD_WATER: disp_A = strength; disp_B = 0; break;
+    case LM_REMOVE_WATER: disp_A = -strength; disp_B = 0; break;
+    case LM_STIR_WATER: disp_A = -strength; disp_B = 1.5f * strength; break;
+    default: return;
+    }
+
+    // transformation from world coords to texture index (as in applyMouseShader)
+    const float x_scale = (nx-1) / W * ev.radius;
+    const float x_bias = (nx-1) / W * ev.x + (nx+4) / 2.0f;
+    const float y_scale = (ny-1) / L * ev.radius;
+    const float y_bias = (ny-1) / L * ev.y + 2.5f;
+
+    // pixel ix is drawn if its centre (ix + 0.5) is inside the polygon
+    const int x0 = std::max(0, int(std::floor(x_bias - x_scale)));
+    const int x1 = std::min(nx+4, int(std::ceil(x_bias + x_scale)) + 1);
+    const int y0 = std::max(0, int(std::floor(y_bias - y_scale)));
+    const int y1 = std::min(ny+4, int(std::ceil(y_bias + y_scale)) + 1);
+
+    for (int iy = y0; iy < y1; ++iy) {
+        const float uy = (iy + 0.5f - y_bias) / y_scale;
+        for (int ix = x0; ix < x1; ++ix) {
+            const float ux = (ix + 0.5f - x_bias) / x_scale;
+            const float r = FanRadius(ux, uy);
+            if (r > 1) continue;
+
+            const int k = iy * (nx+4) + ix;
+            depth_delta[k] += disp_A + disp_B * r;
+            water_mask[k] = 1;
+        }
+    }
+
+    extendBox(x0, x1, y0, y1);
+}
+
+int BrushReplay::collect(float t, BrushBatch &batch)
+{
+    int count = 0;
+    while (next < log.events.size() && log.events[next].time <= t) {
+        batch.add(log.events[next]);
+        ++next;
+        ++count;
+    }
+    return count;
+}
@@ -0,0 +1,139 @@
+/*
+ * FILE:
+ *   brush_log.hpp
+ *
+ * PURPOSE:
+ *   Recording and replay of left mouse "brush" interactions (adding,
+ *   removing and stirring water, raising and lowering terrain).
+ *
+ *   BrushRecorder logs each application of the brush, with the
+ *   simulated time (relative to the start of the recording) and all
+ *   the parameters needed to repeat it, so that the log does not
+ *   depend on the GUI settings or frame rate at replay time.
+ *
+ *   BrushReplay feeds the events back, one timestep at a time: every
+ *   event due by the start of a step is added to a BrushBatch, which
+ *   sums their effects into one set of per-cell changes, so that all
+ *   the strokes landing in that step are applied in a single update
+ *   (CpuSolver::applyBrushBatch).
+ *
+ *   Log file format (text):
+ *     # comment
+ *     mesh <nx> <ny> <W> <L>
+ *     <time> <action> <x> <y> <radius> <strength> <dt>
+ *     ...
+ *   where action is add_water, remove_water, stir_water, raise_terrain
+ *   or lower_terrain.
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef BRUSH_LOG_HPP
+#define BRUSH_LOG_HPP
+
+#include "terrain_brush.hpp"
+#include "terrain_heightfield.hpp"
+
+#include <string>
+#include <vector>
+
+struct BrushEvent {
+    float time;        // simulated time, relative to the start of the recording
+    int action;        // LM_ADD_WATER etc (see settings.hpp)
+    float x, y;        // world position
+    float radius;      // SH_LEFT_MOUSE_RADIUS
+    float strength;    // SH_LEFT_MOUSE_STRENGTH
+    float dt;          // the dt that was passed to ShallowWaterEngine::applyMouseShader
+};
+
+struct BrushLog {
+    BrushLog() : nx(0), ny(0), W(0), L(0) { }
+    int nx, ny;        // mesh that the log was recorded on
+    float W, L;
+    std::vector<BrushEvent> events;   // in time order
+};
+
+// These throw std::runtime_error on failure.
+void SaveBrushLog(const std::string &filename, const BrushLog &log);
+void LoadBrushLog(const std::string &filename, BrushLog &log);
+
+class BrushRecorder {
+public:
+    BrushRecorder() : recording(false), start_time(0) { }
+
+    // Starts a new recording (discarding any previous one). total_time is the
+    // current simulated time; event times are recorded relative to it.
+    void start(float total_time, int nx, int ny, float W, float L);
+    void stop() { recording = false; }
+    bool isRecording() const { return recording; }
+
+    // Adds an event (if recording). ev.time should be the absolute simulated time.
+    void record(const BrushEvent &ev);
+
+    const BrushLog & getLog() const { return log; }
+
+private:
+    bool recording;
+    float start_time;
+    BrushLog log;
+};
+
+// The summed effect of any number of brush events on an (nx+4) * (ny+4) grid.
+class BrushBatch {
+public:
+    BrushBatch(int nx, int ny, float W, float L);
+
+    void clear();
+    bool empty() const { return ix_min >= ix_max; }
+
+    void add(const BrushEvent &ev);
+
+    // Cells touched by the batch (max exclusive)
+    int getXMin() const { return ix_min; }
+    int getXMax() const { return ix_max; }
+    int getYMin() const { return iy_min; }
+    int getYMax() const { return iy_max; }
+
+    // Per cell, row major, (nx+4) * (ny+4):
+    //  - change to the bottom (w changes by the same amount as BA);
+    //  - change to the water depth, from the water brushes, and whether any
+    //    water brush covered the cell (see CpuSolver::applyBrushBatch).
+    const BottomEntry * getBottomDelta() const { return &bottom_delta[0]; }
+    const float * getDepthDelta() const { return &depth_delta[0]; }
+    const unsigned char * getWaterMask() const { return &water_mask[0]; }
+
+private:
+    void addWater(const BrushEvent &ev);
+    void extendBox(int x0, int x1, int y0, int y1);
+
+private:
+    int nx, ny;
+    float W, L;
+    int ix_min, ix_max, iy_min, iy_max;
+    TerrainBrush terrain_brush;
+    std::vector<BottomEntry> bottom_delta;
+    std::vector<float> depth_delta;
+    std::vector<unsigned char> water_mask;
+};
+
+class BrushReplay {
+public:
+    explicit BrushReplay(const BrushLog &log_) : log(log_), next(0) { }
+
+    // Adds all the events due at or before time t, that have not been added
+    // already, to the batch. Returns the number of events added.
+    int collect(float t, BrushBatch &batch);
+
+    bool done() const { return next >= log.events.size(); }
+
+private:
+    const BrushLog &log;
+    size_t next;
+};
+
+#endif
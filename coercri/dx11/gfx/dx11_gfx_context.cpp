@@ -44,7 +44,9 @@
 #include "dx11_gfx_context.hpp"
 #include "dx11_graphic.hpp"
 #include "primitive_batch.hpp"
+#include "../core/com_ptr_wrapper.hpp"
 #include "../core/dx_error.hpp"
+#include "../../gfx/glyph_atlas.hpp"
 #include "../../gfx/rectangle.hpp"
 
 namespace Coercri {
@@ -65,9 +67,11 @@ namespace Coercri {
     {
         primitive_batch.end();
 
-        HRESULT hr = swap_chain->Present(0, 0);
-        if (FAILED(hr)) {
-            throw DXError("IDXGISwapChain::Present failed", hr);
+        if (swap_chain) {
+            HRESULT hr = swap_chain->Present(0, 0);
+            if (FAILED(hr)) {
+                throw DXError("IDXGISwapChain::Present failed", hr);
+            }
         }
     }
     
@@ -131,4 +135,18 @@ namespace Coercri {
     {
         primitive_batch.plotPixelBatch(buf, num);
     }
+
+    void DX11GfxContext::drawGlyphs(int x, int y, const GlyphAtlas &atlas, const GlyphQuad *quads, int num_quads, Color col)
+    {
+        boost::shared_ptr<Graphic> &cache = atlas.getGraphicCache();
+        const DX11Graphic *graphic = dynamic_cast<const DX11Graphic*>(cache.get());
+        if (!graphic) {
+            ID3D11Device *device;
+            device_context->GetDevice(&device);
+            ComPtrWrapper<ID3D11Device> psDevice(device);
+            cache.reset(new DX11Graphic(device, atlas.getPixelsPtr(), 0, 0));
+            graphic = static_cast<const DX11Graphic*>(cache.get());
+        }
+        primitive_batch.drawGlyphs(x, y, *graphic, quads, num_quads, col);
+    }
 }
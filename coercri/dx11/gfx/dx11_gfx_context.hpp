@@ -63,7 +63,9 @@ namespace Coercri {
     
     class DX11GfxContext : public GfxContext {
     public:
-        // ctor not intended to be called directly. Use Window::createGfxContext.
+        // ctor not intended to be called directly. Use Window::createGfxContext
+        // (or DX11RenderTexture::createGfxContext, which passes a null swap chain:
+        // then nothing is presented when the context is destroyed).
         DX11GfxContext(ID3D11DeviceContext *pDeviceContext,
                        ID3D11RenderTargetView *pRenderTargetView,
                        IDXGISwapChain *pSwapChain,
@@ -87,6 +89,12 @@ namespace Coercri {
         void fillRectangle(const Rectangle &rect, Color col);
 
         void plotPixelBatch(const Pixel *buf, int num);
+
+        // the atlas is uploaded as a DX11Graphic the first time it is drawn
+        void drawGlyphs(int x, int y, const GlyphAtlas &atlas, const GlyphQuad *quads, int num_quads, Color col);
+
+        // the render target being drawn to
+        ID3D11RenderTargetView * getRenderTargetView() const { return render_target_view; }
         
     private:
         ID3D11DeviceContext *device_context;
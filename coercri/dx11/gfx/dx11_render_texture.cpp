@@ -0,0 +1,113 @@
+/*
+ * FILE:
+ *   dx11_render_texture.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) Stephen Thompson, 2008 - 2012.
+ *
+ *   This file is part of the "Coercri" software library. Usage of "Coercri"
+ *   is permitted under the terms of the Boost Software License, Version 1.0, 
+ *   the text of which is displayed below.
+ *
+ *   Boost Software License - Version 1.0 - August 17th, 2003
+ *
+ *   Permission is hereby granted, free of charge, to any person or organization
+ *   obtaining a copy of the software and accompanying documentation covered by
+ *   this license (the "Software") to use, reproduce, display, distribute,
+ *   execute, and transmit the Software, and to prepare derivative works of the
+ *   Software, and to permit third-parties to whom the Software is furnished to
+ *   do so, all subject to the following:
+ *
+ *   The copyright notices in the Software and this entire statement, including
+ *   the above license grant, this restriction and the following disclaimer,
+ *   must be included in all copies of the Software, in whole or in part, and
+ *   all derivative works of the Software, unless such copies or derivative
+ *   works are solely in the form of machine-executable object code generated by
+ *   a source language processor.
+ *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *   FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+ *   SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+ *   FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+ *   ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *   DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "dx11_gfx_context.hpp"
+#include "dx11_gfx_driver.hpp"
+#include "dx11_render_texture.hpp"
+#include "../core/dx_error.hpp"
+#include "../../gfx/rectangle.hpp"
+
+namespace Coercri {
+
+    DX11RenderTexture::DX11RenderTexture(DX11GfxDriver &driver, int w, int h)
+        : gfx_driver(driver), width(w), height(h)
+    {
+        D3D11_TEXTURE2D_DESC td;
+        memset(&td, 0, sizeof(td));
+        td.Width = width;
+        td.Height = height;
+        td.MipLevels = 1;
+        td.ArraySize = 1;
+        td.Format = DXGI_FORMAT_R8G8B8A8_UNORM;   // as the swap chain (see DX11Window)
+        td.SampleDesc.Count = 1;
+        td.SampleDesc.Quality = 0;
+        td.Usage = D3D11_USAGE_DEFAULT;
+        td.BindFlags = D3D11_BIND_RENDER_TARGET;
+        td.CPUAccessFlags = 0;
+        td.MiscFlags = 0;
+
+        ID3D11Texture2D *pTexture;
+        HRESULT hr = gfx_driver.getDevice()->CreateTexture2D(&td, 0, &pTexture);
+        if (FAILED(hr)) {
+            throw DXError("DX11RenderTexture: Failed to create 2D texture", hr);
+        }
+        m_psTexture.reset(pTexture);
+
+        ID3D11RenderTargetView *pRTV;
+        hr = gfx_driver.getDevice()->CreateRenderTargetView(pTexture, 0, &pRTV);
+        if (FAILED(hr)) {
+            throw DXError("DX11RenderTexture: Failed to create render target view", hr);
+        }
+        m_psRenderTargetView.reset(pRTV);
+    }
+
+    std::auto_ptr<GfxContext> DX11RenderTexture::createGfxContext()
+    {
+        std::auto_ptr<GfxContext> gc(new DX11GfxContext(gfx_driver.getDeviceContext(),
+                                                        m_psRenderTargetView.get(),
+                                                        0,   // no swap chain, i.e. don't Present
+                                                        gfx_driver.getPrimitiveBatch()));
+        return gc;
+    }
+
+    void DX11RenderTexture::copyTo(GfxContext &dest, const Rectangle &rect)
+    {
+        DX11GfxContext &dx11_dest = dynamic_cast<DX11GfxContext&>(dest);
+
+        const Rectangle r = IntersectRects(IntersectRects(rect, Rectangle(0, 0, width, height)),
+                                           Rectangle(0, 0, dest.getWidth(), dest.getHeight()));
+        if (r.isDegenerate()) return;
+
+        ID3D11Resource *resource;
+        dx11_dest.getRenderTargetView()->GetResource(&resource);
+        ComPtrWrapper<ID3D11Resource> psResource(resource);
+
+        D3D11_BOX box;
+        box.left = r.getLeft();
+        box.right = r.getRight();
+        box.top = r.getTop();
+        box.bottom = r.getBottom();
+        box.front = 0;
+        box.back = 1;
+
+        gfx_driver.getDeviceContext()->CopySubresourceRegion(resource, 0, r.getLeft(), r.getTop(), 0,
+                                                             m_psTexture.get(), 0, &box);
+    }
+}
@@ -0,0 +1,100 @@
+/*
+ * FILE:
+ *   dx11_render_texture.hpp
+ *
+ * PURPOSE:
+ *   An offscreen texture that can be drawn to with the usual Coercri
+ *   GfxContext routines, and copied to a window. Used for caching
+ *   things that rarely change (e.g. a GUI), so that they only need
+ *   to be redrawn where they have changed.
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) Stephen Thompson, 2008 - 2012.
+ *
+ *   This file is part of the "Coercri" software library. Usage of "Coercri"
+ *   is permitted under the terms of the Boost Software License, Version 1.0, 
+ *   the text of which is displayed below.
+ *
+ *   Boost Software License - Version 1.0 - August 17th, 2003
+ *
+ *   Permission is hereby granted, free of charge, to any person or organization
+ *   obtaining a copy of the software and accompanying documentation covered by
+ *   this license (the "Software") to use, reproduce, display, distribute,
+ *   execute, and transmit the Software, and to prepare derivative works of the
+ *   Software, and to permit third-parties to whom the Software is furnished to
+ *   do so, all subject to the following:
+ *
+ *   The copyright notices in the Software and this entire statement, including
+ *   the above license grant, this restriction and the following disclaimer,
+ *   must be included in all copies of the Software, in whole or in part, and
+ *   all derivative works of the Software, unless such copies or derivative
+ *   works are solely in the form of machine-executable object code generated by
+ *   a source language processor.
+ *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *   FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+ *   SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+ *   FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+ *   ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *   DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef COERCRI_DX11_RENDER_TEXTURE_HPP
+#define COERCRI_DX11_RENDER_TEXTURE_HPP
+
+#include "../core/com_ptr_wrapper.hpp"
+
+#include <d3d11.h>
+#ifdef min
+#undef min
+#endif
+#ifdef max
+#undef max
+#endif
+
+#include <memory>
+
+namespace Coercri {
+
+    class DX11GfxDriver;
+    class GfxContext;
+    class Rectangle;
+
+    class DX11RenderTexture {
+    public:
+        // The texture has the same format as a DX11Window's back buffer.
+        DX11RenderTexture(DX11GfxDriver &driver, int width, int height);
+
+        int getWidth() const { return width; }
+        int getHeight() const { return height; }
+
+        // Draw to the texture. As with DX11Window::createGfxContext, only one
+        // GfxContext can exist at a time. The contents are kept between contexts.
+        std::auto_ptr<GfxContext> createGfxContext();
+
+        // Copy the given rectangle of the texture to the same position on the
+        // target of dest (which must be a DX11GfxContext). This is a straight
+        // copy, with no blending, and ignores dest's clip rectangle.
+        void copyTo(GfxContext &dest, const Rectangle &rect);
+
+    private:
+        // prevent copying
+        DX11RenderTexture(const DX11RenderTexture &);
+        void operator=(const DX11RenderTexture &);
+
+    private:
+        DX11GfxDriver &gfx_driver;
+        int width, height;
+
+        ComPtrWrapper<ID3D11Texture2D> m_psTexture;
+        ComPtrWrapper<ID3D11RenderTargetView> m_psRenderTargetView;
+    };
+
+}
+
+#endif
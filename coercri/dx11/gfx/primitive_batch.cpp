@@ -45,11 +45,13 @@
 #include "primitive_batch.hpp"
 #include "../core/dx_error.hpp"
 #include "../core/load_dx11_dlls.hpp"
+#include "../../gfx/glyph_atlas.hpp"
 
 // these headers are built by MSVC.
 // you need to add the HLSL files to your project, configure MSVC to build header files,
 // then add the build dir to your include-path.
 #include "primitive_batch_ps.h"
+#include "primitive_batch_ps_glyphs.h"
 #include "primitive_batch_ps_tex.h"
 #include "primitive_batch_vs.h"
 
@@ -66,6 +68,7 @@ namespace Coercri {
         unsigned char g;
         unsigned char b;
         unsigned char a;
+        DirectX::XMFLOAT2 tex;   // texture coordinates (texture blits and glyphs only)
     };
 
     struct MyConstBuffer {
@@ -119,12 +122,13 @@ namespace Coercri {
         // create input layout while we still have the code blob
         D3D11_INPUT_ELEMENT_DESC layout[] = {
             { "POSITION", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-            { "COLOR", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, 8, D3D11_INPUT_PER_VERTEX_DATA, 0 }
+            { "COLOR", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, 8, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+            { "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 }
         };
 
         ID3D11InputLayout *input_layout;
         hr = device->CreateInputLayout(&layout[0],
-                                       2,
+                                       3,
                                        primitive_batch_vs,
                                        sizeof(primitive_batch_vs),
                                        &input_layout);
@@ -153,6 +157,16 @@ namespace Coercri {
             throw DXError("CreatePixelShader (2) failed", hr);
         }
         m_psPixelShader_Tex.reset(pix_shader);
+
+        // and the 3rd (for glyphs)
+        hr = device->CreatePixelShader(primitive_batch_ps_glyphs,
+                                       sizeof(primitive_batch_ps_glyphs),
+                                       0,
+                                       &pix_shader);
+        if (FAILED(hr)) {
+            throw DXError("CreatePixelShader (3) failed", hr);
+        }
+        m_psPixelShader_Glyphs.reset(pix_shader);
     }
 
     // Create the dynamic vertex buffer
@@ -361,7 +375,7 @@ namespace Coercri {
 
     void PrimitiveBatch::plotPixel(int x, int y, Color col)
     {
-        setupPrim(D3D11_PRIMITIVE_TOPOLOGY_POINTLIST, 0, 1);
+        setupPrim(D3D11_PRIMITIVE_TOPOLOGY_POINTLIST, SHADER_FLAT, 0, 1);
         addVertex(x + 0.5f, y + 0.5f, col);
     }
     
@@ -372,7 +386,7 @@ namespace Coercri {
             plotPixelBatch(buf + NUM_VERTS_IN_BUFFER, num - NUM_VERTS_IN_BUFFER);
         } else {
         
-            setupPrim(D3D11_PRIMITIVE_TOPOLOGY_POINTLIST, 0, num);
+            setupPrim(D3D11_PRIMITIVE_TOPOLOGY_POINTLIST, SHADER_FLAT, 0, num);
             
             for (int i = 0; i < num; ++i) {
                 addVertex(buf->x + 0.5f, buf->y + 0.5f, buf->col);
@@ -383,7 +397,7 @@ namespace Coercri {
 
     void PrimitiveBatch::drawLine(int x1, int y1, int x2, int y2, Color col)
     {
-        setupPrim(D3D11_PRIMITIVE_TOPOLOGY_LINELIST, 0, 2);
+        setupPrim(D3D11_PRIMITIVE_TOPOLOGY_LINELIST, SHADER_FLAT, 0, 2);
 
         // be careful about direct3d rasterization rules.
         // in Coercri, both endpoints are to be included in the line.
@@ -414,7 +428,7 @@ namespace Coercri {
 
     void PrimitiveBatch::fillRectangle(const Rectangle &rect, Color col)
     {
-        setupPrim(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, 0, 6);
+        setupPrim(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, SHADER_FLAT, 0, 6);
 
         addVertex(float(rect.getLeft()), float(rect.getTop()), col);
         addVertex(float(rect.getRight()), float(rect.getTop()), col);
@@ -427,7 +441,7 @@ namespace Coercri {
 
     void PrimitiveBatch::drawGraphic(int x, int y, const DX11Graphic &gfx)
     {
-        setupPrim(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, gfx.getShaderResourceView(), 6);
+        setupPrim(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, SHADER_TEX, gfx.getShaderResourceView(), 6);
 
         int hx, hy;
         gfx.getHandle(hx, hy);
@@ -440,12 +454,43 @@ namespace Coercri {
         const float bottom = float(y + gfx.getHeight());
         
         addTexVertex(left, top, 0, 0);
-        addTexVertex(right, top, 255, 0);
-        addTexVertex(left, bottom, 0, 255);
+        addTexVertex(right, top, 1, 0);
+        addTexVertex(left, bottom, 0, 1);
 
-        addTexVertex(right, top, 255, 0);
-        addTexVertex(right, bottom, 255, 255);
-        addTexVertex(left, bottom, 0, 255);
+        addTexVertex(right, top, 1, 0);
+        addTexVertex(right, bottom, 1, 1);
+        addTexVertex(left, bottom, 0, 1);
+    }
+
+    void PrimitiveBatch::drawGlyphs(int x, int y, const DX11Graphic &atlas, const GlyphQuad *quads, int num, Color col)
+    {
+        // All the quads use the same texture and shader, so they go
+        // into one Draw (unless the vertex buffer fills up).
+        ID3D11ShaderResourceView *srv = atlas.getShaderResourceView();
+        const float inv_w = 1.0f / atlas.getWidth();
+        const float inv_h = 1.0f / atlas.getHeight();
+        
+        for (const GlyphQuad *q = quads; q != quads + num; ++q) {
+            setupPrim(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, SHADER_GLYPHS, srv, 6);
+
+            const float left = float(x + q->x);
+            const float top = float(y + q->y);
+            const float right = left + q->width;
+            const float bottom = top + q->height;
+
+            const float tleft = q->atlas_x * inv_w;
+            const float ttop = q->atlas_y * inv_h;
+            const float tright = (q->atlas_x + q->width) * inv_w;
+            const float tbottom = (q->atlas_y + q->height) * inv_h;
+
+            addGlyphVertex(left, top, tleft, ttop, col);
+            addGlyphVertex(right, top, tright, ttop, col);
+            addGlyphVertex(left, bottom, tleft, tbottom, col);
+
+            addGlyphVertex(right, top, tright, ttop, col);
+            addGlyphVertex(right, bottom, tright, tbottom, col);
+            addGlyphVertex(left, bottom, tleft, tbottom, col);
+        }
     }
 
     //
@@ -494,6 +539,7 @@ namespace Coercri {
     //
 
     void PrimitiveBatch::setupPrim(D3D11_PRIMITIVE_TOPOLOGY prim_type,
+                                   ShaderMode shader_mode,
                                    ID3D11ShaderResourceView *tex_resource_view,
                                    int nverts)
     {
@@ -508,13 +554,15 @@ namespace Coercri {
         // If a primitive is in progress, but it is of the wrong type,
         // then close out the current primitive so we can start a new
         // one. (but keep same location in the buffer.)
-        if (prim_started && (curr_prim_type != prim_type || curr_tex_resource_view != tex_resource_view)) {
+        if (prim_started && (curr_prim_type != prim_type
+                             || curr_shader_mode != shader_mode
+                             || curr_tex_resource_view != tex_resource_view)) {
             endPrim();
         }
 
         // If no primitive is in progress, then start one.
         if (!prim_started) {
-            startPrim(prim_type, tex_resource_view);
+            startPrim(prim_type, shader_mode, tex_resource_view);
         }
 
         // at this point we know that prim_started == true,
@@ -524,6 +572,7 @@ namespace Coercri {
     }
 
     void PrimitiveBatch::startPrim(D3D11_PRIMITIVE_TOPOLOGY prim_type,
+                                   ShaderMode shader_mode,
                                    ID3D11ShaderResourceView *tex_resource_view)
     {
         // precondition: !prim_started
@@ -531,19 +580,28 @@ namespace Coercri {
         // set D3D states accordingly
         device_context->IASetPrimitiveTopology(prim_type);
 
-        if (tex_resource_view) {
+        switch (shader_mode) {
+        case SHADER_TEX:
             // texture blit
             device_context->PSSetShader(m_psPixelShader_Tex.get(), 0, 0);
             device_context->PSSetShaderResources(0, 1, &tex_resource_view);
-        } else {
+            break;
+        case SHADER_GLYPHS:
+            // text, tinted with the vertex colour
+            device_context->PSSetShader(m_psPixelShader_Glyphs.get(), 0, 0);
+            device_context->PSSetShaderResources(0, 1, &tex_resource_view);
+            break;
+        default:
             // flat shaded primitive
             device_context->PSSetShader(m_psPixelShader.get(), 0, 0);
+            break;
         }
 
         // ensure the "runtime state" variables are set correctly
         prim_started = true;
         start_vertex = end_vertex;
         curr_prim_type = prim_type;
+        curr_shader_mode = shader_mode;
         curr_tex_resource_view = tex_resource_view;
 
         // map the vertex buffer
@@ -588,13 +646,22 @@ namespace Coercri {
         ++end_vertex;
     }
 
-    void PrimitiveBatch::addTexVertex(float x, float y, unsigned char tx, unsigned char ty)
+    void PrimitiveBatch::addTexVertex(float x, float y, float tx, float ty)
+    {
+        addGlyphVertex(x, y, tx, ty, Color(255, 255, 255));
+    }
+
+    void PrimitiveBatch::addGlyphVertex(float x, float y, float tx, float ty, Color col)
     {
         PrimitiveBatchVertex &vert = vb_ptr[end_vertex];
         vert.pos.x = x;
         vert.pos.y = y;
-        vert.r = tx;
-        vert.g = ty;
+        vert.r = col.r;
+        vert.g = col.g;
+        vert.b = col.b;
+        vert.a = col.a;
+        vert.tex.x = tx;
+        vert.tex.y = ty;
         ++end_vertex;
     }
 }
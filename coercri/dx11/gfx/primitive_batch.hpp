@@ -70,6 +70,7 @@
 namespace Coercri {
 
     class DX11Graphic;
+    struct GlyphQuad;
     struct PrimitiveBatchVertex;  // internal use
     
     class PrimitiveBatch {
@@ -96,6 +97,7 @@ namespace Coercri {
         void drawLine(int x1, int y1, int x2, int y2, Color col);
         void fillRectangle(const Rectangle &rect, Color col);
         void drawGraphic(int x, int y, const DX11Graphic &graphic);
+        void drawGlyphs(int x, int y, const DX11Graphic &atlas, const GlyphQuad *quads, int num, Color col);
         
         // End drawing. This flushes any not-yet-drawn primitives
         // (making a Draw call) if necessary.
@@ -111,6 +113,12 @@ namespace Coercri {
         Rectangle getScissorRectangle() const;
         
     private:
+        enum ShaderMode {
+            SHADER_FLAT,     // points, lines, rectangles
+            SHADER_TEX,      // graphic blits
+            SHADER_GLYPHS    // text: colour from the vertex, alpha from the texture
+        };
+        
         void createShaders(ID3D11Device *device);
         void createVertexBuffer(ID3D11Device *device);
         void createRasterizerState(ID3D11Device *device);
@@ -119,13 +127,16 @@ namespace Coercri {
         void createConstantBuffer(ID3D11Device *device);
         
         void setupPrim(D3D11_PRIMITIVE_TOPOLOGY prim_type,
-                       ID3D11ShaderResourceView *tex_resource_view,   // NULL if not a texture blit
+                       ShaderMode shader_mode,
+                       ID3D11ShaderResourceView *tex_resource_view,   // NULL for SHADER_FLAT
                        int nverts);
         void startPrim(D3D11_PRIMITIVE_TOPOLOGY prim_type,
-                       ID3D11ShaderResourceView *tex_resource_view);  // NULL if not a texture blit
+                       ShaderMode shader_mode,
+                       ID3D11ShaderResourceView *tex_resource_view);  // NULL for SHADER_FLAT
         void endPrim();
         void addVertex(float x, float y, Color col);
-        void addTexVertex(float x, float y, unsigned char tx, unsigned char ty);
+        void addTexVertex(float x, float y, float tx, float ty);
+        void addGlyphVertex(float x, float y, float tx, float ty, Color col);
         
     private:
         ID3D11DeviceContext *device_context;
@@ -134,6 +145,7 @@ namespace Coercri {
         ComPtrWrapper<ID3D11VertexShader> m_psVertexShader_Tex;
         ComPtrWrapper<ID3D11PixelShader> m_psPixelShader;     // for points, lines, rectangles
         ComPtrWrapper<ID3D11PixelShader> m_psPixelShader_Tex; // for graphic blits
+        ComPtrWrapper<ID3D11PixelShader> m_psPixelShader_Glyphs; // for text
         ComPtrWrapper<ID3D11SamplerState> m_psSampler;
 
         ComPtrWrapper<ID3D11InputLayout> m_psInputLayout;
@@ -155,6 +167,7 @@ namespace Coercri {
         //        (and this has been loaded into IASetPrimitiveTopology)
         //   -- start_vertex = where does it start in the buffer
         //   -- end_vertex = one-past-the-end of verts written so far.
+        //   -- curr_shader_mode = which pixel shader is set
         //   -- curr_tex_resource_view = texture being rendered (or NULL)
         //
         //   and the vertex buffer is Mapped, such that we can write
@@ -163,13 +176,14 @@ namespace Coercri {
         //   
         // if prim_started = false:
         // 
-        //   -- curr_tex_resource_view, curr_prim_type, start_vertex are invalid
+        //   -- curr_tex_resource_view, curr_shader_mode, curr_prim_type, start_vertex are invalid
         //   -- end_vertex = where should the next prim be started from.
         //
         //   and the vertex buffer is Unmapped.
         //
         bool prim_started;
         D3D11_PRIMITIVE_TOPOLOGY curr_prim_type;
+        ShaderMode curr_shader_mode;
         ID3D11ShaderResourceView *curr_tex_resource_view;
         int start_vertex;
         int end_vertex;
@@ -30,11 +30,13 @@ struct VS_INPUT
 {
     float2 Pos : POSITION;
     unorm float4 Col : COLOR;
+    float2 Tex : TEXCOORD;
 };
 
 struct PS_INPUT
 {
     float4 Pos : SV_POSITION;
     float4 Col : COLOR;
+    float2 Tex : TEXCOORD;
 };
 
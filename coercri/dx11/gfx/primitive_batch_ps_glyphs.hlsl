@@ -0,0 +1,26 @@
+/*
+ * FILE:
+ *   primitive_batch_ps_glyphs.hlsl
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * CREATED:
+ *   19-Oct-2014
+ *
+ * COPYRIGHT:
+ *   Copyright (C) Stephen Thompson 2014.
+ *
+ *   This file is part of the "Coercri" software library. Usage of
+ *   "Coercri" is permitted under the terms of the Boost Software
+ *   Licence, version 1.0. 
+ * 
+ */
+
+#include "primitive_batch_common.hlsl"
+
+// glyph atlas: the colour comes from the vertex, the coverage from the texture alpha
+float4 PS_Glyphs( PS_INPUT input ) : SV_TARGET
+{
+    return float4(input.Col.rgb, input.Col.a * myTexture.Sample(mySampler, input.Tex).a);
+}
@@ -21,5 +21,5 @@
 
 float4 PS_Tex( PS_INPUT input ) : SV_TARGET
 {
-    return myTexture.Sample(mySampler, float2(input.Col.x, input.Col.y));
+    return myTexture.Sample(mySampler, input.Tex);
 }
@@ -29,5 +29,6 @@ PS_INPUT VS( VS_INPUT input )
                          0.5f,   
                          1.0f ); 
     output.Col = input.Col;
+    output.Tex = input.Tex;
     return output;
 }
@@ -51,6 +51,7 @@ namespace Coercri {
         if (!cg_gfx) {
             throw GCN_EXCEPTION("CGFont can only be used with CGGraphics");
         }
+        if (cg_gfx->isClippedOut()) return;
 
         GfxContext * gfx_context = cg_gfx->getTarget();
         if (!gfx_context) {
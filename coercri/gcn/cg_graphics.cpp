@@ -66,19 +66,22 @@ namespace Coercri {
     {
         // Load the current clip area into Coercri
         if (mClipStack.empty()) {
-            gfx_context->clearClipRectangle();
+            if (has_limit) gfx_context->setClipRectangle(limit);
+            else gfx_context->clearClipRectangle();
+            clipped_out = has_limit && limit.isDegenerate();
         } else {
             const gcn::Rectangle & curr_clip = mClipStack.top();
-            gfx_context->setClipRectangle(Coercri::Rectangle(curr_clip.x,
-                                                             curr_clip.y,
-                                                             curr_clip.width,
-                                                             curr_clip.height));
+            Coercri::Rectangle rect(curr_clip.x, curr_clip.y, curr_clip.width, curr_clip.height);
+            if (has_limit) rect = IntersectRects(rect, limit);
+            gfx_context->setClipRectangle(rect);
+            clipped_out = rect.isDegenerate();
         }
     }
     
     void CGGraphics::drawImage(const gcn::Image *image, int srcX, int srcY, int dstX, int dstY, int width, int height)
     {
         if (!gfx_context) throw GCN_EXCEPTION("drawImage: no gfx context");
+        if (clipped_out) return;
         
         if (srcX != 0 || srcY != 0 || width != image->getWidth() || height != image->getHeight()) {
             throw GCN_EXCEPTION("drawImage: not implemented for partial images");
@@ -101,6 +104,7 @@ namespace Coercri {
     void CGGraphics::drawPoint(int x, int y)
     {
         if (!gfx_context) throw GCN_EXCEPTION("drawPoint: no gfx_context");
+        if (clipped_out) return;
         transformPoint(x, y);
         gfx_context->plotPixel(x, y, getCoercriColor());
     }
@@ -108,6 +112,7 @@ namespace Coercri {
     void CGGraphics::drawLine(int x1, int y1, int x2, int y2)
     {
         if (!gfx_context) throw GCN_EXCEPTION("drawLine: no gfx_context");
+        if (clipped_out) return;
         transformPoint(x1, y1);
         transformPoint(x2, y2);
         gfx_context->drawLine(x1, y1, x2, y2, getCoercriColor());
@@ -116,6 +121,7 @@ namespace Coercri {
     void CGGraphics::drawRectangle(const gcn::Rectangle &rectangle)
     {
         if (!gfx_context) throw GCN_EXCEPTION("drawRectangle: no gfx_context");
+        if (clipped_out) return;
         int x = rectangle.x, y = rectangle.y;
         transformPoint(x, y);
         Coercri::Rectangle rect(x, y, rectangle.width, rectangle.height);
@@ -125,6 +131,7 @@ namespace Coercri {
     void CGGraphics::fillRectangle(const gcn::Rectangle &rectangle)
     {
         if (!gfx_context) throw GCN_EXCEPTION("fillRectangle: no gfx_context");
+        if (clipped_out) return;
         int x = rectangle.x, y = rectangle.y;
         transformPoint(x, y);        
         Coercri::Rectangle rect(x, y, rectangle.width, rectangle.height);
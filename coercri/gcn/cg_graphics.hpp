@@ -45,6 +45,7 @@
 #define COERCRI_CG_GRAPHICS_HPP
 
 #include "../gfx/color.hpp"
+#include "../gfx/rectangle.hpp"
 
 #include "guichan.hpp"
 
@@ -54,10 +55,19 @@ namespace Coercri {
     
     class CGGraphics : public gcn::Graphics {
     public:
-        CGGraphics() : gfx_context(0), curr_col(255,255,255) { }
+        CGGraphics() : gfx_context(0), curr_col(255,255,255), has_limit(false), clipped_out(false) { }
 
         void setTarget(GfxContext *cxt) { gfx_context = cxt; }
         GfxContext * getTarget() const { return gfx_context; }
+
+        // Restrict all drawing to the given rectangle (in target coordinates),
+        // on top of the clip areas pushed by the widgets. Drawing calls made
+        // while the clip area is entirely outside it are skipped altogether.
+        void setLimitRectangle(const Rectangle &rect) { limit = rect; has_limit = true; }
+        void clearLimitRectangle() { has_limit = false; clipped_out = false; }
+
+        // True if nothing drawn at the moment would be visible.
+        bool isClippedOut() const { return clipped_out; }
         
         virtual bool pushClipArea(gcn::Rectangle area);
         virtual void popClipArea();
@@ -87,6 +97,9 @@ namespace Coercri {
     private:
         GfxContext *gfx_context;
         gcn::Color curr_col;
+        bool has_limit;
+        Rectangle limit;
+        bool clipped_out;
     };
 }
 
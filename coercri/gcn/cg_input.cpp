@@ -45,50 +45,56 @@ namespace Coercri {
 
     bool CGInput::isKeyQueueEmpty()
     {
-        return key_inputs.empty();
+        return key_pos == key_inputs.size();
     }
 
     gcn::KeyInput CGInput::dequeueKeyInput()
     {
-        if (key_inputs.empty()) {
+        if (isKeyQueueEmpty()) {
             throw GCN_EXCEPTION("Key input queue empty");
         }
 
-        gcn::KeyInput k = key_inputs.front();
-        key_inputs.pop();
+        gcn::KeyInput k = key_inputs[key_pos++];
+        if (key_pos == key_inputs.size()) {
+            key_inputs.clear();
+            key_pos = 0;
+        }
         return k;
     }
 
     bool CGInput::isMouseQueueEmpty()
     {
-        return mouse_inputs.empty();
+        return mouse_pos == mouse_inputs.size();
     }
     
     gcn::MouseInput CGInput::dequeueMouseInput()    
     {
-        if (mouse_inputs.empty()) {
+        if (isMouseQueueEmpty()) {
             throw GCN_EXCEPTION("Mouse input queue empty");
         }
 
-        gcn::MouseInput m = mouse_inputs.front();
-        mouse_inputs.pop();
+        gcn::MouseInput m = mouse_inputs[mouse_pos++];
+        if (mouse_pos == mouse_inputs.size()) {
+            mouse_inputs.clear();
+            mouse_pos = 0;
+        }
         return m;
     }
 
     void CGInput::addKeyInput(const gcn::KeyInput &ki)
     {
-        key_inputs.push(ki);
+        key_inputs.push_back(ki);
     }
 
     void CGInput::addMouseInput(const gcn::MouseInput &mi)
     {
-        mouse_inputs.push(mi);
+        mouse_inputs.push_back(mi);
     }
 
 
     bool CGInput::inputWaiting() const
     {
-        return !key_inputs.empty() || !mouse_inputs.empty();
+        return key_pos != key_inputs.size() || mouse_pos != mouse_inputs.size();
     }
     
 }
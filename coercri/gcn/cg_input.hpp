@@ -52,6 +52,8 @@
 
 #include "boost/shared_ptr.hpp"
 
+#include <vector>
+
 namespace Coercri {
 
     class Timer;
@@ -62,7 +64,7 @@ namespace Coercri {
         // Constructor requires a Timer -- this is for the timestamps
         // in the guichan MouseInputs (which are used to check for
         // double clicks).
-        explicit CGInput(boost::shared_ptr<Timer> tmr) : timer(tmr) { }
+        explicit CGInput(boost::shared_ptr<Timer> tmr) : timer(tmr), key_pos(0), mouse_pos(0) { }
         
         // Functions from gcn::Input
         virtual bool isKeyQueueEmpty();
@@ -80,8 +82,12 @@ namespace Coercri {
         
     private:
         boost::shared_ptr<Timer> timer;
-        std::queue<gcn::KeyInput> key_inputs;
-        std::queue<gcn::MouseInput> mouse_inputs;
+
+        // FIFO queues. Emptied (keeping their capacity) once everything
+        // has been read, so that queueing an input does not allocate.
+        std::vector<gcn::KeyInput> key_inputs;
+        std::vector<gcn::MouseInput> mouse_inputs;
+        std::size_t key_pos, mouse_pos;   // next input to read
     };
 }
 
@@ -41,6 +41,7 @@
 #include "cg_graphics.hpp"
 #include "cg_input.hpp"
 #include "cg_listener.hpp"
+#include "../gfx/region.hpp"
 #include "../gfx/window.hpp"
 #include "../timer/timer.hpp"
 
@@ -118,6 +119,21 @@ namespace Coercri {
         pimpl->graphics.setTarget(0);
     }
 
+    void CGListener::draw(GfxContext &gc, const Region &region)
+    {
+        if (!pimpl->gui_enabled) return;
+
+        pimpl->gui->logic();
+
+        pimpl->graphics.setTarget(&gc);
+        for (Region::const_iterator it = region.begin(); it != region.end(); ++it) {
+            pimpl->graphics.setLimitRectangle(*it);
+            pimpl->gui->draw();
+        }
+        pimpl->graphics.clearLimitRectangle();
+        pimpl->graphics.setTarget(0);
+    }
+
     void CGListener::onResize(int new_width, int new_height)
     {
         if (!pimpl->gui_enabled) return;
@@ -56,6 +56,7 @@ namespace gcn {
 namespace Coercri {
 
     class CGListenerImpl;
+    class Region;
     class Timer;
     class Window;
     
@@ -95,6 +96,10 @@ namespace Coercri {
         // This function draws the GUI. It should be called from the
         // main loop whenever the window is invalid.
         void draw(GfxContext &gc);
+
+        // As draw(), but only redraws the parts of the GUI inside the given
+        // region. (Widgets entirely outside it cost very little.)
+        void draw(GfxContext &gc, const Region &region);
         
         // Overridden from WindowListener:
         virtual void onResize(int new_width, int new_height);
@@ -43,6 +43,7 @@
 #include "kern_table.hpp"
 #include "pixel_array.hpp"
 
+#include <algorithm>
 #include <cstring>
 
 namespace Coercri {
@@ -125,6 +126,7 @@ namespace Coercri {
         characters[ch]->xofs = xofs;
         characters[ch]->yofs = yofs;
         characters[ch]->xadvance = xadvance;
+        atlas.reset();
     }
 
     void BitmapFont::plotPixel(char c, int x, int y, unsigned char alpha)
@@ -137,6 +139,7 @@ namespace Coercri {
         
         int idx = y * characters[ch]->width + x;
         characters[ch]->pixels[idx] = alpha;
+        atlas.reset();
     }
     
     BitmapFont::~BitmapFont()
@@ -148,58 +151,103 @@ namespace Coercri {
         }
     }
     
-    void BitmapFont::drawText(GfxContext &dest, int x, int y, const std::string &text, Color col) const
+    namespace {
+        const int MIN_ATLAS_WIDTH = 256;
+        const int ATLAS_PADDING = 1;      // empty pixels between the glyphs in the atlas
+        const int MAX_STACK_QUADS = 64;   // quads laid out at a time by drawText(string)
+    }
+
+    const GlyphAtlas & BitmapFont::getAtlas() const
     {
-        bool use_input_alpha = (col.a != 255);
-        int input_alpha = col.a;
-        
-        char previous = 0;
+        if (!atlas) buildAtlas();
+        return *atlas;
+    }
 
-        static std::vector<Pixel> pixel_buf;
-        pixel_buf.clear();
-        
-        for (std::string::const_iterator it = text.begin(); it != text.end(); ++it) {
+    void BitmapFont::buildAtlas() const
+    {
+        // Pack the glyphs in rows ("shelves"), in character order.
+        int atlas_width = MIN_ATLAS_WIDTH;
+        for (int ch = 33; ch < 256; ++ch) {
+            if (characters[ch]) atlas_width = std::max(atlas_width, characters[ch]->width);
+        }
+
+        int x = 0, y = 0, row_height = 0;
+        for (int ch = 33; ch < 256; ++ch) {
+            Character *chr = characters[ch];
+            if (!chr) continue;
+            if (x + chr->width > atlas_width) {
+                x = 0;
+                y += row_height + ATLAS_PADDING;
+                row_height = 0;
+            }
+            chr->atlas_x = x;
+            chr->atlas_y = y;
+            x += chr->width + ATLAS_PADDING;
+            row_height = std::max(row_height, chr->height);
+        }
+
+        boost::shared_ptr<PixelArray> pixels(new PixelArray(atlas_width, std::max(1, y + row_height),
+                                                            Color(255, 255, 255, 0)));
+        for (int ch = 33; ch < 256; ++ch) {
+            const Character *chr = characters[ch];
+            if (!chr) continue;
+            for (int j = 0; j < chr->height; ++j) {
+                for (int i = 0; i < chr->width; ++i) {
+                    (*pixels)(chr->atlas_x + i, chr->atlas_y + j).a = chr->pixels[j * chr->width + i];
+                }
+            }
+        }
+
+        atlas.reset(new GlyphAtlas(pixels));
+    }
+
+    int BitmapFont::layoutGlyphs(std::string::const_iterator &it, std::string::const_iterator end,
+                                 int &pen_x, char &previous, GlyphQuad *out, int max_quads) const
+    {
+        // Stops early (leaving "it" at the next character) if out[] fills up.
+        int n = 0;
+        for (; it != end; ++it) {
 
             const char c = *it;
+            if (c <= 0 || !characters[c]) continue;
 
-            if (c > 0 && c < 256) {
+            const Character &chr = *characters[c];
+            const bool visible = c != 32 && chr.width > 0 && chr.height > 0;
+            if (visible && n == max_quads) break;
 
-                // apply kerning if required
-                if (previous && kern_table) {
-                    x += kern_table->getKern(previous, c);
-                }
-                
-                if (c != 32) {  // non-space character
+            // apply kerning if required
+            if (previous && kern_table) {
+                pen_x += kern_table->getKern(previous, c);
+            }
 
-                    const int width = characters[c]->width;
-                    const int height = characters[c]->height;
-                    const int xofs = characters[c]->xofs;
-                    const int yofs = characters[c]->yofs;                    
-                    
-                    for (int j = 0; j < height; ++j) {
-                        for (int i = 0; i < width; ++i) {
-                            unsigned char font_alpha = characters[c]->pixels[j * width + i];
-                            if (font_alpha > 0) {
-                            
-                                if (use_input_alpha) {
-                                    col.a = static_cast<unsigned char>(int(font_alpha) * input_alpha / 255);
-                                } else {
-                                    col.a = font_alpha;
-                                }
-
-                                pixel_buf.push_back(Pixel(x + xofs + i, y + yofs + j, col));
-                            }
-                        }
-                    }
-                }
-                
-                x += characters[c]->xadvance;
-                previous = c;
+            if (visible) {
+                GlyphQuad &quad = out[n++];
+                quad.x = pen_x + chr.xofs;
+                quad.y = chr.yofs;
+                quad.width = chr.width;
+                quad.height = chr.height;
+                quad.atlas_x = chr.atlas_x;
+                quad.atlas_y = chr.atlas_y;
             }
+
+            pen_x += chr.xadvance;
+            previous = c;
         }
+        return n;
+    }
+
+    void BitmapFont::drawText(GfxContext &dest, int x, int y, const std::string &text, Color col) const
+    {
+        const GlyphAtlas &atl = getAtlas();
+
+        GlyphQuad quads[MAX_STACK_QUADS];
+        int pen_x = 0;
+        char previous = 0;
 
-        if (!pixel_buf.empty()) {
-            dest.plotPixelBatch(&pixel_buf[0], pixel_buf.size());
+        std::string::const_iterator it = text.begin();
+        while (it != text.end()) {
+            const int n = layoutGlyphs(it, text.end(), pen_x, previous, quads, MAX_STACK_QUADS);
+            if (n > 0) dest.drawGlyphs(x, y, atl, quads, n, col);
         }
     }
 
@@ -209,11 +257,11 @@ namespace Coercri {
         char previous = 0;
         for (std::string::const_iterator it = text.begin(); it != text.end(); ++it) {
             const char c = *it;
-            if (c > 0 && c < 256) {
+            if (c > 0 && characters[c]) {
                 if (previous && kern_table) {
                     w += kern_table->getKern(previous, c);
                 }
-                w += characters[*it]->xadvance;
+                w += characters[c]->xadvance;
                 previous = c;
             }
         }
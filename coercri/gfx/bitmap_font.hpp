@@ -45,6 +45,7 @@
 #define COERCRI_BITMAP_FONT_HPP
 
 #include "font.hpp"
+#include "glyph_atlas.hpp"
 
 #include "boost/noncopyable.hpp"
 #include "boost/shared_ptr.hpp"
@@ -109,18 +110,31 @@ namespace Coercri {
         int getTextHeight() const;
         void drawText(GfxContext &dest, int x, int y, const std::string &text, Color col) const;
 
+        
+        // All the characters are packed into one atlas (built when
+        // first needed). drawText lays the string out as quads of
+        // the atlas, kerning included, into a small buffer on the
+        // stack, and draws them with GfxContext::drawGlyphs.
+        const GlyphAtlas & getAtlas() const;
+
     private:
         struct Character {
             int width, height;  // width and height of pixels[] array
             int xofs, yofs;     // offset from "pen position" (top left of character) to top left of pixels[] array.
             int xadvance;       // amount to move right after drawing this character.
+            int atlas_x, atlas_y;        // where pixels[] is in the atlas.
             unsigned char pixels[];      // Variable sized array, row major, contains alpha values from 0-255.
         };
 
+        int layoutGlyphs(std::string::const_iterator &it, std::string::const_iterator end,
+                         int &pen_x, char &previous, GlyphQuad *out, int max_quads) const;
+        void buildAtlas() const;
+
     private:
         Character * characters[256];
         boost::shared_ptr<KernTable> kern_table;
         int text_height;
+        mutable boost::shared_ptr<GlyphAtlas> atlas;  // NULL until getAtlas(); reset when characters change.
     };
 }
 
@@ -40,8 +40,11 @@
 
 #include "font.hpp"
 #include "gfx_context.hpp"
+#include "glyph_atlas.hpp"
 #include "rectangle.hpp"
 
+#include <vector>
+
 namespace Coercri {
 
     void GfxContext::drawLine(int x0, int y0, int x1, int y1, Color col)
@@ -123,4 +126,33 @@ namespace Coercri {
             plotPixel(buf[i].x, buf[i].y, buf[i].col);
         }
     }
+
+    void GfxContext::drawGlyphs(int x, int y, const GlyphAtlas &atlas, const GlyphQuad *quads, int num_quads, Color col)
+    {
+        const PixelArray &pixels = atlas.getPixels();
+        const bool use_input_alpha = (col.a != 255);
+        const int input_alpha = col.a;
+
+        glyph_pixels.clear();
+
+        for (const GlyphQuad *q = quads; q != quads + num_quads; ++q) {
+            for (int j = 0; j < q->height; ++j) {
+                for (int i = 0; i < q->width; ++i) {
+                    const unsigned char font_alpha = pixels(q->atlas_x + i, q->atlas_y + j).a;
+                    if (font_alpha > 0) {
+                        if (use_input_alpha) {
+                            col.a = static_cast<unsigned char>(int(font_alpha) * input_alpha / 255);
+                        } else {
+                            col.a = font_alpha;
+                        }
+                        glyph_pixels.push_back(Pixel(x + q->x + i, y + q->y + j, col));
+                    }
+                }
+            }
+        }
+
+        if (!glyph_pixels.empty()) {
+            plotPixelBatch(&glyph_pixels[0], int(glyph_pixels.size()));
+        }
+    }
 }
@@ -47,12 +47,15 @@
 #include "color.hpp"
 
 #include <string>
+#include <vector>
 
 namespace Coercri {
 
     class Font;
+    class GlyphAtlas;
     class Graphic;
     class Rectangle;
+    struct GlyphQuad;
 
     // This struct is used in plotPixelBatch.
     struct Pixel {
@@ -94,6 +97,17 @@ namespace Coercri {
         virtual void drawRectangle(const Rectangle &rect, Color col);  // draws outline only.
         virtual void fillRectangle(const Rectangle &rect, Color col);  // draws a solid rectangle.
         virtual void plotPixelBatch(const Pixel *buf_start, int num_pixels);
+
+        // Draws quads (laid out by e.g. BitmapFont::drawText) from
+        // a glyph atlas, offset by (x,y), in colour col. The atlas
+        // alpha is multiplied by col.a. The default implementation
+        // plots the pixels through plotPixelBatch.
+        virtual void drawGlyphs(int x, int y, const GlyphAtlas &atlas, const GlyphQuad *quads, int num_quads, Color col);
+
+    private:
+        // pixels for the default drawGlyphs (kept between calls, so
+        // that drawing text does not allocate once it has grown)
+        std::vector<Pixel> glyph_pixels;
     };
 
 }
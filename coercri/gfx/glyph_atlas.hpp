@@ -0,0 +1,86 @@
+/*
+ * FILE:
+ *   glyph_atlas.hpp
+ *
+ * PURPOSE:
+ *   Laid out text, for drawing a whole string as one batch of
+ *   textured quads rather than pixel by pixel.
+ *
+ *   A GlyphAtlas is an image with every character of a font packed
+ *   into it (see BitmapFont::getAtlas). A GlyphQuad is a rectangle of
+ *   the atlas and where to draw it, with the kerning already applied.
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) Stephen Thompson, 2008 - 2012.
+ *
+ *   This file is part of the "Coercri" software library. Usage of "Coercri"
+ *   is permitted under the terms of the Boost Software License, Version 1.0, 
+ *   the text of which is displayed below.
+ *
+ *   Boost Software License - Version 1.0 - August 17th, 2003
+ *
+ *   Permission is hereby granted, free of charge, to any person or organization
+ *   obtaining a copy of the software and accompanying documentation covered by
+ *   this license (the "Software") to use, reproduce, display, distribute,
+ *   execute, and transmit the Software, and to prepare derivative works of the
+ *   Software, and to permit third-parties to whom the Software is furnished to
+ *   do so, all subject to the following:
+ *
+ *   The copyright notices in the Software and this entire statement, including
+ *   the above license grant, this restriction and the following disclaimer,
+ *   must be included in all copies of the Software, in whole or in part, and
+ *   all derivative works of the Software, unless such copies or derivative
+ *   works are solely in the form of machine-executable object code generated by
+ *   a source language processor.
+ *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *   FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+ *   SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+ *   FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+ *   ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *   DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef COERCRI_GLYPH_ATLAS_HPP
+#define COERCRI_GLYPH_ATLAS_HPP
+
+#include "pixel_array.hpp"
+
+#include "boost/noncopyable.hpp"
+#include "boost/shared_ptr.hpp"
+
+namespace Coercri {
+
+    class Graphic;
+
+    struct GlyphQuad {
+        int x, y;               // top left, relative to the position the text is drawn at
+        int width, height;
+        int atlas_x, atlas_y;   // top left of the glyph in the atlas
+    };
+
+    class GlyphAtlas : boost::noncopyable {
+    public:
+        // The colour channels are white; the glyphs are in the alpha channel.
+        explicit GlyphAtlas(boost::shared_ptr<const PixelArray> pixels_) : pixels(pixels_) { }
+
+        const PixelArray & getPixels() const { return *pixels; }
+        boost::shared_ptr<const PixelArray> getPixelsPtr() const { return pixels; }
+
+        // The atlas as a Graphic, for GfxContexts that need one to draw it
+        // (e.g. a texture). Created by the GfxContext the first time it is used.
+        boost::shared_ptr<Graphic> & getGraphicCache() const { return graphic; }
+
+    private:
+        boost::shared_ptr<const PixelArray> pixels;
+        mutable boost::shared_ptr<Graphic> graphic;
+    };
+
+}
+
+#endif
@@ -45,135 +45,307 @@
 #include "pixel_array.hpp"
 #include "../core/coercri_error.hpp"
 
-#include "boost/shared_array.hpp"
+#include <fstream>
 #include <istream>
+#include <iterator>
+#include <thread>
+#include <vector>
 
-namespace Coercri {
-
-    // BMPs are stored little-endian so we need some endian-independent read functions:
+#ifdef WIN32
+#include <windows.h>
+#ifdef min
+#undef min
+#endif
+#ifdef max
+#undef max
+#endif
+#endif
 
-    unsigned char ReadByte(std::istream &str)
-    {
-        unsigned char c = 0;
-        str.read((char*)&c, 1);
-        return c;
-    }
-    
-    unsigned short int ReadShort(std::istream &str)
-    {
-        unsigned char c[2] = {0,0};
-        str.read((char*)c, 2);
-        return (c[0] + (c[1]<<8));
-    }
+namespace Coercri {
 
-    unsigned int ReadLong(std::istream &str)
-    {
-        unsigned char c[4] = {0,0,0,0};
-        str.read((char*)c, 4);
-        return (c[0] + (c[1]<<8) + (c[2]<<16) + (c[3]<<24));
-    }
+    namespace {
 
-    boost::shared_ptr<PixelArray> LoadBMP(std::istream &str)
-    {
-        boost::shared_ptr<PixelArray> result;
+        // BMPs are stored little-endian so we need some endian-independent read functions:
 
-        // Check stream is valid
-        if (!str) {
-            throw CoercriError("Failed to load BMP file: could not open file");
+        unsigned int GetShort(const unsigned char *p)
+        {
+            return p[0] + (p[1]<<8);
         }
 
-        // Check the magic number
-        char magic[2] = {0,0};
-        str.read(magic, 2);
-        if (!str || magic[0] != 'B' || magic[1] != 'M') {
-            throw CoercriError("Failed to load BMP file: incorrect file format");
+        unsigned int GetLong(const unsigned char *p)
+        {
+            return p[0] + (p[1]<<8) + (p[2]<<16) + (p[3]<<24);
         }
 
-        ReadLong(str);   // file size
-        ReadLong(str);   // reserved
-        ReadLong(str);   // offset to bitmap data
-        const unsigned int header_size = ReadLong(str);
-
-        // Header size 40 is the Windows V3 format, which is the most common
-        // Header size 12 is the OS/2 V1 format which is apparently also popular
-        if (header_size != 40 && header_size != 12) throw CoercriError("Failed to load BMP file: unsupported header size");
-
-        const unsigned int bitmap_width = (header_size == 40 ? ReadLong(str) : ReadShort(str));
-        const unsigned int bitmap_height = (header_size == 40 ? ReadLong(str) : ReadShort(str));
-        ReadShort(str);   // number of color planes (always 1)
-        const unsigned int bits_per_pixel = ReadShort(str);
-
-        // I only support either 8-bpp or 24-bpp bitmaps for now.
-        // (other values are more complicated to work with and also
-        // uncommon in practice.)
-        if (bits_per_pixel != 8 && bits_per_pixel != 24) {
-            throw CoercriError("Failed to load BMP file: unsupported bits per pixel");
+        // The whole of a file, in memory. On Windows the file is mapped
+        // rather than read, so the OS pages it in as the rows are decoded.
+        class FileData {
+        public:
+            explicit FileData(const std::string &filename);
+            ~FileData();
+
+            const unsigned char * data() const { return ptr; }
+            size_t size() const { return sz; }
+
+        private:
+            FileData(const FileData &);
+            void operator=(const FileData &);
+
+            const unsigned char *ptr;
+            size_t sz;
+#ifdef WIN32
+            void close();
+            HANDLE file, mapping;
+#else
+            std::vector<unsigned char> buf;
+#endif
+        };
+
+#ifdef WIN32
+        FileData::FileData(const std::string &filename)
+            : ptr(0), sz(0), file(INVALID_HANDLE_VALUE), mapping(0)
+        {
+            file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, 0,
+                               OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+            if (file == INVALID_HANDLE_VALUE) {
+                throw CoercriError("Failed to load BMP file: could not open file");
+            }
+
+            LARGE_INTEGER file_size;
+            if (!GetFileSizeEx(file, &file_size)) {
+                close();
+                throw CoercriError("Failed to load BMP file: could not read file");
+            }
+            if (file_size.QuadPart == 0) return;   // can't map an empty file (the header check will fail instead)
+
+            mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+            if (mapping) ptr = static_cast<const unsigned char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            if (!ptr) {
+                close();
+                throw CoercriError("Failed to load BMP file: could not map file");
+            }
+            sz = size_t(file_size.QuadPart);
         }
-        
-        unsigned int compression_method = 0;
-        unsigned int number_of_colors = 0;
-        if (header_size == 40) {
-            compression_method = ReadLong(str);
-            ReadLong(str);   // image size
-            ReadLong(str);   // horizontal resolution
-            ReadLong(str);   // vertical resolution
-            number_of_colors = ReadLong(str);
-            ReadLong(str);   // number of important colors
+
+        FileData::~FileData()
+        {
+            close();
         }
 
-        if (number_of_colors == 0 && bits_per_pixel <= 8) {
-            // Number_of_colors == 0 means use the default of 2^n colours
-            number_of_colors = (1 << bits_per_pixel);
+        void FileData::close()
+        {
+            if (ptr) UnmapViewOfFile(ptr);
+            if (mapping) CloseHandle(mapping);
+            if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+            ptr = 0;
+            mapping = 0;
+            file = INVALID_HANDLE_VALUE;
         }
-        if (bits_per_pixel > 8) {
-            // The palette isn't used for greater than 8 bits per pixel.
-            number_of_colors = 0;
+#else
+        FileData::FileData(const std::string &filename)
+            : ptr(0), sz(0)
+        {
+            std::ifstream str(filename.c_str(), std::ios::in | std::ios::binary);
+            if (!str) {
+                throw CoercriError("Failed to load BMP file: could not open file");
+            }
+
+            // one read for the whole file
+            str.seekg(0, std::ios::end);
+            buf.resize(size_t(str.tellg()));
+            str.seekg(0, std::ios::beg);
+            if (!buf.empty() && !str.read(reinterpret_cast<char*>(&buf[0]), buf.size())) {
+                throw CoercriError("Failed to load BMP file: could not read file");
+            }
+
+            ptr = buf.empty() ? 0 : &buf[0];
+            sz = buf.size();
         }
-        if (number_of_colors > 256) {
-            throw CoercriError("Failed to load BMP file: Incorrect number of colors");
+
+        FileData::~FileData()
+        {
         }
-        
-        if (compression_method != 0) {
-            // We don't support compressed bitmaps yet
-            throw CoercriError("Failed load BMP file: unsupported compression method");
+#endif
+
+        // Everything needed to decode the pixels, taken from the headers.
+        struct BMPInfo {
+            int width, height;
+            int bits_per_pixel;
+            int bytes_per_row;                 // including the padding
+            const unsigned char *pixels;       // bottom row first
+            Color palette[256];
+        };
+
+        void ReadHeader(const unsigned char *data, size_t size, BMPInfo &info)
+        {
+            // Check the magic number (and that the fixed part of the headers is there)
+            if (size < 26 || data[0] != 'B' || data[1] != 'M') {
+                throw CoercriError("Failed to load BMP file: incorrect file format");
+            }
+
+            // 2: file size; 6: reserved
+            const unsigned int data_offset = GetLong(data + 10);
+            const unsigned int header_size = GetLong(data + 14);
+
+            // Header size 40 is the Windows V3 format, which is the most common
+            // Header size 12 is the OS/2 V1 format which is apparently also popular
+            if (header_size != 40 && header_size != 12) throw CoercriError("Failed to load BMP file: unsupported header size");
+            if (size < 14 + header_size) throw CoercriError("Failed to load BMP file: incorrect file format");
+
+            const unsigned char *h = data + 18;
+            const unsigned int bitmap_width = (header_size == 40 ? GetLong(h) : GetShort(h));
+            const unsigned int bitmap_height = (header_size == 40 ? GetLong(h+4) : GetShort(h+2));
+            h += (header_size == 40 ? 8 : 4);
+            // h+0: number of color planes (always 1)
+            const unsigned int bits_per_pixel = GetShort(h+2);
+
+            // I only support either 8-bpp or 24-bpp bitmaps for now.
+            // (other values are more complicated to work with and also
+            // uncommon in practice.)
+            if (bits_per_pixel != 8 && bits_per_pixel != 24) {
+                throw CoercriError("Failed to load BMP file: unsupported bits per pixel");
+            }
+
+            // (this also rules out top-down bitmaps, which have a negative height.)
+            if (bitmap_width == 0 || bitmap_height == 0 || bitmap_width > 65535 || bitmap_height > 65535) {
+                throw CoercriError("Failed to load BMP file: unsupported bitmap size");
+            }
+
+            unsigned int compression_method = 0;
+            unsigned int number_of_colors = 0;
+            if (header_size == 40) {
+                compression_method = GetLong(h+4);
+                // h+8: image size; h+12, h+16: resolution
+                number_of_colors = GetLong(h+20);
+                // h+24: number of important colors
+            }
+
+            if (number_of_colors == 0 && bits_per_pixel <= 8) {
+                // Number_of_colors == 0 means use the default of 2^n colours
+                number_of_colors = (1 << bits_per_pixel);
+            }
+            if (bits_per_pixel > 8) {
+                // The palette isn't used for greater than 8 bits per pixel.
+                number_of_colors = 0;
+            }
+            if (number_of_colors > 256) {
+                throw CoercriError("Failed to load BMP file: Incorrect number of colors");
+            }
+
+            if (compression_method != 0) {
+                // We don't support compressed bitmaps yet
+                throw CoercriError("Failed load BMP file: unsupported compression method");
+            }
+
+            // The palette follows the header. Entries are stored in BGR order,
+            // plus a padding byte in the Windows format.
+            const size_t palette_start = 14 + header_size;
+            const size_t entry_size = (header_size == 40 ? 4 : 3);
+            const size_t palette_end = palette_start + number_of_colors * entry_size;
+            if (size < palette_end) throw CoercriError("Failed to load BMP file: file is truncated");
+
+            for (unsigned int i = 0; i < 256; ++i) {
+                if (i < number_of_colors) {
+                    const unsigned char *p = data + palette_start + i * entry_size;
+                    info.palette[i] = Color(p[2], p[1], p[0]);
+                } else {
+                    info.palette[i] = Color(0, 0, 0);
+                }
+            }
+
+            // Rows are padded to a multiple of 4 bytes. The pixels usually
+            // follow the palette, but the header says exactly where they are.
+            const size_t bytes_per_row = ((bits_per_pixel/8) * bitmap_width + 3) & ~3u;
+            const size_t pixel_start = (data_offset != 0 ? data_offset : palette_end);
+            if (pixel_start < palette_end
+            || size < pixel_start || size - pixel_start < bytes_per_row * bitmap_height) {
+                throw CoercriError("Failed to load BMP file: file is truncated");
+            }
+
+            info.width = int(bitmap_width);
+            info.height = int(bitmap_height);
+            info.bits_per_pixel = int(bits_per_pixel);
+            info.bytes_per_row = int(bytes_per_row);
+            info.pixels = data + pixel_start;
         }
 
-        boost::shared_array<Color> palette(new Color[number_of_colors]);
-        for (unsigned int i = 0; i < number_of_colors; ++i) {
-            // palette entries are stored in BGR order
-            const unsigned char b = ReadByte(str);
-            const unsigned char g = ReadByte(str);
-            const unsigned char r = ReadByte(str);
-            if (header_size==40) ReadByte(str);  // skip padding byte
-            palette[i] = Color(r,g,b);
+        // Decodes file rows [row_begin, row_end) (counting from the bottom,
+        // as they are stored) into the PixelArray.
+        void DecodeRows(const BMPInfo &info, PixelArray &result, int row_begin, int row_end)
+        {
+            const int w = info.width;
+
+            for (int row = row_begin; row < row_end; ++row) {
+                const unsigned char *src = info.pixels + size_t(row) * info.bytes_per_row;
+                Color *dst = &result(0, info.height - 1 - row);
+
+                if (info.bits_per_pixel == 24) {
+                    // don't forget: BGR order! (BMPs don't support transparency so A=255.)
+                    for (int x = 0; x < w; ++x, src += 3) {
+                        dst[x] = Color(src[2], src[1], src[0]);
+                    }
+                } else {
+                    for (int x = 0; x < w; ++x) {
+                        dst[x] = info.palette[src[x]];
+                    }
+                }
+            }
         }
 
-        result.reset(new PixelArray(bitmap_width, bitmap_height));
-
-        // calculate the number of padding bytes at the end of each row.
-        const int bytes_per_row = (bits_per_pixel/8) * bitmap_width;
-        const int left_over = bytes_per_row % 4;
-        const int padding = (left_over==0) ? 0 : 4 - left_over;
-        
-        // Read the data. (BMPs are stored bottom-to-top so the y loop runs backwards.)
-        for (int y = int(bitmap_height) - 1; y >= 0; --y) {
-            for (int x = 0; x < int(bitmap_width); ++x) {
-                Color& col = (*result)(x,y);
-                if (bits_per_pixel == 24) {
-                    // don't forget: BGR order!
-                    col.b = ReadByte(str);
-                    col.g = ReadByte(str);
-                    col.r = ReadByte(str);
+        struct DecodeRowsTask {
+            const BMPInfo *info;
+            PixelArray *result;
+            int row_begin, row_end;
+            void operator()() const { DecodeRows(*info, *result, row_begin, row_end); }
+        };
+
+        boost::shared_ptr<PixelArray> DecodeBMP(const unsigned char *data, size_t size, int num_threads)
+        {
+            // validate everything up front, so the decoding needs no checks
+            BMPInfo info;
+            ReadHeader(data, size, info);
+
+            boost::shared_ptr<PixelArray> result(new PixelArray(info.width, info.height));
+
+            if (num_threads > info.height) num_threads = info.height;
+            if (num_threads <= 1) {
+                DecodeRows(info, *result, 0, info.height);
+                return result;
+            }
+
+            // the rows are independent; this thread does the last band itself
+            std::vector<std::thread> threads;
+            threads.reserve(num_threads - 1);
+            for (int i = 0; i < num_threads; ++i) {
+                DecodeRowsTask task = { &info, result.get(),
+                                        info.height * i / num_threads,
+                                        info.height * (i+1) / num_threads };
+                if (i + 1 < num_threads) {
+                    threads.push_back(std::thread(task));
                 } else {
-                    unsigned char index = ReadByte(str);
-                    col = palette[index];
+                    task();
                 }
-                // BMPs don't support transparency so make sure A=255
-                col.a = 255;
             }
-            for (int p = 0; p < padding; ++p) ReadByte(str);
+            for (size_t i = 0; i < threads.size(); ++i) threads[i].join();
+
+            return result;
         }
+    }
 
-        return result;
+    boost::shared_ptr<PixelArray> LoadBMP(std::istream &str)
+    {
+        // Check stream is valid
+        if (!str) {
+            throw CoercriError("Failed to load BMP file: could not open file");
+        }
+
+        const std::vector<unsigned char> buf((std::istreambuf_iterator<char>(str)), std::istreambuf_iterator<char>());
+        return DecodeBMP(buf.empty() ? 0 : &buf[0], buf.size(), 1);
+    }
+
+    boost::shared_ptr<PixelArray> LoadBMPFile(const std::string &filename, int num_threads)
+    {
+        FileData file(filename);
+        return DecodeBMP(file.data(), file.size(), num_threads);
     }
 }
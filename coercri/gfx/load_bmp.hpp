@@ -54,6 +54,7 @@
 
 #include "boost/shared_ptr.hpp"
 #include <iosfwd>
+#include <string>
 
 namespace Coercri {
 
@@ -61,6 +62,12 @@ namespace Coercri {
 
     boost::shared_ptr<PixelArray> LoadBMP(std::istream &str);
 
+    // Faster version for loading straight from a file: the file is
+    // memory mapped (where supported) and decoded a whole row at a
+    // time. If num_threads > 1 the rows are split between that many
+    // threads. Safe to call from several threads at once.
+    boost::shared_ptr<PixelArray> LoadBMPFile(const std::string &filename, int num_threads = 1);
+
 }
 
 #endif
@@ -67,6 +67,12 @@ namespace Coercri {
         // so we use timeBeginPeriod / timeGetTime / timeEndTime instead.
         // Request 1ms resolution.
         timeBeginPeriod(1);
+
+        // getNsec uses QueryPerformanceCounter regardless, as nothing else
+        // has the resolution (and it is only used for measuring intervals).
+        LARGE_INTEGER freq;
+        QueryPerformanceFrequency(&freq);
+        perf_freq = freq.QuadPart;
 #endif
     }
 
@@ -92,6 +98,25 @@ namespace Coercri {
 #endif
     }    
 
+    unsigned long long GenericTimer::getNsec()
+    {
+#ifdef WIN32
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        const unsigned long long t = now.QuadPart;
+        // (split up to avoid overflowing 64 bits)
+        return (t / perf_freq) * 1000000000ull + (t % perf_freq) * 1000000000ull / perf_freq;
+
+#elif defined(__linux__)
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (unsigned long long)(now.tv_sec) * 1000000000ull + (unsigned long long)(now.tv_nsec);
+
+#else
+#error "Timer not implemented for this operating system!"
+#endif
+    }
+
     void GenericTimer::sleepMsec(int msec)
     {
 #ifdef WIN32
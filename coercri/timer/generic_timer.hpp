@@ -55,7 +55,13 @@ namespace Coercri {
         GenericTimer();
         ~GenericTimer();
         unsigned int getMsec();
+        unsigned long long getNsec();
         void sleepMsec(int msec);
+
+    private:
+#ifdef WIN32
+        unsigned long long perf_freq;   // QueryPerformanceFrequency
+#endif
     };
 }
 
@@ -56,6 +56,14 @@ namespace Coercri {
         // Get current "clock time" in milliseconds -- note does not necessarily start from zero.
         virtual unsigned int getMsec() = 0;
 
+        // Get current monotonic time in nanoseconds, for measuring short intervals.
+        // Again, does not necessarily start from zero. The resolution depends on the
+        // platform, but is much finer than getMsec (typically well under a microsecond).
+        virtual unsigned long long getNsec() = 0;
+
+        // As getNsec, but in microseconds.
+        unsigned long long getUsec() { return getNsec() / 1000; }
+
         // Sleep for at least the given number of milliseconds. Yields the CPU in the meantime.
         virtual void sleepMsec(int msec) = 0;
     };
@@ -0,0 +1,725 @@
+/*
+ * FILE:
+ *   cpu_solver.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "cpu_solver.hpp"
+#include "worker_pool.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// The functions in this anonymous namespace correspond directly to the
+// functions of the same name in kp07.hlsl.
+namespace {
+
+    inline float MinMod(float a, float b, float c)
+    {
+        return (a > 0 && b > 0 && c > 0) ? std::min(std::min(a,b),c)
+            : (a < 0 && b < 0 && c < 0) ? std::max(std::max(a,b),c) : 0;
+    }
+
+    inline void Reconstruct(float two_theta, float west, float here, float east,
+                            float &out_west, float &out_east)
+    {
+        const float dx_grad_over_two = 0.25f * MinMod(two_theta * (here - west),
+                                                      (east - west),
+                                                      two_theta * (east - here));
+        out_east = here + dx_grad_over_two;
+        out_west = here - dx_grad_over_two;
+    }
+
+    inline void CorrectW(float B_west, float B_east, float w_bar,
+                         float &w_west, float &w_east)
+    {
+        if (w_east < B_east) {
+            w_east = B_east;
+            w_west = std::max(B_west, 2 * w_bar - B_east);
+
+        } else if (w_west < B_west) {
+            w_east = std::max(B_east, 2 * w_bar - B_west);
+            w_west = B_west;
+        }
+    }
+
+    // returns "divide_by_h", i.e. the desingularized 1/h
+    inline float DivideByH(float h, float epsilon)
+    {
+        const float h2 = h * h;
+        const float h4 = h2 * h2;
+        return std::sqrt(2.0f) * h / std::sqrt(h4 + std::max(h4, epsilon));
+    }
+
+    inline float NumericalFlux(float aplus, float aminus, float Fplus, float Fminus, float Udifference)
+    {
+        if (aplus - aminus > 0) {
+            return (aplus * Fminus - aminus * Fplus + aplus * aminus * Udifference) / (aplus - aminus);
+        } else {
+            return 0;
+        }
+    }
+
+    inline float FrictionCalc(float h, float u, float dt, float friction)
+    {
+        return std::max(h*u*dt*0.2f, friction * h * std::abs(u) * u);
+    }
+
+    void FixedHBoundary(float g, float epsilon, float h_desired,
+                        float h_real, float hu_real,
+                        float &h_ghost, float &hu_ghost)
+    {
+        const float u_real = DivideByH(h_real, epsilon) * hu_real;
+        const float c_real = std::sqrt(g * h_real);
+        const float c_desired = std::sqrt(g * h_desired);
+        const float c_ghost = -u_real/2 - c_real + 2 * c_desired;
+
+        if (c_ghost < 0) {
+            h_ghost = 0;
+            hu_ghost = hu_real + h_real * (2 * c_real - 4 * c_desired);
+        } else {
+            const float LIMIT = 2.0f;
+            h_ghost = std::min(h_real + LIMIT, c_ghost*c_ghost / g);
+            hu_ghost = 0;
+        }
+    }
+
+    float CalcSeaLevel(const SimSettings &s, float sea_level, float total_time, float x, float y)
+    {
+        float waves = 0;
+        for (int i = 0; i < 4; ++i) {
+            waves += s.sa[i] * std::cos(s.skx[i] * x + s.sky[i] * y - s.so[i] * total_time);
+        }
+        const float sdecay = 0.01f / s.ny * s.L;
+        return sea_level + waves * std::exp(-sdecay * y);
+    }
+}
+
+CpuSolver::CpuSolver(const SimSettings &settings_,
+                     const BottomEntry *bottom_,
+                     float inlet_x_,
+                     const float *initial_state)
+    : nx(settings_.nx), ny(settings_.ny), pitch(settings_.nx + 4),
+      settings(settings_),
+      inlet_x(inlet_x_),
+      sim_idx(0),
+      bootstrap_needed(true),
+      current_timestep(0),
+      total_time(0),
+      pool(0)
+{
+    const int size = (nx+4) * (ny+4);
+
+    bottom.assign(bottom_, bottom_ + size);
+
+    const CellState *ic = reinterpret_cast<const CellState*>(initial_state);
+    state[0].assign(ic, ic + size);
+    state[1] = state[0];   // so the corner ghost cells (never written) are initialized
+
+    const Edges zero_edges = { 0, 0, 0, 0 };
+    h.assign(size, zero_edges);
+    u.assign(size, zero_edges);
+    v.assign(size, zero_edges);
+
+    const Flux zero_flux = { 0, 0, 0 };
+    xflux.assign(size, zero_flux);
+    yflux.assign(size, zero_flux);
+}
+
+void CpuSolver::setSettings(const SimSettings &s)
+{
+    settings = s;
+}
+
+void CpuSolver::setWorkerPool(WorkerPool *p)
+{
+    pool = p;
+}
+
+// Each task is one band of rows. Every row of a pass reads only the
+// previous pass's output, so the bands are independent.
+struct CpuSolver::PassJob : WorkerPool::Job {
+    CpuSolver &solver;
+    Pass pass;
+    const CellState *in;
+    CellState *out;
+    int row_begin, row_end, num_bands;
+
+    PassJob(CpuSolver &s, Pass p, const CellState *i, CellState *o, int rb, int re, int nb)
+        : solver(s), pass(p), in(i), out(o), row_begin(rb), row_end(re), num_bands(nb) { }
+
+    void run(int band)
+    {
+        const int rows = row_end - row_begin;
+        const int begin = row_begin + rows * band / num_bands;
+        const int end = row_begin + rows * (band + 1) / num_bands;
+
+        switch (pass) {
+        case PASS1: solver.pass1(in, begin, end); break;
+        case PASS2: solver.pass2(begin, end); break;
+        case PASS3: solver.pass3(out, begin, end); break;
+        }
+    }
+
+private:
+    void operator=(const PassJob &);
+};
+
+void CpuSolver::runPass(Pass pass, const CellState *in, CellState *out, int row_begin, int row_end)
+{
+    // A few bands per thread evens out the load if some threads start late.
+    const int num_bands = pool ? std::min(row_end - row_begin, 4 * pool->getNumThreads()) : 1;
+
+    PassJob job(*this, pass, in, out, row_begin, row_end, num_bands);
+    if (num_bands > 1) {
+        pool->run(job, num_bands);
+    } else {
+        job.run(0);
+    }
+}
+
+void CpuSolver::timestep()
+{
+    const CellState *old_state = &state[sim_idx][0];
+    CellState *new_state = &state[1 - sim_idx][0];
+
+    // Pass 1 runs on bulk + first ghost layer either side,
+    // Pass 2 on bulk + first ghost layer to west and south only,
+    // Pass 3 on the interior points only (see the vertex buffers in ShallowWaterEngine::createSimBuffers).
+
+    if (bootstrap_needed) {
+        runPass(PASS1, old_state, 0, 1, ny + 3);
+        bootstrap_needed = false;
+    }
+
+    runPass(PASS2, 0, 0, 1, ny + 2);
+    runPass(PASS3, 0, new_state, 2, ny + 2);
+    boundaries(new_state);
+
+    // Now do "pass 1" again, so that h, u, v are ready for the next timestep.
+    runPass(PASS1, new_state, 0, 1, ny + 3);
+
+    sim_idx = 1 - sim_idx;
+    total_time += current_timestep;
+}
+
+void CpuSolver::pass1(const CellState *in, int row_begin, int row_end)
+{
+    const float two_theta = 2 * settings.theta;
+    const float epsilon = settings.epsilon;
+
+    for (int j = row_begin; j < row_end; ++j) {
+        for (int i = 1; i < nx + 3; ++i) {
+            const int k = j * pitch + i;
+
+            const CellState &in_here = in[k];
+            const CellState &in_south = in[k - pitch];
+            const CellState &in_north = in[k + pitch];
+            const CellState &in_west = in[k - 1];
+            const CellState &in_east = in[k + 1];
+
+            const float BN = bottom[k].BY;
+            const float BE = bottom[k].BX;
+            const float BS = bottom[k - pitch].BY;
+            const float BW = bottom[k - 1].BX;
+
+            // Reconstruct w, hu and hv at the four cell edges (N, E, S, W)
+            Edges w, hu, hv;
+            Reconstruct(two_theta, in_west.w, in_here.w, in_east.w, w.w, w.e);
+            Reconstruct(two_theta, in_south.w, in_here.w, in_north.w, w.s, w.n);
+
+            Reconstruct(two_theta, in_west.hu, in_here.hu, in_east.hu, hu.w, hu.e);
+            Reconstruct(two_theta, in_south.hu, in_here.hu, in_north.hu, hu.s, hu.n);
+
+            Reconstruct(two_theta, in_west.hv, in_here.hv, in_east.hv, hv.w, hv.e);
+            Reconstruct(two_theta, in_south.hv, in_here.hv, in_north.hv, hv.s, hv.n);
+
+            // Correct the w values to ensure positivity of h
+            CorrectW(BW, BE, in_here.w, w.w, w.e);
+            CorrectW(BS, BN, in_here.w, w.s, w.n);
+
+            // Reconstruct h from (corrected) w, then calculate u and v
+            Edges &h_out = h[k];
+            h_out.n = w.n - BN;
+            h_out.e = w.e - BE;
+            h_out.s = w.s - BS;
+            h_out.w = w.w - BW;
+
+            const float dn = DivideByH(h_out.n, epsilon);
+            const float de = DivideByH(h_out.e, epsilon);
+            const float ds = DivideByH(h_out.s, epsilon);
+            const float dw = DivideByH(h_out.w, epsilon);
+
+            Edges &u_out = u[k];
+            u_out.n = dn * hu.n;
+            u_out.e = de * hu.e;
+            u_out.s = ds * hu.s;
+            u_out.w = dw * hu.w;
+
+            Edges &v_out = v[k];
+            v_out.n = dn * hv.n;
+            v_out.e = de * hv.e;
+            v_out.s = ds * hv.s;
+            v_out.w = dw * hv.w;
+        }
+    }
+}
+
+void CpuSolver::pass2(int row_begin, int row_end)
+{
+    const float g = settings.gravity;
+    const float half_g = 0.5f * g;
+
+    for (int j = row_begin; j < row_end; ++j) {
+        for (int i = 1; i < nx + 2; ++i) {
+            const int k = j * pitch + i;
+
+            const float hN = h[k].n;                // evaluated here
+            const float hE = h[k].e;
+            const float hW_east = h[k + 1].w;       // hW evaluated at (j+1, k)
+            const float hS_north = h[k + pitch].s;  // hS evaluated at (j, k+1)
+
+            const float uN = u[k].n;
+            const float uE = u[k].e;
+            const float uW_east = u[k + 1].w;
+            const float uS_north = u[k + pitch].s;
+
+            const float vN = v[k].n;
+            const float vE = v[k].e;
+            const float vW_east = v[k + 1].w;
+            const float vS_north = v[k + pitch].s;
+
+            // compute wave speeds
+            const float cN = std::sqrt(std::max(0.0f, g * hN));
+            const float cE = std::sqrt(std::max(0.0f, g * hE));
+            const float cW = std::sqrt(std::max(0.0f, g * hW_east));
+            const float cS = std::sqrt(std::max(0.0f, g * hS_north));
+
+            // compute propagation speeds
+            const float aplus  = std::max(std::max(uE + cE, uW_east + cW), 0.0f);
+            const float aminus = std::min(std::min(uE - cE, uW_east - cW), 0.0f);
+            const float bplus  = std::max(std::max(vN + cN, vS_north + cS), 0.0f);
+            const float bminus = std::min(std::min(vN - cN, vS_north - cS), 0.0f);
+
+            // compute fluxes
+            Flux &xf = xflux[k];
+            xf.w = NumericalFlux(aplus, aminus,
+                                 hW_east * uW_east,
+                                 hE * uE,
+                                 hW_east - hE);
+            xf.hu = NumericalFlux(aplus, aminus,
+                                  hW_east * (uW_east * uW_east + half_g * hW_east),
+                                  hE * (uE * uE + half_g * hE),
+                                  hW_east * uW_east - hE * uE);
+            xf.hv = NumericalFlux(aplus, aminus,
+                                  hW_east * uW_east * vW_east,
+                                  hE * uE * vE,
+                                  hW_east * vW_east - hE * vE);
+
+            Flux &yf = yflux[k];
+            yf.w = NumericalFlux(bplus, bminus,
+                                 hS_north * vS_north,
+                                 hN * vN,
+                                 hS_north - hN);
+            yf.hu = NumericalFlux(bplus, bminus,
+                                  hS_north * uS_north * vS_north,
+                                  hN * uN * vN,
+                                  hS_north * uS_north - hN * uN);
+            yf.hv = NumericalFlux(bplus, bminus,
+                                  hS_north * (vS_north * vS_north + half_g * hS_north),
+                                  hN * (vN * vN + half_g * hN),
+                                  hS_north * vS_north - hN * vN);
+        }
+    }
+}
+
+void CpuSolver::pass3(CellState *out, int row_begin, int row_end)
+{
+    const CellState *in = &state[sim_idx][0];
+
+    const float g = settings.gravity;
+    const float one_over_dx = 1.0f / settings.dx;
+    const float one_over_dy = 1.0f / settings.dy;
+    const float g_over_dx = g * one_over_dx;
+    const float g_over_dy = g * one_over_dy;
+    const float dt = current_timestep;
+    const float friction = settings.friction;
+    const float epsilon = settings.epsilon;
+
+    for (int j = row_begin; j < row_end; ++j) {
+        for (int i = 2; i < nx + 2; ++i) {
+            const int k = j * pitch + i;
+
+            const BottomEntry &B_here = bottom[k];
+            const CellState &in_state = in[k];
+
+            const Flux &xflux_here = xflux[k];
+            const Flux &xflux_west = xflux[k - 1];
+            const Flux &yflux_here = yflux[k];
+            const Flux &yflux_south = yflux[k - pitch];
+
+            const float BX_west = bottom[k - 1].BX;
+            const float BY_south = bottom[k - pitch].BY;
+
+            // friction calculation
+            const float h_ = std::max(0.0f, in_state.w - B_here.BA);
+            const float divide_by_h = DivideByH(h_, epsilon);
+            const float u_ = divide_by_h * in_state.hu;
+            const float v_ = divide_by_h * in_state.hv;
+
+            const float source_hu = -g_over_dx * h_ * (B_here.BX - BX_west) - FrictionCalc(h_, u_, dt, friction);
+            const float source_hv = -g_over_dy * h_ * (B_here.BY - BY_south) - FrictionCalc(h_, v_, dt, friction);
+
+            const float dw_by_dt = (xflux_west.w - xflux_here.w) * one_over_dx
+                + (yflux_south.w - yflux_here.w) * one_over_dy;
+            const float dhu_by_dt = (xflux_west.hu - xflux_here.hu) * one_over_dx
+                + (yflux_south.hu - yflux_here.hu) * one_over_dy
+                + source_hu;
+            const float dhv_by_dt = (xflux_west.hv - xflux_here.hv) * one_over_dx
+                + (yflux_south.hv - yflux_here.hv) * one_over_dy
+                + source_hv;
+
+            // simple Euler time stepping
+            CellState &result = out[k];
+            result.w = in_state.w + dw_by_dt * dt;
+            result.hu = in_state.hu + dhu_by_dt * dt;
+            result.hv = in_state.hv + dhv_by_dt * dt;
+            result.unused = 0;
+        }
+    }
+}
+
+void CpuSolver::boundaries(CellState *out)
+{
+    // See ShallowWaterEngine::timestep and the four boundary shaders.
+    // The ghost cells only read from interior cells, so this can be done in place.
+
+    const float g = settings.gravity;
+    const float epsilon = settings.epsilon;
+    const bool solid_wall_flag = settings.solid_walls;
+    const float sea_level = settings.use_sea_level ? settings.sea_level : -9999;
+    const int reflect_x = 2*nx + 3;
+    const int reflect_y = 2*ny + 3;
+
+    const float dx = settings.dx;
+    const int inflow_x_min = int((inlet_x - settings.inflow_width + settings.W/2)/dx) + 1;
+    const int inflow_x_max = int((inlet_x + settings.inflow_width + settings.W/2)/dx) + 3;
+    const float inflow_height = settings.inflow_height;
+    const float inflow_speed = 0.01f;
+
+    // North
+    for (int j = ny + 2; j < ny + 4; ++j) {
+        for (int i = 2; i < nx + 2; ++i) {
+            const int k_real = (reflect_y - j) * pitch + i;
+            const CellState &real = out[k_real];
+            const float B = bottom[k_real].BA;
+            const float h_real = real.w - B;
+            const float SL = sea_level;
+
+            CellState &ghost = out[j * pitch + i];
+            if (i >= inflow_x_min && i <= inflow_x_max) {
+                ghost.w = B + inflow_height;
+                ghost.hu = 0;
+                ghost.hv = inflow_height * (-inflow_speed);
+            } else if (B > SL && solid_wall_flag) {
+                ghost.w = real.w;
+                ghost.hu = real.hu;
+                ghost.hv = -real.hv;
+            } else {
+                float h_ghost;
+                FixedHBoundary(g, epsilon, std::max(0.0f, SL - B), h_real, real.hv, h_ghost, ghost.hv);
+                ghost.w = h_ghost + B;
+                ghost.hu = 0;
+            }
+            ghost.unused = 0;
+        }
+    }
+
+    // East
+    for (int j = 2; j < ny + 2; ++j) {
+        for (int i = nx + 2; i < nx + 4; ++i) {
+            const int k_real = j * pitch + (reflect_x - i);
+            const CellState &real = out[k_real];
+            const float B = bottom[k_real].BA;
+            const float h_real = real.w - B;
+            const float SL = CalcSeaLevel(settings, sea_level, total_time, i + 0.5f, j + 0.5f);
+
+            CellState &ghost = out[j * pitch + i];
+            if (B > SL && solid_wall_flag) {
+                ghost.w = real.w;
+                ghost.hu = -real.hu;
+                ghost.hv = real.hv;
+            } else {
+                float h_ghost;
+                FixedHBoundary(g, epsilon, std::max(0.0f, SL - B), h_real, real.hu, h_ghost, ghost.hu);
+                ghost.w = h_ghost + B;
+                ghost.hv = 0;
+            }
+            ghost.unused = 0;
+        }
+    }
+
+    // South
+    for (int j = 0; j < 2; ++j) {
+        for (int i = 2; i < nx + 2; ++i) {
+            const int k_real = (3 - j) * pitch + i;
+            const CellState &real = out[k_real];
+            const float B = bottom[k_real].BA;
+            const float h_real = real.w - B;
+            const float SL = CalcSeaLevel(settings, sea_level, total_time, i + 0.5f, j + 0.5f);
+
+            CellState &ghost = out[j * pitch + i];
+            if (B > SL && solid_wall_flag) {
+                ghost.w = real.w;
+                ghost.hu = real.hu;
+                ghost.hv = -real.hv;
+            } else {
+                float h_ghost, hv_ghost;
+                FixedHBoundary(g, epsilon, std::max(0.0f, SL - B), h_real, -real.hv, h_ghost, hv_ghost);
+                ghost.w = h_ghost + B;
+                ghost.hu = 0;
+                ghost.hv = -hv_ghost;
+            }
+            ghost.unused = 0;
+        }
+    }
+
+    // West
+    for (int j = 2; j < ny + 2; ++j) {
+        for (int i = 0; i < 2; ++i) {
+            const int k_real = j * pitch + (3 - i);
+            const CellState &real = out[k_real];
+            const float B = bottom[k_real].BA;
+            const float h_real = real.w - B;
+            const float SL = CalcSeaLevel(settings, sea_level, total_time, i + 0.5f, j + 0.5f);
+
+            CellState &ghost = out[j * pitch + i];
+            if (B > SL && solid_wall_flag) {
+                ghost.w = real.w;
+                ghost.hu = -real.hu;
+                ghost.hv = real.hv;
+            } else {
+                float h_ghost, hu_ghost;
+                FixedHBoundary(g, epsilon, std::max(0.0f, SL - B), h_real, -real.hu, h_ghost, hu_ghost);
+                ghost.w = h_ghost + B;
+                ghost.hu = -hu_ghost;
+                ghost.hv = 0;
+            }
+            ghost.unused = 0;
+        }
+    }
+}
+
+void CpuSolver::runStage(Stage stage)
+{
+    switch (stage) {
+    case STAGE_RECONSTRUCT:
+        runPass(PASS1, &state[sim_idx][0], 0, 1, ny + 3);
+        break;
+    case STAGE_FLUX:
+        runPass(PASS2, 0, 0, 1, ny + 2);
+        break;
+    case STAGE_UPDATE:
+        runPass(PASS3, 0, &state[1 - sim_idx][0], 2, ny + 2);
+        break;
+    case STAGE_BOUNDARY:
+        boundaries(&state[1 - sim_idx][0]);
+        break;
+    case STAGE_STATS:
+        {
+            SimStats stats;
+            computeStats(stats);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+double CpuSolver::getStageBytes(Stage stage) const
+{
+    const double bulk_cells = double(nx) * double(ny);
+    const double boundary_cells = 4.0 * (nx + ny);
+
+    switch (stage) {
+    case STAGE_RECONSTRUCT:
+        return double(nx + 2) * double(ny + 2)
+            * (sizeof(CellState) + sizeof(BottomEntry) + 3 * sizeof(Edges));
+    case STAGE_FLUX:
+        return double(nx + 1) * double(ny + 1)
+            * (3 * sizeof(Edges) + 2 * sizeof(Flux));
+    case STAGE_UPDATE:
+        return bulk_cells * (2 * sizeof(CellState) + sizeof(BottomEntry) + 2 * sizeof(Flux));
+    case STAGE_BOUNDARY:
+        return boundary_cells * (2 * sizeof(CellState) + sizeof(BottomEntry));
+    case STAGE_STATS:
+        return bulk_cells * (sizeof(CellState) + sizeof(BottomEntry));
+    default:
+        return 0;
+    }
+}
+
+void CpuSolver::resetTimestep(float max_dt, SimStats &stats)
+{
+    const float max_cfl = computeStats(stats);
+
+    // The CFL number is cfl * dt, and this must be less than max_cfl_number
+    if (max_cfl > 0) {
+        current_timestep = std::min(max_dt, settings.max_cfl_number / max_cfl);
+    } else {
+        current_timestep = max_dt;
+    }
+}
+
+void CpuSolver::applyTerrainBrush(const TerrainBrush &brush, float world_x, float world_y, float displacement)
+{
+    int cx, cy;
+    brush.locate(world_x, world_y, cx, cy);
+    brush.applyToBottom(&bottom[0], cx, cy, displacement);
+    brush.applyToW(&state[sim_idx][0].w, sizeof(CellState) / sizeof(float), cx, cy, displacement);
+}
+
+void CpuSolver::applyBrushBatch(const BrushBatch &batch)
+{
+    const BottomEntry *bottom_delta = batch.getBottomDelta();
+    const float *depth_delta = batch.getDepthDelta();
+    const unsigned char *water_mask = batch.getWaterMask();
+    CellState *out = &state[sim_idx][0];
+
+    for (int j = batch.getYMin(); j < batch.getYMax(); ++j) {
+        for (int i = batch.getXMin(); i < batch.getXMax(); ++i) {
+            const int k = j * pitch + i;
+            CellState &s = out[k];
+            BottomEntry &b = bottom[k];
+
+            // terrain brushes: move the water level with the bottom
+            b.BX += bottom_delta[k].BX;
+            b.BY += bottom_delta[k].BY;
+            b.BA += bottom_delta[k].BA;
+            s.w += bottom_delta[k].BA;
+
+            // water brushes (as LeftMousePixelShader)
+            if (water_mask[k]) {
+                const float B = b.BA;
+                const float old_h = s.w - B;
+                const float new_w = std::max(B, s.w + depth_delta[k]);
+                const float new_h = new_w - B;
+
+                // crude velocity calculation, as in the shader
+                const float limited_old_h = std::max(0.5f, old_h);
+                s.w = new_w;
+                s.hu = new_h * (s.hu / limited_old_h);
+                s.hv = new_h * (s.hv / limited_old_h);
+            }
+        }
+    }
+}
+
+void CpuSolver::updateTerrain(const BottomEntry *new_bottom, float new_inlet_x)
+{
+    const int size = (nx+4) * (ny+4);
+
+    // (both buffers, as timestep never writes the corner ghost cells, so the
+    // other buffer's would otherwise be left on the old terrain)
+    for (int idx = 0; idx < 2; ++idx) {
+        CellState *out = &state[idx][0];
+        for (int k = 0; k < size; ++k) {
+            out[k].w += new_bottom[k].BA - bottom[k].BA;
+        }
+    }
+
+    bottom.assign(new_bottom, new_bottom + size);
+    inlet_x = new_inlet_x;
+
+    // h, u, v were reconstructed from the old bottom
+    bootstrap_needed = true;
+}
+
+void CpuSolver::sampleProbes(ProbeSet &probes) const
+{
+    probes.locate(nx, ny, settings.W, settings.L);
+
+    const CellState *in = &state[sim_idx][0];
+    const ProbeSet::Cell *cells = probes.getCells();
+    ProbeSample *out = probes.getResults();
+
+    for (int p = 0; p < probes.size(); ++p) {
+        const int k = cells[p].j * pitch + cells[p].i;
+        const CellState &s = in[k];
+
+        const float h_ = std::max(0.0f, s.w - bottom[k].BA);
+        const float divide_by_h = DivideByH(h_, settings.epsilon);
+
+        out[p].depth = h_;
+        out[p].u = divide_by_h * s.hu;
+        out[p].v = divide_by_h * s.hv;
+        out[p].surface = s.w;
+    }
+
+    probes.setSampleTime(total_time);
+}
+
+float CpuSolver::computeStats(SimStats &stats) const
+{
+    // This is the GetStats shader followed by the CPU side of
+    // ShallowWaterEngine::resetTimestep. Sums are accumulated in double
+    // precision since we are not limited to 4x4 blocks here.
+
+    const CellState *in = &state[sim_idx][0];
+    const float g = settings.gravity;
+    const float one_over_dx = 1.0f / settings.dx;
+    const float one_over_dy = 1.0f / settings.dy;
+    const float epsilon = settings.epsilon;
+
+    double sum_h = 0, sum_Bhh2 = 0, sum_hu = 0, sum_hv = 0, sum_hu2v2 = 0;
+    float max_u2v2 = 0, max_h = 0, max_cfl = 0, max_f2 = 0;
+
+    for (int j = 2; j < ny + 2; ++j) {
+        for (int i = 2; i < nx + 2; ++i) {
+            const int k = j * pitch + i;
+            const CellState &s = in[k];
+            const float B = bottom[k].BA;
+
+            const float h_ = std::max(0.0f, s.w - B);
+            const float c = std::sqrt(g * h_);
+
+            const float divide_by_h = DivideByH(h_, epsilon);
+            const float u_ = divide_by_h * s.hu;
+            const float v_ = divide_by_h * s.hv;
+
+            sum_h += h_;
+            sum_Bhh2 += h_ * (B + 0.5f * h_);
+            sum_hu += s.hu;
+            sum_hv += s.hv;
+            sum_hu2v2 += (s.hu * u_ + s.hv * v_);
+
+            const float u2v2 = u_*u_ + v_*v_;
+            max_u2v2 = std::max(max_u2v2, u2v2);
+            max_h = std::max(max_h, h_);
+            max_cfl = std::max(max_cfl, (std::abs(u_) + c) * one_over_dx);
+            max_cfl = std::max(max_cfl, (std::abs(v_) + c) * one_over_dy);
+            max_f2 = std::max(max_f2, u2v2 * divide_by_h);
+        }
+    }
+
+    const double DENSITY = 1000;   // kg m^-3
+    const double AREA = settings.dx * settings.dy;   // m^2 (area of one cell)
+
+    stats.mass = float(sum_h * DENSITY * AREA);
+    stats.x_momentum = float(sum_hu * DENSITY * AREA);
+    stats.y_momentum = float(sum_hv * DENSITY * AREA);
+    stats.kinetic_energy = float(sum_hu2v2 * 0.5 * DENSITY * AREA);
+    stats.potential_energy = float(sum_Bhh2 * g * DENSITY * AREA);
+    stats.max_speed = std::sqrt(max_u2v2);
+    stats.max_depth = max_h;
+    stats.max_froude_number = std::sqrt(max_f2 / g);
+    stats.cfl = max_cfl;
+
+    return max_cfl;
+}
@@ -0,0 +1,163 @@
+/*
+ * FILE:
+ *   cpu_solver.hpp
+ *
+ * PURPOSE:
+ *   CPU implementation of the Kurganov-Petrova shallow water solver.
+ *   This is a straight port of the HLSL code in shaders/kp07.hlsl
+ *   (Pass1/2/3, the boundary shaders and GetStats) and produces the
+ *   same results as the GPU version, up to floating point rounding.
+ *   Used by the headless batch runner, where no D3D device exists.
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef CPU_SOLVER_HPP
+#define CPU_SOLVER_HPP
+
+#include "brush_log.hpp"
+#include "probe_set.hpp"
+#include "settings.hpp"
+#include "terrain_brush.hpp"
+#include "terrain_heightfield.hpp"
+
+#include <vector>
+
+class WorkerPool;
+
+// Cell averages. Same layout as the GPU state texture (R32G32B32A32_FLOAT)
+struct CellState {
+    float w, hu, hv, unused;
+};
+
+// Aggregate statistics (the same quantities the GUI shows as labels)
+struct SimStats {
+    float mass, x_momentum, y_momentum;
+    float kinetic_energy, potential_energy;
+    float max_speed, max_depth, max_froude_number;
+    float cfl;     // max((|u|+c)/dx, (|v|+c)/dy), i.e. the CFL number is cfl * dt
+};
+
+class CpuSolver {
+public:
+    // bottom and initial_state must have (nx+4) * (ny+4) entries (i.e. include ghost zones);
+    // they are copied. initial_state is {w, hu, hv, 0} per cell, as from ComputeInitialConditions.
+    // inlet_x is the value of g_inlet_x that goes with the given bottom.
+    CpuSolver(const SimSettings &settings,
+              const BottomEntry *bottom,
+              float inlet_x,
+              const float *initial_state);
+
+    // Settings may be changed between timesteps, except for nx and ny
+    // (create a new solver for that).
+    void setSettings(const SimSettings &settings);
+
+    // If set, Pass1/2/3 are split into bands of rows and run on the pool
+    // (which must outlive the solver, or be reset to null first).
+    // The default is to run everything on the calling thread.
+    void setWorkerPool(WorkerPool *pool);
+
+    // Used when taking over a simulation from the GPU, so that the sea level
+    // waves carry on from the same phase.
+    void setTotalTime(float t) { total_time = t; }
+
+    // Advance the simulation by getTimestep() seconds.
+    void timestep();
+
+    // Compute the aggregate stats, and set the timestep for subsequent calls
+    // to timestep() to the largest allowed by max_cfl_number (but no more than max_dt).
+    // Note: unlike ShallowWaterEngine::resetTimestep, max_dt is in simulated
+    // time, i.e. the caller should apply time_acceleration if required.
+    void resetTimestep(float max_dt, SimStats &stats);
+
+    // Raises (or, for negative displacement, lowers) the terrain with the given brush,
+    // which must have been set up for this mesh. The water depth is unchanged.
+    // Only the solver's own copy of the bottom is changed (not g_bottom).
+    void applyTerrainBrush(const TerrainBrush &brush, float world_x, float world_y, float displacement);
+
+    // Applies the combined effect of a batch of brush events (see brush_log.hpp),
+    // in one pass over the cells they touch.
+    void applyBrushBatch(const BrushBatch &batch);
+
+    // Switches to a new bottom (and inlet_x), for a new terrain of the same size.
+    // w is moved by the change in BA in every cell, so the water depth is unchanged.
+    void updateTerrain(const BottomEntry *new_bottom, float new_inlet_x);
+
+    // Fills in probes.getResults() from the current state, and sets the sample time
+    // to getTotalTime(). (Locates the probes first, if necessary.)
+    void sampleProbes(ProbeSet &probes) const;
+
+    float getTimestep() const { return current_timestep; }
+    float getTotalTime() const { return total_time; }
+
+    int getNX() const { return nx; }
+    int getNY() const { return ny; }
+
+    // Current state (including ghost zones), row major, (nx+4) * (ny+4) entries.
+    const CellState * getState() const { return &state[sim_idx][0]; }
+    const BottomEntry * getBottom() const { return &bottom[0]; }
+
+    // The individual stages of timestep() (and resetTimestep), for benchmarking.
+    // runStage does not advance the simulation, so can be repeated any number of times.
+    enum Stage {
+        STAGE_RECONSTRUCT,   // Pass1
+        STAGE_FLUX,          // Pass2
+        STAGE_UPDATE,        // Pass3
+        STAGE_BOUNDARY,      // the four boundary shaders
+        STAGE_STATS,         // GetStats
+        NUM_STAGES
+    };
+    void runStage(Stage stage);
+
+    // Approximate number of bytes read and written by one run of a stage
+    // (counting each array element once, i.e. assuming neighbouring reads hit the cache)
+    double getStageBytes(Stage stage) const;
+
+private:
+    // {N, E, S, W} values reconstructed at the four cell edges
+    struct Edges {
+        float n, e, s, w;
+    };
+
+    // fluxes of w, hu, hv
+    struct Flux {
+        float w, hu, hv;
+    };
+
+    // each pass processes rows [row_begin, row_end) of the (nx+4) * (ny+4) grid.
+    void pass1(const CellState *in, int row_begin, int row_end);   // reconstruct h, u, v
+    void pass2(int row_begin, int row_end);   // fluxes
+    void pass3(CellState *out, int row_begin, int row_end);   // euler step
+    void boundaries(CellState *out);
+
+    // runs pass 1, 2 or 3 over the given rows, split across the worker pool if there is one
+    enum Pass { PASS1, PASS2, PASS3 };
+    struct PassJob;
+    void runPass(Pass pass, const CellState *in, CellState *out, int row_begin, int row_end);
+
+    float computeStats(SimStats &stats) const;   // returns the cfl value
+
+private:
+    const int nx, ny, pitch;
+    SimSettings settings;
+    float inlet_x;
+
+    std::vector<BottomEntry> bottom;
+    std::vector<CellState> state[2];
+    std::vector<Edges> h, u, v;
+    std::vector<Flux> xflux, yflux;
+
+    int sim_idx;
+    bool bootstrap_needed;
+    float current_timestep;
+    float total_time;
+
+    WorkerPool *pool;
+};
+
+#endif
@@ -22,6 +22,10 @@
 
 #include "engine.hpp"
 #include "settings.hpp"
+#include "mesh.hpp"
+#include "mip_cache.hpp"
+#include "perf_counters.hpp"
+#include "profiler.hpp"
 #include "terrain_heightfield.hpp"
 
 // shader includes
@@ -42,20 +46,25 @@
 #include "SouthBoundary.h"
 #include "WestBoundary.h"
 #include "GetStats.h"
+#include "ProbeGather.h"
+#include "BrushApply.h"
+#include "TerrainUpdate.h"
 
 // coercri includes
 #include "coercri/dx11/core/dx_error.hpp"
-#include "coercri/gfx/load_bmp.hpp"
-#include "coercri/gfx/pixel_array.hpp"
 
 #include "boost/scoped_array.hpp"
 
 #include <d3d11.h>
 #include <DirectXMath.h>
 
+#include <algorithm>
 #include <cmath>
 #include <fstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <vector>
 
 #ifdef near
 #undef near
@@ -77,24 +86,51 @@
 #include <iomanip>
 #endif
 
+// Times a block of D3D work on both the CPU and the GPU (see profiler.hpp and gpu_profiler.hpp)
+#define PROFILE_GPU_SCOPE(name) \
+    PROFILE_SCOPE(name); \
+    GpuProfileScope PROFILE_SCOPE_CONCAT(gpu_profile_scope_, __LINE__)(*gpu_profiler, name)
+
 namespace {
 
     const float PI = 4.0f * std::atan(1.0f);
 
-    float GaussianBrush(float x, float y, float r)
+    // a cell counts as wet (for the perf counters) if deeper than this
+    const float WET_DEPTH = 1.0e-3f;   // m
+
+    // orders patches by the index set they are drawn with
+    bool DrawItemLess(const PatchQuadtree::DrawItem &a, const PatchQuadtree::DrawItem &b)
     {
-        const float sigma = 1.0f / 3.0f;
-        float z = (x*x + y*y) / (r*r);
-        if (z > 1) return 0;
-        else return 2 * std::exp(-z/(2*sigma*sigma));
+        return a.lod < b.lod || (a.lod == b.lod && a.stitch < b.stitch);
     }
-    
+
+    // updates the stats labels on the GUI. dt is the wall clock time per step.
+    void SetStatsLabels(const SimStats &stats, float timestep, float dt)
+    {
+        SetSetting(SH_MASS, stats.mass);
+        SetSetting(SH_X_MOMENTUM, stats.x_momentum);
+        SetSetting(SH_Y_MOMENTUM, stats.y_momentum);
+        SetSetting(SH_KINETIC_ENERGY, stats.kinetic_energy);
+        SetSetting(SH_POTENTIAL_ENERGY, stats.potential_energy);
+        SetSetting(SH_TOTAL_ENERGY, stats.kinetic_energy + stats.potential_energy);
+        SetSetting(SH_MAX_SPEED, stats.max_speed);
+        SetSetting(SH_MAX_DEPTH, stats.max_depth);
+        SetSetting(SH_MAX_FROUDE_NUMBER, stats.max_froude_number);
+        SetSetting(SH_TIMESTEP, timestep);
+        SetSetting(SH_CFL_NUMBER, stats.cfl * timestep);
+        SetSetting(SH_TIME_RATIO, timestep / dt);
+    }
+
     class MapTexture {
     public:
         MapTexture(ID3D11DeviceContext &cxt, ID3D11Texture2D & tex)
             : context(cxt), texture(tex)
         {
+            // Map waits for any pending copy into the staging texture, so this is
+            // where readback stalls show up
+            const unsigned long long start = ProfilerTicks();
             HRESULT hr = context.Map(&texture, 0, D3D11_MAP_READ, 0, &msr);
+            g_perf_counters.readback_ns += ProfilerTicks() - start;
             if (FAILED(hr)) {
                 throw Coercri::DXError("Map failed", hr);
             }
@@ -113,11 +149,6 @@ namespace {
         ID3D11Texture2D &texture;  // must be a staging texture
     };                   
     
-    // VS input for water/terrain rendering
-    struct MeshVertex {
-        int x, y;
-    };
-
     // Const buffer for water/terrain rendering
     struct MyConstBuffer {
         DirectX::XMMATRIX tex_to_clip;   // transforms (tex_x, tex_y, world_z, 1) into clip space 
@@ -186,20 +217,16 @@ namespace {
         float disp_A, disp_B;
     };
 
-    float CalcEpsilon()
-    {
-        const float W = GetSetting("valley_width");
-        const float L = GetSetting("valley_length");
-        const float nx = GetSetting("mesh_size_x");
-        const float ny = GetSetting("mesh_size_y");
-        const float dx = W / (nx-1);
-        const float dy = L / (ny-1);
-        return std::min(0.5f, std::powf(std::max(dx, dy), 4.0f));
-    }
+    // Const buffer for BrushApply
+    struct BrushConstBuffer {
+        int brush_left, brush_top;
+        float brush_displacement;
+        float pad;
+    };
 
-    float CalcU(float h, float hu)
+    // epsilon is SimSettings::epsilon
+    float CalcU(float h, float hu, float epsilon)
     {
-        float epsilon = CalcEpsilon();
         float h2 = h*h;
         float h4 = h2*h2;
         float divide_by_h = sqrt(2.0f) * h / sqrt(h4 + std::max(h4, epsilon));
@@ -344,39 +371,23 @@ namespace {
         CreateTextureImpl(device, td, initial_data, out_tex, out_srv, out_rtv);
     }
 
-    int GetNumMipLevels(int width, int height)
-    {
-        int num_levels = 1;
-        while (width > 1 && height > 1) {
-            width /= 2;
-            height /= 2;
-            ++num_levels;
-        }
-        return num_levels;
-    }
-
-    int TexIndex(int x, int y, int component, int width)
-    {
-        return (y * width + x)*4 + component;
-    }
-
-
-    // creates a 2d texture array (immutable)
+    // creates an immutable 2d texture array, with mips, from the given images
+    // followed by num_blank black ones
     void CreateTextureArrayWithMips(ID3D11Device *device,
-                                    int width,
-                                    int height,
-                                    int array_size,
+                                    const MipChains &chains,
+                                    int num_blank,
                                     bool is_cube,
-                                    const unsigned char ** initial_data,
                                     Coercri::ComPtrWrapper<ID3D11Texture2D> &out_tex,
                                     Coercri::ComPtrWrapper<ID3D11ShaderResourceView> &out_view)
     {
-        const int num_mip_levels = 1; /// GetNumMipLevels(width, height);
+        const int num_images = int(chains.images.size());
+        const int array_size = num_images + num_blank;
+        const int num_mip_levels = chains.num_levels;
         
         D3D11_TEXTURE2D_DESC td;
         memset(&td, 0, sizeof(td));
-        td.Width = width;
-        td.Height = height;
+        td.Width = chains.width;
+        td.Height = chains.height;
         td.MipLevels = num_mip_levels;
         td.ArraySize = array_size;
         td.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
@@ -387,78 +398,30 @@ namespace {
             td.MiscFlags = D3D11_RESOURCE_MISC_TEXTURECUBE;
         }
 
+        // every level of a blank image can use (the start of) the same texels
+        std::vector<unsigned char> blank;
+        if (num_blank > 0) {
+            blank.resize(chains.width * chains.height * 4, 0);
+            for (size_t i = 3; i < blank.size(); i += 4) blank[i] = 255;
+        }
+
         boost::scoped_array<D3D11_SUBRESOURCE_DATA> srd(new D3D11_SUBRESOURCE_DATA[array_size * num_mip_levels]);
-        boost::scoped_array<std::vector<unsigned char> > pixels(new std::vector<unsigned char>[array_size * num_mip_levels]);
 
-        const int orig_width = width;
-        const int orig_height = height;
-        
         for (int array_elem = 0; array_elem < array_size; ++array_elem) {
-            width = orig_width;
-            height = orig_height;
-
-            const int idx_base = array_elem * num_mip_levels;
-
-            srd[idx_base].pSysMem = initial_data[array_elem];
-            srd[idx_base].SysMemPitch = width * 4;
-
-            for (int level = 1; level < num_mip_levels; ++level) {
-                const int prev_width = width;
-                width = std::max(width/2, 1);
-                height = std::max(height/2, 1);
-
-                pixels[idx_base + level].resize(width * height * 4);
-                unsigned char * out = &pixels[idx_base + level][0];
-
-                const unsigned char * in;
-                if (level == 1) {
-                    in = initial_data[array_elem];
+            for (int level = 0; level < num_mip_levels; ++level) {
+                D3D11_SUBRESOURCE_DATA &sr = srd[array_elem * num_mip_levels + level];
+                if (array_elem < num_images) {
+                    sr.pSysMem = &chains.images[array_elem][GetMipOffset(chains.width, chains.height, level)];
                 } else {
-                    in = &pixels[idx_base + level - 1][0];
-                }
-
-                for (int y = 0; y < height; ++y) {
-                    for (int x = 0; x < height; ++x) {
-                        for (int component = 0; component < 4; ++component) {
-                            
-                            const int in1 = in[TexIndex(2*x,   2*y,   component, prev_width)];
-                            const int in2 = in[TexIndex(2*x+1, 2*y,   component, prev_width)];
-                            const int in3 = in[TexIndex(2*x,   2*y+1, component, prev_width)];
-                            const int in4 = in[TexIndex(2*x+1, 2*y+1, component, prev_width)];
-                            
-                            const int avg = (in1 + in2 + in3 + in4 + 2) / 4;
-                            
-                            *out++ = avg;
-                        }
-                    }
+                    sr.pSysMem = &blank[0];
                 }
-                
-                srd[idx_base + level].pSysMem = &pixels[idx_base + level][0];
-                srd[idx_base + level].SysMemPitch = width * 4;
+                sr.SysMemPitch = GetMipSize(chains.width, level) * 4;
+                sr.SysMemSlicePitch = 0;
             }
         }
 
         CreateTextureImpl(device, td, &srd[0], out_tex, &out_view, 0);
     }
-
-    
-    // creates an IMMUTABLE texture and auto generates the mip maps.
-    void CreateTextureWithMips(ID3D11Device *device,
-                               int width,
-                               int height,
-                               const unsigned char * initial_data,  // 32-bit RGBA (8-bit per channel)
-                               Coercri::ComPtrWrapper<ID3D11Texture2D> &out_tex,
-                               Coercri::ComPtrWrapper<ID3D11ShaderResourceView> &out_view)
-    {
-        CreateTextureArrayWithMips(device,
-                                   width,
-                                   height,
-                                   1,
-                                   false,
-                                   &initial_data,
-                                   out_tex,
-                                   out_view);
-    }
     
     void CreateSimBuffer(ID3D11Device *device, Coercri::ComPtrWrapper<ID3D11Buffer> &vert_buf, 
                          int i_left, int i_top, int i_right, int i_bottom)
@@ -514,8 +477,8 @@ namespace {
     {
         static int count = 0;
         
-        const int nx = GetIntSetting("mesh_size_x");
-        const int ny = GetIntSetting("mesh_size_y");
+        const int nx = GetIntSetting(SH_MESH_SIZE_X);
+        const int ny = GetIntSetting(SH_MESH_SIZE_Y);
         
         if (count == 0) {
             // check the BX, BY textures average to BA
@@ -595,8 +558,8 @@ namespace {
 #ifdef DUMP_TO_FILE
     void DumpToFile(std::ofstream &str, ID3D11DeviceContext *context, ID3D11Texture2D *staging, ID3D11Texture2D *tex)
     {
-        const int nx = GetIntSetting("mesh_size_x");
-        const int ny = GetIntSetting("mesh_size_y");
+        const int nx = GetIntSetting(SH_MESH_SIZE_X);
+        const int ny = GetIntSetting(SH_MESH_SIZE_Y);
         
         context->CopyResource(staging, tex);
 
@@ -616,8 +579,8 @@ namespace {
     {
         float result = 0;
         
-        const int nx = GetIntSetting("mesh_size_x");
-        const int ny = GetIntSetting("mesh_size_y");
+        const int nx = GetIntSetting(SH_MESH_SIZE_X);
+        const int ny = GetIntSetting(SH_MESH_SIZE_Y);
 
         MapTexture m(staging);
 
@@ -634,8 +597,8 @@ namespace {
 
     void WriteTotal(std::ofstream &str, ID3D11DeviceContext *context, ID3D11Texture2D *staging, ID3D11Texture2D *tex)
     {
-        const int nx = GetIntSetting("mesh_size_x");
-        const int ny = GetIntSetting("mesh_size_y");
+        const int nx = GetIntSetting(SH_MESH_SIZE_X);
+        const int ny = GetIntSetting(SH_MESH_SIZE_Y);
         
         context->CopyResource(staging, tex);
 
@@ -654,23 +617,17 @@ namespace {
         str << "Total H = " << total << "\n\n";
     }
 #endif
-
-    void SeaWaveSettings(char c, float &sa, float &skx, float &sky, float &so)
-    {
-        using std::string;
-        sa = GetSetting(string("sa") + c);
-        float k = GetSetting(string("sk") + c);
-        float kdir = GetSetting(string("sk") + c + "_dir");
-        skx = k * std::cos(kdir);
-        sky = k * std::sin(kdir);
-        so = GetSetting(string("so") + c);
-    }
 }
 
 ShallowWaterEngine::ShallowWaterEngine(ID3D11Device *device_,
                                        ID3D11DeviceContext *context_)
-    : device(device_), context(context_), current_timestep(0), total_time(0)
+    : device(device_), context(context_), patch_instance_capacity(0), probe_rows(0), probe_slot(0),
+      sim_steps_seen(0), current_timestep(0), total_time(0)
 {
+    probe_pending[0] = probe_pending[1] = false;
+
+    gpu_profiler.reset(new GpuProfiler(device, context));
+
     // create D3D objects
     createShadersAndInputLayout();
     createConstantBuffers();
@@ -679,23 +636,72 @@ ShallowWaterEngine::ShallowWaterEngine(ID3D11Device *device_,
     loadSkybox();
     setupMousePicking();
     
-    remesh(R_MESH);
-    newTerrainSettings();
+    beginRebuild(R_MESH, SettingsSnapshot());
+    finishRebuild();
     moveCamera(0, 0, 30, 0, 0, 100, 100);
 }
 
-void ShallowWaterEngine::remesh(ResetType reset_type)
+void ShallowWaterEngine::beginRebuild(ResetType reset_type, const SettingsSnapshot &settings)
+{
+    // (a build already in progress is finished first: only one may run at a time)
+    rebuild.reset();
+    rebuild.reset(new TerrainBuild(reset_type, settings));
+}
+
+void ShallowWaterEngine::finishRebuild()
 {
+    PROFILE_SCOPE("FinishRebuild");
+
+    boost::scoped_ptr<TerrainBuild> build;
+    build.swap(rebuild);
+    build->wait();
+
+    if (build->getResetType() >= R_MESH) {
+        remesh(*build);
+    } else {
+        newTerrainSettings(*build);
+    }
+}
+
+void ShallowWaterEngine::remesh(TerrainBuild &build)
+{
+    PROFILE_SCOPE("Remesh");
+
+    // The CPU simulation is restarted from the new initial conditions
+    const bool threaded = isSimThreaded();
+    if (threaded) stopSimThread();
+
+    GetSimSettings(sim_settings);
     createMeshBuffers();
     createSimBuffers();
     createTerrainTexture();
-    fillTerrainTextureLite();
-    createSimTextures(reset_type);
+    height_pyramid.resize(sim_settings.nx, sim_settings.ny, sim_settings.W, sim_settings.L);
+    fillTerrainTextureLite(build, false);
+    createSimTextures(&build.getInitialState()[0]);
+
+    if (threaded) startSimThreadFromGpu();
 }
 
-void ShallowWaterEngine::newTerrainSettings()
+void ShallowWaterEngine::newTerrainSettings(TerrainBuild &build)
 {
-    fillTerrainTexture();
+    PROFILE_SCOPE("NewTerrainSettings");
+
+    // The water depth is kept. The GPU copy of the state is updated in place;
+    // the CPU simulation (if running) makes the same change to its own state
+    // at its next timestep, and carries on without stopping.
+    GetSimSettings(sim_settings);
+    fillTerrainTextureLite(build, true);
+
+    if (isSimThreaded()) {
+        sim_thread->setSettings(sim_settings);
+        sim_thread->setTerrain(&g_bottom[0], g_inlet_x);
+    }
+}
+
+void ShallowWaterEngine::newSimSettings()
+{
+    GetSimSettings(sim_settings);
+    if (isSimThreaded()) sim_thread->setSettings(sim_settings);
 }
 
 void ShallowWaterEngine::moveCamera(float x, float y, float z, float yaw_, float pitch_, int vw, int vh)
@@ -710,9 +716,9 @@ void ShallowWaterEngine::moveCamera(float x, float y, float z, float yaw_, float
     vp_height = vh;
 
     near_plane_dist = 1;
-    far_plane_dist = 2 * std::max(GetSetting("valley_width"), GetSetting("valley_length"));
+    far_plane_dist = 2 * std::max(GetSetting(SH_VALLEY_WIDTH), GetSetting(SH_VALLEY_LENGTH));
 
-    const float fov = GetSetting("fov");  // x fov in degrees
+    const float fov = GetSetting(SH_FOV);  // x fov in degrees
     const float fov_r = fov / 45.0f * std::atan(1.0f);
     xpersp = 1.0f / tan(fov_r * 0.5f);
     ypersp = float(vw)/float(vh) * xpersp;
@@ -724,6 +730,9 @@ void ShallowWaterEngine::moveCamera(float x, float y, float z, float yaw_, float
 
 void ShallowWaterEngine::timestep()
 {
+    PROFILE_GPU_SCOPE("Timestep");
+    PerfBusyScope busy;
+
     /// Allow only a single timestep for debugging
     //static bool debug_flag = false;
     //if (debug_flag) return;
@@ -760,10 +769,13 @@ void ShallowWaterEngine::timestep()
 
     context->VSSetShader(m_psSimVertexShader.get(), 0, 0);
     
+    // (sim_settings is kept up to date by remesh, newTerrainSettings and newSimSettings;
+    // nothing below looks up settings by name)
+
     D3D11_VIEWPORT vp;
     memset(&vp, 0, sizeof(vp));
-    const int nx = GetIntSetting("mesh_size_x");
-    const int ny = GetIntSetting("mesh_size_y");
+    const int nx = sim_settings.nx;
+    const int ny = sim_settings.ny;
     vp.Width = float(nx + 4);
     vp.Height = float(ny + 4);
     vp.MinDepth = 0;
@@ -786,6 +798,7 @@ void ShallowWaterEngine::timestep()
         // Pass 1
         // read: old_state; bottom
         // write: h, u, v
+        PROFILE_GPU_SCOPE("Pass1 (bootstrap)");
         
         vert_buf = m_psSimVertexBuffer11.get();
         context->IASetVertexBuffers(0, 1, &vert_buf, &stride, &offset);
@@ -839,18 +852,22 @@ void ShallowWaterEngine::timestep()
     // read: h, u, v
     // write: xflux, yflux
 
-    vert_buf = m_psSimVertexBuffer10.get();
-    context->IASetVertexBuffers(0, 1, &vert_buf, &stride, &offset);
+    {
+        PROFILE_GPU_SCOPE("Pass2");
 
-    ID3D11RenderTargetView * p2_tgt[] = { xflux_target, yflux_target, 0, 0 };
-    context->OMSetRenderTargets(4, &p2_tgt[0], 0);
+        vert_buf = m_psSimVertexBuffer10.get();
+        context->IASetVertexBuffers(0, 1, &vert_buf, &stride, &offset);
 
-    context->PSSetShader(m_psSimPixelShader[1].get(), 0, 0);
-    context->PSSetShaderResources(0, 1, &new_state_or_h_tex);
-    context->PSSetShaderResources(1, 1, &u_tex);
-    context->PSSetShaderResources(2, 1, &v_tex);
+        ID3D11RenderTargetView * p2_tgt[] = { xflux_target, yflux_target, 0, 0 };
+        context->OMSetRenderTargets(4, &p2_tgt[0], 0);
 
-    context->Draw(6, 0);
+        context->PSSetShader(m_psSimPixelShader[1].get(), 0, 0);
+        context->PSSetShaderResources(0, 1, &new_state_or_h_tex);
+        context->PSSetShaderResources(1, 1, &u_tex);
+        context->PSSetShaderResources(2, 1, &v_tex);
+
+        context->Draw(6, 0);
+    }
     
 
 #ifdef DUMP_TO_FILE
@@ -878,21 +895,25 @@ void ShallowWaterEngine::timestep()
     // read: old_state, bottom, xflux, yflux
     // write: new_state
 
-    vert_buf = m_psSimVertexBuffer00.get();
-    context->IASetVertexBuffers(0, 1, &vert_buf, &stride, &offset);
+    {
+        PROFILE_GPU_SCOPE("Pass3");
 
-    context->PSSetShaderResources(0, 1, &pNULL); // unbind new_state_or_h_target so we can set it as output.
+        vert_buf = m_psSimVertexBuffer00.get();
+        context->IASetVertexBuffers(0, 1, &vert_buf, &stride, &offset);
 
-    ID3D11RenderTargetView * p3_tgt[] = { new_state_or_h_target, 0 };
-    context->OMSetRenderTargets(2, &p3_tgt[0], 0);
+        context->PSSetShaderResources(0, 1, &pNULL); // unbind new_state_or_h_target so we can set it as output.
 
-    context->PSSetShader(m_psSimPixelShader[2].get(), 0, 0);
-    context->PSSetShaderResources(0, 1, &old_state_tex);
-    context->PSSetShaderResources(1, 1, &bottom_tex);
-    context->PSSetShaderResources(2, 1, &xflux_tex);
-    context->PSSetShaderResources(3, 1, &yflux_tex);
+        ID3D11RenderTargetView * p3_tgt[] = { new_state_or_h_target, 0 };
+        context->OMSetRenderTargets(2, &p3_tgt[0], 0);
 
-    context->Draw(6, 0);
+        context->PSSetShader(m_psSimPixelShader[2].get(), 0, 0);
+        context->PSSetShaderResources(0, 1, &old_state_tex);
+        context->PSSetShaderResources(1, 1, &bottom_tex);
+        context->PSSetShaderResources(2, 1, &xflux_tex);
+        context->PSSetShaderResources(3, 1, &yflux_tex);
+
+        context->Draw(6, 0);
+    }
 
 #else
 
@@ -901,98 +922,111 @@ void ShallowWaterEngine::timestep()
     // read: old state, bottom
     // write: new state
 
-    vert_buf = m_psSimVertexBuffer00.get();
-    context->IASetVertexBuffers(0, 1, &vert_buf, &stride, &offset);
+    {
+        PROFILE_GPU_SCOPE("LaxWendroff");
 
-    ID3D11RenderTargetView * p3_tgt[] = { new_state_or_h_target, normal_target };
-    context->OMSetRenderTargets(2, &p3_tgt[0], 0);
+        vert_buf = m_psSimVertexBuffer00.get();
+        context->IASetVertexBuffers(0, 1, &vert_buf, &stride, &offset);
 
-    context->PSSetShader(m_psLaxWendroffPixelShader.get(), 0, 0);
-    context->PSSetShaderResources(0, 1, &old_state_tex);
-    context->PSSetShaderResources(1, 1, &bottom_tex);
+        ID3D11RenderTargetView * p3_tgt[] = { new_state_or_h_target, normal_target };
+        context->OMSetRenderTargets(2, &p3_tgt[0], 0);
 
-    context->Draw(6, 0);
+        context->PSSetShader(m_psLaxWendroffPixelShader.get(), 0, 0);
+        context->PSSetShaderResources(0, 1, &old_state_tex);
+        context->PSSetShaderResources(1, 1, &bottom_tex);
+
+        context->Draw(6, 0);
+    }
 
 #endif
   
 
     // Boundary Conditions
 
-    BoundaryConstBuffer cb;
-    cb.boundary_epsilon = CalcEpsilon();
-    cb.reflect_x = 2*nx+3;
-    cb.reflect_y = 2*ny+3;
-    cb.solid_wall_flag = (GetIntSetting("solid_walls") != 0);
-    cb.sea_level = GetIntSetting("use_sea_level") ? GetSetting("sea_level") : -9999;
-
-    const float inflow_width = GetSetting("inflow_width");
-    const float inflow_height = GetSetting("inflow_height");
-    const float W = GetSetting("valley_width");
-    const float dx = GetSetting("valley_width") / (nx-1);
-    cb.inflow_x_min = int((g_inlet_x - inflow_width + W/2)/dx) + 1;
-    cb.inflow_x_max = int((g_inlet_x + inflow_width + W/2)/dx) + 3;
-    cb.inflow_height = inflow_height;
-    cb.inflow_speed = 0.01f;
-    cb.g = GetSetting("gravity");
-    cb.total_time = total_time;
-    SeaWaveSettings('1', cb.sa1, cb.skx1, cb.sky1, cb.so1);
-    SeaWaveSettings('2', cb.sa2, cb.skx2, cb.sky2, cb.so2);
-    SeaWaveSettings('3', cb.sa3, cb.skx3, cb.sky3, cb.so3);
-    SeaWaveSettings('4', cb.sa4, cb.skx4, cb.sky4, cb.so4);
-    cb.sdecay = 0.01f / ny * GetSetting("valley_length");
-
-    context->UpdateSubresource(m_psBoundaryConstantBuffer.get(), 0, 0, &cb, 0, 0);
-
-    ID3D11Buffer *b_cst_buf = m_psBoundaryConstantBuffer.get();
-    context->PSSetConstantBuffers(0, 1, &b_cst_buf);
-    for (int i = 0; i < 3; ++i) context->PSSetShaderResources(1+i, 1, &pNULL);
-
-    // use XFLUX as scratch space, then we'll copy back to the main output 
-    context->OMSetRenderTargets(1, &xflux_target, 0);
-
-    // now rebind the input as the output from the previous step (ie the new state).
-    context->PSSetShaderResources(0, 1, &new_state_or_h_tex);
-    context->PSSetShaderResources(1, 1, &bottom_tex);
+    {
+        PROFILE_GPU_SCOPE("Boundaries");
+
+        BoundaryConstBuffer cb;
+        cb.boundary_epsilon = sim_settings.epsilon;
+        cb.reflect_x = 2*nx+3;
+        cb.reflect_y = 2*ny+3;
+        cb.solid_wall_flag = sim_settings.solid_walls;
+        cb.sea_level = sim_settings.use_sea_level ? sim_settings.sea_level : -9999;
+
+        const float inflow_width = sim_settings.inflow_width;
+        const float inflow_height = sim_settings.inflow_height;
+        const float W = sim_settings.W;
+        const float dx = sim_settings.dx;
+        cb.inflow_x_min = int((g_inlet_x - inflow_width + W/2)/dx) + 1;
+        cb.inflow_x_max = int((g_inlet_x + inflow_width + W/2)/dx) + 3;
+        cb.inflow_height = inflow_height;
+        cb.inflow_speed = 0.01f;
+        cb.g = sim_settings.gravity;
+        cb.total_time = total_time;
+        cb.sa1 = sim_settings.sa[0]; cb.skx1 = sim_settings.skx[0]; cb.sky1 = sim_settings.sky[0]; cb.so1 = sim_settings.so[0];
+        cb.sa2 = sim_settings.sa[1]; cb.skx2 = sim_settings.skx[1]; cb.sky2 = sim_settings.sky[1]; cb.so2 = sim_settings.so[1];
+        cb.sa3 = sim_settings.sa[2]; cb.skx3 = sim_settings.skx[2]; cb.sky3 = sim_settings.sky[2]; cb.so3 = sim_settings.so[2];
+        cb.sa4 = sim_settings.sa[3]; cb.skx4 = sim_settings.skx[3]; cb.sky4 = sim_settings.sky[3]; cb.so4 = sim_settings.so[3];
+        cb.sdecay = 0.01f / ny * sim_settings.L;
+
+        context->UpdateSubresource(m_psBoundaryConstantBuffer.get(), 0, 0, &cb, 0, 0);
+        g_perf_counters.upload_bytes += sizeof(cb);
+
+        ID3D11Buffer *b_cst_buf = m_psBoundaryConstantBuffer.get();
+        context->PSSetConstantBuffers(0, 1, &b_cst_buf);
+        for (int i = 0; i < 3; ++i) context->PSSetShaderResources(1+i, 1, &pNULL);
+
+        // use XFLUX as scratch space, then we'll copy back to the main output 
+        context->OMSetRenderTargets(1, &xflux_target, 0);
+
+        // now rebind the input as the output from the previous step (ie the new state).
+        context->PSSetShaderResources(0, 1, &new_state_or_h_tex);
+        context->PSSetShaderResources(1, 1, &bottom_tex);
     
-    for (int i = 0; i < 4; ++i) {
-        vert_buf = m_psBoundaryVertexBuffer[i].get();
-        context->IASetVertexBuffers(0, 1, &vert_buf, &stride, &offset);
+        for (int i = 0; i < 4; ++i) {
+            vert_buf = m_psBoundaryVertexBuffer[i].get();
+            context->IASetVertexBuffers(0, 1, &vert_buf, &stride, &offset);
 
-        context->PSSetShader(m_psBoundaryPixelShader[i].get(), 0, 0);
+            context->PSSetShader(m_psBoundaryPixelShader[i].get(), 0, 0);
         
-        context->Draw(6, 0);
+            context->Draw(6, 0);
+        }
     }
     
     // copy the temporary stuff from "xflux" back into the main texture.
-    D3D11_BOX src_box;
-    src_box.left = 2;
-    src_box.right = nx + 2;
-    src_box.top = 0;
-    src_box.bottom = 2;
-    src_box.front = 0;
-    src_box.back = 1;
-    context->CopySubresourceRegion(m_psSimTexture[1 - sim_idx].get(),
-                                   0,  // subresource
-                                   2,  // dest x
-                                   0,   // dest y
-                                   0,  // dest z
-                                   m_psSimTexture[4].get(),  // xflux tex
-                                   0, // subresource
-                                   &src_box);
-
-    src_box.top = ny+2;
-    src_box.bottom = ny+4;
-    context->CopySubresourceRegion(m_psSimTexture[1-sim_idx].get(), 0, 2, ny+2, 0, m_psSimTexture[4].get(), 0, &src_box);
-
-    src_box.left = 0;
-    src_box.right = 2;
-    src_box.top = 2;
-    src_box.bottom = ny + 2;
-    context->CopySubresourceRegion(m_psSimTexture[1-sim_idx].get(), 0, 0, 2, 0, m_psSimTexture[4].get(), 0, &src_box);
-
-    src_box.left = nx+2;
-    src_box.right = nx+4;
-    context->CopySubresourceRegion(m_psSimTexture[1-sim_idx].get(), 0, nx+2, 2, 0, m_psSimTexture[4].get(), 0, &src_box);
+    {
+        PROFILE_GPU_SCOPE("BoundaryCopyBack");
+
+        D3D11_BOX src_box;
+        src_box.left = 2;
+        src_box.right = nx + 2;
+        src_box.top = 0;
+        src_box.bottom = 2;
+        src_box.front = 0;
+        src_box.back = 1;
+        context->CopySubresourceRegion(m_psSimTexture[1 - sim_idx].get(),
+                                       0,  // subresource
+                                       2,  // dest x
+                                       0,   // dest y
+                                       0,  // dest z
+                                       m_psSimTexture[4].get(),  // xflux tex
+                                       0, // subresource
+                                       &src_box);
+
+        src_box.top = ny+2;
+        src_box.bottom = ny+4;
+        context->CopySubresourceRegion(m_psSimTexture[1-sim_idx].get(), 0, 2, ny+2, 0, m_psSimTexture[4].get(), 0, &src_box);
+
+        src_box.left = 0;
+        src_box.right = 2;
+        src_box.top = 2;
+        src_box.bottom = ny + 2;
+        context->CopySubresourceRegion(m_psSimTexture[1-sim_idx].get(), 0, 0, 2, 0, m_psSimTexture[4].get(), 0, &src_box);
+
+        src_box.left = nx+2;
+        src_box.right = nx+4;
+        context->CopySubresourceRegion(m_psSimTexture[1-sim_idx].get(), 0, nx+2, 2, 0, m_psSimTexture[4].get(), 0, &src_box);
+    }
 
 
 #ifdef DUMP_TO_FILE
@@ -1016,19 +1050,23 @@ void ShallowWaterEngine::timestep()
     // next timestep. 
     // Also, the Normal texture will be created at this point.
 
-    // first need to unbind 'old_state' from the pixel shader (as it is the target for our 'H' texture)
-    context->PSSetShaderResources(0, 1, &pNULL);
+    {
+        PROFILE_GPU_SCOPE("Pass1");
 
-    context->PSSetConstantBuffers(0, 1, &cst_buf);
+        // first need to unbind 'old_state' from the pixel shader (as it is the target for our 'H' texture)
+        context->PSSetShaderResources(0, 1, &pNULL);
+
+        context->PSSetConstantBuffers(0, 1, &cst_buf);
     
-    vert_buf = m_psSimVertexBuffer11.get();
-    context->IASetVertexBuffers(0, 1, &vert_buf, &stride, &offset);
-    ID3D11RenderTargetView * p1_tgt[] = { old_state_or_h_target, u_target, v_target, normal_target };
-    context->OMSetRenderTargets(4, &p1_tgt[0], 0);
-    context->PSSetShader(m_psSimPixelShader[0].get(), 0, 0);
-    context->PSSetShaderResources(0, 1, &new_state_or_h_tex);
-    context->PSSetShaderResources(1, 1, &bottom_tex);
-    context->Draw(6, 0);
+        vert_buf = m_psSimVertexBuffer11.get();
+        context->IASetVertexBuffers(0, 1, &vert_buf, &stride, &offset);
+        ID3D11RenderTargetView * p1_tgt[] = { old_state_or_h_target, u_target, v_target, normal_target };
+        context->OMSetRenderTargets(4, &p1_tgt[0], 0);
+        context->PSSetShader(m_psSimPixelShader[0].get(), 0, 0);
+        context->PSSetShaderResources(0, 1, &new_state_or_h_tex);
+        context->PSSetShaderResources(1, 1, &bottom_tex);
+        context->Draw(6, 0);
+    }
 
 #endif
     
@@ -1036,12 +1074,81 @@ void ShallowWaterEngine::timestep()
     sim_idx = 1 - sim_idx;
 
     total_time += current_timestep;
+
+    ++g_perf_counters.timesteps;
+    g_perf_counters.cell_updates += (long long)nx * ny;
+
+    gatherProbes();
+}
+
+// Samples all the probes from the current state into the next staging texture,
+// after reading back the previous one.
+// Assumes the IA stage, vertex shader and viewport are set up as in timestep().
+void ShallowWaterEngine::gatherProbes()
+{
+    if (probes.locate(sim_settings.nx, sim_settings.ny, sim_settings.W, sim_settings.L)) {
+        createProbeTextures();
+    }
+    if (probes.empty()) return;
+
+    PROFILE_GPU_SCOPE("ProbeGather");
+
+    // The previous gather was queued a whole timestep ago, so reading it
+    // now should not stall.
+    if (probe_pending[1 - probe_slot]) readProbes(1 - probe_slot);
+
+    ID3D11Buffer * cst_buf = m_psSimConstantBuffer.get();
+    ID3D11ShaderResourceView * state_tex = m_psSimTextureView[sim_idx].get();
+    ID3D11ShaderResourceView * bottom_tex = m_psBottomTextureView.get();
+    ID3D11ShaderResourceView * cell_tex = m_psProbeCellTextureView.get();
+    ID3D11RenderTargetView * probe_target = m_psProbeRenderTargetView.get();
+
+    ID3D11Buffer *vert_buf = m_psProbeVertexBuffer.get();
+    const UINT stride = 8;
+    const UINT offset = 0;
+    context->IASetVertexBuffers(0, 1, &vert_buf, &stride, &offset);
+
+    context->OMSetRenderTargets(1, &probe_target, 0);
+    context->PSSetConstantBuffers(0, 1, &cst_buf);
+    context->PSSetShader(m_psProbeGatherPixelShader.get(), 0, 0);
+    context->PSSetShaderResources(0, 1, &state_tex);
+    context->PSSetShaderResources(1, 1, &bottom_tex);
+    context->PSSetShaderResources(4, 1, &cell_tex);
+    context->Draw(6, 0);
+
+    context->CopyResource(m_psProbeStagingTexture[probe_slot].get(), m_psProbeTexture.get());
+    probe_pending[probe_slot] = true;
+    probe_time[probe_slot] = total_time;
+    probe_slot = 1 - probe_slot;
+}
+
+void ShallowWaterEngine::readProbes(int slot)
+{
+    const int width = sim_settings.nx + 4;
+    ProbeSample *out = probes.getResults();
+
+    MapTexture m(*context, *m_psProbeStagingTexture[slot]);
+    for (int k = 0; k < probes.size(); ++k) {
+        const char *row_ptr = reinterpret_cast<const char*>(m.msr.pData) + (k / width) * m.msr.RowPitch;
+        const float *p = reinterpret_cast<const float*>(row_ptr) + (k % width) * 4;
+        out[k].depth = p[0];
+        out[k].u = p[1];
+        out[k].v = p[2];
+        out[k].surface = p[3];
+    }
+
+    probes.setSampleTime(probe_time[slot]);
+    probe_pending[slot] = false;
 }
 
 void ShallowWaterEngine::resetTimestep(float dt)
 {
-    const int nx = GetIntSetting("mesh_size_x");
-    const int ny = GetIntSetting("mesh_size_y");
+    PROFILE_GPU_SCOPE("ResetTimestep");
+    PerfBusyScope busy;
+
+    GetSimSettings(sim_settings);
+    const int nx = sim_settings.nx;
+    const int ny = sim_settings.ny;
         
     // Run the GetStats pass
     // note: this uses the xflux, yflux textures as scratch space.
@@ -1136,15 +1243,25 @@ void ShallowWaterEngine::resetTimestep(float dt)
     float max_speed = 0, max_depth = 0;
     float cfl = 0;
     float max_froude = 0.0f;
+    int wet_blocks = 0;
+
+    PROFILE_SCOPE("GetStatsReadback");
 
     {
         MapTexture m(*context, *m_psGetStatsStagingTexture4);
+        HeightPyramid::WaterBlock *water = height_pyramid.getWater();
 
         for (int j = 0; j < ny/4; ++j) {
             const char *row_ptr = reinterpret_cast<const char *>(m.msr.pData) + j * m.msr.RowPitch;
             for (int i = 0; i < nx/4; ++i) {
                 const float *col_ptr_1 = reinterpret_cast<const float*>(row_ptr) + i * 4;
                 const float *col_ptr_2 = reinterpret_cast<const float*>(row_ptr) + (i+nx/4) * 4;
+
+                // block averages, for mouse picking
+                HeightPyramid::WaterBlock &wb = water[j * (nx/4) + i];
+                wb.h = col_ptr_1[0] / 16;
+                wb.hu = col_ptr_1[2] / 16;
+                wb.hv = col_ptr_1[3] / 16;
                 
                 mass += col_ptr_1[0];   // sum(h)
                 pe += col_ptr_1[1];     // sum(B*h + 0.5 * h^2)
@@ -1154,6 +1271,7 @@ void ShallowWaterEngine::resetTimestep(float dt)
                 max_speed = std::max(max_speed, col_ptr_2[1]);   // max(u2+v2)
                 max_depth = std::max(max_depth, col_ptr_2[2]);   // max(h)
                 cfl = std::max(cfl, col_ptr_2[3]);  // max((|u|+c)/dx, (|v|+c)/dy)
+                if (col_ptr_2[2] > WET_DEPTH) ++wet_blocks;
             }
         }
     }
@@ -1171,10 +1289,9 @@ void ShallowWaterEngine::resetTimestep(float dt)
     }
     
     const float DENSITY = 1000;   // kg m^-3
-    const float AREA = GetSetting("valley_width") / float(nx-1) 
-        * GetSetting("valley_length") / float(ny-1);   // m^2 (area of one cell)
+    const float AREA = sim_settings.dx * sim_settings.dy;   // m^2 (area of one cell)
 
-    const float g = GetSetting("gravity");
+    const float g = sim_settings.gravity;
     mass *= DENSITY * AREA;
     x_mtm *= DENSITY * AREA;
     y_mtm *= DENSITY * AREA;
@@ -1185,28 +1302,218 @@ void ShallowWaterEngine::resetTimestep(float dt)
     max_froude = std::sqrt(max_froude);
         
     // The CFL number is cfl * dt, and this must be less than safety_factor, so dt < safety_factor/cfl
-    const float safety_factor = GetSetting("max_cfl_number");
-    current_timestep = std::min(dt * GetSetting("time_acceleration"), safety_factor / cfl);
+    const float safety_factor = sim_settings.max_cfl_number;
+    current_timestep = std::min(dt * sim_settings.time_acceleration, safety_factor / cfl);
 
     // update the displays
-    SetSetting("mass", mass);
-    SetSetting("x_momentum", x_mtm);
-    SetSetting("y_momentum", y_mtm);
-    SetSetting("kinetic_energy", ke);
-    SetSetting("potential_energy", pe);
-    SetSetting("total_energy", ke + pe);
-    SetSetting("max_speed", max_speed);
-    SetSetting("max_depth", max_depth);
-    SetSetting("max_froude_number", max_froude);
-    SetSetting("timestep", current_timestep);
-    SetSetting("cfl_number", cfl * current_timestep);
-    SetSetting("time_ratio", current_timestep / dt);
+    SimStats stats;
+    stats.mass = mass;
+    stats.x_momentum = x_mtm;
+    stats.y_momentum = y_mtm;
+    stats.kinetic_energy = ke;
+    stats.potential_energy = pe;
+    stats.max_speed = max_speed;
+    stats.max_depth = max_depth;
+    stats.max_froude_number = max_froude;
+    stats.cfl = cfl;
+    SetStatsLabels(stats, current_timestep, dt);
+
+    height_pyramid.rebuild();
+
+    // (at the granularity of the 4x4 GetStats blocks)
+    g_perf_counters.wet_fraction = float(wet_blocks) / float(std::max(1, (nx/4) * (ny/4)));
     
     fillConstantBuffers();  // communicate new dt to the simulation.
 }
 
+void ShallowWaterEngine::setSimThreaded(bool threaded)
+{
+    if (threaded == isSimThreaded()) return;
+
+    if (threaded) {
+        startSimThreadFromGpu();
+    } else {
+        stopSimThread();
+    }
+}
+
+void ShallowWaterEngine::startSimThread(const float *initial_state)
+{
+    GetSimSettings(sim_settings);
+
+    // leave one core for the render thread
+    const int num_threads = std::max(1, int(std::thread::hardware_concurrency()) - 1);
+
+    sim_thread.reset(new SimThread(sim_settings, &g_bottom[0], g_inlet_x, initial_state, total_time, num_threads));
+    sim_steps_seen = 0;
+
+    // the GPU copy of the state is now just for rendering
+    probe_pending[0] = probe_pending[1] = false;
+}
+
+// Starts the CPU simulation from the current GPU state
+void ShallowWaterEngine::startSimThreadFromGpu()
+{
+    PROFILE_GPU_SCOPE("StartSimThread");
+
+    const int nx = sim_settings.nx;
+    const int ny = sim_settings.ny;
+    const int row_size = (nx+4) * 4;
+    std::vector<float> state(row_size * (ny+4));
+
+    context->CopyResource(m_psFullSizeStagingTexture.get(), m_psSimTexture[sim_idx].get());
+    {
+        MapTexture m(*context, *m_psFullSizeStagingTexture);
+        for (int j = 0; j < ny+4; ++j) {
+            const char *row_ptr = reinterpret_cast<const char*>(m.msr.pData) + j * m.msr.RowPitch;
+            memcpy(&state[j * row_size], row_ptr, row_size * sizeof(float));
+        }
+    }
+
+    startSimThread(&state[0]);
+}
+
+// Stops the CPU simulation and puts its final state back on the GPU,
+// ready for timestep() to carry on from
+void ShallowWaterEngine::stopSimThread()
+{
+    PROFILE_SCOPE("StopSimThread");
+
+    sim_thread->stop();
+
+    const SimFrame &frame = sim_thread->getCurrentFrame();
+    const int nx = sim_thread->getNX();
+    const int ny = sim_thread->getNY();
+    context->UpdateSubresource(m_psSimTexture[sim_idx].get(),
+                               0,   // subresource
+                               0,   // overwrite whole resource
+                               &frame.state[0],
+                               (nx+4) * sizeof(CellState),
+                               0);  // slab pitch
+    g_perf_counters.upload_bytes += (nx+4) * (ny+4) * sizeof(CellState);
+
+    total_time = frame.total_time;
+    current_timestep = frame.timestep;
+
+    sim_thread.reset();
+    bootstrap_needed = true;
+}
+
+void ShallowWaterEngine::updateFromSimThread()
+{
+    PROFILE_GPU_SCOPE("UpdateFromSimThread");
+
+    g_perf_counters.busy_ns += sim_thread->takeBusyNs();
+    sim_thread->takeStepTimes(g_perf_counters.step_times);
+
+    const SimFrame *frame = sim_thread->getLatestFrame();
+    if (!frame) return;   // no new state yet; keep drawing the old one
+
+    const int nx = sim_thread->getNX();
+    const int ny = sim_thread->getNY();
+
+    context->UpdateSubresource(m_psSimTexture[sim_idx].get(),
+                               0,   // subresource
+                               0,   // overwrite whole resource
+                               &frame->state[0],
+                               (nx+4) * sizeof(CellState),
+                               0);  // slab pitch
+    g_perf_counters.upload_bytes += (nx+4) * (ny+4) * sizeof(CellState);
+
+    const long long new_steps = frame->steps - sim_steps_seen;
+    g_perf_counters.timesteps += new_steps;
+    g_perf_counters.cell_updates += new_steps * nx * ny;
+    sim_steps_seen = frame->steps;
+
+    total_time = frame->total_time;
+    current_timestep = frame->timestep;
+    SetStatsLabels(frame->stats, current_timestep, frame->wall_dt);
+
+    // block averages, for mouse picking (as the GetStats readback in resetTimestep)
+    HeightPyramid::WaterBlock *water = height_pyramid.getWater();
+    int wet_blocks = 0;
+
+    for (int jb = 0; jb < ny/4; ++jb) {
+        for (int ib = 0; ib < nx/4; ++ib) {
+            float sum_h = 0, sum_hu = 0, sum_hv = 0, max_h = 0;
+
+            for (int j = 4*jb + 2; j < 4*jb + 6; ++j) {   // add 2 to avoid ghost zones
+                const int row = j * (nx+4);
+                for (int i = 4*ib + 2; i < 4*ib + 6; ++i) {
+                    const CellState &s = frame->state[row + i];
+                    const float h = std::max(0.0f, s.w - g_bottom[row + i].BA);
+                    sum_h += h;
+                    sum_hu += s.hu;
+                    sum_hv += s.hv;
+                    max_h = std::max(max_h, h);
+                }
+            }
+
+            HeightPyramid::WaterBlock &wb = water[jb * (nx/4) + ib];
+            wb.h = sum_h / 16;
+            wb.hu = sum_hu / 16;
+            wb.hv = sum_hv / 16;
+            if (max_h > WET_DEPTH) ++wet_blocks;
+        }
+    }
+
+    height_pyramid.rebuild();
+    g_perf_counters.wet_fraction = float(wet_blocks) / float(std::max(1, (nx/4) * (ny/4)));
+
+    fillConstantBuffers();
+    computeNormals();
+    gatherProbes();
+}
+
+// Runs Pass1 on the current state, for the sake of the normal texture
+// (the h, u, v outputs are not needed). This leaves the IA stage, vertex
+// shader and viewport set up as gatherProbes expects.
+void ShallowWaterEngine::computeNormals()
+{
+    PROFILE_GPU_SCOPE("ComputeNormals");
+
+    ID3D11Buffer * cst_buf = m_psSimConstantBuffer.get();
+    ID3D11ShaderResourceView * state_tex = m_psSimTextureView[sim_idx].get();
+    ID3D11ShaderResourceView * bottom_tex = m_psBottomTextureView.get();
+
+    context->ClearState();
+
+    context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    context->IASetInputLayout(m_psSimInputLayout.get());
+
+    ID3D11Buffer *vert_buf = m_psSimVertexBuffer11.get();
+    const UINT stride = 8;
+    const UINT offset = 0;
+    context->IASetVertexBuffers(0, 1, &vert_buf, &stride, &offset);
+
+    context->VSSetShader(m_psSimVertexShader.get(), 0, 0);
+    context->VSSetConstantBuffers(0, 1, &cst_buf);
+
+    D3D11_VIEWPORT vp;
+    memset(&vp, 0, sizeof(vp));
+    vp.Width = float(sim_settings.nx + 4);
+    vp.Height = float(sim_settings.ny + 4);
+    vp.MaxDepth = 1;
+    context->RSSetViewports(1, &vp);
+
+    ID3D11RenderTargetView * p1_tgt[] = { m_psSimRenderTargetView[1 - sim_idx].get(),
+                                          m_psSimRenderTargetView[2].get(),
+                                          m_psSimRenderTargetView[3].get(),
+                                          m_psSimRenderTargetView[6].get() };
+    context->OMSetRenderTargets(4, &p1_tgt[0], 0);
+
+    context->PSSetShader(m_psSimPixelShader[0].get(), 0, 0);
+    context->PSSetConstantBuffers(0, 1, &cst_buf);
+    context->PSSetShaderResources(0, 1, &state_tex);
+    context->PSSetShaderResources(1, 1, &bottom_tex);
+
+    context->Draw(6, 0);
+}
+
 void ShallowWaterEngine::render(ID3D11RenderTargetView *render_target_view)
 {
+    PROFILE_GPU_SCOPE("Render");
+
     // Setup rendering state
     context->ClearState();
 
@@ -1218,15 +1525,21 @@ void ShallowWaterEngine::render(ID3D11RenderTargetView *render_target_view)
     ID3D11SamplerState * linear_sampler = m_psLinearSamplerState.get();
     
     
+    // choose the patches to draw, and their lods
+    // (pixels_per_unit: x_ndc = xpersp * x / depth, and x_ndc = 1 at the right of the viewport)
+    patch_quadtree.updateSurface(height_pyramid);
+    patch_quadtree.select(tex_to_clip, 0.5f * xpersp * vp_width, GetSetting(SH_LOD_PIXEL_ERROR), patch_draws);
+    uploadPatchInstances();
+
     // input assembler
     context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
     context->IASetInputLayout(m_psInputLayout.get());
 
-    ID3D11Buffer *vert_buf = m_psMeshVertexBuffer.get();
-    UINT stride = sizeof(MeshVertex);
+    ID3D11Buffer *vert_buf = m_psPatchInstanceBuffer.get();
+    UINT stride = sizeof(PatchInstance);
     const UINT offset = 0;
     context->IASetVertexBuffers(0, 1, &vert_buf, &stride, &offset);
-    context->IASetIndexBuffer(m_psMeshIndexBuffer.get(), DXGI_FORMAT_R32_UINT, 0);
+    context->IASetIndexBuffer(m_psMeshIndexBuffer.get(), DXGI_FORMAT_R16_UINT, 0);
 
     // vertex shader
     context->VSSetShader(m_psWaterVertexShader.get(), 0, 0);
@@ -1271,9 +1584,7 @@ void ShallowWaterEngine::render(ID3D11RenderTargetView *render_target_view)
     context->OMSetRenderTargets(1, &render_target_view, m_psDepthStencilView.get());
 
     // draw the mesh
-    const int mesh_width = GetIntSetting("mesh_size_x");
-    const int mesh_height = GetIntSetting("mesh_size_y");
-    context->DrawIndexed(6 * (mesh_width - 1) * (mesh_height - 1), 0, 0);
+    drawPatches();
 
     // now setup for the terrain mesh
     // (it uses the same mesh, but different shaders.)
@@ -1281,7 +1592,7 @@ void ShallowWaterEngine::render(ID3D11RenderTargetView *render_target_view)
     context->PSSetShader(m_psTerrainPixelShader.get(), 0, 0);
 
     // draw the mesh
-    context->DrawIndexed(6 * (mesh_width - 1) * (mesh_height - 1), 0, 0);
+    drawPatches();
 
 
     // Now draw the skybox
@@ -1294,6 +1605,49 @@ void ShallowWaterEngine::render(ID3D11RenderTargetView *render_target_view)
     context->Draw(30, 0);
 }
 
+// Sorts patch_draws by index set, and writes the matching patch origins
+// to the instance buffer.
+void ShallowWaterEngine::uploadPatchInstances()
+{
+    std::sort(patch_draws.begin(), patch_draws.end(), DrawItemLess);
+
+    const int npx = patch_quadtree.getPatchesX();
+    patch_instances.clear();
+    for (size_t k = 0; k < patch_draws.size(); ++k) {
+        const int patch = patch_draws[k].patch;
+        patch_instances.push_back(GetPatchInstance(patch % npx, patch / npx));
+    }
+    if (patch_instances.empty()) return;
+
+    D3D11_BOX box;
+    box.left = 0;
+    box.right = UINT(sizeof(PatchInstance) * patch_instances.size());
+    box.top = 0;
+    box.bottom = 1;
+    box.front = 0;
+    box.back = 1;
+    context->UpdateSubresource(m_psPatchInstanceBuffer.get(), 0, &box, &patch_instances[0], 0, 0);
+    g_perf_counters.upload_bytes += box.right;
+}
+
+// Draws the patches chosen by patch_quadtree.select, with the current shaders:
+// one instanced draw per index set.
+void ShallowWaterEngine::drawPatches()
+{
+    size_t first = 0;
+    while (first < patch_draws.size()) {
+        const PatchQuadtree::DrawItem &item = patch_draws[first];
+        size_t end = first + 1;
+        while (end < patch_draws.size() && patch_draws[end].lod == item.lod && patch_draws[end].stitch == item.stitch) ++end;
+
+        const PatchIndexRange &range = patch_index_ranges[item.lod * NUM_STITCH_MASKS + item.stitch];
+        context->DrawIndexedInstanced(range.count, UINT(end - first), range.start, 0, UINT(first));
+        g_perf_counters.triangles += (range.count / 3) * (end - first);
+
+        first = end;
+    }
+}
+
 
 void ShallowWaterEngine::createShadersAndInputLayout()
 {
@@ -1304,7 +1658,7 @@ void ShallowWaterEngine::createShadersAndInputLayout()
     CreatePixelShader(device, WaterPixelShader, sizeof(WaterPixelShader), m_psWaterPixelShader);
 
     D3D11_INPUT_ELEMENT_DESC layout[] = {
-        { "INT_POSITION", 0, DXGI_FORMAT_R32G32_SINT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 }
+        { "PATCH_ORIGIN", 0, DXGI_FORMAT_R32G32_SINT, 0, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1 }
     };
 
     ID3D11InputLayout *input_layout = 0;
@@ -1324,6 +1678,7 @@ void ShallowWaterEngine::createShadersAndInputLayout()
     CreatePixelShader(device, Pass2, sizeof(Pass2), m_psSimPixelShader[1]);
     CreatePixelShader(device, Pass3, sizeof(Pass3), m_psSimPixelShader[2]);
     CreatePixelShader(device, GetStats, sizeof(GetStats), m_psGetStatsPixelShader);
+    CreatePixelShader(device, ProbeGather, sizeof(ProbeGather), m_psProbeGatherPixelShader);
     CreatePixelShader(device, NorthBoundary, sizeof(NorthBoundary), m_psBoundaryPixelShader[0]);
     CreatePixelShader(device, EastBoundary, sizeof(EastBoundary), m_psBoundaryPixelShader[1]);
     CreatePixelShader(device, SouthBoundary, sizeof(SouthBoundary), m_psBoundaryPixelShader[2]);
@@ -1352,82 +1707,60 @@ void ShallowWaterEngine::createShadersAndInputLayout()
 // (needs to be called again every time the mesh size changes.)
 void ShallowWaterEngine::createMeshBuffers()
 {
-    const int width = GetIntSetting("mesh_size_x");
-    const int height = GetIntSetting("mesh_size_y");
+    // The vertex positions are worked out in the vertex shaders, so the only
+    // thing here that depends on the mesh size is the instance buffer (one
+    // entry per patch), and that only ever grows.
+    const int num_patches = NumPatches(GetIntSetting(SH_MESH_SIZE_X)) * NumPatches(GetIntSetting(SH_MESH_SIZE_Y));
+    patch_instances.reserve(num_patches);
 
-    // fill in the array of vertex positions
-    // (these are texture indices -- add two to avoid the ghost zones)
-
-    boost::scoped_array<MeshVertex> vertices(new MeshVertex[width*height]);
-    
-    for (int j = 0; j < height; ++j) {
-        for (int i = 0; i < width; ++i) {
-            MeshVertex &v = vertices[j * width + i];
-            v.x = i + 2;
-            v.y = j + 2;
-        }
-    }
-
-    // create data for the index buffer
-    boost::scoped_array<int> indices(new int[6 * (width-1) * (height-1)]);
-    int *p = &indices[0];
-    for (int j = 0; j < height - 1; ++j) {
-        for (int i = 0; i < width - 1; ++i) {
-            const int tl = (j+1) * width + i;
-            const int bl = j * width + i;
-            const int tr = (j+1) * width + i+1;
-            const int br = j * width + i+1;
-
-            // write triangles in clockwise order.
-            *p++ = tl;
-            *p++ = br;
-            *p++ = bl;
-
-            *p++ = tl;
-            *p++ = tr;
-            *p++ = br;
-        }
-    }
-            
-    // create the vertex buffer
     D3D11_BUFFER_DESC bd;
     memset(&bd, 0, sizeof(bd));
-    bd.ByteWidth = sizeof(MeshVertex) * width * height;
-    bd.Usage = D3D11_USAGE_IMMUTABLE;
-    bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-
     D3D11_SUBRESOURCE_DATA sd;
     memset(&sd, 0, sizeof(sd));
-    sd.pSysMem = &vertices[0];
-
     ID3D11Buffer *pBuffer;
-    HRESULT hr = device->CreateBuffer(&bd, &sd, &pBuffer);
-    if (FAILED(hr)) {
-        throw Coercri::DXError("Failed to create mesh vertex buffer", hr);
+    HRESULT hr;
+
+    if (num_patches > patch_instance_capacity) {
+        bd.ByteWidth = UINT(sizeof(PatchInstance) * num_patches);
+        bd.Usage = D3D11_USAGE_DEFAULT;
+        bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+
+        hr = device->CreateBuffer(&bd, 0, &pBuffer);
+        if (FAILED(hr)) {
+            throw Coercri::DXError("Failed to create patch instance buffer", hr);
+        }
+        m_psPatchInstanceBuffer.reset(pBuffer);
+        patch_instance_capacity = num_patches;
     }
-    m_psMeshVertexBuffer.reset(pBuffer);
 
     // create the index buffer
-    bd.ByteWidth = sizeof(int) * 6 * (width-1) * (height-1);
-    bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
-    sd.pSysMem = &indices[0];
-    sd.SysMemPitch = 0;
+    // (the index data is per patch, so does not depend on the mesh size)
+    if (!m_psMeshIndexBuffer.get()) {
+        std::vector<PatchIndex> indices;
+        BuildPatchIndices(indices, patch_index_ranges);
 
-    hr = device->CreateBuffer(&bd, &sd, &pBuffer);
-    if (FAILED(hr)) {
-        throw Coercri::DXError("Failed to create mesh index buffer", hr);
+        bd.ByteWidth = UINT(sizeof(PatchIndex) * indices.size());
+        bd.Usage = D3D11_USAGE_IMMUTABLE;
+        bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
+        sd.pSysMem = &indices[0];
+
+        hr = device->CreateBuffer(&bd, &sd, &pBuffer);
+        if (FAILED(hr)) {
+            throw Coercri::DXError("Failed to create mesh index buffer", hr);
+        }
+        m_psMeshIndexBuffer.reset(pBuffer);
     }
-    m_psMeshIndexBuffer.reset(pBuffer);
 }
 
 void ShallowWaterEngine::createSimBuffers()
 {
-    const int nx = GetIntSetting("mesh_size_x");
-    const int ny = GetIntSetting("mesh_size_y");
+    const int nx = GetIntSetting(SH_MESH_SIZE_X);
+    const int ny = GetIntSetting(SH_MESH_SIZE_Y);
     
     CreateSimBuffer(device, m_psSimVertexBuffer11, 1, 1, nx + 3, ny + 3);   // single ghost layer around each side
     CreateSimBuffer(device, m_psSimVertexBuffer10, 1, 1, nx + 2, ny + 2);   // west/south ghost layer only
     CreateSimBuffer(device, m_psSimVertexBuffer00, 2, 2, nx + 2, ny + 2);   // interior zones only
+    CreateSimBuffer(device, m_psSimVertexBuffer22, 0, 0, nx + 4, ny + 4);   // both ghost layers
 
     CreateSimBuffer(device, m_psGetStatsVertexBuffer, 0, 0, nx/4, ny/4);
 
@@ -1442,8 +1775,8 @@ void ShallowWaterEngine::createTerrainTexture()
 {
     // allow space for two ghost zones around each edge (four in total)
     CreateTexture(device,
-                  GetIntSetting("mesh_size_x") + 4,
-                  GetIntSetting("mesh_size_y") + 4,
+                  GetIntSetting(SH_MESH_SIZE_X) + 4,
+                  GetIntSetting(SH_MESH_SIZE_Y) + 4,
                   0,  // initial data
                   DXGI_FORMAT_R32G32B32_FLOAT,
                   false,  // staging
@@ -1452,84 +1785,36 @@ void ShallowWaterEngine::createTerrainTexture()
                   0);
 
     CreateTexture(device,
-                  GetIntSetting("mesh_size_x") + 4,
-                  GetIntSetting("mesh_size_y") + 4,
+                  GetIntSetting(SH_MESH_SIZE_X) + 4,
+                  GetIntSetting(SH_MESH_SIZE_Y) + 4,
                   0,  // initial data
                   DXGI_FORMAT_R32G32B32_FLOAT,
                   false, 
                   m_psBottomTexture,
                   &m_psBottomTextureView,
                   0);
+
+    CreateTexture(device,
+                  GetIntSetting(SH_MESH_SIZE_X) + 4,
+                  GetIntSetting(SH_MESH_SIZE_Y) + 4,
+                  0,  // initial data
+                  DXGI_FORMAT_R32G32B32_FLOAT,
+                  false, 
+                  m_psNewBottomTexture,
+                  &m_psNewBottomTextureView,
+                  0);
 }
 
-// Creates and initializes the simulation textures
-// Precondition: terrain heightfield is up to date
-void ShallowWaterEngine::createSimTextures(ResetType reset_type)
+// Creates the simulation textures, with the given initial state
+// ((nx+4) * (ny+4) * 4 floats, see ComputeInitialConditions)
+void ShallowWaterEngine::createSimTextures(const float *initial_state)
 {
-    const int nx = GetIntSetting("mesh_size_x");
-    const int ny = GetIntSetting("mesh_size_y");
-    const float W = GetSetting("valley_width");
-    const float L = GetSetting("valley_length");
-    const float dam_pos = GetSetting("dam_position");
-
-    const float xmin = -W/6;
-    const float xmax = W/6;
-    const float ymin = L/3;
-    const float ymax = 2*L/3;
-
-    float init_w = 0;
-    if (reset_type == R_VALLEY) {
-        // find the height of the lowest point along the dam
-        float B_min = 99999999.f;
-        for (float x = -W/2; x < W/2; x += W/(nx-1)) {
-            B_min = std::min(B_min, GetTerrainHeight(x, dam_pos));
-        }
+    const int nx = GetIntSetting(SH_MESH_SIZE_X);
+    const int ny = GetIntSetting(SH_MESH_SIZE_Y);
 
-        init_w = B_min + 1;
-    } else if (reset_type == R_SEA) {
-        init_w = GetSetting("sea_level");
-    }
-            
-    boost::scoped_array<float> ic(new float[(nx+4) * (ny+4) * 4]);
-    float *p = &ic[0];
-
-    for (int j = 0; j < ny + 4; ++j) {
-
-        for (int i = 0; i < nx + 4; ++i) {
-
-            const int ii = std::max(2, std::min(nx+1, i));
-            const int jj = std::max(2, std::min(ny+1, j));
-            const float B = g_bottom[(nx+4) * jj + ii].BA;
-
-            const float x = (ii-2)*W/(nx-1) - W/2;
-            const float y = (jj-2)*L/(ny-1);
-
-            float w = B;
-            if (reset_type == R_VALLEY) {
-                if (y > dam_pos && B < init_w) {
-                    w = init_w;
-
-                    // add a wave pattern for some extra interest
-                    w += 0.02f * sin(-0.2f*x + 0.8f*y);
-                }
-            } else if (reset_type == R_SEA) {
-                w = std::max(B, init_w);
-            } else if (reset_type == R_SQUARE && x >= xmin && x < xmax && y >= ymin && y < ymax) {
-                w = B + 7.0f;
-            }
-
-            // initial condition
-
-            *p++ = w;  // w
-            *p++ = 0;  // hu
-            *p++ = 0;  // hv
-            *p++ = 0;  // unused
-        }
-    }
-    
     D3D11_SUBRESOURCE_DATA sd;
     memset(&sd, 0, sizeof(sd));
-    sd.pSysMem = &ic[0];
+    sd.pSysMem = initial_state;
     sd.SysMemPitch = (nx+4) * 4 * sizeof(float);
 
     for (int i = 0; i < 7; ++i) {
@@ -1594,105 +1879,175 @@ void ShallowWaterEngine::createSimTextures(ResetType reset_type)
                   m_psGetStatsStagingTexture1,
                   0,
                   0);
+
+    // any gathered probes are from the old state
+    probe_pending[0] = probe_pending[1] = false;
 }
 
+// (Re)creates the probe textures, for the current probes and mesh size.
+// Called when probes are added or the mesh changes (see ProbeSet::locate).
+void ShallowWaterEngine::createProbeTextures()
+{
+    const int nx = sim_settings.nx;
+    const int ny = sim_settings.ny;
+    const int num_probes = probes.size();
 
+    probe_pending[0] = probe_pending[1] = false;
+    if (num_probes == 0) {
+        probe_rows = 0;
+        return;
+    }
 
-// Updates the terrain texture given current settings.
-// Also updates the water state texture such that the water depth remains unchanged.
-// NOTE: If size has changed then call createTerrainTexture first.
-void ShallowWaterEngine::fillTerrainTexture()
-{
-    const int nx = GetIntSetting("mesh_size_x");
-    const int ny = GetIntSetting("mesh_size_y");
+    // The gather pass uses the same viewport as the simulation, so at most ny+4 rows
+    probe_rows = (num_probes + nx + 3) / (nx + 4);
+    if (probe_rows > ny + 4) {
+        throw std::runtime_error("Too many probes for the mesh size");
+    }
 
-    // Get the existing water state onto the CPU
-    context->CopyResource(m_psFullSizeStagingTexture.get(), m_psSimTexture[sim_idx].get());
+    // cell index of each probe, as floats (like the tex_idx input of the simulation shaders).
+    // Unused entries point at the first interior cell.
+    std::vector<float> cells((nx + 4) * probe_rows * 2, 2.0f);
+    const ProbeSet::Cell *pc = probes.getCells();
+    for (int k = 0; k < num_probes; ++k) {
+        cells[2*k] = float(pc[k].i);
+        cells[2*k + 1] = float(pc[k].j);
+    }
 
-    // Now loop through and change w values into h values
-    // TODO: it would probably be better to do this on the GPU (would avoid a copy / copy back; and could
-    // save memory for the staging texture as well).
-    {
-        MapTexture m(*context, *m_psFullSizeStagingTexture);
-        for (int j = 0; j < ny+4; ++j) {
-            char * row_ptr = reinterpret_cast<char*>(m.msr.pData) + j * m.msr.RowPitch;
-            const BottomEntry *B_row_ptr = &g_bottom[j * (nx+4)];
-            
-            for (int i = 0; i < nx+4; ++i) {
-                float *col_ptr = reinterpret_cast<float*>(row_ptr) + i * 4;
-                const BottomEntry *B_col_ptr = B_row_ptr + i;
-                
-                (*col_ptr) -= (B_col_ptr->BA);
-            }
-        }
-        
-        // Compute the new terrain heightfield
-        UpdateTerrainHeightfield();
-        
-        // Write the new terrain textures
-        context->UpdateSubresource(m_psTerrainTexture.get(),
-                                   0,   // subresource
-                                   0,   // overwrite whole resource
-                                   &g_terrain_heightfield[0],
-                                   (nx+4) * 12,
-                                   0);  // slab pitch
-        context->UpdateSubresource(m_psBottomTexture.get(),
-                                   0,  // subresource
-                                   0,  // overwrite whole resource
-                                   &g_bottom[0],
-                                   (nx+4) * 12,
-                                   0); // slab pitch
-        
-        // Loop through and change h values back into w values
-        for (int j = 0; j < ny+4; ++j) {
-            char * row_ptr = reinterpret_cast<char*>(m.msr.pData) + j * m.msr.RowPitch;
-            const BottomEntry *B_row_ptr = &g_bottom[j * (nx+4)];
-            
-            for (int i = 0; i < nx+4; ++i) {
-                float *col_ptr = reinterpret_cast<float*>(row_ptr) + i * 4;
-                const BottomEntry *B_col_ptr = B_row_ptr + i;
-                
-                (*col_ptr) += (B_col_ptr->BA);
-            }
-        }
+    D3D11_SUBRESOURCE_DATA sd;
+    memset(&sd, 0, sizeof(sd));
+    sd.pSysMem = &cells[0];
+    sd.SysMemPitch = (nx + 4) * 2 * sizeof(float);
+
+    CreateTexture(device,
+                  nx + 4,
+                  probe_rows,
+                  &sd,
+                  DXGI_FORMAT_R32G32_FLOAT,
+                  false,
+                  m_psProbeCellTexture,
+                  &m_psProbeCellTextureView,
+                  0);
+    g_perf_counters.upload_bytes += cells.size() * sizeof(float);
+
+    CreateTexture(device,
+                  nx + 4,
+                  probe_rows,
+                  0,
+                  DXGI_FORMAT_R32G32B32A32_FLOAT,
+                  false,
+                  m_psProbeTexture,
+                  0,
+                  &m_psProbeRenderTargetView);
+
+    for (int i = 0; i < 2; ++i) {
+        CreateTexture(device,
+                      nx + 4,
+                      probe_rows,
+                      0,
+                      DXGI_FORMAT_R32G32B32A32_FLOAT,
+                      true,
+                      m_psProbeStagingTexture[i],
+                      0,
+                      0);
     }
-    
-    // Copy water texture back to the GPU
-    context->CopyResource(m_psSimTexture[sim_idx].get(), m_psFullSizeStagingTexture.get());
 
-    // need to re-bootstrap
-    bootstrap_needed = true;
+    CreateSimBuffer(device, m_psProbeVertexBuffer, 0, 0, nx + 4, probe_rows);
 }
 
 
 
-// Updates the terrain texture, but does not touch the water texture
-void ShallowWaterEngine::fillTerrainTextureLite()
+// Switches to the build's terrain. If keep_depth, the water state texture is
+// updated (on the GPU, by updateWaterForTerrain) so that the water depth remains
+// unchanged; the terrain must then be the same size as the current one.
+// Otherwise the caller replaces the water state afterwards.
+// NOTE: If size has changed then call createTerrainTexture first.
+void ShallowWaterEngine::fillTerrainTextureLite(TerrainBuild &build, bool keep_depth)
 {
-    const int nx = GetIntSetting("mesh_size_x");
-    const int ny = GetIntSetting("mesh_size_y");
+    PROFILE_GPU_SCOPE("FillTerrainTexture");
+
+    const int nx = GetIntSetting(SH_MESH_SIZE_X);
+    const int ny = GetIntSetting(SH_MESH_SIZE_Y);
 
-    // Compute the new terrain heightfield
-    UpdateTerrainHeightfield();
+    // Switch to the new terrain heightfield
+    g_terrain_heightfield.swap(build.getHeightfield());
+    g_bottom.swap(build.getBottom());
+    g_inlet_x = build.getInletX();
         
-    // Write the new terrain textures
+    // Write the new terrain textures. The bottom goes to the spare texture
+    // first, as updateWaterForTerrain needs the old one as well.
     context->UpdateSubresource(m_psTerrainTexture.get(),
                                0,   // subresource
                                0,   // overwrite whole resource
                                &g_terrain_heightfield[0],
                                (nx+4) * 12,
                                0);  // slab pitch
-    context->UpdateSubresource(m_psBottomTexture.get(),
+    context->UpdateSubresource(m_psNewBottomTexture.get(),
                                0,  // subresource
                                0,  // overwrite whole resource
                                &g_bottom[0],
                                (nx+4) * 12,
                                0); // slab pitch
+    g_perf_counters.upload_bytes += (nx+4) * (ny+4) * (sizeof(TerrainEntry) + sizeof(BottomEntry));
+
+    if (keep_depth) updateWaterForTerrain();
+    context->CopyResource(m_psBottomTexture.get(), m_psNewBottomTexture.get());
+
+    height_pyramid.updateTerrain(&g_terrain_heightfield[0]);
+    height_pyramid.rebuild();
+    patch_quadtree = build.getQuadtree();
     
     // need to re-bootstrap
     bootstrap_needed = true;
 }
 
+// Draws the TerrainUpdate shader over the whole grid (ghost zones included),
+// moving w by the change from m_psBottomTexture to m_psNewBottomTexture.
+void ShallowWaterEngine::updateWaterForTerrain()
+{
+    PROFILE_GPU_SCOPE("UpdateWaterForTerrain");
+
+    context->ClearState();
+
+    context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    context->IASetInputLayout(m_psSimInputLayout.get());
+
+    ID3D11Buffer *vert_buf = m_psSimVertexBuffer22.get();
+    const UINT stride = 8;
+    const UINT offset = 0;
+    context->IASetVertexBuffers(0, 1, &vert_buf, &stride, &offset);
+
+    ID3D11Buffer *cst_buf = m_psSimConstantBuffer.get();
+    context->VSSetShader(m_psSimVertexShader.get(), 0, 0);
+    context->VSSetConstantBuffers(0, 1, &cst_buf);
+
+    D3D11_VIEWPORT vp;
+    memset(&vp, 0, sizeof(vp));
+    vp.Width = float(GetIntSetting(SH_MESH_SIZE_X) + 4);
+    vp.Height = float(GetIntSetting(SH_MESH_SIZE_Y) + 4);
+    vp.MaxDepth = 1;
+    context->RSSetViewports(1, &vp);
+
+    ID3D11ShaderResourceView *tex_views[] = { m_psSimTextureView[sim_idx].get(), m_psBottomTextureView.get() };
+    ID3D11ShaderResourceView *new_bottom_tex = m_psNewBottomTextureView.get();
+    context->PSSetShader(m_psTerrainUpdatePixelShader.get(), 0, 0);
+    context->PSSetShaderResources(0, 2, &tex_views[0]);
+    context->PSSetShaderResources(4, 1, &new_bottom_tex);
+
+    ID3D11RenderTargetView * rtv = m_psSimRenderTargetView[1 - sim_idx].get();
+    context->OMSetRenderTargets(1, &rtv, 0);
+
+    context->Draw(6, 0);
+
+    // (unbind the bottom texture before the caller copies into it)
+    context->ClearState();
+
+    sim_idx = 1 - sim_idx;
+
+    // the timestep never writes the corner ghost cells, so bring the other
+    // buffer's onto the new terrain as well (as CpuSolver::updateTerrain does)
+    context->CopyResource(m_psSimTexture[1 - sim_idx].get(), m_psSimTexture[sim_idx].get());
+}
+
 
 
 // create the constant buffers, leaving them uninitialized
@@ -1733,18 +2088,18 @@ void ShallowWaterEngine::fillConstantBuffers()
     using DirectX::XMFLOAT3;
     using DirectX::XMMATRIX;
 
-    const float W = GetSetting("valley_width");
-    const float L = GetSetting("valley_length");
+    const float W = GetSetting(SH_VALLEY_WIDTH);
+    const float L = GetSetting(SH_VALLEY_LENGTH);
     
-    const int nx = GetIntSetting("mesh_size_x");
-    const int ny = GetIntSetting("mesh_size_y");
+    const int nx = GetIntSetting(SH_MESH_SIZE_X);
+    const int ny = GetIntSetting(SH_MESH_SIZE_Y);
 
     MyConstBuffer cb;
 
-    const float sun_alt = GetSetting("sun_alt") * PI / 180.0f;
-    const float sun_az = GetSetting("sun_az") * PI / 180.0f;
+    const float sun_alt = GetSetting(SH_SUN_ALT) * PI / 180.0f;
+    const float sun_az = GetSetting(SH_SUN_AZ) * PI / 180.0f;
     cb.light_dir = XMFLOAT3(cos(sun_alt)*sin(sun_az), cos(sun_alt)*cos(sun_az), sin(sun_alt));
-    cb.ambient = GetSetting("ambient");
+    cb.ambient = GetSetting(SH_AMBIENT);
 
     cb.eye_mult = XMFLOAT3(-W/(nx-1), -L/(ny-1), -1.0f);
     cb.eye_trans = XMFLOAT3(W/2 + 2*W/(nx-1) + camera_x, 2*L/(ny-1) + camera_y, camera_z);
@@ -1761,16 +2116,16 @@ void ShallowWaterEngine::fillConstantBuffers()
     cb.grass_tex_of_origin_x = W/2 / grass_size;
     cb.grass_tex_of_origin_y = 0;
 
-    cb.fresnel_coeff = GetSetting("fresnel_coeff");
-    cb.fresnel_exponent = GetSetting("fresnel_exponent");
-    cb.specular_intensity = GetSetting("specular_intensity");
-    cb.specular_exponent = GetSetting("specular_exponent");
-    cb.refractive_index = GetSetting("refractive_index");
-    cb.attenuation_1 = GetSetting("attenuation_1");
-    cb.attenuation_2 = GetSetting("attenuation_2");
-    cb.deep_r = GetSetting("deep_r");
-    cb.deep_g = GetSetting("deep_g");
-    cb.deep_b = GetSetting("deep_b");
+    cb.fresnel_coeff = GetSetting(SH_FRESNEL_COEFF);
+    cb.fresnel_exponent = GetSetting(SH_FRESNEL_EXPONENT);
+    cb.specular_intensity = GetSetting(SH_SPECULAR_INTENSITY);
+    cb.specular_exponent = GetSetting(SH_SPECULAR_EXPONENT);
+    cb.refractive_index = GetSetting(SH_REFRACTIVE_INDEX);
+    cb.attenuation_1 = GetSetting(SH_ATTENUATION_1);
+    cb.attenuation_2 = GetSetting(SH_ATTENUATION_2);
+    cb.deep_r = GetSetting(SH_DEEP_R);
+    cb.deep_g = GetSetting(SH_DEEP_G);
+    cb.deep_b = GetSetting(SH_DEEP_B);
     cb.nx_plus_1 = nx + 1;
     cb.ny_plus_1 = ny + 1;
 
@@ -1813,6 +2168,11 @@ void ShallowWaterEngine::fillConstantBuffers()
 
     cb.skybox_mtx = perspective * swap_y_and_z * rotate_around_x * rotate_around_z;
 
+    // keep a copy for patch culling (row major, as the shaders use it)
+    XMFLOAT4X4 tex_to_clip_f;
+    XMStoreFloat4x4(&tex_to_clip_f, cb.tex_to_clip);
+    memcpy(tex_to_clip, &tex_to_clip_f, sizeof(tex_to_clip));
+
     // Now write it to the const buffer
     context->UpdateSubresource(m_psConstantBuffer.get(),
                                0,     // subresource
@@ -1820,13 +2180,14 @@ void ShallowWaterEngine::fillConstantBuffers()
                                &cb,
                                0,     // row pitch
                                0);    // slab pitch
+    g_perf_counters.upload_bytes += sizeof(cb);
 
 
     // Now do the sim parameters
     SimConstBuffer sb;
 
-    const float theta = GetSetting("theta");  // 1=most dissipative, 2=most oscillatory, 1.3 = good default.
-    const float g = GetSetting("gravity");
+    const float theta = sim_settings.theta;  // 1=most dissipative, 2=most oscillatory, 1.3 = good default.
+    const float g = sim_settings.gravity;
     const float dt = current_timestep;
     
     const float dx = W / (nx-1);
@@ -1842,10 +2203,10 @@ void ShallowWaterEngine::fillConstantBuffers()
     sb.one_over_dx = 1.0f / dx;
     sb.one_over_dy = 1.0f / dy;
     sb.dt = dt;
-    sb.epsilon = CalcEpsilon();
+    sb.epsilon = sim_settings.epsilon;
     sb.nx = nx;
     sb.ny = ny;
-    sb.friction = GetSetting("friction");
+    sb.friction = sim_settings.friction;
 
     // Now write it to the constant buffer
     context->UpdateSubresource(m_psSimConstantBuffer.get(),
@@ -1854,6 +2215,7 @@ void ShallowWaterEngine::fillConstantBuffers()
                                &sb,
                                0,  // row pitch
                                0); // slab pitch
+    g_perf_counters.upload_bytes += sizeof(sb);
 }
 
 void ShallowWaterEngine::createDepthStencil(int w, int h)
@@ -1891,15 +2253,10 @@ void ShallowWaterEngine::createDepthStencil(int w, int h)
 
 void ShallowWaterEngine::loadGraphics()
 {
-    std::ifstream str("grass01.bmp", std::ios::binary);
-    boost::shared_ptr<Coercri::PixelArray> parr = Coercri::LoadBMP(str);
-    
-    CreateTextureWithMips(device,
-                          parr->getWidth(),
-                          parr->getHeight(),
-                          reinterpret_cast<unsigned char *>(&(*parr)(0,0)),
-                          m_psGrassTexture,
-                          m_psGrassTextureView);
+    MipChains grass;
+    LoadMipChains(std::vector<std::string>(1, "Grass01.bmp"), "grass01.mips", grass);
+
+    CreateTextureArrayWithMips(device, grass, 0, false, m_psGrassTexture, m_psGrassTextureView);
 
     D3D11_SAMPLER_DESC sd;
     memset(&sd, 0, sizeof(sd));
@@ -1943,32 +2300,15 @@ void ShallowWaterEngine::loadSkybox()
 {
     // load the cube texture
 
-    using Coercri::LoadBMP;
-    using std::ifstream;
-    using std::ios;
-
     // these BMPs MUST all have the same width/height.
-    boost::shared_ptr<Coercri::PixelArray>
-        p0 = LoadBMP(ifstream("skybox_east.bmp", ios::binary)),
-        p1 = LoadBMP(ifstream("skybox_west.bmp", ios::binary)),
-        p2 = LoadBMP(ifstream("skybox_north.bmp", ios::binary)),
-        p3 = LoadBMP(ifstream("skybox_south.bmp", ios::binary)),
-        p4 = LoadBMP(ifstream("skybox_up.bmp", ios::binary));
-
-    boost::shared_ptr<Coercri::PixelArray> p5(new Coercri::PixelArray(p0->getWidth(), p0->getHeight()));
-
-    const Coercri::Color * pdata[] =
-        { &(*p0)(0,0), &(*p1)(0,0), &(*p2)(0,0),
-          &(*p3)(0,0), &(*p4)(0,0), &(*p5)(0,0) };
-    
-    CreateTextureArrayWithMips(device,
-                               p0->getWidth(),
-                               p0->getHeight(),
-                               6,
-                               true,
-                               reinterpret_cast<const unsigned char**>(pdata),
-                               m_psSkyboxTexture,
-                               m_psSkyboxView);
+    // The sixth (bottom) face is never seen, so is left black.
+    const char * const filenames[5] = {
+        "skybox_east.bmp", "skybox_west.bmp", "skybox_north.bmp", "skybox_south.bmp", "skybox_up.bmp"
+    };
+    MipChains skybox;
+    LoadMipChains(std::vector<std::string>(filenames, filenames + 5), "skybox.mips", skybox);
+
+    CreateTextureArrayWithMips(device, skybox, 1, true, m_psSkyboxTexture, m_psSkyboxView);
     
     // create shaders
     Coercri::ComPtrWrapper<ID3DBlob> bytecode;
@@ -2073,16 +2413,12 @@ namespace {
 bool ShallowWaterEngine::mousePick(int mouse_x, int mouse_y,
                                    float &world_x, float &world_y, float &world_z, float &depth, float &u, float &v)
 {
-    using DirectX::XMVECTOR;
+    PROFILE_SCOPE("MousePick");
+
     using DirectX::XMMATRIX;
     using DirectX::XMFLOAT4;
     using DirectX::XMVectorSet;
 
-    const float W = GetSetting("valley_width");
-    const float L = GetSetting("valley_length");
-    const int nx = GetIntSetting("mesh_size_x");
-    const int ny = GetIntSetting("mesh_size_y");
-
     const XMMATRIX translate_camera_pos( 1, 0, 0, camera_x,
                                          0, 1, 0, camera_y,
                                          0, 0, 1, camera_z,
@@ -2107,81 +2443,59 @@ bool ShallowWaterEngine::mousePick(int mouse_x, int mouse_y,
     const float ndc_x = 2 * (mouse_x + 0.5f) / vp_width - 1;
     const float ndc_y = -2 * (mouse_y + 0.5f) / vp_height + 1;
 
-    const float stepsize = 1;  // in metres
-
-    bool found = false;
-    XMFLOAT4 world_pos;
+    // The ray is eye_to_world * (eye_z * ndc_x / xpersp, eye_z * ndc_y / ypersp, eye_z, 1),
+    // i.e. origin + eye_z * direction, and we look for the first hit with 1 <= eye_z < 1000.
+    XMFLOAT4 origin, direction;
+    XMStoreFloat4(&origin, XMVector4Transform(XMVectorSet(0, 0, 0, 1), eye_to_world));
+    XMStoreFloat4(&direction, XMVector4Transform(XMVectorSet(ndc_x / xpersp, ndc_y / ypersp, 1, 0), eye_to_world));
 
+    // this assumes resetTimestep has previously been called (to fill in the water part of the pyramid).
+    float t;
+    if (!height_pyramid.castRay(origin.x, origin.y, origin.z, direction.x, direction.y, direction.z, 1, 1000, t)) {
+        return false;
+    }
 
-    // step along the ray in multiples of stepsize.
-    // this is a bit inefficient, but it works well enough for what we want to use it for...
-
-    // this assumes resetTimestep has previously been called.
-    MapTexture m(*context, *m_psGetStatsStagingTexture4);
-
-    for (float eye_z = 1; eye_z < 1000 && !found; eye_z += stepsize) {
+    world_x = origin.x + t * direction.x;
+    world_y = origin.y + t * direction.y;
 
-        XMVECTOR eye_pos_vec = XMVectorSet( eye_z * ndc_x / xpersp,
-                                            eye_z * ndc_y / ypersp, 
-                                            eye_z,
-                                            1 );
-        XMVECTOR world_pos_vec = XMVector4Transform(eye_pos_vec, eye_to_world);
-        XMStoreFloat4(&world_pos, world_pos_vec);
-        
-        // clip to the terrain region
-        if (world_pos.x >= -W/2 && world_pos.x <= W/2 
-        && world_pos.y >= 0 && world_pos.y <= L) {
-
-            // convert world pos to a texture position in the staging texture.
-            const float tex_x = (world_pos.x + W/2) / W;
-            const float tex_y = (world_pos.y) / L;
-            int ix = int(tex_x * (nx/4));
-            int iy = int(tex_y * (ny/4));
-            if (ix<0) ix=0;
-            if (iy<0) iy=0;
-            if (ix>nx/4-1) ix=nx/4-1;
-            if (iy>ny/4-1) iy=ny/4-1;
-
-            // lookup the "h" value at this point
-            const char *row_ptr = reinterpret_cast<const char*>(m.msr.pData) + iy * m.msr.RowPitch;
-            const float *col_ptr = reinterpret_cast<const float*>(row_ptr) + ix * 4;
-            const float avg_h = (*col_ptr) / 16.0f;
-
-            // lookup terrain height at this position
-            const float B = GetTerrainHeight(world_pos.x, world_pos.y);
-            const float w = B + avg_h;
-            
-            if (world_pos.z <= w) {
-                world_x = world_pos.x;
-                world_y = world_pos.y;
-                world_z = w;
-                depth = avg_h;
-
-                u = CalcU(avg_h, col_ptr[2]/16);
-                v = CalcU(avg_h, col_ptr[3]/16);
-                
-                found = true;
-            }
-        }
-    }
+    const HeightPyramid::WaterBlock &wb = height_pyramid.getWaterAt(world_x, world_y);
+    world_z = GetTerrainHeight(world_x, world_y) + wb.h;
+    depth = wb.h;
+    u = CalcU(wb.h, wb.hu, sim_settings.epsilon);
+    v = CalcU(wb.h, wb.hv, sim_settings.epsilon);
 
-    return found;
+    return true;
 }
 
 void ShallowWaterEngine::applyMouseShader(float world_x, float world_y, float dt)
 {
-    const int action = GetIntSetting("left_mouse_action");
+    PROFILE_GPU_SCOPE("ApplyMouseShader");
+
+    const int action = GetIntSetting(SH_LEFT_MOUSE_ACTION);
+
+    const BrushEvent ev = { total_time, action, world_x, world_y,
+                            GetSetting(SH_LEFT_MOUSE_RADIUS), GetSetting(SH_LEFT_MOUSE_STRENGTH), dt };
+    brush_recorder.record(ev);
+
+    // The CPU simulation applies the stroke to its own state at the start of
+    // its next timestep. Terrain strokes still go through raiseLowerTerrain, to
+    // update the terrain textures and g_bottom (which then agree with the
+    // simulation's copy of the bottom).
+    if (sim_thread) sim_thread->addBrushEvent(ev);
+
     if (action == LM_RAISE_TERRAIN || action == LM_LOWER_TERRAIN) {
         raiseLowerTerrain(world_x, world_y, dt);
         return;
     }
+
+    if (sim_thread) return;
     
-    const float W = GetSetting("valley_width");
-    const float L = GetSetting("valley_length");
-    const int nx = GetIntSetting("mesh_size_x");
-    const int ny = GetIntSetting("mesh_size_y");
-    const float brush_radius = GetSetting("left_mouse_radius");
-    const float strength = GetSetting("left_mouse_strength") * dt;
+    const float W = GetSetting(SH_VALLEY_WIDTH);
+    const float L = GetSetting(SH_VALLEY_LENGTH);
+    const int nx = GetIntSetting(SH_MESH_SIZE_X);
+    const int ny = GetIntSetting(SH_MESH_SIZE_Y);
+    const float brush_radius = GetSetting(SH_LEFT_MOUSE_RADIUS);
+    const float strength = GetSetting(SH_LEFT_MOUSE_STRENGTH) * dt;
     
     // transformation from world coords to texture index.
     const float world_to_idx_x_scale = (nx-1)/W;
@@ -2227,6 +2541,7 @@ void ShallowWaterEngine::applyMouseShader(float world_x, float world_y, float dt
     
     context->UpdateSubresource(m_psLeftMouseConstantBuffer.get(),
                                0, 0, &cb, 0, 0);
+    g_perf_counters.upload_bytes += sizeof(cb);
 
     // prepare to copy state texture to a temporary work area.
     // find the texture indices for the copy region.
@@ -2292,161 +2607,157 @@ void ShallowWaterEngine::applyMouseShader(float world_x, float world_y, float dt
     context->Draw(MOUSE_PICK_NUM_TRIANGLES * 3, 0);
 }
 
+void ShallowWaterEngine::startBrushRecording()
+{
+    brush_recorder.start(total_time, sim_settings.nx, sim_settings.ny, sim_settings.W, sim_settings.L);
+}
+
 void ShallowWaterEngine::raiseLowerTerrain(float world_x, float world_y, float dt)
 {
-    // Do this on CPU as it is the easiest way -- just want to get this code written
-    // quickly, don't care about efficiency at this point :)
+    PROFILE_GPU_SCOPE("RaiseLowerTerrain");
 
-    const float W = GetSetting("valley_width");
-    const float L = GetSetting("valley_length");
-    const int nx = GetIntSetting("mesh_size_x");
-    const int ny = GetIntSetting("mesh_size_y");
-    const float dx = W / (nx-1);
-    const float dy = L / (ny-1);    
-    const float brush_radius = GetSetting("left_mouse_radius") * 2; // *2 to account for 'gaussian' nature of brush
-    float strength = GetSetting("left_mouse_strength");
-    const int action = GetIntSetting("left_mouse_action");    
-    float displacement;
-    if (action == LM_LOWER_TERRAIN) displacement = -strength*dt; else displacement = strength*dt;
-    
-    const float world_to_idx_x_scale = (nx-1)/W;
-    const float world_to_idx_x_bias = (nx+4)/2.0f;
-    const float world_to_idx_y_scale = (ny-1)/L;
-    const float world_to_idx_y_bias = 2.5f;
+    const int nx = sim_settings.nx;
+    const int ny = sim_settings.ny;
+    const float brush_radius = GetSetting(SH_LEFT_MOUSE_RADIUS) * 2; // *2 to account for 'gaussian' nature of brush
+    const float strength = GetSetting(SH_LEFT_MOUSE_STRENGTH);
+    const int action = GetIntSetting(SH_LEFT_MOUSE_ACTION);
+    const float displacement = (action == LM_LOWER_TERRAIN ? -strength : strength) * dt;
 
-    const int centre_ix = int(world_to_idx_x_scale * world_x + world_to_idx_x_bias);
-    const int centre_iy = int(world_to_idx_y_scale * world_y + world_to_idx_y_bias);
-    const int radius_x = int(world_to_idx_x_scale * brush_radius) + 3;  // safety margin
-    const int radius_y = int(world_to_idx_y_scale * brush_radius) + 3;
+    if (terrain_brush.setup(brush_radius, nx, ny, sim_settings.W, sim_settings.L)) {
+        createBrushTexture();
+    }
 
-    const int ix_min = std::max(0, std::min(nx+4, centre_ix - radius_x));   // inclusive
-    const int ix_max = std::max(0, std::min(nx+4, centre_ix + radius_x + 1));  // exclusive
-    const int iy_min = std::max(0, std::min(ny+4, centre_iy - radius_y));
-    const int iy_max = std::max(0, std::min(ny+4, centre_iy + radius_y + 1));    
+    int cx, cy;
+    terrain_brush.locate(world_x, world_y, cx, cy);
 
-    D3D11_BOX src_box;
-    src_box.left = ix_min;
-    src_box.right = ix_max;
-    src_box.top = iy_min;
-    src_box.bottom = iy_max;
-    src_box.front = 0;
-    src_box.back = 1;
-    context->CopySubresourceRegion(m_psFullSizeStagingTexture.get(),
+    int ix_min, ix_max, iy_min, iy_max;
+    terrain_brush.getBox(cx, cy, ix_min, ix_max, iy_min, iy_max);
+    if (ix_min == ix_max || iy_min == iy_max) return;
+
+    D3D11_BOX box;
+    box.left = ix_min;
+    box.right = ix_max;
+    box.top = iy_min;
+    box.bottom = iy_max;
+    box.front = 0;
+    box.back = 1;
+
+    // Water level: copy the footprint of the state texture to scratch space,
+    // then draw the footprint back into the state texture with BrushApply.
+    // This all stays on the GPU.
+
+    context->CopySubresourceRegion(m_psSimTexture[4].get(),  // dest texture (xflux -- being used here as scratch space)
                                    0,  // subresource
                                    ix_min,  // dest x
                                    iy_min,  // dest y
                                    0,  // dest z
                                    m_psSimTexture[sim_idx].get(),  // src texture -- current state
                                    0,  // subresource
-                                   &src_box);
-
-    {
-        MapTexture m(*context, *m_psFullSizeStagingTexture);
-
-        for (int iy = iy_min; iy < iy_max; ++iy) {
-
-            // have to be careful about the exact definitions of BX, BY, BA (see terrain_heightfield.cpp)
-            // (Water level w must be brought up in line with BA)
-            
-            const float wy_plus = (iy + 0.5f - world_to_idx_y_bias) / world_to_idx_y_scale - world_y;
-            const float wy_minus = (iy - 0.5f - world_to_idx_y_bias) / world_to_idx_y_scale - world_y;
-
-            char * row_ptr = static_cast<char*>(m.msr.pData) + m.msr.RowPitch * iy;
-            
-            for (int ix = ix_min; ix < ix_max; ++ix) {
-
-                const float wx_plus = (ix + 0.5f - world_to_idx_x_bias) / world_to_idx_x_scale - world_x;
-                const float wx_minus = (ix - 0.5f - world_to_idx_x_bias) / world_to_idx_x_scale - world_x;
+                                   &box);
+
+    BrushConstBuffer cb;
+    cb.brush_left = cx - terrain_brush.getRadiusX();
+    cb.brush_top = cy - terrain_brush.getRadiusY();
+    cb.brush_displacement = displacement;
+    cb.pad = 0;
+    context->UpdateSubresource(m_psBrushConstantBuffer.get(), 0, 0, &cb, 0, 0);
+
+    const float left = float(ix_min), right = float(ix_max);
+    const float top = float(iy_min), bottom = float(iy_max);
+    const float vertices[12] = {
+        left, top,
+        right, top,
+        left, bottom,
+        right, top,
+        right, bottom,
+        left, bottom
+    };
+    context->UpdateSubresource(m_psBrushVertexBuffer.get(), 0, 0, &vertices[0], 0, 0);
 
-                const float plus_plus = GaussianBrush(wx_plus, wy_plus, brush_radius) * displacement;
-                const float plus_minus = GaussianBrush(wx_plus, wy_minus, brush_radius) * displacement;
-                const float minus_plus = GaussianBrush(wx_minus, wy_plus, brush_radius) * displacement;
-                const float minus_minus = GaussianBrush(wx_minus, wy_minus, brush_radius) * displacement;
+    context->ClearState();
 
-                float * ptr = reinterpret_cast<float*>(row_ptr) + 4 * ix;
+    context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    context->IASetInputLayout(m_psSimInputLayout.get());
 
-                *ptr += (plus_plus + plus_minus + minus_plus + minus_minus) / 4;
-            }
-        }
-    }
+    ID3D11Buffer *vert_buf = m_psBrushVertexBuffer.get();
+    const UINT stride = 8;
+    const UINT offset = 0;
+    context->IASetVertexBuffers(0, 1, &vert_buf, &stride, &offset);
 
-    context->CopySubresourceRegion(m_psSimTexture[sim_idx].get(),  // dest texture
-                                   0,  // subresource
-                                   ix_min,  // dest x
-                                   iy_min,  // dest y
-                                   0,  // dest z
-                                   m_psFullSizeStagingTexture.get(),  // src texture
-                                   0,  // subresource
-                                   &src_box);    
+    ID3D11Buffer *sim_cst_buf = m_psSimConstantBuffer.get();
+    ID3D11Buffer *brush_cst_buf = m_psBrushConstantBuffer.get();
+    context->VSSetShader(m_psSimVertexShader.get(), 0, 0);
+    context->VSSetConstantBuffers(0, 1, &sim_cst_buf);
 
-    // Now we are going to update the in-memory copy of BottomTexture and
-    // upload it to the GPU via UpdateSubresource.
+    D3D11_VIEWPORT vp;
+    memset(&vp, 0, sizeof(vp));
+    vp.Width = float(nx+4);
+    vp.Height = float(ny+4);
+    vp.MaxDepth = 1;
+    context->RSSetViewports(1, &vp);
 
-    for (int iy = iy_min; iy < iy_max; ++iy) {
+    ID3D11ShaderResourceView *scratch_tex = m_psSimTextureView[4].get();
+    ID3D11ShaderResourceView *brush_tex = m_psBrushTextureView.get();
+    context->PSSetShader(m_psBrushPixelShader.get(), 0, 0);
+    context->PSSetConstantBuffers(1, 1, &brush_cst_buf);
+    context->PSSetShaderResources(0, 1, &scratch_tex);
+    context->PSSetShaderResources(4, 1, &brush_tex);
 
-        const float wy_plus = (iy + 0.5f - world_to_idx_y_bias) / world_to_idx_y_scale - world_y;
-        const float wy_minus = (iy - 0.5f - world_to_idx_y_bias) / world_to_idx_y_scale - world_y;
+    ID3D11RenderTargetView * rtv = m_psSimRenderTargetView[sim_idx].get();
+    context->OMSetRenderTargets(1, &rtv, 0);
 
-        BottomEntry * row_ptr = &g_bottom[iy * (nx+4)];
-            
-        for (int ix = ix_min; ix < ix_max; ++ix) {
-            
-            const float wx_plus = (ix + 0.5f - world_to_idx_x_bias) / world_to_idx_x_scale - world_x;
-            const float wx_minus = (ix - 0.5f - world_to_idx_x_bias) / world_to_idx_x_scale - world_x;
-            
-            const float plus_plus = GaussianBrush(wx_plus, wy_plus, brush_radius) * displacement;
-            const float plus_minus = GaussianBrush(wx_plus, wy_minus, brush_radius) * displacement;
-            const float minus_plus = GaussianBrush(wx_minus, wy_plus, brush_radius) * displacement;
-            const float minus_minus = GaussianBrush(wx_minus, wy_minus, brush_radius) * displacement;
+    context->Draw(6, 0);
 
-            BottomEntry * ptr = row_ptr + ix;
+    // Bottom and terrain: update the CPU copies (which the picking code and
+    // updateFromSimThread also use) and upload just the footprint.
 
-            ptr->BX += (plus_plus + plus_minus)/2;
-            ptr->BY += (plus_plus + minus_plus)/2;
-            ptr->BA += (plus_plus + plus_minus + minus_plus + minus_minus)/4;
-        }
-    }
+    terrain_brush.applyToBottom(&g_bottom[0], cx, cy, displacement);
+    terrain_brush.applyToTerrain(&g_terrain_heightfield[0], cx, cy, displacement);
 
     context->UpdateSubresource(m_psBottomTexture.get(),  // dest texture
                                0,  // subresource
-                               &src_box,  // dest box
+                               &box,  // dest box
                                &g_bottom[iy_min * (nx+4) + ix_min],  // src data
-                               (nx+4) * 3 * sizeof(float),   // row pitch
+                               (nx+4) * sizeof(BottomEntry),   // row pitch
                                0);  // depth pitch (unused)
 
-    // more crappy copy paste code...
-    
-    for (int iy = iy_min; iy < iy_max; ++iy) {
+    context->UpdateSubresource(m_psTerrainTexture.get(),  // dest texture
+                               0,  // subresource
+                               &box,  // dest box
+                               &g_terrain_heightfield[iy_min * (nx+4) + ix_min],  // src data
+                               (nx+4) * sizeof(TerrainEntry),   // row pitch
+                               0);  // depth pitch (unused)
 
-        const float wy_plus = (iy + 0.5f - world_to_idx_y_bias) / world_to_idx_y_scale - world_y;
-        const float wy_minus = (iy - 0.5f - world_to_idx_y_bias) / world_to_idx_y_scale - world_y;
-        
-        TerrainEntry * row_ptr = &g_terrain_heightfield[iy * (nx+4)];
-            
-        for (int ix = ix_min; ix < ix_max; ++ix) {
+    g_perf_counters.upload_bytes += sizeof(cb) + sizeof(vertices)
+        + (ix_max - ix_min) * (iy_max - iy_min) * (sizeof(TerrainEntry) + sizeof(BottomEntry));
 
-            const float wx_plus = (ix + 0.5f - world_to_idx_x_bias) / world_to_idx_x_scale - world_x;
-            const float wx_minus = (ix - 0.5f - world_to_idx_x_bias) / world_to_idx_x_scale - world_x;
+    height_pyramid.updateTerrain(&g_terrain_heightfield[0], ix_min, ix_max, iy_min, iy_max);
+    height_pyramid.rebuild();
+    patch_quadtree.updateTerrain(&g_terrain_heightfield[0], ix_min, ix_max, iy_min, iy_max);
+}
 
-            const float plus_plus = GaussianBrush(wx_plus, wy_plus, brush_radius) * displacement;
-            const float plus_minus = GaussianBrush(wx_plus, wy_minus, brush_radius) * displacement;
-            const float minus_plus = GaussianBrush(wx_minus, wy_plus, brush_radius) * displacement;
-            const float minus_minus = GaussianBrush(wx_minus, wy_minus, brush_radius) * displacement;
-            
-            TerrainEntry * ptr = row_ptr + ix;
+// (Re)creates the texture of brush weights used by BrushApply.
+// Called whenever the terrain brush kernel changes.
+void ShallowWaterEngine::createBrushTexture()
+{
+    const int w = 2 * terrain_brush.getRadiusX() + 1;
+    const int h = 2 * terrain_brush.getRadiusY() + 1;
 
-            ptr->B += (plus_plus + plus_minus + minus_plus + minus_minus)/4;
-            ptr->dBdx += (plus_plus + plus_minus - minus_plus - minus_minus) / (2*dx);
-            ptr->dBdy += (plus_plus + minus_plus - plus_minus - minus_minus) / (2*dy);
-        }
-    }  
+    D3D11_SUBRESOURCE_DATA sd;
+    memset(&sd, 0, sizeof(sd));
+    sd.pSysMem = terrain_brush.getBAWeights();
+    sd.SysMemPitch = w * sizeof(float);
 
-    context->UpdateSubresource(m_psTerrainTexture.get(),  // dest texture
-                               0,  // subresource
-                               &src_box,  // dest box
-                               &g_terrain_heightfield[iy_min * (nx+4) + ix_min],  // src data
-                               (nx+4) * 3 * sizeof(float),   // row pitch
-                               0);  // depth pitch (unused)    
+    CreateTexture(device,
+                  w,
+                  h,
+                  &sd,
+                  DXGI_FORMAT_R32_FLOAT,
+                  false,
+                  m_psBrushTexture,
+                  &m_psBrushTextureView,
+                  0);
+    g_perf_counters.upload_bytes += w * h * sizeof(float);
 }
 
 void ShallowWaterEngine::setupMousePicking()
@@ -2515,24 +2826,32 @@ void ShallowWaterEngine::setupMousePicking()
         throw Coercri::DXError("Failed to create constant buffer", hr);
     }
     m_psLeftMouseConstantBuffer.reset(pBuffer);
+
+    // terrain brush (the brush weights texture is created on first use, see createBrushTexture)
+    CreatePixelShader(device, BrushApply, sizeof(BrushApply), m_psBrushPixelShader);
+
+    bd.ByteWidth = RoundUpTo16(sizeof(BrushConstBuffer));
+    hr = device->CreateBuffer(&bd, 0, &pBuffer);
+    if (FAILED(hr)) {
+        throw Coercri::DXError("Failed to create constant buffer", hr);
+    }
+    m_psBrushConstantBuffer.reset(pBuffer);
+
+    // a quad covering the brush footprint; rewritten each time the brush is applied
+    bd.ByteWidth = 12 * sizeof(float);
+    bd.Usage = D3D11_USAGE_DEFAULT;
+    bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    hr = device->CreateBuffer(&bd, 0, &pBuffer);
+    if (FAILED(hr)) {
+        throw Coercri::DXError("Failed to create brush vertex buffer", hr);
+    }
+    m_psBrushVertexBuffer.reset(pBuffer);
+
+    // terrain changes
+    CreatePixelShader(device, TerrainUpdate, sizeof(TerrainUpdate), m_psTerrainUpdatePixelShader);
 }
 
 float ShallowWaterEngine::getWaterHeight(float world_x, float world_y)
 {
-    const float W = GetSetting("valley_width");
-    const float L = GetSetting("valley_length");
-    const int nx = GetIntSetting("mesh_size_x");
-    const int ny = GetIntSetting("mesh_size_y");
-    MapTexture m(*context, *m_psGetStatsStagingTexture4);
-    const float tex_x = (world_x + W/2) / W;
-    const float tex_y = (world_y) / L;
-    int ix = int(tex_x * (nx/4));
-    int iy = int(tex_y * (ny/4));
-    if (ix < 0) ix = 0;
-    if (iy < 0) iy = 0;
-    const char *row_ptr = reinterpret_cast<const char*>(m.msr.pData) + iy * m.msr.RowPitch;
-    const float *col_ptr = reinterpret_cast<const float*>(row_ptr) + ix * 4;
-    const float avg_h = (*col_ptr) / 16.0f;
-    const float B = GetTerrainHeight(world_x, world_y);
-    return B + avg_h;
+    return height_pyramid.getSurfaceHeight(world_x, world_y);
 }
@@ -20,10 +20,21 @@
 #ifndef ENGINE_HPP
 #define ENGINE_HPP
 
+#include "brush_log.hpp"
+#include "gpu_profiler.hpp"
+#include "height_pyramid.hpp"
+#include "mesh.hpp"
+#include "patch_quadtree.hpp"
+#include "probe_set.hpp"
 #include "settings.hpp"
+#include "sim_thread.hpp"
+#include "terrain_brush.hpp"
+#include "terrain_build.hpp"
 
 #include "coercri/dx11/core/com_ptr_wrapper.hpp"
 
+#include "boost/scoped_ptr.hpp"
+
 #include <d3d11.h>
 #ifdef max
 #undef max
@@ -36,8 +47,17 @@ class ShallowWaterEngine {
 public:
     ShallowWaterEngine(ID3D11Device *device_, ID3D11DeviceContext *context_);
 
-    void newTerrainSettings();  // call if any terrain settings change.
-    void remesh(ResetType rt);   // call if mesh size changes.
+    // Terrain and mesh rebuilds (see terrain_build.hpp). beginRebuild starts
+    // building the terrain for the given settings (and for R_MESH and above,
+    // the mesh and initial water state too) on another thread, while the
+    // old ones stay in use. Once isRebuildReady(), finishRebuild() switches
+    // over, all in one go; g_settings must match the given settings by then.
+    // (finishRebuild waits for the build, if it is not ready yet.)
+    void beginRebuild(ResetType rt, const SettingsSnapshot &settings);
+    bool isRebuildReady() const { return rebuild && rebuild->isReady(); }
+    void finishRebuild();
+
+    void newSimSettings();      // call if any other settings in SimSettings change.
 
     // call following camera move or window resize
     void moveCamera(float cam_x, float cam_y, float cam_z, float yaw, float pitch, int vp_width, int vp_height);
@@ -45,10 +65,20 @@ public:
     // update the water
     void timestep();
 
+    // CPU simulation (see sim_thread.hpp). While this is on, the simulation
+    // runs by itself on other threads, and timestep() and resetTimestep() must
+    // not be called; instead, call updateFromSimThread() once per frame, to
+    // pick up the newest state (if any).
+    // Switching carries the current water state across.
+    bool isSimThreaded() const { return sim_thread.get() != 0; }
+    void setSimThreaded(bool threaded);
+    void updateFromSimThread();
+
     // set timestep to the given dt (multiplied by time_acceleration),
     // or to safety_factor * CFL-timestep,
     // whichever is smaller.
     void resetTimestep(float dt);
+    float getTimestep() const { return current_timestep; }   // simulated seconds per step
     
     // render a frame to the given render target
     void render(ID3D11RenderTargetView *rtv);
@@ -61,17 +91,39 @@ public:
 
     // get water height (h + B) at the given point
     float getWaterHeight(float world_x, float world_y);
+
+    // Brush recording (see brush_log.hpp). Every call to applyMouseShader
+    // is logged while recording; event times are relative to the start.
+    void startBrushRecording();
+    BrushRecorder & getBrushRecorder() { return brush_recorder; }
+
+    // Water gauges. Add points to this at any time; from the next timestep on,
+    // all of them are sampled at the end of every timestep, with one draw call
+    // and one readback. The readback is one timestep behind (so that the CPU
+    // does not wait for the GPU): after timestep(), the results are those of
+    // the previous timestep, and getProbes().getSampleTime() says which.
+    // (With the CPU simulation, probes are sampled from each state picked up
+    // by updateFromSimThread instead, i.e. once per frame.)
+    ProbeSet & getProbes() { return probes; }
+
+    // GPU timing (call beginFrame/endFrame around each frame; see gpu_profiler.hpp)
+    GpuProfiler & getGpuProfiler() { return *gpu_profiler; }
     
     
 private:
     void createShadersAndInputLayout();
     void createMeshBuffers();
     void createSimBuffers();
+    void uploadPatchInstances();
+    void drawPatches();
     
+    void remesh(TerrainBuild &build);
+    void newTerrainSettings(TerrainBuild &build);
+
     void createTerrainTexture();
-    void fillTerrainTexture();
-    void fillTerrainTextureLite();
-    void createSimTextures(ResetType reset_type);
+    void fillTerrainTextureLite(TerrainBuild &build, bool keep_depth);
+    void updateWaterForTerrain();
+    void createSimTextures(const float *initial_state);
     void createConstantBuffers();
     void fillConstantBuffers();
     void createDepthStencil(int w, int h);
@@ -80,11 +132,23 @@ private:
 
     void setupMousePicking();
     void raiseLowerTerrain(float wx, float wy, float dt);
+    void createBrushTexture();
+
+    void createProbeTextures();
+    void gatherProbes();
+    void readProbes(int slot);
+
+    void startSimThread(const float *initial_state);
+    void startSimThreadFromGpu();
+    void stopSimThread();
+    void computeNormals();
     
 private:
     ID3D11Device *device;
     ID3D11DeviceContext *context;
 
+    boost::scoped_ptr<GpuProfiler> gpu_profiler;
+
     // vertex & pixel shaders
     Coercri::ComPtrWrapper<ID3D11VertexShader> m_psTerrainVertexShader, m_psWaterVertexShader;
     Coercri::ComPtrWrapper<ID3D11PixelShader> m_psTerrainPixelShader, m_psWaterPixelShader;
@@ -96,16 +160,23 @@ private:
     // input layouts
     Coercri::ComPtrWrapper<ID3D11InputLayout> m_psInputLayout, m_psSimInputLayout;
     
-    // vertex and index buffers (for the triangle meshes).
+    // instance and index buffers (for the triangle meshes).
     // can be used for both terrain & water.
-    Coercri::ComPtrWrapper<ID3D11Buffer> m_psMeshVertexBuffer;
+    // the mesh is drawn in patches (see mesh.hpp and patch_quadtree.hpp).
+    Coercri::ComPtrWrapper<ID3D11Buffer> m_psPatchInstanceBuffer;
     Coercri::ComPtrWrapper<ID3D11Buffer> m_psMeshIndexBuffer;
+    int patch_instance_capacity;
+    std::vector<PatchIndexRange> patch_index_ranges;
+    PatchQuadtree patch_quadtree;
+    std::vector<PatchQuadtree::DrawItem> patch_draws;   // reused every frame
+    std::vector<PatchInstance> patch_instances;         // same order as patch_draws
 
     // vertex buffers for the simulation render-to-texture.
     // (one for each pass.)
     // TODO: Might be better to have one large vertex buffer, with offsets,
     // rather than lots of little ones like this.
     Coercri::ComPtrWrapper<ID3D11Buffer> m_psSimVertexBuffer11, m_psSimVertexBuffer10, m_psSimVertexBuffer00;
+    Coercri::ComPtrWrapper<ID3D11Buffer> m_psSimVertexBuffer22;   // whole grid, for TerrainUpdate
     Coercri::ComPtrWrapper<ID3D11Buffer> m_psGetStatsVertexBuffer;
     Coercri::ComPtrWrapper<ID3D11Buffer> m_psBoundaryVertexBuffer[4];
 
@@ -115,10 +186,14 @@ private:
     // textures:
     //  -- terrain (contains B, dB/dx, dB/dy)
     //  -- bottom (contains BY, BX, BA; used for simulation)
+    //  -- new bottom (the next terrain's bottom, while TerrainUpdate moves the water onto it)
     Coercri::ComPtrWrapper<ID3D11Texture2D> m_psTerrainTexture;
     Coercri::ComPtrWrapper<ID3D11ShaderResourceView> m_psTerrainTextureView;
     Coercri::ComPtrWrapper<ID3D11Texture2D> m_psBottomTexture;
     Coercri::ComPtrWrapper<ID3D11ShaderResourceView> m_psBottomTextureView;
+    Coercri::ComPtrWrapper<ID3D11Texture2D> m_psNewBottomTexture;
+    Coercri::ComPtrWrapper<ID3D11ShaderResourceView> m_psNewBottomTextureView;
+    Coercri::ComPtrWrapper<ID3D11PixelShader> m_psTerrainUpdatePixelShader;
 
     // simulation textures:
     // [sim_idx] = state
@@ -159,7 +234,40 @@ private:
     Coercri::ComPtrWrapper<ID3D11VertexShader> m_psLeftMouseVertexShader;
     Coercri::ComPtrWrapper<ID3D11PixelShader> m_psLeftMousePixelShader;
     Coercri::ComPtrWrapper<ID3D11InputLayout> m_psLeftMouseInputLayout;
+    HeightPyramid height_pyramid;   // terrain + water (from the GetStats readback)
+
+    // terrain brush
+    TerrainBrush terrain_brush;
+    BrushRecorder brush_recorder;
+    Coercri::ComPtrWrapper<ID3D11PixelShader> m_psBrushPixelShader;
+    Coercri::ComPtrWrapper<ID3D11Buffer> m_psBrushConstantBuffer, m_psBrushVertexBuffer;
+    Coercri::ComPtrWrapper<ID3D11Texture2D> m_psBrushTexture;
+    Coercri::ComPtrWrapper<ID3D11ShaderResourceView> m_psBrushTextureView;
+
+    // probes: the probe cells and results are (nx+4) * probe_rows textures, one
+    // pixel per probe. The two staging textures are used alternately.
+    ProbeSet probes;
+    Coercri::ComPtrWrapper<ID3D11PixelShader> m_psProbeGatherPixelShader;
+    Coercri::ComPtrWrapper<ID3D11Buffer> m_psProbeVertexBuffer;
+    Coercri::ComPtrWrapper<ID3D11Texture2D> m_psProbeCellTexture, m_psProbeTexture, m_psProbeStagingTexture[2];
+    Coercri::ComPtrWrapper<ID3D11ShaderResourceView> m_psProbeCellTextureView;
+    Coercri::ComPtrWrapper<ID3D11RenderTargetView> m_psProbeRenderTargetView;
+    int probe_rows;           // 0 if the textures have not been created
+    int probe_slot;           // staging texture for the next gather
+    bool probe_pending[2];    // staging texture holds a gather that has not been read yet
+    float probe_time[2];      // total_time of that gather
     
+    // CPU simulation (null when simulating on the GPU)
+    boost::scoped_ptr<SimThread> sim_thread;
+    long long sim_steps_seen;   // SimFrame::steps of the last frame picked up
+
+    // snapshot of the simulation settings, refreshed whenever they change
+    // (see newSimSettings) so the hot paths avoid name lookups
+    SimSettings sim_settings;
+
+    // terrain/mesh rebuild in progress (null if none)
+    boost::scoped_ptr<TerrainBuild> rebuild;
+
     // current timestep
     float current_timestep;
     float total_time;
@@ -168,6 +276,7 @@ private:
     int vp_width, vp_height;
     float pitch, yaw, camera_x, camera_y, camera_z;
     float xpersp, ypersp;  // perspective coefficients.
+    float tex_to_clip[16];  // as in the constant buffer (row major)
     float near_plane_dist, far_plane_dist;
 };
 
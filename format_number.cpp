@@ -0,0 +1,104 @@
+/*
+ * FILE:
+ *   format_number.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "format_number.hpp"
+
+#include <cmath>
+#include <cstdio>
+
+namespace {
+    const int SIG_DIGITS = 6;   // as the ostream default precision
+
+    const double POWERS_OF_TEN[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    const int NUM_POWERS = sizeof(POWERS_OF_TEN) / sizeof(POWERS_OF_TEN[0]);
+
+    // a * 10^n. (Divides for negative n, as 10^-n is not exact.)
+    double ScaleByPowerOfTen(double a, int n)
+    {
+        if (n >= 0) return a * (n < NUM_POWERS ? POWERS_OF_TEN[n] : std::pow(10.0, n));
+        else return a / (-n < NUM_POWERS ? POWERS_OF_TEN[-n] : std::pow(10.0, -n));
+    }
+}
+
+int FormatNumber(double value, char *buf)
+{
+    double a = std::fabs(value);
+
+    // infinities, NaNs, zero and denormals are left to the C library
+    if (!(a >= 1e-300 && a <= 1e300)) {
+        return std::sprintf(buf, "%g", value);
+    }
+
+    // find the decimal exponent e, and the digits as an integer m, 10^5 <= m < 10^6
+    int e = int(std::floor(std::log10(a)));
+    double m;
+    for (int tries = 0; tries < 3; ++tries) {
+        const double scaled = ScaleByPowerOfTen(a, SIG_DIGITS - 1 - e);
+        m = std::floor(scaled + 0.5);
+
+        // too close to half way to be sure which way the exact value rounds
+        if (std::fabs(scaled - m) > 0.5 - 1e-6) return std::sprintf(buf, "%g", value);
+
+        if (m >= POWERS_OF_TEN[SIG_DIGITS]) ++e;           // log10 rounded down, or m rounded up
+        else if (m < POWERS_OF_TEN[SIG_DIGITS - 1]) --e;   // log10 rounded up
+        else break;
+    }
+
+    char digits[SIG_DIGITS];
+    int n = SIG_DIGITS;
+    {
+        int im = int(m);
+        for (int i = SIG_DIGITS - 1; i >= 0; --i) {
+            digits[i] = char('0' + im % 10);
+            im /= 10;
+        }
+    }
+    while (n > 1 && digits[n-1] == '0') --n;   // (%g drops trailing zeros)
+
+    char *p = buf;
+    if (value < 0) *p++ = '-';
+
+    if (e < -4 || e >= SIG_DIGITS) {
+        // scientific
+        *p++ = digits[0];
+        if (n > 1) {
+            *p++ = '.';
+            for (int i = 1; i < n; ++i) *p++ = digits[i];
+        }
+        *p++ = 'e';
+        *p++ = e < 0 ? '-' : '+';
+        const int abs_e = e < 0 ? -e : e;
+        if (abs_e >= 100) *p++ = char('0' + abs_e / 100);
+        *p++ = char('0' + abs_e / 10 % 10);
+        *p++ = char('0' + abs_e % 10);
+
+    } else if (e >= 0) {
+        // integer part is digits[0..e]
+        for (int i = 0; i <= e; ++i) *p++ = digits[i];
+        if (n > e + 1) {
+            *p++ = '.';
+            for (int i = e + 1; i < n; ++i) *p++ = digits[i];
+        }
+
+    } else {
+        *p++ = '0';
+        *p++ = '.';
+        for (int i = 0; i < -e - 1; ++i) *p++ = '0';
+        for (int i = 0; i < n; ++i) *p++ = digits[i];
+    }
+
+    *p = 0;
+    return int(p - buf);
+}
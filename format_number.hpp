@@ -0,0 +1,26 @@
+/*
+ * FILE:
+ *   format_number.hpp
+ *
+ * PURPOSE:
+ *   Formats numbers for the GUI's value labels (see value_label.hpp)
+ *   into a fixed buffer, without going through sprintf or an ostream
+ *   for the common cases.
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef FORMAT_NUMBER_HPP
+#define FORMAT_NUMBER_HPP
+
+// Writes value into buf (which must hold at least FORMAT_NUMBER_SIZE chars), in
+// the same format as "std::cout << value" (i.e. printf "%g"). Returns the length.
+const int FORMAT_NUMBER_SIZE = 24;
+int FormatNumber(double value, char *buf);
+
+#endif
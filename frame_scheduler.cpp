@@ -0,0 +1,107 @@
+/*
+ * FILE:
+ *   frame_scheduler.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "frame_scheduler.hpp"
+
+#include <algorithm>
+
+namespace {
+    const double NS_PER_SEC = 1.0e9;
+
+    // Time per frame to spend on timesteps (~30 fps if the steps use it all).
+    const double STEP_BUDGET_NS = 25.0e6;
+
+    // Even when behind, draw at least this often, so the GUI stays usable.
+    const unsigned long long MAX_RENDER_INTERVAL_NS = 100000000ULL;
+
+    // Real time the simulation may fall behind by before the excess is dropped.
+    const double MAX_LAG_SEC = 0.25;
+
+    // Re-estimate the step cost after this many steps. This should be at least the
+    // number of steps between resetTimestep calls (whose readback waits for the GPU).
+    const int STEPS_PER_SAMPLE = 10;
+
+    // Weight of each new sample in the smoothed step cost.
+    const double STEP_COST_SMOOTHING = 0.25;
+
+    // Measure the achieved time ratio over periods this long.
+    const unsigned long long RATIO_PERIOD_NS = 500000000ULL;
+}
+
+FrameScheduler::FrameScheduler()
+    : owed(0), last_frame(0), last_render(0), frame_steps(0), last_timestep(0),
+      step_ns(1.0e6), sample_ns(0), sample_steps(0),
+      ratio_start(0), ratio_sim_time(0), achieved_ratio(0)
+{
+}
+
+void FrameScheduler::reset(unsigned long long now)
+{
+    owed = 0;
+    last_frame = now;
+    frame_steps = 0;
+    ratio_start = now;
+    ratio_sim_time = 0;
+}
+
+void FrameScheduler::beginFrame(unsigned long long now, float time_ratio)
+{
+    const double elapsed = double(now - last_frame) / NS_PER_SEC;
+    last_frame = now;
+
+    owed = std::min(owed + elapsed * time_ratio, MAX_LAG_SEC * time_ratio);
+    frame_steps = 0;
+
+    if (now - ratio_start >= RATIO_PERIOD_NS) {
+        achieved_ratio = float(ratio_sim_time * NS_PER_SEC / double(now - ratio_start));
+        ratio_start = now;
+        ratio_sim_time = 0;
+    }
+}
+
+bool FrameScheduler::wantStep(float timestep) const
+{
+    if (timestep <= 0 || owed < timestep) return false;
+
+    // Always allow one step, so that the simulation still makes progress
+    // when a single step costs more than the budget.
+    return frame_steps == 0 || (frame_steps + 1) * step_ns <= STEP_BUDGET_NS;
+}
+
+void FrameScheduler::stepDone(float timestep)
+{
+    owed -= timestep;
+    last_timestep = timestep;
+    ratio_sim_time += timestep;
+    ++frame_steps;
+}
+
+void FrameScheduler::endSteps(unsigned long long elapsed)
+{
+    sample_ns += elapsed;
+    sample_steps += frame_steps;
+
+    if (sample_steps >= STEPS_PER_SAMPLE) {
+        const double ns = double(sample_ns) / sample_steps;
+        step_ns += STEP_COST_SMOOTHING * (ns - step_ns);
+        sample_ns = 0;
+        sample_steps = 0;
+    }
+}
+
+bool FrameScheduler::wantRender(unsigned long long now) const
+{
+    // If the steps stopped with a whole step still owed, it was the
+    // budget that stopped them, i.e. the simulation is behind.
+    const bool behind = frame_steps > 0 && owed >= last_timestep;
+    return !behind || now - last_render >= MAX_RENDER_INTERVAL_NS;
+}
@@ -0,0 +1,85 @@
+/*
+ * FILE:
+ *   frame_scheduler.hpp
+ *
+ * PURPOSE:
+ *   Decides, each time round the main loop, how many timesteps to
+ *   run and whether to draw a frame, so that simulated time advances
+ *   at time_acceleration times real time (for the GPU simulation;
+ *   the CPU simulation paces itself, see sim_thread.hpp).
+ *
+ *   Real time is paid into an accumulator (scaled by the requested
+ *   ratio), and each timestep takes its simulated length back out.
+ *   The number of steps per frame therefore follows from the
+ *   timestep and the frame rate, rather than being set by hand.
+ *
+ *   Steps are limited to a fixed budget of (estimated) time per frame.
+ *   If the accumulator still holds more than a step after that, the
+ *   simulation is behind, and the frame is not drawn (unless it has
+ *   been too long since the last one) so that the time goes to
+ *   simulation instead. If it falls further behind than a set
+ *   limit, the excess is dropped, i.e. the achieved ratio falls,
+ *   rather than the backlog growing without bound.
+ *
+ *   Times are in nanoseconds, as from Coercri::Timer::getNsec().
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef FRAME_SCHEDULER_HPP
+#define FRAME_SCHEDULER_HPP
+
+class FrameScheduler {
+public:
+    FrameScheduler();
+
+    // Forgets the accumulated time (e.g. after a reset, or after
+    // running the CPU simulation for a while).
+    void reset(unsigned long long now);
+
+    // Call at the start of each frame. time_ratio is the requested
+    // simulated seconds per real second.
+    void beginFrame(unsigned long long now, float time_ratio);
+
+    // Whether to run another timestep of the given (simulated) length this frame.
+    bool wantStep(float timestep) const;
+
+    // Call after running each timestep.
+    void stepDone(float timestep);
+
+    // Call after the last step of the frame, with the time spent running
+    // them. (This should include any readback that waits for the GPU to
+    // finish the steps, otherwise the cost is underestimated.)
+    void endSteps(unsigned long long elapsed);
+
+    // Whether to draw this frame. Call after endSteps.
+    bool wantRender(unsigned long long now) const;
+    void rendered(unsigned long long now) { last_render = now; }
+
+    // Simulated seconds per real second actually achieved recently.
+    float getTimeRatio() const { return achieved_ratio; }
+
+    // Estimated cost of one timestep.
+    double getStepNs() const { return step_ns; }
+
+private:
+    double owed;                     // simulated seconds not yet stepped
+    unsigned long long last_frame, last_render;
+    int frame_steps;                 // steps run so far this frame
+    float last_timestep;
+
+    double step_ns;                  // smoothed cost per step
+    unsigned long long sample_ns;    // step time since step_ns was last updated
+    int sample_steps;
+
+    unsigned long long ratio_start;  // start of the current achieved_ratio period
+    double ratio_sim_time;           // simulated time so far in that period
+    float achieved_ratio;
+};
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ * FILE:
+ *   gpu_profiler.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "gpu_profiler.hpp"
+#include "perf_counters.hpp"
+#include "profiler.hpp"
+
+#include "coercri/dx11/core/dx_error.hpp"
+
+namespace {
+    void CreateQuery(ID3D11Device *device, D3D11_QUERY type, Coercri::ComPtrWrapper<ID3D11Query> &out)
+    {
+        D3D11_QUERY_DESC qd;
+        qd.Query = type;
+        qd.MiscFlags = 0;
+
+        ID3D11Query *query;
+        HRESULT hr = device->CreateQuery(&qd, &query);
+        if (FAILED(hr)) {
+            throw Coercri::DXError("Failed to create timestamp query", hr);
+        }
+        out.reset(query);
+    }
+}
+
+GpuProfiler::GpuProfiler(ID3D11Device *device, ID3D11DeviceContext *context_)
+    : context(context_), current(0), in_frame(false)
+{
+    for (int f = 0; f < NUM_FRAMES; ++f) {
+        Frame &frame = frames[f];
+        CreateQuery(device, D3D11_QUERY_TIMESTAMP_DISJOINT, frame.disjoint_query);
+        CreateQuery(device, D3D11_QUERY_TIMESTAMP, frame.start_query);
+        for (int z = 0; z < MAX_ZONES; ++z) {
+            frame.zones[z].name = 0;
+            CreateQuery(device, D3D11_QUERY_TIMESTAMP, frame.zones[z].start_query);
+            CreateQuery(device, D3D11_QUERY_TIMESTAMP, frame.zones[z].end_query);
+        }
+        frame.num_zones = 0;
+        frame.cpu_start = 0;
+        frame.pending = false;
+    }
+}
+
+void GpuProfiler::beginFrame()
+{
+    if (in_frame) endFrame();   // previous frame was abandoned part way through
+    ++g_perf_counters.frames;
+    if (!ProfilerEnabled() && !PerfCountersEnabled()) return;
+
+    Frame &frame = frames[current];
+
+    // This slot was last used NUM_FRAMES frames ago, so its results are
+    // normally available by now. If not, they are dropped rather than waited for.
+    if (frame.pending) collect(current);
+
+    context->Begin(frame.disjoint_query.get());
+    context->End(frame.start_query.get());
+    frame.cpu_start = ProfilerTicks();
+    frame.num_zones = 0;
+    in_frame = true;
+}
+
+void GpuProfiler::endFrame()
+{
+    if (!in_frame) return;
+    context->End(frames[current].disjoint_query.get());
+    frames[current].pending = true;
+    current = (current + 1) % NUM_FRAMES;
+    in_frame = false;
+}
+
+int GpuProfiler::begin(const char *name)
+{
+    if (!in_frame) return -1;
+    Frame &frame = frames[current];
+    if (frame.num_zones == MAX_ZONES) return -1;
+
+    Zone &zone = frame.zones[frame.num_zones];
+    zone.name = name;
+    context->End(zone.start_query.get());
+    return frame.num_zones++;
+}
+
+void GpuProfiler::end(int id)
+{
+    if (id < 0 || !in_frame) return;
+    context->End(frames[current].zones[id].end_query.get());
+}
+
+void GpuProfiler::collect(int slot)
+{
+    Frame &frame = frames[slot];
+    frame.pending = false;
+
+    D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+    if (context->GetData(frame.disjoint_query.get(), &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK
+    || disjoint.Disjoint || disjoint.Frequency == 0) {
+        return;
+    }
+
+    UINT64 gpu_start;
+    if (context->GetData(frame.start_query.get(), &gpu_start, sizeof(gpu_start), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK) {
+        return;
+    }
+
+    // The GPU clock is not related to the CPU clock, so we line up the start-of-frame
+    // timestamp with the CPU time at which it was issued. GPU events therefore appear
+    // slightly early in the trace (by the submission latency), but their durations,
+    // and their spacing within a frame, are exact.
+    const double ns_per_tick = 1.0e9 / double(disjoint.Frequency);
+    const bool record = ProfilerEnabled();
+
+    for (int z = 0; z < frame.num_zones; ++z) {
+        const Zone &zone = frame.zones[z];
+        UINT64 t0, t1;
+        if (context->GetData(zone.start_query.get(), &t0, sizeof(t0), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK
+        || context->GetData(zone.end_query.get(), &t1, sizeof(t1), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK
+        || t0 < gpu_start || t1 < t0) {
+            continue;
+        }
+        const unsigned long long start = (unsigned long long)(double(t0 - gpu_start) * ns_per_tick);
+        const unsigned long long end = (unsigned long long)(double(t1 - gpu_start) * ns_per_tick);
+
+        if (record) ProfilerRecordGpu(zone.name, frame.cpu_start + start, frame.cpu_start + end);
+
+        const int timer = PerfTimerForZone(zone.name);
+        if (timer >= 0) {
+            g_perf_counters.gpu_ns[timer] += end - start;
+            ++g_perf_counters.gpu_count[timer];
+        }
+    }
+}
@@ -0,0 +1,88 @@
+/*
+ * FILE:
+ *   gpu_profiler.hpp
+ *
+ * PURPOSE:
+ *   GPU side of the profiler (see profiler.hpp). Brackets regions of
+ *   D3D11 work with timestamp queries and, a few frames later (so
+ *   that the CPU never waits for the GPU), converts the results to
+ *   profiler ticks and records them on the "GPU" track of the trace.
+ *
+ *   Also feeds the GPU timings on the perf tab (see perf_counters.hpp).
+ *   Does nothing unless ProfilerEnabled() or PerfCountersEnabled().
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef GPU_PROFILER_HPP
+#define GPU_PROFILER_HPP
+
+#include "coercri/dx11/core/com_ptr_wrapper.hpp"
+
+#include <d3d11.h>
+#ifdef max
+#undef max
+#endif
+#ifdef min
+#undef min
+#endif
+
+class GpuProfiler {
+public:
+    GpuProfiler(ID3D11Device *device, ID3D11DeviceContext *context);
+
+    // Call at the start and end of each frame. beginFrame also collects
+    // the results of an earlier frame, if they are ready.
+    void beginFrame();
+    void endFrame();
+
+    // Bracket a region of GPU work. "name" must be a string literal (or
+    // otherwise static). begin returns an id to pass to end, or -1 if the
+    // region is not being timed.
+    int begin(const char *name);
+    void end(int id);
+
+private:
+    void collect(int slot);
+
+private:
+    enum { NUM_FRAMES = 4, MAX_ZONES = 64 };
+
+    struct Zone {
+        const char *name;
+        Coercri::ComPtrWrapper<ID3D11Query> start_query, end_query;
+    };
+
+    struct Frame {
+        Coercri::ComPtrWrapper<ID3D11Query> disjoint_query, start_query;
+        Zone zones[MAX_ZONES];
+        int num_zones;
+        unsigned long long cpu_start;   // profiler ticks when start_query was issued
+        bool pending;
+    };
+
+    ID3D11DeviceContext *context;
+    Frame frames[NUM_FRAMES];
+    int current;      // index into frames
+    bool in_frame;    // true between beginFrame and endFrame (when enabled)
+};
+
+class GpuProfileScope {
+public:
+    GpuProfileScope(GpuProfiler &p, const char *name) : profiler(p), id(p.begin(name)) { }
+    ~GpuProfileScope() { profiler.end(id); }
+
+private:
+    GpuProfileScope(const GpuProfileScope &);
+    void operator=(const GpuProfileScope &);
+
+    GpuProfiler &profiler;
+    int id;
+};
+
+#endif
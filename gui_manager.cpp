@@ -15,26 +15,20 @@
 
 #include "settings.hpp"
 #include "gui_manager.hpp"
+#include "presets.hpp"
+#include "settings_queue.hpp"
+#include "value_label.hpp"
 
+#include "coercri/dx11/gfx/dx11_render_texture.hpp"
 #include "coercri/gfx/bitmap_font.hpp"
+#include "coercri/gfx/gfx_context.hpp"
 #include "coercri/gfx/load_bmp.hpp"
 
 #include <cmath>
+#include <cstring>
 #include <fstream>
-#include <sstream>
 
 namespace {
-    // Constantly creating and destroying ostringstream objects seems v. bad
-    // for performance, so we create a global one and re-use it
-    std::ostringstream g_stringstream;
-    void SetLabelTxt(gcn::Label &label, double value)
-    {
-        g_stringstream.str("");
-        g_stringstream << value;
-        label.setCaption(g_stringstream.str());
-        label.adjustSize();
-    }
-    
     double RealToSlider(const Setting &setting, double value)
     {
         /*
@@ -76,152 +70,25 @@ namespace {
         std::vector<std::string> elts;
     };
 
-
-
-    void SetupValley()
-    {
-        SetSettingD("mesh_size_x", 300);
-        SetSettingD("mesh_size_y", 900);
-        SetSettingD("solid_walls", 0);
-        SetSettingD("inflow_width", 4);
-        SetSettingD("inflow_height", 1);
-        SetSettingD("gravity", 10);
-        SetSettingD("friction", 0.02);
-        SetSettingD("theta", 1.1);
-        SetSettingD("max_cfl_number", 0.2);
-        SetSettingD("timesteps_per_frame", 4);
-        SetSettingD("time_acceleration", 1);
-        SetSettingD("clip_camera", 1);
-        SetSettingD("valley_length", 300);
-        SetSettingD("valley_width", 100);
-        SetSettingD("valley_wall_height", 6);
-        SetSettingD("gradient_top", 0.1);
-        SetSettingD("gradient_bottom", 0.02);
-        SetSettingD("valley_shape", 2);
-        SetSettingD("channel_depth_top", 2);
-        SetSettingD("channel_depth_bottom", 2);
-        SetSettingD("channel_width_top", 10);
-        SetSettingD("channel_width_bottom", 10);
-        SetSettingD("dam_on", 1);
-        SetSettingD("dam_height", 10);
-        SetSettingD("dam_position", 150);
-        SetSettingD("dam_middle_width", 4);
-        SetSettingD("dam_middle_height", -5);
-        SetSettingD("dam_thickness", 8);
-        SetSettingD("meander_wavelength", 100);
-        SetSettingD("meander_amplitude", 8);
-        SetSettingD("meander_fractal", 0.3);
-        SetSettingD("use_sea_level", 0);
-        SetSettingD("sea_level", 10);
-        SetSettingD("sa1", 0.3);
-        SetSettingD("sk1", 0.224);
-        SetSettingD("sk1_dir", 5.18);
-        SetSettingD("so1", 1);
-        SetSettingD("sa2", 0.25);
-        SetSettingD("sk2", 0.201);
-        SetSettingD("sk2_dir", 4.83);
-        SetSettingD("so2", 1.07);
-        SetSettingD("sa3", 0.1);
-        SetSettingD("sk3", 0.3);
-        SetSettingD("sk3_dir", 4.9);
-        SetSettingD("so3", 4);
-        SetSettingD("sa4", 0);
-        SetSettingD("sk4", 0);
-        SetSettingD("sk4_dir", 0);
-        SetSettingD("s04", 0);
-        SetSettingD("fov", 45);
-        SetSettingD("sun_alt", 25);
-        SetSettingD("sun_az", 300);
-        SetSettingD("ambient", 0.75);
-        SetSettingD("fresnel_coeff", 0.983);
-        SetSettingD("fresnel_exponent", 5);
-        SetSettingD("specular_intensity", 1);
-        SetSettingD("specular_exponent", 15);
-        SetSettingD("refractive_index", 1.33);
-        SetSettingD("attenuation_1", 0.08);
-        SetSettingD("attenuation_2", 0.08);
-        SetSettingD("deep_r", 0.05);
-        SetSettingD("deep_g", 0.1);
-        SetSettingD("deep_b", 0.2);
-    }
-
-    void SetupValleyHires()
-    {
-        SetupValley();
-        SetSettingD("mesh_size_x", 600);
-        SetSettingD("mesh_size_y", 1200);
-        SetSettingD("inflow_width", 2);
-        SetSettingD("timesteps_per_frame", 10);
-        SetSettingD("valley_length", 100);
-        SetSettingD("valley_width", 50);
-        SetSettingD("channel_width_top", 5);
-        SetSettingD("channel_width_bottom", 5);
-        SetSettingD("dam_position", 50);
-        SetSettingD("dam_height", 7);
-        SetSettingD("dam_middle_height", -3);
-        SetSettingD("dam_thickness", 4);
-    }
-
-    void SetupSea()
-    {
-        SetupValley();
-        SetSettingD("mesh_size_x", 600);
-        SetSettingD("mesh_size_y", 300);
-        SetSettingD("inflow_width", 0);
-        SetSettingD("inflow_height", 0);
-        SetSettingD("valley_length", 300);
-        SetSettingD("valley_width", 600);
-        SetSettingD("valley_wall_height", 0);
-        SetSettingD("channel_depth_top", 0);
-        SetSettingD("channel_depth_bottom", 0);
-        SetSettingD("channel_width_top", 0);
-        SetSettingD("channel_width_bottom", 0);
-        SetSettingD("dam_on", 0);
-        SetSettingD("use_sea_level", 1);
-        SetSettingD("sea_level", 8);
-        SetSettingD("attenuation_2", 0.5);
-        SetSettingD("deep_r", 0.01);
-        SetSettingD("deep_g", 0.08);
-        SetSettingD("deep_b", 0.1);
-    }
-
-    void SetupFlatPlane()
-    {
-        SetupValley();
-        SetSettingD("mesh_size_x", 400);
-        SetSettingD("mesh_size_y", 400);
-        SetSettingD("solid_walls", 1);
-        SetSettingD("inflow_width", 0);
-        SetSettingD("inflow_height", 0);
-        SetSettingD("valley_length", 200);
-        SetSettingD("valley_width", 200);
-        SetSettingD("valley_wall_height", 0);
-        SetSettingD("gradient_top", 0);
-        SetSettingD("gradient_bottom", 0);
-        SetSettingD("channel_depth_top", 0);
-        SetSettingD("channel_depth_bottom", 0);
-        SetSettingD("channel_width_top", 0);
-        SetSettingD("channel_width_bottom", 0);
-        SetSettingD("dam_on", 0);
-        SetSettingD("clip_camera", 0);
-    }
 }
 
-GuiManager::GuiManager(boost::shared_ptr<Coercri::Window> window_,
+GuiManager::GuiManager(Coercri::DX11GfxDriver &gfx_driver_,
+                       boost::shared_ptr<Coercri::Window> window_,
                        boost::shared_ptr<Coercri::Timer> timer_,
                        int gui_width_)
-    : gui(new gcn::Gui),
+    : gfx_driver(gfx_driver_),
+      gui(new gcn::Gui),
       window(window_),
       listener(window_, gui, timer_),
       gui_width(gui_width_),
       last_time(0), frame_count(-999),
       timer(timer_),
       gui_shown(true),
+      perf_tab_index(-1),
       cam_reset(false), cam_x(0), cam_y(0), cam_z(0), cam_pitch(0), cam_yaw(0)
 {
     // load a font
-    std::ifstream str("knights_sfont.bmp", std::ios::in | std::ios::binary);
-    boost::shared_ptr<Coercri::PixelArray> parr = Coercri::LoadBMP(str);
+    boost::shared_ptr<Coercri::PixelArray> parr = Coercri::LoadBMPFile("knights_sfont.bmp");
     font.reset(new Coercri::BitmapFont(parr));
     cg_font.reset(new Coercri::CGFont(font));
     gcn::Widget::setGlobalFont(cg_font.get());
@@ -236,7 +103,7 @@ GuiManager::GuiManager(boost::shared_ptr<Coercri::Window> window_,
     // Default settings
     // note: duplicated code (see action())
     SetupValley();
-    g_reset_type = R_VALLEY;
+    g_settings_queue.reset(R_VALLEY);
     cam_reset = true;
     cam_x = -90;
     cam_y = 280;
@@ -318,6 +185,7 @@ void GuiManager::createGui()
         if (setting->type == S_NEW_TAB && setting->name[0] != 0) {
             boost::shared_ptr<gcn::Container> current_tab(new gcn::Container);
             current_tab->setSize(container->getWidth(), container->getHeight());
+            if (std::strcmp(setting->name, "perf") == 0) perf_tab_index = int(tabs.size());
             tabs.push_back(current_tab);
             tabbed_area->addTab(setting->name, current_tab.get());
         }
@@ -366,10 +234,11 @@ void GuiManager::createGui()
         check_boxes.push_back(checkbox);
         dropdowns.push_back(dropdown);
 
-        boost::shared_ptr<gcn::Label> val_lbl;
+        boost::shared_ptr<ValueLabel> val_lbl;
         if (setting->type == S_LABEL || setting->type == S_SLIDER || setting->type == S_SLIDER_MULT_4 || setting->type == S_SLIDER_INT) {
-            val_lbl.reset(new gcn::Label);
-            SetLabelTxt(*val_lbl, setting->value);
+            val_lbl.reset(new ValueLabel);
+            val_lbl->setDirtyRegion(&dirty_region, container.get());
+            val_lbl->setValue(setting->value);
         }
         values.push_back(val_lbl);
         
@@ -468,25 +337,71 @@ void GuiManager::resize()
     } else {
         gui->setTop(show_gui_container.get());
     }
+
+    dirty_region.addRectangle(getPanelRect());
+}
+
+Coercri::Rectangle GuiManager::getPanelRect() const
+{
+    return Coercri::Rectangle(container->getX(), container->getY(), container->getWidth(), container->getHeight());
 }
 
 void GuiManager::logic()
 {
+    // (any input invalidates the whole window, and so the whole panel; see updatePanel)
     listener.processInput();
 
     // reset all value labels (every few frames)
     if (frame_count == 0) {
         for (int i = 0; i < int(sliders.size()); ++i) {
             if (values[i]) {
-                SetLabelTxt(*values[i], g_settings[i].value);
+                values[i]->setValue(g_settings[i].value);
             }
         }
     }
 }
 
+void GuiManager::updatePanel()
+{
+    if (!gui_shown) {
+        dirty_region.clear();   // (resize() redraws everything when it is shown again)
+        return;
+    }
+
+    int win_width, win_height;
+    window->getSize(win_width, win_height);
+    if (!panel_cache || panel_cache->getWidth() != win_width || panel_cache->getHeight() != win_height) {
+        panel_cache.reset();
+        if (win_width <= 0 || win_height <= 0) return;
+        panel_cache.reset(new Coercri::DX11RenderTexture(gfx_driver, win_width, win_height));
+        dirty_region.addRectangle(getPanelRect());
+    }
+
+    dirty_region.addRegion(window->getInvalidRegion());
+    if (dirty_region.isEmpty()) return;
+
+    const Coercri::Rectangle panel = getPanelRect();
+    Coercri::Region region;
+    for (Coercri::Region::const_iterator it = dirty_region.begin(); it != dirty_region.end(); ++it) {
+        region.addRectangle(Coercri::IntersectRects(*it, panel));
+    }
+    dirty_region.clear();
+    if (region.isEmpty()) return;
+
+    std::auto_ptr<Coercri::GfxContext> gc = panel_cache->createGfxContext();
+    for (Coercri::Region::const_iterator it = region.begin(); it != region.end(); ++it) {
+        gc->fillRectangle(*it, Coercri::Color(0, 0, 0));
+    }
+    listener.draw(*gc, region);
+}
+
 void GuiManager::draw(Coercri::GfxContext &gc)
 {
-    listener.draw(gc);
+    if (gui_shown && panel_cache) {
+        panel_cache->copyTo(gc, getPanelRect());
+    } else {
+        listener.draw(gc);
+    }
 
     if (frame_count < 0) {
         frame_count = 0;
@@ -502,7 +417,7 @@ void GuiManager::draw(Coercri::GfxContext &gc)
             frame_count = 0;
             last_time = time_now;
 
-            SetSetting("fps", fps);
+            SetSetting(SH_FPS, fps);
         }
     }
 }
@@ -515,31 +430,30 @@ void GuiManager::action(const gcn::ActionEvent &e)
 
     for (size_t i = 0; i < sliders.size(); ++i) {
         if (sliders[i].get() == slid) {
-            g_settings[i].value = SliderToReal(g_settings[i], slid->getValue());
-            g_reset_type = std::max(g_reset_type, g_settings[i].reset_type);
+            double value = SliderToReal(g_settings[i], slid->getValue());
 
             if (g_settings[i].type == S_SLIDER_MULT_4) {
-                int val = int(g_settings[i].value + 0.5);
+                int val = int(value + 0.5);
                 val = (val + 3) & (~3);
-                g_settings[i].value = double(val);
+                value = double(val);
             } else if (g_settings[i].type == S_SLIDER_INT) {
-                int val = int(g_settings[i].value + 0.5);
-                g_settings[i].value = double(val);
+                int val = int(value + 0.5);
+                value = double(val);
             }
-            
-            SetLabelTxt(*values[i], g_settings[i].value);
+
+            // (g_settings[i] itself changes when the main loop next updates the queue)
+            g_settings_queue.set(int(i), value);
+            values[i]->setValue(value);
             break;
         }
 
         if (check_boxes[i].get() == cb) {
-            g_settings[i].value = cb->isSelected() ? 1.0 : 0.0;
-            g_reset_type = std::max(g_reset_type, g_settings[i].reset_type);
+            g_settings_queue.set(int(i), cb->isSelected() ? 1.0 : 0.0);
             break;
         }
 
         if (dropdowns[i].get() == dd) {
-            g_settings[i].value = dd->getSelected();
-            g_reset_type = std::max(g_reset_type, g_settings[i].reset_type);
+            g_settings_queue.set(int(i), dd->getSelected());
             break;
         }
     }
@@ -551,55 +465,69 @@ void GuiManager::action(const gcn::ActionEvent &e)
         gui_shown = true;
         resize();
     } else if (e.getSource() == reset_simulation_button.get()) {
-        g_reset_type = R_MESH;
+        g_settings_queue.reset(R_MESH);
     } else if (e.getSource() == preset_button_valley.get()) {
         // note: code duplicated in ctor
-        SetupValley();
-        g_reset_type = R_VALLEY;
+        loadPreset(SetupValley, R_VALLEY);
         cam_reset = true;
         cam_x = -90;
         cam_y = 280;
         cam_z = 40;
         cam_pitch = -0.2f;
         cam_yaw = 2.7f;
-        resetSliders();
     } else if (e.getSource() == preset_button_valley_hires.get()) {
-        SetupValleyHires();
-        g_reset_type = R_VALLEY;
+        loadPreset(SetupValleyHires, R_VALLEY);
         cam_reset = true;
         cam_x = -7;
         cam_y = 20;
         cam_z = 7;
         cam_pitch = -0.3f;
         cam_yaw = 0.0f;
-        resetSliders();
     } else if (e.getSource() == preset_button_sea.get()) {
-        SetupSea();
-        g_reset_type = R_SEA;
+        loadPreset(SetupSea, R_SEA);
         cam_reset = true;
         cam_x = -350;
         cam_y = -10;
         cam_z = 50;
         cam_pitch = -0.2f;
         cam_yaw = 1.1f;
-        resetSliders();
     } else if (e.getSource() == preset_button_flat.get()) {
-        SetupFlatPlane();
-        g_reset_type = R_SQUARE;
+        loadPreset(SetupFlatPlane, R_SQUARE);
         cam_reset = true;
         cam_x = -130;
         cam_y = -30;
         cam_z = 40;
         cam_pitch = -0.2f;
         cam_yaw = 0.785f;
-        resetSliders();
     }
 }
 
 
+// Queues all the preset's values as edits, as the terrain and mesh
+// settings must not change until they have been rebuilt.
+void GuiManager::loadPreset(void (*setup)(), ResetType reset_type)
+{
+    std::vector<double> old_values(sliders.size());
+    for (size_t i = 0; i < sliders.size(); ++i) old_values[i] = g_settings[i].value;
+
+    setup();
+    resetSliders();
+
+    g_settings_queue.clear();   // (edits not yet applied would override the preset)
+    for (size_t i = 0; i < sliders.size(); ++i) {
+        if (sliders[i] || check_boxes[i] || dropdowns[i]) {
+            g_settings_queue.set(int(i), g_settings[i].value);
+        }
+        g_settings[i].value = old_values[i];
+    }
+    g_settings_queue.reset(reset_type);
+}
+
 bool GuiManager::getCameraReset(float &x, float &y, float &z, float &pitch, float &yaw)
 {
-    if (cam_reset) {
+    // (the camera is not moved to the preset's position before its terrain is ready,
+    // otherwise it would be clipped to the old one)
+    if (cam_reset && !g_settings_queue.isRebuildPending()) {
         x = cam_x;
         y = cam_y;
         z = cam_z;
@@ -618,7 +546,7 @@ void GuiManager::resetSliders()
         Setting &s = g_settings[i];
         if (s.type == S_SLIDER || s.type == S_SLIDER_MULT_4 || s.type == S_SLIDER_INT) {
             sliders[i]->setValue(RealToSlider(s, s.value));
-            SetLabelTxt(*values[i], s.value);
+            values[i]->setValue(s.value);
         } else if (s.type == S_CHECKBOX) {
             check_boxes[i]->setSelected(s.value != 0);
         }
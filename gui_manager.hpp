@@ -5,6 +5,11 @@
  * PURPOSE:
  *   Class that takes care of the GUI.
  *
+ *   While it is shown, the GUI panel is drawn into an offscreen copy,
+ *   and just copied to the window each frame. Only the parts that
+ *   have changed (value labels, or everything after any input) are
+ *   redrawn into the copy, so an idle panel costs almost nothing.
+ *
  * AUTHOR:
  *   Stephen Thompson <stephen@solarflare.org.uk>
  *
@@ -19,18 +24,30 @@
 #ifndef GUI_MANAGER_HPP
 #define GUI_MANAGER_HPP
 
+#include "settings.hpp"
+
 #include "coercri/gcn/cg_font.hpp"
 #include "coercri/gcn/cg_listener.hpp"
 #include "coercri/gfx/font.hpp"
+#include "coercri/gfx/region.hpp"
 #include "coercri/gfx/window.hpp"
 #include "coercri/timer/timer.hpp"
 
+#include "boost/scoped_ptr.hpp"
 #include "boost/shared_ptr.hpp"
 
+namespace Coercri {
+    class DX11GfxDriver;
+    class DX11RenderTexture;
+}
+
+class ValueLabel;
+
 class GuiManager : public gcn::ActionListener {
 public:
 
-    GuiManager(boost::shared_ptr<Coercri::Window> window,
+    GuiManager(Coercri::DX11GfxDriver &gfx_driver_,
+               boost::shared_ptr<Coercri::Window> window,
                boost::shared_ptr<Coercri::Timer> timer_,
                int gui_width_);
     
@@ -40,6 +57,9 @@ public:
     void logic();
 
     // Caller should call draw() from main loop, whenever the window is invalid.
+    // updatePanel() must be called first, before the GfxContext is created
+    // (it needs a GfxContext of its own).
+    void updatePanel();
     void draw(Coercri::GfxContext &gc);
 
     // this should be called (by the main loop) whenever the window changes size
@@ -49,6 +69,9 @@ public:
 
     bool isGuiShown() const { return gui_shown; }
 
+    // true if the "perf" tab is the one currently showing
+    bool isPerfTabShown() const { return gui_shown && tabbed_area->getSelectedTabIndex() == perf_tab_index; }
+
     // communicate camera motion back to main loop (HACK)
     bool getCameraReset(float &x, float &y, float &z, float &pitch, float &yaw);
     
@@ -67,6 +90,8 @@ private:
         virtual void onCookedKey(Coercri::CookedKey ck, int ch, Coercri::KeyModifier mods) { }
     };
     
+    Coercri::DX11GfxDriver &gfx_driver;
+
     boost::shared_ptr<Coercri::Font> font;
     boost::shared_ptr<Coercri::CGFont> cg_font;
     boost::shared_ptr<Coercri::Timer> timer;
@@ -87,14 +112,18 @@ private:
     std::vector<boost::shared_ptr<gcn::Slider> > sliders;
     std::vector<boost::shared_ptr<gcn::CheckBox> > check_boxes;
     std::vector<boost::shared_ptr<gcn::DropDown> > dropdowns;
-    std::vector<boost::shared_ptr<gcn::Label> > values;
+    std::vector<boost::shared_ptr<ValueLabel> > values;
 
     std::vector<boost::shared_ptr<gcn::ListModel> > list_models;
 
     boost::shared_ptr<gcn::TabbedArea> tabbed_area;
     std::vector<boost::shared_ptr<gcn::Container> > tabs;
+    int perf_tab_index;
     int max_y;
 
+    boost::scoped_ptr<Coercri::DX11RenderTexture> panel_cache;
+    Coercri::Region dirty_region;   // parts of panel_cache that are out of date (window coordinates)
+
     unsigned int last_time;
     int frame_count;
 
@@ -104,6 +133,8 @@ private:
     // private methods
     void createGui();
     void resetSliders();
+    void loadPreset(void (*setup)(), ResetType reset_type);
+    Coercri::Rectangle getPanelRect() const;
     
     // prevent copying
     GuiManager(const GuiManager &);
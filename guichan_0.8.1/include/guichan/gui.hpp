@@ -45,12 +45,12 @@
 #define GCN_GUI_HPP
 
 #include <list>
-#include <deque>
 
 #include "guichan/keyevent.hpp"
 #include "guichan/mouseevent.hpp"
 #include "guichan/mouseinput.hpp"
 #include "guichan/platform.hpp"
+#include "guichan/smallvector.hpp"
 
 namespace gcn
 {
@@ -486,10 +486,10 @@ namespace gcn
         int mLastMouseDragButton;
 
         /**
-         * Holds a stack with all the widgets with the mouse.
-         * Used to properly distribute mouse events.
+         * Holds a stack with all the widgets with the mouse, innermost
+         * first. Used to properly distribute mouse events.
          */
-        std::deque<Widget*> mWidgetWithMouseQueue;
+        SmallVector<Widget*, 16> mWidgetWithMouseQueue;
     };
 }
 
@@ -0,0 +1,199 @@
+/*      _______   __   __   __   ______   __   __   _______   __   __
+ *     / _____/\ / /\ / /\ / /\ / ____/\ / /\ / /\ / ___  /\ /  |\/ /\
+ *    / /\____\// / // / // / // /\___\// /_// / // /\_/ / // , |/ / /
+ *   / / /__   / / // / // / // / /    / ___  / // ___  / // /| ' / /
+ *  / /_// /\ / /_// / // / // /_/_   / / // / // /\_/ / // / |  / /
+ * /______/ //______/ //_/ //_____/\ /_/ //_/ //_/ //_/ //_/ /|_/ /
+ * \______\/ \______\/ \_\/ \_____\/ \_\/ \_\/ \_\/ \_\/ \_\/ \_\/
+ *
+ * Copyright (c) 2004 - 2008 Olof Naessn and Per Larsson
+ *
+ *
+ * Per Larsson a.k.a finalman
+ * Olof Naessn a.k.a jansem/yakslem
+ *
+ * Visit: http://guichan.sourceforge.net
+ *
+ * License: (BSD)
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of Guichan nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GCN_SMALLVECTOR_HPP
+#define GCN_SMALLVECTOR_HPP
+
+#include <cstring>
+
+namespace gcn
+{
+    /**
+     * A vector of plain values (in Guichan, pointers) that keeps its
+     * first N elements inside the object itself, and only allocates
+     * once it grows past that. Once grown, the capacity is kept, so
+     * it never allocates again at that size.
+     *
+     * Used for the listener lists walked on every input event, and for
+     * the Gui's "widget with mouse" queue, so that dispatching an event
+     * does not touch the heap.
+     *
+     * NOTE: T must be safe to copy with memcpy (e.g. a pointer).
+     */
+    template <typename T, unsigned int N>
+    class SmallVector
+    {
+    public:
+        typedef T* iterator;
+        typedef const T* const_iterator;
+
+        /**
+         * Constructor.
+         */
+        SmallVector()
+                : mData(mInline),
+                  mSize(0),
+                  mCapacity(N)
+        {
+        }
+
+        /**
+         * Destructor.
+         */
+        ~SmallVector()
+        {
+            if (mData != mInline)
+            {
+                delete[] mData;
+            }
+        }
+
+        unsigned int size() const { return mSize; }
+        bool empty() const { return mSize == 0; }
+
+        T& operator[](unsigned int i) { return mData[i]; }
+        const T& operator[](unsigned int i) const { return mData[i]; }
+
+        iterator begin() { return mData; }
+        iterator end() { return mData + mSize; }
+        const_iterator begin() const { return mData; }
+        const_iterator end() const { return mData + mSize; }
+
+        /**
+         * Adds an element at the end.
+         */
+        void push_back(const T& value)
+        {
+            insert(mSize, value);
+        }
+
+        /**
+         * Inserts an element before position i (0 to size()).
+         */
+        void insert(unsigned int i, const T& value)
+        {
+            if (mSize == mCapacity)
+            {
+                grow();
+            }
+
+            std::memmove(mData + i + 1, mData + i, (mSize - i) * sizeof(T));
+            mData[i] = value;
+            ++mSize;
+        }
+
+        /**
+         * Removes the element at position i.
+         */
+        void erase(unsigned int i)
+        {
+            std::memmove(mData + i, mData + i + 1, (mSize - i - 1) * sizeof(T));
+            --mSize;
+        }
+
+        /**
+         * Removes all elements equal to value (as std::list::remove).
+         */
+        void remove(const T& value)
+        {
+            unsigned int j = 0;
+            for (unsigned int i = 0; i < mSize; ++i)
+            {
+                if (!(mData[i] == value))
+                {
+                    mData[j++] = mData[i];
+                }
+            }
+            mSize = j;
+        }
+
+        /**
+         * Gets the position of the first element equal to value.
+         *
+         * @return The position, or size() if there is no such element.
+         */
+        unsigned int find(const T& value) const
+        {
+            unsigned int i = 0;
+            while (i < mSize && !(mData[i] == value))
+            {
+                ++i;
+            }
+            return i;
+        }
+
+        /**
+         * Removes all elements. The capacity is kept.
+         */
+        void clear()
+        {
+            mSize = 0;
+        }
+
+    private:
+        void grow()
+        {
+            T* data = new T[mCapacity * 2];
+            std::memcpy(data, mData, mSize * sizeof(T));
+
+            if (mData != mInline)
+            {
+                delete[] mData;
+            }
+
+            mData = data;
+            mCapacity *= 2;
+        }
+
+        // not copyable
+        SmallVector(const SmallVector&);
+        SmallVector& operator=(const SmallVector&);
+
+        T mInline[N];
+        T* mData;
+        unsigned int mSize;
+        unsigned int mCapacity;
+    };
+}
+
+#endif // end GCN_SMALLVECTOR_HPP
@@ -49,6 +49,7 @@
 
 #include "guichan/color.hpp"
 #include "guichan/rectangle.hpp"
+#include "guichan/smallvector.hpp"
 
 namespace gcn
 {
@@ -812,13 +813,23 @@ namespace gcn
          */
         virtual Widget *getWidgetAt(int x, int y);
 
+        /**
+         * Typdef.
+         */
+        typedef SmallVector<MouseListener*, 4> MouseListenerList;
+
+        /**
+         * Typdef.
+         */
+        typedef SmallVector<KeyListener*, 4> KeyListenerList;
+
         /**
          * Gets the mouse listeners of the widget.
          *
          * @return The mouse listeners of the widget.
          * @since 0.6.0
          */
-        virtual const std::list<MouseListener*>& _getMouseListeners();
+        virtual const MouseListenerList& _getMouseListeners();
 
         /**
          * Gets the key listeners of the widget.
@@ -826,7 +837,18 @@ namespace gcn
          * @return The key listeners of the widget.
          * @since 0.6.0
          */
-        virtual const std::list<KeyListener*>& _getKeyListeners();
+        virtual const KeyListenerList& _getKeyListeners();
+
+        /**
+         * Gets a counter that changes whenever a mouse or key listener
+         * is added to or removed from any widget, or any widget is
+         * deleted. The Gui walks the listener lists directly while
+         * dispatching an event, and uses this to notice when a listener
+         * has changed them.
+         *
+         * @return The listener generation.
+         */
+        static unsigned int _getListenerGeneration() { return mListenerGeneration; }
 
         /**
          * Gets the focus listeners of the widget.
@@ -986,11 +1008,6 @@ namespace gcn
          */
         void distributeShownEvent();
 
-        /**
-         * Typdef.
-         */
-        typedef std::list<MouseListener*> MouseListenerList;
-
         /**
          * Typdef.
          */
@@ -1001,11 +1018,6 @@ namespace gcn
          */
         MouseListenerList mMouseListeners;
 
-        /**
-         * Typdef.
-         */
-        typedef std::list<KeyListener*> KeyListenerList;
-
         /**
          * Holds the key listeners of the widget.
          */
@@ -1174,6 +1186,11 @@ namespace gcn
          * Holds a list of all instances of widgets.
          */
         static std::list<Widget*> mWidgets;
+
+        /**
+         * Holds the listener generation (see _getListenerGeneration).
+         */
+        static unsigned int mListenerGeneration;
     };
 }
 
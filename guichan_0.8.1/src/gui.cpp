@@ -60,6 +60,32 @@
 
 namespace gcn
 {
+    namespace
+    {
+        /**
+         * Gets where to carry on walking a widget's listeners, after the
+         * listener at position next - 1 has added or removed listeners.
+         * Listeners that have been removed are not called; listeners that
+         * have been added at the end are.
+         */
+        template <typename ListenerList, typename Listener>
+        unsigned int resumePosition(const ListenerList& listeners,
+                                    Listener* listener,
+                                    unsigned int next)
+        {
+            const unsigned int position = listeners.find(listener);
+
+            if (position < listeners.size())
+            {
+                return position + 1;
+            }
+
+            // The listener removed itself, so the next one has moved
+            // down into its place.
+            return next - 1;
+        }
+    }
+
     Gui::Gui()
             :mTop(NULL),
              mGraphics(NULL),
@@ -339,7 +365,7 @@ namespace gcn
             // Distribute an event to all widgets in the "widget with mouse" queue.
             while (!mWidgetWithMouseQueue.empty())
             {
-                Widget* widget = mWidgetWithMouseQueue.front();
+                Widget* widget = mWidgetWithMouseQueue[0];
 
                 if (Widget::widgetExists(widget))
                 {
@@ -352,7 +378,7 @@ namespace gcn
                                          true);
                 }
 
-                mWidgetWithMouseQueue.pop_front();
+                mWidgetWithMouseQueue.erase(0);
             }
 
             return;
@@ -364,18 +390,16 @@ namespace gcn
         while (!widgetWithMouseQueueCheckDone)
         {
             unsigned int iterations = 0;
-            std::deque<Widget*>::iterator iter;
-            for (iter = mWidgetWithMouseQueue.begin();
-                 iter != mWidgetWithMouseQueue.end();
-                 iter++)
+            unsigned int i;
+            for (i = 0; i < mWidgetWithMouseQueue.size(); i++)
             {
-                Widget* widget = *iter;
+                Widget* widget = mWidgetWithMouseQueue[i];
                             
                 // If a widget in the "widget with mouse queue" doesn't
                 // exists anymore it should be removed from the queue.
                 if (!Widget::widgetExists(widget))
                 {
-                    mWidgetWithMouseQueue.erase(iter);
+                    mWidgetWithMouseQueue.erase(i);
                     break;
                 }
                 else
@@ -398,7 +422,7 @@ namespace gcn
                                              true);                                       
                         mClickCount = 1;
                         mLastMousePressTimeStamp = 0;
-                        mWidgetWithMouseQueue.erase(iter);
+                        mWidgetWithMouseQueue.erase(i);
                         break;
                     }
                 }
@@ -442,18 +466,8 @@ namespace gcn
             parent = (Widget*)widget->getParent();
 
             // Check if the widget is present in the "widget with mouse" queue.
-            bool widgetIsPresentInQueue = false;
-            std::deque<Widget*>::iterator iter;
-            for (iter = mWidgetWithMouseQueue.begin();
-                 iter != mWidgetWithMouseQueue.end();
-                 iter++)
-            {
-                if (*iter == widget)
-                {
-                    widgetIsPresentInQueue = true;
-                    break;
-                }
-            }
+            bool widgetIsPresentInQueue =
+                mWidgetWithMouseQueue.find(widget) < mWidgetWithMouseQueue.size();
 
             // Widget is not present, send an entered event and add
             // it to the "widget with mouse" queue.
@@ -467,7 +481,7 @@ namespace gcn
                                      mouseInput.getY(),
                                      true,
                                      true);
-                mWidgetWithMouseQueue.push_front(widget);
+                mWidgetWithMouseQueue.insert(0, widget);
             }
 
             Widget* swap = widget;
@@ -721,45 +735,59 @@ namespace gcn
                 mouseEvent.mX = x - widgetX;
                 mouseEvent.mY = y - widgetY;
                                       
-                std::list<MouseListener*> mouseListeners = widget->_getMouseListeners();
+                const Widget::MouseListenerList& mouseListeners = widget->_getMouseListeners();
+                unsigned int generation = Widget::_getListenerGeneration();
 
                 // Send the event to all mouse listeners of the widget.
-                for (std::list<MouseListener*>::iterator it = mouseListeners.begin();
-                     it != mouseListeners.end();
-                     ++it)
+                // The list is walked in place rather than copied, so if a
+                // listener changes it, find where to carry on from.
+                unsigned int i = 0;
+                while (i < mouseListeners.size())
                 {
+                    MouseListener* mouseListener = mouseListeners[i++];
+
                     switch (mouseEvent.getType())
                     {
                       case MouseEvent::ENTERED:
-                          (*it)->mouseEntered(mouseEvent);
+                          mouseListener->mouseEntered(mouseEvent);
                           break;
                       case MouseEvent::EXITED:
-                          (*it)->mouseExited(mouseEvent);
+                          mouseListener->mouseExited(mouseEvent);
                           break;
                       case MouseEvent::MOVED:
-                          (*it)->mouseMoved(mouseEvent);
+                          mouseListener->mouseMoved(mouseEvent);
                           break;
                       case MouseEvent::PRESSED:
-                          (*it)->mousePressed(mouseEvent);
+                          mouseListener->mousePressed(mouseEvent);
                           break;
                       case MouseEvent::RELEASED:
-                          (*it)->mouseReleased(mouseEvent);
+                          mouseListener->mouseReleased(mouseEvent);
                           break;
                       case MouseEvent::WHEEL_MOVED_UP:
-                          (*it)->mouseWheelMovedUp(mouseEvent);
+                          mouseListener->mouseWheelMovedUp(mouseEvent);
                           break;
                       case MouseEvent::WHEEL_MOVED_DOWN:
-                          (*it)->mouseWheelMovedDown(mouseEvent);
+                          mouseListener->mouseWheelMovedDown(mouseEvent);
                           break;
                       case MouseEvent::DRAGGED:
-                          (*it)->mouseDragged(mouseEvent);
+                          mouseListener->mouseDragged(mouseEvent);
                           break;
                       case MouseEvent::CLICKED:
-                          (*it)->mouseClicked(mouseEvent);
+                          mouseListener->mouseClicked(mouseEvent);
                           break;
                       default:
                           throw GCN_EXCEPTION("Unknown mouse event type.");
-                    }                    
+                    }
+
+                    if (Widget::_getListenerGeneration() != generation)
+                    {
+                        if (!Widget::widgetExists(widget))
+                        {
+                            return;
+                        }
+                        i = resumePosition(mouseListeners, mouseListener, i);
+                        generation = Widget::_getListenerGeneration();
+                    }
                 }
                 
                 if (toSourceOnly)
@@ -821,24 +849,37 @@ namespace gcn
 
             if (widget->isEnabled())
             {
-                std::list<KeyListener*> keyListeners = widget->_getKeyListeners();
+                const Widget::KeyListenerList& keyListeners = widget->_getKeyListeners();
+                unsigned int generation = Widget::_getListenerGeneration();
             
                 // Send the event to all key listeners of the source widget.
-                for (std::list<KeyListener*>::iterator it = keyListeners.begin();
-                     it != keyListeners.end();
-                     ++it)
+                // (Walked in place, as in distributeMouseEvent.)
+                unsigned int i = 0;
+                while (i < keyListeners.size())
                 {
+                    KeyListener* keyListener = keyListeners[i++];
+
                     switch (keyEvent.getType())
                     {
                       case KeyEvent::PRESSED:
-                          (*it)->keyPressed(keyEvent);
+                          keyListener->keyPressed(keyEvent);
                           break;
                       case KeyEvent::RELEASED:
-                          (*it)->keyReleased(keyEvent);
+                          keyListener->keyReleased(keyEvent);
                           break;
                       default:
                           throw GCN_EXCEPTION("Unknown key event type.");
-                    }                
+                    }
+
+                    if (Widget::_getListenerGeneration() != generation)
+                    {
+                        if (!Widget::widgetExists(widget))
+                        {
+                            return;
+                        }
+                        i = resumePosition(keyListeners, keyListener, i);
+                        generation = Widget::_getListenerGeneration();
+                    }
                 }
             }
 
@@ -926,7 +967,7 @@ namespace gcn
          // Distribute an event to all widgets in the "widget with mouse" queue.
         while (!mWidgetWithMouseQueue.empty())
         {
-            Widget* widget = mWidgetWithMouseQueue.front();
+            Widget* widget = mWidgetWithMouseQueue[0];
 
             if (Widget::widgetExists(widget))
             {
@@ -939,7 +980,7 @@ namespace gcn
                                      true);
             }
 
-            mWidgetWithMouseQueue.pop_front();
+            mWidgetWithMouseQueue.erase(0);
         }
 
         mFocusHandler->setLastWidgetWithModalMouseInputFocus(mFocusHandler->getModalMouseInputFocused());
@@ -959,18 +1000,8 @@ namespace gcn
             parent = (Widget*)widget->getParent();
 
             // Check if the widget is present in the "widget with mouse" queue.
-            bool widgetIsPresentInQueue = false;
-            std::deque<Widget*>::iterator iter;
-            for (iter = mWidgetWithMouseQueue.begin();
-                 iter != mWidgetWithMouseQueue.end();
-                 iter++)
-            {
-                if (*iter == widget)
-                {
-                    widgetIsPresentInQueue = true;
-                    break;
-                }
-            }
+            bool widgetIsPresentInQueue =
+                mWidgetWithMouseQueue.find(widget) < mWidgetWithMouseQueue.size();
 
             // Widget is not present, send an entered event and add
             // it to the "widget with mouse" queue.
@@ -984,7 +1015,7 @@ namespace gcn
                                      mLastMouseY,
                                      false,
                                      true);
-                mWidgetWithMouseQueue.push_front(widget);
+                mWidgetWithMouseQueue.insert(0, widget);
             }
 
             Widget* swap = widget;
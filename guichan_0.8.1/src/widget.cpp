@@ -67,6 +67,7 @@ namespace gcn
     Font* Widget::mGlobalFont = NULL;
     DefaultFont Widget::mDefaultFont;
     std::list<Widget*> Widget::mWidgets;
+    unsigned int Widget::mListenerGeneration = 0;
 
     Widget::Widget()
             : mForegroundColor(0x000000),
@@ -100,6 +101,7 @@ namespace gcn
         _setFocusHandler(NULL);
 
         mWidgets.remove(this);
+        ++mListenerGeneration;
     }
 
     void Widget::drawFrame(Graphics* graphics)
@@ -409,11 +411,13 @@ namespace gcn
     void Widget::addKeyListener(KeyListener* keyListener)
     {
         mKeyListeners.push_back(keyListener);
+        ++mListenerGeneration;
     }
 
     void Widget::removeKeyListener(KeyListener* keyListener)
     {
         mKeyListeners.remove(keyListener);
+        ++mListenerGeneration;
     }
 
     void Widget::addFocusListener(FocusListener* focusListener)
@@ -429,11 +433,13 @@ namespace gcn
     void Widget::addMouseListener(MouseListener* mouseListener)
     {
         mMouseListeners.push_back(mouseListener);
+        ++mListenerGeneration;
     }
 
     void Widget::removeMouseListener(MouseListener* mouseListener)
     {
         mMouseListeners.remove(mouseListener);
+        ++mListenerGeneration;
     }
 
     void Widget::addWidgetListener(WidgetListener* widgetListener)
@@ -631,12 +637,12 @@ namespace gcn
         return NULL;
     }
 
-    const std::list<MouseListener*>& Widget::_getMouseListeners()
+    const Widget::MouseListenerList& Widget::_getMouseListeners()
     {
         return mMouseListeners;
     }
 
-    const std::list<KeyListener*>& Widget::_getKeyListeners()
+    const Widget::KeyListenerList& Widget::_getKeyListeners()
     {
         return mKeyListeners;
     }
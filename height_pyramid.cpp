@@ -0,0 +1,290 @@
+/*
+ * FILE:
+ *   height_pyramid.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "height_pyramid.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    // The leaf test samples the surface this many times per mesh cell along
+    // the ray, then refines the first crossing by bisection.
+    const int LEAF_SAMPLES_PER_CELL = 4;
+    const int BISECTION_STEPS = 12;
+}
+
+// The ray in "block space", where block (i,j) covers [i,i+1] * [j,j+1].
+// z is left in world units.
+struct HeightPyramid::Ray {
+    float ox, oy, oz;   // world space
+    float dx, dy, dz;
+    float bx0, by0;     // block space origin
+    float bdx, bdy;     // block space direction
+
+    float z(float t) const { return oz + dz * t; }
+};
+
+HeightPyramid::HeightPyramid()
+    : nx(0), ny(0), bw(0), bh(0), W(1), L(1)
+{ }
+
+void HeightPyramid::resize(int nx_, int ny_, float W_, float L_)
+{
+    nx = nx_;
+    ny = ny_;
+    bw = std::max(1, nx / 4);
+    bh = std::max(1, ny / 4);
+    W = W_;
+    L = L_;
+
+    WaterBlock dry = { 0, 0, 0 };
+    terrain_max.assign(bw * bh, 0.0f);
+    water.assign(bw * bh, dry);
+
+    levels.clear();
+    level_w.clear();
+    level_h.clear();
+    int w = bw, h = bh;
+    while (true) {
+        levels.push_back(std::vector<float>(w * h));
+        level_w.push_back(w);
+        level_h.push_back(h);
+        if (w == 1 && h == 1) break;
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+    }
+}
+
+void HeightPyramid::updateTerrain(const TerrainEntry *heightfield)
+{
+    updateTerrain(heightfield, 0, nx + 4, 0, ny + 4);
+}
+
+void HeightPyramid::updateTerrain(const TerrainEntry *heightfield, int ix_min, int ix_max, int iy_min, int iy_max)
+{
+    if (bw == 0) return;
+
+    // Block i covers mesh x coordinates [i, i+1] * (nx-1)/bw (see GetTerrainHeight),
+    // so the bilinear surface over it is bounded by the vertices floor(lo) .. ceil(hi).
+    const float cells_x = float(nx - 1) / bw;
+    const float cells_y = float(ny - 1) / bh;
+
+    // blocks that can see the changed vertices (heightfield index = mesh index + 2)
+    const int bi_min = std::max(0, int(std::floor((ix_min - 3) / cells_x)));
+    const int bi_max = std::min(bw, int(std::floor((ix_max - 1) / cells_x)) + 1);
+    const int bj_min = std::max(0, int(std::floor((iy_min - 3) / cells_y)));
+    const int bj_max = std::min(bh, int(std::floor((iy_max - 1) / cells_y)) + 1);
+
+    for (int j = bj_min; j < bj_max; ++j) {
+        const int y0 = std::max(0, int(std::floor(j * cells_y)));
+        const int y1 = std::min(ny - 1, int(std::ceil((j + 1) * cells_y)));
+
+        for (int i = bi_min; i < bi_max; ++i) {
+            const int x0 = std::max(0, int(std::floor(i * cells_x)));
+            const int x1 = std::min(nx - 1, int(std::ceil((i + 1) * cells_x)));
+
+            float m = heightfield[(y0 + 2) * (nx + 4) + x0 + 2].B;
+            for (int y = y0; y <= y1; ++y) {
+                const TerrainEntry *row = heightfield + (y + 2) * (nx + 4) + 2;
+                for (int x = x0; x <= x1; ++x) {
+                    m = std::max(m, row[x].B);
+                }
+            }
+            terrain_max[j * bw + i] = m;
+        }
+    }
+}
+
+void HeightPyramid::rebuild()
+{
+    if (bw == 0) return;
+
+    std::vector<float> &base = levels[0];
+    for (int k = 0; k < bw * bh; ++k) {
+        base[k] = terrain_max[k] + std::max(0.0f, water[k].h);
+    }
+
+    for (size_t lev = 1; lev < levels.size(); ++lev) {
+        const std::vector<float> &below = levels[lev - 1];
+        std::vector<float> &here = levels[lev];
+        const int bw_below = level_w[lev - 1], bh_below = level_h[lev - 1];
+
+        for (int j = 0; j < level_h[lev]; ++j) {
+            const int j0 = 2*j, j1 = std::min(2*j + 1, bh_below - 1);
+            for (int i = 0; i < level_w[lev]; ++i) {
+                const int i0 = 2*i, i1 = std::min(2*i + 1, bw_below - 1);
+                here[j * level_w[lev] + i] = std::max(std::max(below[j0 * bw_below + i0], below[j0 * bw_below + i1]),
+                                                      std::max(below[j1 * bw_below + i0], below[j1 * bw_below + i1]));
+            }
+        }
+    }
+}
+
+float HeightPyramid::getMaxHeight(int mx_min, int mx_max, int my_min, int my_max) const
+{
+    if (bw == 0) return 0;
+
+    // blocks whose range of mesh coordinates overlaps the given one
+    const float cells_x = float(nx - 1) / bw;
+    const float cells_y = float(ny - 1) / bh;
+    const int bi_min = std::max(0, std::min(bw - 1, int(std::floor(mx_min / cells_x))));
+    const int bi_max = std::max(0, std::min(bw - 1, int(std::floor(mx_max / cells_x))));
+    const int bj_min = std::max(0, std::min(bh - 1, int(std::floor(my_min / cells_y))));
+    const int bj_max = std::max(0, std::min(bh - 1, int(std::floor(my_max / cells_y))));
+
+    const std::vector<float> &base = levels[0];
+    float m = base[bj_min * bw + bi_min];
+    for (int j = bj_min; j <= bj_max; ++j) {
+        for (int i = bi_min; i <= bi_max; ++i) {
+            m = std::max(m, base[j * bw + i]);
+        }
+    }
+    return m;
+}
+
+// Clips [t0, t1] to the part of the ray inside node (i,j) of the given level.
+// Returns false if that is empty.
+bool HeightPyramid::clip(const Ray &ray, int level, int i, int j, float &t0, float &t1) const
+{
+    const float x_lo = float(i << level), x_hi = float(std::min((i + 1) << level, bw));
+    const float y_lo = float(j << level), y_hi = float(std::min((j + 1) << level, bh));
+
+    if (ray.bdx == 0) {
+        if (ray.bx0 < x_lo || ray.bx0 > x_hi) return false;
+    } else {
+        float ta = (x_lo - ray.bx0) / ray.bdx, tb = (x_hi - ray.bx0) / ray.bdx;
+        if (ta > tb) std::swap(ta, tb);
+        t0 = std::max(t0, ta);
+        t1 = std::min(t1, tb);
+    }
+
+    if (ray.bdy == 0) {
+        if (ray.by0 < y_lo || ray.by0 > y_hi) return false;
+    } else {
+        float ta = (y_lo - ray.by0) / ray.bdy, tb = (y_hi - ray.by0) / ray.bdy;
+        if (ta > tb) std::swap(ta, tb);
+        t0 = std::max(t0, ta);
+        t1 = std::min(t1, tb);
+    }
+
+    return t0 <= t1;
+}
+
+bool HeightPyramid::castNode(const Ray &ray, int level, int i, int j, float t0, float t1, float &t_hit) const
+{
+    if (!clip(ray, level, i, j, t0, t1)) return false;
+
+    // z is linear in t, so its minimum over the segment is at one of the ends.
+    // If that is above everything in this node, the ray cannot hit anything here.
+    if (std::min(ray.z(t0), ray.z(t1)) > levels[level][j * level_w[level] + i]) return false;
+
+    if (level == 0) return castLeaf(ray, i, j, t0, t1, t_hit);
+
+    // visit the (up to) four children in the order the ray enters them
+    struct Child { float t0, t1; int i, j; };
+    Child children[4];
+    int num_children = 0;
+
+    for (int cj = 2*j; cj <= 2*j + 1 && cj < level_h[level - 1]; ++cj) {
+        for (int ci = 2*i; ci <= 2*i + 1 && ci < level_w[level - 1]; ++ci) {
+            Child c = { t0, t1, ci, cj };
+            if (clip(ray, level - 1, ci, cj, c.t0, c.t1)) {
+                int k = num_children++;
+                while (k > 0 && children[k-1].t0 > c.t0) {
+                    children[k] = children[k-1];
+                    --k;
+                }
+                children[k] = c;
+            }
+        }
+    }
+
+    for (int k = 0; k < num_children; ++k) {
+        if (castNode(ray, level - 1, children[k].i, children[k].j, children[k].t0, children[k].t1, t_hit)) return true;
+    }
+    return false;
+}
+
+bool HeightPyramid::castLeaf(const Ray &ray, int i, int j, float t0, float t1, float &t_hit) const
+{
+    const float h = std::max(0.0f, water[j * bw + i].h);
+
+    // (surface - ray) height at parameter t
+    struct Gap {
+        const Ray &ray;
+        float h;
+        float operator()(float t) const { return GetTerrainHeight(ray.ox + ray.dx * t, ray.oy + ray.dy * t) + h - ray.z(t); }
+    } gap = { ray, h };
+
+    if (gap(t0) >= 0) {
+        t_hit = t0;
+        return true;
+    }
+
+    // number of samples: enough to resolve each mesh cell the segment crosses
+    const float cells = std::max(std::abs(ray.bdx) * float(nx - 1) / bw,
+                                 std::abs(ray.bdy) * float(ny - 1) / bh) * (t1 - t0);
+    const int n = std::max(1, int(std::ceil(cells * LEAF_SAMPLES_PER_CELL)));
+
+    float ta = t0;
+    for (int s = 1; s <= n; ++s) {
+        float tb = (s == n) ? t1 : t0 + (t1 - t0) * s / n;
+        if (gap(tb) >= 0) {
+            // crossing is in [ta, tb]
+            for (int b = 0; b < BISECTION_STEPS; ++b) {
+                const float tm = 0.5f * (ta + tb);
+                if (gap(tm) >= 0) tb = tm; else ta = tm;
+            }
+            t_hit = tb;
+            return true;
+        }
+        ta = tb;
+    }
+    return false;
+}
+
+bool HeightPyramid::castRay(float ox, float oy, float oz, float dx, float dy, float dz,
+                            float t_min, float t_max, float &t_hit) const
+{
+    if (bw == 0) return false;
+
+    Ray ray;
+    ray.ox = ox; ray.oy = oy; ray.oz = oz;
+    ray.dx = dx; ray.dy = dy; ray.dz = dz;
+    ray.bx0 = (ox + W/2) * bw / W;
+    ray.by0 = oy * bh / L;
+    ray.bdx = dx * bw / W;
+    ray.bdy = dy * bh / L;
+
+    const int top = int(levels.size()) - 1;
+    return castNode(ray, top, 0, 0, t_min, t_max, t_hit);
+}
+
+void HeightPyramid::blockIndex(float world_x, float world_y, int &i, int &j) const
+{
+    i = int((world_x + W/2) / W * bw);
+    j = int(world_y / L * bh);
+    i = std::max(0, std::min(bw - 1, i));
+    j = std::max(0, std::min(bh - 1, j));
+}
+
+const HeightPyramid::WaterBlock & HeightPyramid::getWaterAt(float world_x, float world_y) const
+{
+    int i, j;
+    blockIndex(world_x, world_y, i, j);
+    return water[j * bw + i];
+}
+
+float HeightPyramid::getSurfaceHeight(float world_x, float world_y) const
+{
+    return GetTerrainHeight(world_x, world_y) + getWaterAt(world_x, world_y).h;
+}
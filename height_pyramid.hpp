@@ -0,0 +1,97 @@
+/*
+ * FILE:
+ *   height_pyramid.hpp
+ *
+ * PURPOSE:
+ *   Max-height pyramid ("maximum mipmap") over the terrain + water
+ *   surface, for mouse picking. Level 0 has one entry per 4x4
+ *   GetStats block; each level above holds the max of 2x2 entries
+ *   of the level below. A ray is traced by descending the pyramid,
+ *   skipping any node that the ray passes entirely above, and only
+ *   evaluating the actual surface in the leaf blocks it could hit.
+ *
+ *   The water part comes from the GetStats readback (average depth
+ *   and momentum of each block), so the surface seen by the picking
+ *   code is B(x,y) + average h of the block, as before.
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef HEIGHT_PYRAMID_HPP
+#define HEIGHT_PYRAMID_HPP
+
+#include "terrain_heightfield.hpp"
+
+#include <vector>
+
+class HeightPyramid {
+public:
+    // block averages from GetStats
+    struct WaterBlock {
+        float h, hu, hv;
+    };
+
+    HeightPyramid();
+
+    // Sets up for an nx * ny mesh covering [-W/2, W/2] * [0, L], divided into
+    // (nx/4) * (ny/4) blocks. Clears the water. Call updateTerrain and rebuild afterwards.
+    void resize(int nx, int ny, float W, float L);
+
+    // Recomputes the terrain maxima of all blocks touching the given range
+    // of the heightfield (indices include the ghost zones; max is exclusive).
+    // The heightfield is (nx+4) * (ny+4), i.e. g_terrain_heightfield.
+    void updateTerrain(const TerrainEntry *heightfield);
+    void updateTerrain(const TerrainEntry *heightfield, int ix_min, int ix_max, int iy_min, int iy_max);
+
+    // Water data for each block, row major, getBlocksX() * getBlocksY().
+    // Call rebuild() after changing it.
+    WaterBlock * getWater() { return water.empty() ? 0 : &water[0]; }
+
+    // Recomputes the pyramid from the terrain maxima and the water depths.
+    void rebuild();
+
+    // Casts the ray (ox,oy,oz) + t*(dx,dy,dz), t in [t_min, t_max], against the surface.
+    // On a hit, returns true and sets t_hit to the first t at which the ray is at
+    // or below the surface (accurate to a small fraction of a mesh cell).
+    bool castRay(float ox, float oy, float oz, float dx, float dy, float dz,
+                 float t_min, float t_max, float &t_hit) const;
+
+    // Water block at the given world position (clamped to the mesh).
+    const WaterBlock & getWaterAt(float world_x, float world_y) const;
+
+    // Terrain + water height at the given world position.
+    float getSurfaceHeight(float world_x, float world_y) const;
+
+    // Upper bound on the terrain + water height over the given range of
+    // mesh vertices (0 .. nx-1, 0 .. ny-1; max inclusive).
+    float getMaxHeight(int mx_min, int mx_max, int my_min, int my_max) const;
+
+    int getBlocksX() const { return bw; }
+    int getBlocksY() const { return bh; }
+
+private:
+    struct Ray;
+    bool clip(const Ray &ray, int level, int i, int j, float &t0, float &t1) const;
+    bool castNode(const Ray &ray, int level, int i, int j, float t0, float t1, float &t_hit) const;
+    bool castLeaf(const Ray &ray, int i, int j, float t0, float t1, float &t_hit) const;
+    void blockIndex(float world_x, float world_y, int &i, int &j) const;
+
+private:
+    int nx, ny, bw, bh;
+    float W, L;
+
+    std::vector<float> terrain_max;    // max B over each block (bw * bh)
+    std::vector<WaterBlock> water;     // bw * bh
+
+    // levels[0] is bw * bh; each level after that is half the size (rounded up),
+    // down to 1 * 1.
+    std::vector<std::vector<float> > levels;
+    std::vector<int> level_w, level_h;
+};
+
+#endif
@@ -0,0 +1,90 @@
+/*
+ * FILE:
+ *   initial_conditions.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * CREATED:
+ *   24-Oct-2011
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "initial_conditions.hpp"
+#include "terrain_heightfield.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+void ComputeInitialConditions(ResetType reset_type, float *out)
+{
+    ComputeInitialConditions(SettingsSnapshot(), &g_terrain_heightfield[0], &g_bottom[0], reset_type, out);
+}
+
+void ComputeInitialConditions(const SettingsSnapshot &settings,
+                              const TerrainEntry *heightfield, const BottomEntry *bottom,
+                              ResetType reset_type, float *out)
+{
+    const int nx = settings.getInt(SH_MESH_SIZE_X);
+    const int ny = settings.getInt(SH_MESH_SIZE_Y);
+    const float W = settings.get(SH_VALLEY_WIDTH);
+    const float L = settings.get(SH_VALLEY_LENGTH);
+    const float dam_pos = settings.get(SH_DAM_POSITION);
+
+    const float xmin = -W/6;
+    const float xmax = W/6;
+    const float ymin = L/3;
+    const float ymax = 2*L/3;
+
+    float init_w = 0;
+    if (reset_type == R_VALLEY) {
+        // find the height of the lowest point along the dam
+        float B_min = 99999999.f;
+        for (float x = -W/2; x < W/2; x += W/(nx-1)) {
+            B_min = std::min(B_min, GetTerrainHeight(heightfield, nx, ny, W, L, x, dam_pos));
+        }
+
+        init_w = B_min + 1;
+    } else if (reset_type == R_SEA) {
+        init_w = settings.get(SH_SEA_LEVEL);
+    }
+            
+    float *p = out;
+
+    for (int j = 0; j < ny + 4; ++j) {
+
+        for (int i = 0; i < nx + 4; ++i) {
+
+            const int ii = std::max(2, std::min(nx+1, i));
+            const int jj = std::max(2, std::min(ny+1, j));
+            const float B = bottom[(nx+4) * jj + ii].BA;
+
+            const float x = (ii-2)*W/(nx-1) - W/2;
+            const float y = (jj-2)*L/(ny-1);
+
+            float w = B;
+            if (reset_type == R_VALLEY) {
+                if (y > dam_pos && B < init_w) {
+                    w = init_w;
+
+                    // add a wave pattern for some extra interest
+                    w += 0.02f * sin(-0.2f*x + 0.8f*y);
+                }
+            } else if (reset_type == R_SEA) {
+                w = std::max(B, init_w);
+            } else if (reset_type == R_SQUARE && x >= xmin && x < xmax && y >= ymin && y < ymax) {
+                w = B + 7.0f;
+            }
+
+            // initial condition
+
+            *p++ = w;  // w
+            *p++ = 0;  // hu
+            *p++ = 0;  // hv
+            *p++ = 0;  // unused
+        }
+    }
+}
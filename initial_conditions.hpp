@@ -0,0 +1,37 @@
+/*
+ * FILE:
+ *   initial_conditions.hpp
+ *
+ * PURPOSE:
+ *   Computes the initial water state for a new simulation. Shared
+ *   between the GPU engine and the CPU solver.
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * CREATED:
+ *   24-Oct-2011
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef INITIAL_CONDITIONS_HPP
+#define INITIAL_CONDITIONS_HPP
+
+#include "settings.hpp"
+#include "terrain_heightfield.hpp"
+
+// Writes the initial state {w, hu, hv, 0} for every cell (including
+// ghost zones) into "out", which must have room for
+// (nx+4) * (ny+4) * 4 floats.
+// Reads the current settings; precondition: terrain heightfield is up to date.
+void ComputeInitialConditions(ResetType reset_type, float *out);
+
+// As above, but for the given settings and terrain (as from ComputeTerrainHeightfield).
+void ComputeInitialConditions(const SettingsSnapshot &settings,
+                              const TerrainEntry *heightfield, const BottomEntry *bottom,
+                              ResetType reset_type, float *out);
+
+#endif
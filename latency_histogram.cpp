@@ -0,0 +1,78 @@
+/*
+ * FILE:
+ *   latency_histogram.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "latency_histogram.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+void LatencyHistogram::clear()
+{
+    std::memset(counts, 0, sizeof(counts));
+    count = total = max_value = 0;
+}
+
+// Values below SUB_BUCKETS have a bucket each. Above that, a value whose top
+// bit is bit m goes in one of the SUB_BUCKETS buckets for that m, according to
+// the SUB_BITS bits below the top bit.
+int LatencyHistogram::bucketIndex(unsigned long long value)
+{
+    if (value < SUB_BUCKETS) return int(value);
+
+    int m = SUB_BITS;
+    while ((value >> m) > 1) ++m;
+
+    const int sub = int(value >> (m - SUB_BITS)) - SUB_BUCKETS;
+    return SUB_BUCKETS + (m - SUB_BITS) * SUB_BUCKETS + sub;
+}
+
+unsigned long long LatencyHistogram::bucketMidpoint(int index)
+{
+    if (index < SUB_BUCKETS) return index;
+
+    const int shift = (index - SUB_BUCKETS) / SUB_BUCKETS;
+    const int sub = (index - SUB_BUCKETS) % SUB_BUCKETS;
+    const unsigned long long lower = (unsigned long long)(SUB_BUCKETS + sub) << shift;
+    return lower + ((1ull << shift) >> 1);
+}
+
+void LatencyHistogram::record(unsigned long long value)
+{
+    ++counts[bucketIndex(value)];
+    ++count;
+    total += value;
+    max_value = std::max(max_value, value);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+    for (int i = 0; i < NUM_BUCKETS; ++i) counts[i] += other.counts[i];
+    count += other.count;
+    total += other.total;
+    max_value = std::max(max_value, other.max_value);
+}
+
+unsigned long long LatencyHistogram::getPercentile(double fraction) const
+{
+    if (count == 0) return 0;
+
+    // the rank (1-based) of the value wanted
+    unsigned long long rank = (unsigned long long)(fraction * double(count) + 0.999999);
+    rank = std::max(1ull, std::min(count, rank));
+
+    unsigned long long seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; ++i) {
+        seen += counts[i];
+        if (seen >= rank) return std::min(bucketMidpoint(i), max_value);
+    }
+    return max_value;
+}
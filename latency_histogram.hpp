@@ -0,0 +1,63 @@
+/*
+ * FILE:
+ *   latency_histogram.hpp
+ *
+ * PURPOSE:
+ *   Histogram of durations (frame times, step times, benchmark
+ *   iterations...) for reporting percentiles rather than just the
+ *   mean, which hides the occasional slow frame.
+ *
+ *   The buckets are log-linear, as in HdrHistogram: each power of
+ *   two is split into 32 equal buckets, so any value is known to
+ *   within about 3%, from nanoseconds to hours, in a fixed 8K of
+ *   counts. Recording is a few shifts and an increment, and never
+ *   allocates; the class has no pointers, so can be copied (or
+ *   cleared by memset) freely.
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef LATENCY_HISTOGRAM_HPP
+#define LATENCY_HISTOGRAM_HPP
+
+class LatencyHistogram {
+public:
+    LatencyHistogram() { clear(); }
+
+    void clear();
+
+    // Adds one value (normally in nanoseconds).
+    void record(unsigned long long value);
+
+    // Adds all the values recorded in another histogram.
+    void merge(const LatencyHistogram &other);
+
+    unsigned long long getCount() const { return count; }
+    unsigned long long getMax() const { return max_value; }
+    double getMean() const { return count ? double(total) / double(count) : 0.0; }
+
+    // The value that the given fraction (0 to 1) of the recorded values are
+    // less than or equal to, e.g. 0.99 for the 99th percentile, to within the
+    // bucket resolution. Zero if nothing has been recorded.
+    unsigned long long getPercentile(double fraction) const;
+
+private:
+    enum {
+        SUB_BITS = 5,
+        SUB_BUCKETS = 1 << SUB_BITS,                          // buckets per power of two
+        NUM_BUCKETS = SUB_BUCKETS + (64 - SUB_BITS) * SUB_BUCKETS
+    };
+
+    static int bucketIndex(unsigned long long value);
+    static unsigned long long bucketMidpoint(int index);
+
+    unsigned int counts[NUM_BUCKETS];
+    unsigned long long count, total, max_value;
+};
+
+#endif
@@ -17,8 +17,12 @@
  */
 
 #include "engine.hpp"
+#include "frame_scheduler.hpp"
 #include "gui_manager.hpp"
+#include "perf_counters.hpp"
+#include "profiler.hpp"
 #include "settings.hpp"
+#include "settings_queue.hpp"
 #include "terrain_heightfield.hpp"
 
 #include "coercri/dx11/gfx/dx11_gfx_driver.hpp"
@@ -39,30 +43,53 @@ bool g_resize = false;
 namespace {
     const float PI = std::atan(1.0f) * 4.0f;
 
+    // No GPU timestep covers more than this much real time (times
+    // time_acceleration), so the water moves smoothly at 60 fps.
+    const float MAX_STEP_INTERVAL = 1.0f / 60;   // seconds
+
+    // Steps between resetTimestep calls (each of which reads back from the GPU)
+    const int STEPS_BETWEEN_RESET = 10;
+
     void UpdateMousePick(int mx, int my, ShallowWaterEngine &engine)
     {
         float wx, wy, wz, d, u, v;
         if (mx >= 0 && mx < g_width && my >= 0 && my < g_height
         && engine.mousePick(mx, my, wx, wy, wz, d, u, v)) {
-            SetSetting("x", wx);
-            SetSetting("y", wy);
-            SetSetting("z", wz);
-            SetSetting("depth", d);
-            SetSetting("u", u);
-            SetSetting("v", v);
+            SetSetting(SH_X, wx);
+            SetSetting(SH_Y, wy);
+            SetSetting(SH_Z, wz);
+            SetSetting(SH_DEPTH, d);
+            SetSetting(SH_U, u);
+            SetSetting(SH_V, v);
 
             const float spd = std::sqrt(u*u + v*v);
-            const float c = std::sqrt(GetSetting("gravity") * d);
-            SetSetting("froude", spd / c);
+            const float c = std::sqrt(GetSetting(SH_GRAVITY) * d);
+            SetSetting(SH_FROUDE, spd / c);
             
         } else {
-            SetSetting("x", -1);
-            SetSetting("y", -1);
-            SetSetting("z", -1);
-            SetSetting("depth", -1);
-            SetSetting("u", -1);
-            SetSetting("v", -1);
-            SetSetting("froude", -1);
+            SetSetting(SH_X, -1);
+            SetSetting(SH_Y, -1);
+            SetSetting(SH_Z, -1);
+            SetSetting(SH_DEPTH, -1);
+            SetSetting(SH_U, -1);
+            SetSetting(SH_V, -1);
+            SetSetting(SH_FROUDE, -1);
+        }
+    }
+
+    void ToggleBrushRecording(ShallowWaterEngine &engine)
+    {
+        BrushRecorder &recorder = engine.getBrushRecorder();
+        if (!recorder.isRecording()) {
+            engine.startBrushRecording();
+            return;
+        }
+
+        recorder.stop();
+        try {
+            SaveBrushLog("shallow_water_brushes.txt", recorder.getLog());
+        } catch (std::exception &e) {
+            MessageBox(0, e.what(), "Error", MB_ICONEXCLAMATION | MB_OK);
         }
     }
 }
@@ -98,6 +125,13 @@ public:
         case Coercri::RK_PAGE_UP: up = pressed; break;
         case Coercri::RK_PAGE_DOWN: down = pressed; break;
         case Coercri::RK_LEFT_SHIFT: case Coercri::RK_RIGHT_SHIFT: shift = pressed; break;
+
+        // profiling: F8 starts/stops recording, F9 saves a trace (open in chrome://tracing)
+        case Coercri::RK_F8: if (pressed) SetProfilerEnabled(!ProfilerEnabled()); break;
+        case Coercri::RK_F9: if (pressed) WriteProfilerTrace("shallow_water_trace.json"); break;
+
+        // F10 starts/stops recording brush strokes (saved on stop; see brush_log.hpp)
+        case Coercri::RK_F10: if (pressed) ToggleBrushRecording(engine); break;
         }
     }
 
@@ -145,6 +179,8 @@ public:
 
     void update(float dt)
     {
+        PROFILE_SCOPE("Update");
+
         // HACK to communicate camera resets back from the gui.
         gui_manager.getCameraReset(cam_x, cam_y, cam_z, pitch, yaw);
         
@@ -152,8 +188,8 @@ public:
         float speed = shift ? 300.0f : 30.0f;
         speed *= dt;
 
-        const float W = GetSetting("valley_width");
-        const float L = GetSetting("valley_length");
+        const float W = GetSetting(SH_VALLEY_WIDTH);
+        const float L = GetSetting(SH_VALLEY_LENGTH);
 
         if (fwd) {
             cam_x += sin(yaw) * cos(pitch) * speed;
@@ -187,7 +223,7 @@ public:
         // clip camera position
         const float max_ratio = 0.5f;
         float max_clip = max_ratio*std::max(W,L);
-        if (GetIntSetting("clip_camera")) max_clip = 0;
+        if (GetIntSetting(SH_CLIP_CAMERA)) max_clip = 0;
         if (cam_x < -W/2 -max_clip) cam_x = -W/2 - max_clip;
         if (cam_x > W/2 + max_clip) cam_x = W/2 + max_clip;
         if (cam_y < -max_clip) cam_y = -max_clip;
@@ -204,10 +240,10 @@ public:
 
         // do left mouse interaction
         if (left_mouse_down) {
-            const float wy = GetSetting("y");
+            const float wy = GetSetting(SH_Y);
             if (wy >= 0) {
-                const float wx = GetSetting("x");
-                const float wy = GetSetting("y");
+                const float wx = GetSetting(SH_X);
+                const float wy = GetSetting(SH_Y);
                 engine.applyMouseShader(wx, wy, dt);
             }
         }
@@ -254,7 +290,7 @@ int real_main()
     boost::shared_ptr<Coercri::DX11Window> window = 
         boost::static_pointer_cast<Coercri::DX11Window>(
             gfx_driver->createWindow(g_width + GUI_WIDTH, g_height, true, false, "Shallow Water Demo - Copyright (C) Stephen Thompson 2012 - 2014"));
-    GuiManager gui_manager(window, timer, GUI_WIDTH);
+    GuiManager gui_manager(*gfx_driver, window, timer, GUI_WIDTH);
 
     // Create the ShallowWaterEngine
     boost::scoped_ptr<ShallowWaterEngine> engine(
@@ -262,10 +298,30 @@ int real_main()
 
     listener.reset(new MyListener(*engine, gui_manager, *window));
     window->addWindowListener(listener.get());
+
+    SetProfilerThreadName("Main");
+    GpuProfiler &gpu_profiler = engine->getGpuProfiler();
     
 
-    unsigned int last_draw = timer->getMsec();
+    // (in ns; the scheduler needs better than millisecond resolution)
+    unsigned long long last_update = timer->getNsec();
+    unsigned long long last_frame = last_update;
+    unsigned int last_perf_update = timer->getMsec();
+    FrameScheduler scheduler;
     bool is_gui_shown = true;
+
+    // the GuiManager's initial settings are built straight away (there being
+    // nothing much to show until they are); later rebuilds run in the background
+    SettingsSnapshot rebuild_settings;
+    {
+        const ResetType reset_type = g_settings_queue.update(timer->getMsec()).reset_type;
+        if (reset_type != R_NONE) {
+            g_settings_queue.getRebuildSettings(rebuild_settings);
+            engine->beginRebuild(reset_type, rebuild_settings);
+            g_settings_queue.commitRebuild();
+            engine->finishRebuild();
+        }
+    }
     
     g_resize = true; // make sure it "resizes" first time
 
@@ -285,67 +341,104 @@ int real_main()
             g_resize = false;
         }
 
-        // see if updates need to be done
-        switch (g_reset_type) {
-        case R_MESH:
-        case R_VALLEY:
-        case R_SEA:
-        case R_SQUARE:
-            engine->remesh(g_reset_type);
-            break;
-
-        case R_TERRAIN:
-            engine->newTerrainSettings();
-            break;
-        };
-
-        g_reset_type = R_NONE;        
+        // switch over to the new terrain/mesh, once it has been built
+        if (engine->isRebuildReady()) {
+            g_settings_queue.commitRebuild();
+            engine->finishRebuild();
+        }
         
-        engine->resetTimestep(0.001f);
+        if (!engine->isSimThreaded()) engine->resetTimestep(MAX_STEP_INTERVAL);
         int timestep_count = 0;
-        unsigned int timer_at_zero_timesteps = timer->getMsec();
+        scheduler.reset(timer->getNsec());
         
-        while (!g_resize && g_reset_type == R_NONE && !g_quit && gui_manager.isGuiShown() == is_gui_shown) {
-
-            const unsigned int frame_time = 1;  // in msec. acts as fps limiter.
-
-            // see if dt needs to be reset
-            const int steps_between_reset = 10;
-            if (timestep_count >= steps_between_reset) {
-                unsigned int timer_now = timer->getMsec();
-                float dt = float(timer_now - timer_at_zero_timesteps) / (1000.0f * steps_between_reset);
-                engine->resetTimestep(dt);
+        while (!g_resize && !engine->isRebuildReady() && !g_quit && gui_manager.isGuiShown() == is_gui_shown) {
+
+            // GPU timings are only collected while someone is looking at them
+            SetPerfCountersEnabled(gui_manager.isPerfTabShown());
+            gpu_profiler.beginFrame();
+            PROFILE_SCOPE("Frame");
+
+            // switch between GPU and CPU simulation if required
+            const bool cpu_simulation = GetIntSetting(SH_CPU_SIMULATION) != 0;
+            if (cpu_simulation != engine->isSimThreaded()) {
+                engine->setSimThreaded(cpu_simulation);
+                if (!cpu_simulation) engine->resetTimestep(MAX_STEP_INTERVAL);
                 timestep_count = 0;
-                timer_at_zero_timesteps = timer_now;
+                scheduler.reset(timer->getNsec());
+            }
 
-                UpdateMousePick(listener->getMX(), listener->getMY(), *engine);
+            {
+                PROFILE_SCOPE("PollEvents");
+                gfx_driver->pollEvents();
+            }
+            {
+                PROFILE_SCOPE("GuiLogic");
+                gui_manager.logic();
             }
-            
-            gfx_driver->pollEvents();
-            gui_manager.logic();
 
-            if (g_reset_type != R_NONE) break;  // don't continue if the settings are out of date
-            
-            const unsigned int time_now = timer->getMsec();
-            const int time_since_last = int(time_now - last_draw);
-            
-            bool do_render = true; // int(time_now - last_draw) >= frame_time;
-            if (window->needsRepaint()) do_render = true;
+            // apply this frame's settings edits (see settings_queue.hpp).
+            // terrain and mesh changes carry on with the old ones until rebuilt
+            const SettingsChange change = g_settings_queue.update(timer->getMsec());
+            if (change.reset_type != R_NONE) {
+                g_settings_queue.getRebuildSettings(rebuild_settings);
+                engine->beginRebuild(change.reset_type, rebuild_settings);
+            }
+            if (change.simulation) engine->newSimSettings();
             
-            if (do_render) {
+            const unsigned long long time_now = timer->getNsec();
+            const unsigned long long time_since_last = time_now - last_update;
+            last_update = time_now;
 
-                last_draw = time_now;
+            // mouse picking is cheap (see HeightPyramid), so can be done every frame
+            UpdateMousePick(listener->getMX(), listener->getMY(), *engine);
 
-                // do update
-                listener->update(float(time_since_last) / 1000.0f);
+            // do update
+            listener->update(float(double(time_since_last) * 1e-9));
+
+            // do timesteps
+            // (the CPU simulation runs by itself; we just pick up its latest state)
+            if (engine->isSimThreaded()) {
+                engine->updateFromSimThread();
+            } else {
+                PROFILE_SCOPE("Timesteps");
+                const unsigned long long steps_start = timer->getNsec();
+                scheduler.beginFrame(steps_start, GetSetting(SH_TIME_ACCELERATION));
+                int steps = 0;
+
+                while (true) {
+                    if (timestep_count >= STEPS_BETWEEN_RESET) {
+                        engine->resetTimestep(MAX_STEP_INTERVAL);
+                        timestep_count = 0;
+                    }
+
+                    const float dt = engine->getTimestep();
+                    if (!scheduler.wantStep(dt)) break;
 
-                // do timestep
-                const int timesteps_per_frame = GetIntSetting("timesteps_per_frame");
-                for (int i = 0; i < timesteps_per_frame; ++i) {
                     engine->timestep();
+                    scheduler.stepDone(dt);
                     ++timestep_count;
+                    ++steps;
                 }
 
+                // the GPU runs the steps asynchronously, so they cannot be timed
+                // individually from here; record the frame's average for each
+                const unsigned long long steps_elapsed = timer->getNsec() - steps_start;
+                scheduler.endSteps(steps_elapsed);
+                for (int i = 0; i < steps; ++i) g_perf_counters.step_times.record(steps_elapsed / steps);
+                SetSetting(SH_TIME_RATIO, scheduler.getTimeRatio());
+            }
+
+            // if the simulation is behind, give it the time instead of drawing
+            const unsigned long long render_time = timer->getNsec();
+            const bool do_render = engine->isSimThreaded() || window->needsRepaint()
+                || scheduler.wantRender(render_time);
+
+            if (do_render) {
+
+                scheduler.rendered(render_time);
+                g_perf_counters.frame_times.record(render_time - last_frame);
+                last_frame = render_time;
+
                 // clear the screen
                 const float rgba[] = { 0, 0, 0, 1 };
                 gfx_driver->getDeviceContext()->ClearRenderTargetView(window->getRenderTargetView(), rgba);
@@ -355,15 +448,21 @@ int real_main()
 
                 // draw the gui (using coercri 2D routines)
                 {
+                    PROFILE_SCOPE("GuiDraw");
+                    gui_manager.updatePanel();
                     std::auto_ptr<Coercri::GfxContext> gc = window->createGfxContext();
                     gui_manager.draw(*gc);
-                }
+                }   // (the swap chain is presented here)
 
                 window->cancelInvalidRegion();
-            
-            } else {
-                const int time_to_next_frame = int(last_draw + frame_time - time_now);
-                timer->sleepMsec(std::max(1, time_to_next_frame + 1));
+            }
+
+            gpu_profiler.endFrame();
+
+            const unsigned int perf_elapsed = timer->getMsec() - last_perf_update;
+            if (perf_elapsed >= 500) {
+                PublishPerfCounters(perf_elapsed / 1000.0);
+                last_perf_update += perf_elapsed;
             }
         }
     }
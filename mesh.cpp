@@ -0,0 +1,242 @@
+/*
+ * FILE:
+ *   mesh.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "mesh.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    // Parameters of Forsyth's scoring function (see OptimizeVertexCache)
+    const int MODEL_CACHE_SIZE = 32;
+    const float CACHE_DECAY_POWER = 1.5f;
+    const float LAST_TRI_SCORE = 0.75f;
+    const float VALENCE_BOOST_SCALE = 2.0f;
+    const float VALENCE_BOOST_POWER = 0.5f;
+
+    // How much we want to use a vertex next: more if it is near the front of the
+    // (LRU model of the) cache, and more if few triangles are left to use it, so
+    // that lone triangles are not left behind.
+    float VertexScore(int cache_pos, int remaining_tris)
+    {
+        if (remaining_tris == 0) return -1.0f;
+
+        float score = 0;
+        if (cache_pos >= 0) {
+            if (cache_pos < 3) {
+                // used by the last triangle; a fixed score, so that the strip-like
+                // orderings that would otherwise win do not starve the rest of the cache
+                score = LAST_TRI_SCORE;
+            } else {
+                score = std::pow(1.0f - float(cache_pos - 3) / (MODEL_CACHE_SIZE - 3), CACHE_DECAY_POWER);
+            }
+        }
+        return score + VALENCE_BOOST_SCALE * std::pow(float(remaining_tris), -VALENCE_BOOST_POWER);
+    }
+
+    // Vertex (a, b) of the lod grid (step s), moved onto the coarser grid if it is
+    // an odd vertex on one of the stitched edges. Returns the index within the patch.
+    int StitchedVertex(int a, int b, int s, int n, int mask)
+    {
+        if ((a == 0 && (mask & STITCH_X_MIN)) || (a == n && (mask & STITCH_X_MAX))) {
+            b &= ~1;
+        }
+        if ((b == 0 && (mask & STITCH_Y_MIN)) || (b == n && (mask & STITCH_Y_MAX))) {
+            a &= ~1;
+        }
+        return b * s * PATCH_VERTS + a * s;
+    }
+
+    // True if the triangle has zero area (stitching collapses some of them)
+    bool Degenerate(int p, int q, int r)
+    {
+        const int px = p % PATCH_VERTS, py = p / PATCH_VERTS;
+        const int qx = q % PATCH_VERTS - px, qy = q / PATCH_VERTS - py;
+        const int rx = r % PATCH_VERTS - px, ry = r / PATCH_VERTS - py;
+        return qx * ry == qy * rx;
+    }
+}
+
+void BuildPatchIndices(std::vector<PatchIndex> &indices, std::vector<PatchIndexRange> &ranges,
+                       bool optimize_cache)
+{
+    indices.clear();
+    ranges.resize(NUM_PATCH_LODS * NUM_STITCH_MASKS);
+
+    for (int lod = 0; lod < NUM_PATCH_LODS; ++lod) {
+        const int s = 1 << lod;
+        const int n = PATCH_QUADS / s;
+
+        for (int mask = 0; mask < NUM_STITCH_MASKS; ++mask) {
+            PatchIndexRange &range = ranges[lod * NUM_STITCH_MASKS + mask];
+
+            // the coarsest lod never has a coarser neighbour
+            if (n == 1 && mask != 0) {
+                range = ranges[lod * NUM_STITCH_MASKS];
+                continue;
+            }
+
+            range.start = int(indices.size());
+
+            for (int b = 0; b < n; ++b) {
+                for (int a = 0; a < n; ++a) {
+                    const int tl = StitchedVertex(a,   b+1, s, n, mask);
+                    const int bl = StitchedVertex(a,   b,   s, n, mask);
+                    const int tr = StitchedVertex(a+1, b+1, s, n, mask);
+                    const int br = StitchedVertex(a+1, b,   s, n, mask);
+
+                    // write triangles in clockwise order,
+                    // skipping any that stitching has collapsed.
+                    if (!Degenerate(tl, br, bl)) {
+                        indices.push_back(PatchIndex(tl));
+                        indices.push_back(PatchIndex(br));
+                        indices.push_back(PatchIndex(bl));
+                    }
+                    if (!Degenerate(tl, tr, br)) {
+                        indices.push_back(PatchIndex(tl));
+                        indices.push_back(PatchIndex(tr));
+                        indices.push_back(PatchIndex(br));
+                    }
+                }
+            }
+
+            range.count = int(indices.size()) - range.start;
+
+            if (optimize_cache) {
+                OptimizeVertexCache(&indices[range.start], range.count, PATCH_VERTS * PATCH_VERTS);
+            }
+        }
+    }
+}
+
+// Greedy: always emit the triangle with the highest total vertex score,
+// looking only at triangles that use a vertex in the cache (and falling back to
+// the first triangle not yet emitted when there are none). Only the scores
+// around the cache change after each step, so this runs in linear time.
+void OptimizeVertexCache(PatchIndex *indices, int num_indices, int num_vertices)
+{
+    const int num_tris = num_indices / 3;
+    if (num_tris == 0) return;
+
+    // triangles using each vertex; the first remaining_tris[v] entries of
+    // vertex v's list are the ones not yet emitted
+    std::vector<int> remaining_tris(num_vertices, 0);
+    for (int i = 0; i < num_indices; ++i) ++remaining_tris[indices[i]];
+
+    std::vector<int> adj_start(num_vertices + 1, 0);
+    for (int v = 0; v < num_vertices; ++v) adj_start[v+1] = adj_start[v] + remaining_tris[v];
+
+    std::vector<int> adj(num_indices);
+    std::vector<int> fill(adj_start.begin(), adj_start.end() - 1);
+    for (int i = 0; i < num_indices; ++i) adj[fill[indices[i]]++] = i / 3;
+
+    std::vector<int> cache_pos(num_vertices, -1);
+    std::vector<float> vertex_score(num_vertices);
+    for (int v = 0; v < num_vertices; ++v) vertex_score[v] = VertexScore(-1, remaining_tris[v]);
+
+    int best = -1;
+    float best_score = -1;
+    for (int t = 0; t < num_tris; ++t) {
+        const float score = vertex_score[indices[3*t]] + vertex_score[indices[3*t+1]] + vertex_score[indices[3*t+2]];
+        if (score > best_score) {
+            best_score = score;
+            best = t;
+        }
+    }
+
+    std::vector<unsigned char> emitted(num_tris, 0);
+    std::vector<PatchIndex> output;
+    output.reserve(num_indices);
+    std::vector<int> cache, new_cache;
+    cache.reserve(MODEL_CACHE_SIZE + 3);
+    new_cache.reserve(MODEL_CACHE_SIZE + 3);
+    int next_unemitted = 0;
+
+    while (true) {
+        if (best < 0) {
+            while (next_unemitted < num_tris && emitted[next_unemitted]) ++next_unemitted;
+            if (next_unemitted == num_tris) break;
+            best = next_unemitted;
+        }
+
+        emitted[best] = 1;
+        const PatchIndex *tri = indices + 3*best;
+        output.insert(output.end(), tri, tri + 3);
+
+        // this triangle's vertices go to the front of the cache
+        new_cache.assign(tri, tri + 3);
+        for (size_t i = 0; i < cache.size(); ++i) {
+            if (cache[i] != tri[0] && cache[i] != tri[1] && cache[i] != tri[2]) new_cache.push_back(cache[i]);
+        }
+
+        // take the triangle out of its vertices' lists
+        for (int k = 0; k < 3; ++k) {
+            const int v = tri[k];
+            int *list = &adj[adj_start[v]];
+            int *last = list + remaining_tris[v] - 1;
+            std::swap(*std::find(list, last, best), *last);
+            --remaining_tris[v];
+        }
+
+        // rescore the vertices in the cache (and any just pushed out of it)
+        for (size_t i = 0; i < new_cache.size(); ++i) {
+            const int v = new_cache[i];
+            cache_pos[v] = int(i) < MODEL_CACHE_SIZE ? int(i) : -1;
+            vertex_score[v] = VertexScore(cache_pos[v], remaining_tris[v]);
+        }
+
+        // then their triangles, picking the best for next time
+        best = -1;
+        best_score = -1;
+        for (size_t i = 0; i < new_cache.size(); ++i) {
+            const int v = new_cache[i];
+            const int *list = &adj[adj_start[v]];
+            for (int j = 0; j < remaining_tris[v]; ++j) {
+                const int t = list[j];
+                const float score = vertex_score[indices[3*t]] + vertex_score[indices[3*t+1]] + vertex_score[indices[3*t+2]];
+                if (score > best_score) {
+                    best_score = score;
+                    best = t;
+                }
+            }
+        }
+
+        if (int(new_cache.size()) > MODEL_CACHE_SIZE) new_cache.resize(MODEL_CACHE_SIZE);
+        cache.swap(new_cache);
+    }
+
+    std::copy(output.begin(), output.end(), indices);
+}
+
+float ComputeACMR(const PatchIndex *indices, int num_indices, int cache_size)
+{
+    if (num_indices < 3 || cache_size < 1) return 0;
+
+    // FIFO: a hit does not move the vertex
+    std::vector<int> fifo(cache_size, -1);
+    std::vector<unsigned char> in_cache(65536, 0);
+    int head = 0;
+    int misses = 0;
+
+    for (int i = 0; i < num_indices; ++i) {
+        const int v = indices[i];
+        if (in_cache[v]) continue;
+
+        ++misses;
+        if (fifo[head] >= 0) in_cache[fifo[head]] = 0;
+        fifo[head] = v;
+        in_cache[v] = 1;
+        head = (head + 1) % cache_size;
+    }
+
+    return float(misses) / float(num_indices / 3);
+}
@@ -0,0 +1,95 @@
+/*
+ * FILE:
+ *   mesh.hpp
+ *
+ * PURPOSE:
+ *   Builds the index data for the water/terrain mesh.
+ *
+ *   The mesh is split into square patches of PATCH_QUADS * PATCH_QUADS
+ *   quads (see patch_quadtree.hpp for how they are culled and given a
+ *   level of detail). There is no vertex buffer: every patch is drawn
+ *   from the same index data, as an instance, and the vertex shaders
+ *   work out the position of each vertex from SV_VertexID (the vertex
+ *   within the patch) and the patch origin (per-instance data; see
+ *   GetMeshPos in graphics.hlsl). Patches that hang over the edge of
+ *   the mesh have their positions clamped to the edge, so the extra
+ *   triangles there have zero area.
+ *
+ *   Level of detail l uses every 2^l'th vertex of the patch. The
+ *   index data holds one triangle list per (lod, stitch mask); the
+ *   stitch mask says which edges of the patch border a patch one
+ *   level coarser, and on those edges every other vertex is dropped
+ *   so that there are no cracks between the two.
+ *
+ *   Since a patch has fewer than 65536 vertices the indices are 16
+ *   bit, and the index data is the same whatever the mesh size. Each
+ *   triangle list is reordered for the post-transform vertex cache
+ *   (Forsyth's "linear-speed vertex cache optimisation"), so that
+ *   fewer vertices are shaded more than once; ComputeACMR measures
+ *   how well that works.
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef MESH_HPP
+#define MESH_HPP
+
+#include <vector>
+
+const int PATCH_QUADS = 64;
+const int PATCH_VERTS = PATCH_QUADS + 1;   // must match graphics.hlsl
+const int NUM_PATCH_LODS = 7;    // lod NUM_PATCH_LODS-1 is a single quad per patch
+
+// Edges of a patch that border a coarser patch
+enum StitchEdge {
+    STITCH_X_MIN = 1,
+    STITCH_X_MAX = 2,
+    STITCH_Y_MIN = 4,
+    STITCH_Y_MAX = 8,
+    NUM_STITCH_MASKS = 16
+};
+
+typedef unsigned short PatchIndex;
+
+struct PatchIndexRange {
+    int start;    // first index
+    int count;    // number of indices
+};
+
+// Number of patches needed to cover a mesh of the given number of vertices
+inline int NumPatches(int vertices) { return vertices > 1 ? (vertices - 2) / PATCH_QUADS + 1 : 1; }
+
+// Per-instance VS input for water/terrain rendering: the texture index of
+// the first vertex of patch (px, py) (offset by two to avoid the ghost zones).
+struct PatchInstance {
+    int x, y;
+};
+
+inline PatchInstance GetPatchInstance(int px, int py)
+{
+    PatchInstance p = { px * PATCH_QUADS + 2, py * PATCH_QUADS + 2 };
+    return p;
+}
+
+// Clockwise triangle lists for each lod and stitch mask; vertex (i, j) of
+// a patch is index j * PATCH_VERTS + i. ranges[lod * NUM_STITCH_MASKS + mask] gives the part of
+// indices to draw. If optimize_cache is false the triangles are left in
+// row-major order (for comparison).
+void BuildPatchIndices(std::vector<PatchIndex> &indices, std::vector<PatchIndexRange> &ranges,
+                       bool optimize_cache = true);
+
+// Reorders the triangles of a triangle list (not the vertices within each
+// triangle, so the winding is kept) to make good use of a vertex cache.
+void OptimizeVertexCache(PatchIndex *indices, int num_indices, int num_vertices);
+
+// Average cache miss ratio: vertex shader runs per triangle, for a FIFO
+// post-transform cache of the given size. 0.5 is the ideal for a large
+// regular grid; 3 means no reuse at all.
+float ComputeACMR(const PatchIndex *indices, int num_indices, int cache_size);
+
+#endif
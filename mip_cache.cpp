@@ -0,0 +1,244 @@
+/*
+ * FILE:
+ *   mip_cache.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "mip_cache.hpp"
+
+#include "coercri/gfx/load_bmp.hpp"
+#include "coercri/gfx/pixel_array.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <stdexcept>
+
+namespace {
+    // Increase this whenever the file layout or the downsampling changes.
+    const unsigned int CACHE_VERSION = 1;
+    const char CACHE_MAGIC[8] = { 'S', 'W', 'M', 'I', 'P', 'S', 0, 0 };
+
+    struct CacheHeader {
+        char magic[8];
+        unsigned int version;
+        unsigned int width, height, num_levels, num_images;
+        unsigned long long source_hash;
+    };
+
+    // FNV-1a, a 64-bit word at a time (the tail a byte at a time)
+    const unsigned long long FNV_OFFSET = 14695981039346656037ULL;
+    const unsigned long long FNV_PRIME = 1099511628211ULL;
+
+    void HashBytes(unsigned long long &hash, const unsigned char *p, size_t n)
+    {
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            unsigned long long word;
+            std::memcpy(&word, p + i, 8);
+            hash = (hash ^ word) * FNV_PRIME;
+        }
+        for (; i < n; ++i) {
+            hash = (hash ^ p[i]) * FNV_PRIME;
+        }
+    }
+
+    unsigned long long HashFiles(const std::vector<std::string> &filenames)
+    {
+        unsigned long long hash = FNV_OFFSET;
+        std::vector<unsigned char> buf(1 << 20);
+
+        for (size_t i = 0; i < filenames.size(); ++i) {
+            std::ifstream str(filenames[i].c_str(), std::ios::in | std::ios::binary);
+            if (!str) throw std::runtime_error("Could not open " + filenames[i]);
+
+            unsigned long long length = 0;
+            while (str) {
+                str.read(reinterpret_cast<char*>(&buf[0]), buf.size());
+                const size_t n = size_t(str.gcount());
+                HashBytes(hash, &buf[0], n);
+                length += n;
+            }
+
+            // so that moving bytes from one file to the next changes the hash
+            HashBytes(hash, reinterpret_cast<const unsigned char*>(&length), sizeof(length));
+        }
+
+        return hash;
+    }
+
+    struct LoadedImage {
+        int width, height;
+        std::vector<unsigned char> data;    // with mips
+    };
+
+    LoadedImage LoadImageWithMips(const std::string &filename)
+    {
+        boost::shared_ptr<Coercri::PixelArray> parr = Coercri::LoadBMPFile(filename);
+
+        LoadedImage img;
+        img.width = parr->getWidth();
+        img.height = parr->getHeight();
+
+        const unsigned char *pixels = reinterpret_cast<const unsigned char *>(&(*parr)(0,0));
+        img.data.assign(pixels, pixels + img.width * img.height * 4);
+        BuildMipChain(img.data, img.width, img.height);
+        return img;
+    }
+
+    bool ReadCache(const std::string &cache_filename, unsigned long long source_hash, size_t num_images,
+                   MipChains &result)
+    {
+        std::ifstream str(cache_filename.c_str(), std::ios::in | std::ios::binary);
+        if (!str) return false;
+
+        CacheHeader header;
+        str.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!str
+        || std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0
+        || header.version != CACHE_VERSION
+        || header.source_hash != source_hash
+        || header.num_images != num_images
+        || header.width == 0 || header.width > 65535
+        || header.height == 0 || header.height > 65535
+        || header.num_levels != unsigned(GetNumMipLevels(header.width, header.height))) {
+            return false;
+        }
+
+        result.width = header.width;
+        result.height = header.height;
+        result.num_levels = header.num_levels;
+        result.images.resize(num_images);
+
+        const size_t image_size = GetMipOffset(result.width, result.height, result.num_levels);
+        for (size_t i = 0; i < num_images; ++i) {
+            result.images[i].resize(image_size);
+            str.read(reinterpret_cast<char*>(&result.images[i][0]), image_size);
+        }
+
+        // reject a truncated (or overlong) file
+        return str && str.peek() == std::char_traits<char>::eof();
+    }
+
+    // Failure to write the cache is not an error; the next run will just
+    // have to build the mips again.
+    void WriteCache(const std::string &cache_filename, unsigned long long source_hash, const MipChains &chains)
+    {
+        CacheHeader header;
+        std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        header.version = CACHE_VERSION;
+        header.width = chains.width;
+        header.height = chains.height;
+        header.num_levels = chains.num_levels;
+        header.num_images = unsigned(chains.images.size());
+        header.source_hash = source_hash;
+
+        // write to a temporary file first, so a run that is stopped part way
+        // through never leaves a half-written cache file behind
+        const std::string tmp_filename = cache_filename + ".tmp";
+        {
+            std::ofstream str(tmp_filename.c_str(), std::ios::out | std::ios::binary);
+            str.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            for (size_t i = 0; i < chains.images.size(); ++i) {
+                str.write(reinterpret_cast<const char*>(&chains.images[i][0]), chains.images[i].size());
+            }
+            if (!str) {
+                str.close();
+                std::remove(tmp_filename.c_str());
+                return;
+            }
+        }
+
+        std::remove(cache_filename.c_str());
+        if (std::rename(tmp_filename.c_str(), cache_filename.c_str()) != 0) {
+            std::remove(tmp_filename.c_str());
+        }
+    }
+}
+
+int GetNumMipLevels(int width, int height)
+{
+    int num_levels = 1;
+    while (width > 1 || height > 1) {
+        width = GetMipSize(width, 1);
+        height = GetMipSize(height, 1);
+        ++num_levels;
+    }
+    return num_levels;
+}
+
+size_t GetMipOffset(int width, int height, int level)
+{
+    size_t offset = 0;
+    for (int i = 0; i < level; ++i) {
+        offset += size_t(GetMipSize(width, i)) * GetMipSize(height, i) * 4;
+    }
+    return offset;
+}
+
+void BuildMipChain(std::vector<unsigned char> &image, int width, int height)
+{
+    const int num_levels = GetNumMipLevels(width, height);
+    image.resize(GetMipOffset(width, height, num_levels));
+
+    for (int level = 1; level < num_levels; ++level) {
+        const int in_w = GetMipSize(width, level - 1), in_h = GetMipSize(height, level - 1);
+        const int out_w = GetMipSize(width, level), out_h = GetMipSize(height, level);
+        const unsigned char *in = &image[GetMipOffset(width, height, level - 1)];
+        unsigned char *out = &image[GetMipOffset(width, height, level)];
+
+        // 2x2 box filter. Where the level above has an odd size, the last
+        // row/column is averaged with itself.
+        for (int y = 0; y < out_h; ++y) {
+            const unsigned char *row0 = in + (2*y) * in_w * 4;
+            const unsigned char *row1 = in + std::min(2*y + 1, in_h - 1) * in_w * 4;
+
+            for (int x = 0; x < out_w; ++x) {
+                const int c0 = 2*x*4;
+                const int c1 = std::min(2*x + 1, in_w - 1) * 4;
+                for (int component = 0; component < 4; ++component) {
+                    const int sum = row0[c0 + component] + row0[c1 + component]
+                        + row1[c0 + component] + row1[c1 + component];
+                    *out++ = (sum + 2) / 4;
+                }
+            }
+        }
+    }
+}
+
+void LoadMipChains(const std::vector<std::string> &filenames, const std::string &cache_filename,
+                   MipChains &result)
+{
+    const unsigned long long source_hash = HashFiles(filenames);
+    if (ReadCache(cache_filename, source_hash, filenames.size(), result)) return;
+
+    // decode the images and build their mips at the same time, one thread each
+    std::vector<std::future<LoadedImage> > loads;
+    for (size_t i = 0; i < filenames.size(); ++i) {
+        loads.push_back(std::async(std::launch::async, &LoadImageWithMips, filenames[i]));
+    }
+
+    result.images.resize(filenames.size());
+    for (size_t i = 0; i < filenames.size(); ++i) {
+        LoadedImage img = loads[i].get();    // (rethrows any load error)
+
+        if (i == 0) {
+            result.width = img.width;
+            result.height = img.height;
+            result.num_levels = GetNumMipLevels(img.width, img.height);
+        } else if (img.width != result.width || img.height != result.height) {
+            throw std::runtime_error("Image has the wrong size: " + filenames[i]);
+        }
+        result.images[i].swap(img.data);
+    }
+
+    WriteCache(cache_filename, source_hash, result);
+}
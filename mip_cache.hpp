@@ -0,0 +1,57 @@
+/*
+ * FILE:
+ *   mip_cache.hpp
+ *
+ * PURPOSE:
+ *   Loads the BMP textures (grass, skybox) together with their
+ *   complete mip chains.
+ *
+ *   The first time, the BMPs are decoded (one thread per image) and
+ *   each level is made by averaging 2x2 texels of the level above.
+ *   The result is then written to a cache file, along with a hash of
+ *   the BMP files' contents; later runs that find a cache file made
+ *   from the same BMPs read the mip chains straight from it, without
+ *   decoding anything.
+ *
+ *   None of this touches Direct3D.
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef MIP_CACHE_HPP
+#define MIP_CACHE_HPP
+
+#include <string>
+#include <vector>
+
+// One or more images of the same size, each with all of its mip levels.
+// Texels are RGBA, 8 bits per channel.
+struct MipChains {
+    int width, height;     // of level 0
+    int num_levels;        // down to 1x1
+
+    // one per image: every level in turn, largest first, rows tightly packed
+    std::vector<std::vector<unsigned char> > images;
+};
+
+// Number of levels in a full mip chain (the last level is 1x1).
+int GetNumMipLevels(int width, int height);
+
+// Size of the given level, and where it starts in MipChains::images[i] (bytes).
+inline int GetMipSize(int size, int level) { return size >> level > 0 ? size >> level : 1; }
+size_t GetMipOffset(int width, int height, int level);
+
+// image holds level 0 on entry; the other levels are appended to it.
+void BuildMipChain(std::vector<unsigned char> &image, int width, int height);
+
+// Loads the BMPs, which must all be the same size, via the cache file (which is
+// written if it is missing or out of date). Throws on error.
+void LoadMipChains(const std::vector<std::string> &filenames, const std::string &cache_filename,
+                   MipChains &result);
+
+#endif
@@ -0,0 +1,332 @@
+/*
+ * FILE:
+ *   patch_quadtree.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "mesh.hpp"
+#include "patch_quadtree.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    // Lod error allowed for the water surface, per unit of coarse grid spacing
+    // (see patch_quadtree.hpp).
+    const float WATER_SLOPE = 0.1f;
+
+    // The pyramid only has block average depths, so waves can stand above it by
+    // a little; and WaterVertexShader pulls dry water down to just below the terrain.
+    const float WAVE_MARGIN = 2.0f;
+    const float DRY_MARGIN = 0.5f;
+
+    // w_clip is never allowed below this when projecting the error
+    const float MIN_DEPTH = 0.01f;
+}
+
+Frustum::Frustum(const float m[16])
+{
+    // rows of the matrix
+    const float *r0 = m, *r1 = m + 4, *r2 = m + 8, *r3 = m + 12;
+
+    for (int k = 0; k < 4; ++k) {
+        planes[0][k] = r3[k] + r0[k];   // left
+        planes[1][k] = r3[k] - r0[k];   // right
+        planes[2][k] = r3[k] + r1[k];   // bottom
+        planes[3][k] = r3[k] - r1[k];   // top
+        planes[4][k] = r2[k];           // near
+        planes[5][k] = r3[k] - r2[k];   // far
+    }
+}
+
+Frustum::Result Frustum::testBox(const float lo[3], const float hi[3]) const
+{
+    bool intersects = false;
+
+    for (int p = 0; p < 6; ++p) {
+        const float *pl = planes[p];
+
+        // the corners furthest along and furthest against the plane normal
+        float d_max = pl[3], d_min = pl[3];
+        for (int k = 0; k < 3; ++k) {
+            if (pl[k] >= 0) {
+                d_max += pl[k] * hi[k];
+                d_min += pl[k] * lo[k];
+            } else {
+                d_max += pl[k] * lo[k];
+                d_min += pl[k] * hi[k];
+            }
+        }
+
+        if (d_max < 0) return OUTSIDE;
+        if (d_min < 0) intersects = true;
+    }
+
+    return intersects ? INTERSECTS : INSIDE;
+}
+
+PatchQuadtree::PatchQuadtree()
+    : nx(0), ny(0), npx(0), npy(0), W(1), L(1)
+{ }
+
+void PatchQuadtree::resize(int nx_, int ny_, float W_, float L_)
+{
+    nx = nx_;
+    ny = ny_;
+    npx = NumPatches(nx);
+    npy = NumPatches(ny);
+    W = W_;
+    L = L_;
+
+    const int n = npx * npy;
+    terrain_min.assign(n, 0.0f);
+    terrain_max.assign(n, 0.0f);
+    surface_max.assign(n, 0.0f);
+    lod_error.assign(n * NUM_PATCH_LODS, 0.0f);
+    lod.assign(n, 0);
+    visible.assign(n, 0);
+
+    levels.clear();
+    level_w.clear();
+    level_h.clear();
+    int w = npx, h = npy;
+    while (true) {
+        levels.push_back(std::vector<Bounds>(w * h));
+        level_w.push_back(w);
+        level_h.push_back(h);
+        if (w == 1 && h == 1) break;
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+    }
+}
+
+void PatchQuadtree::updateTerrain(const TerrainEntry *heightfield)
+{
+    updateTerrain(heightfield, 0, nx + 4, 0, ny + 4);
+}
+
+void PatchQuadtree::updateTerrain(const TerrainEntry *heightfield, int ix_min, int ix_max, int iy_min, int iy_max)
+{
+    if (npx == 0) return;
+
+    // mesh vertices that changed (heightfield index = mesh index + 2); the vertex
+    // on the boundary between two patches belongs to both of them.
+    const int mx_min = std::max(0, ix_min - 2), mx_max = std::min(nx - 1, ix_max - 3);
+    const int my_min = std::max(0, iy_min - 2), my_max = std::min(ny - 1, iy_max - 3);
+    if (mx_min > mx_max || my_min > my_max) return;
+
+    const int px_min = std::max(0, (mx_min - 1) / PATCH_QUADS), px_max = std::min(npx - 1, mx_max / PATCH_QUADS);
+    const int py_min = std::max(0, (my_min - 1) / PATCH_QUADS), py_max = std::min(npy - 1, my_max / PATCH_QUADS);
+
+    for (int py = py_min; py <= py_max; ++py) {
+        for (int px = px_min; px <= px_max; ++px) {
+            updatePatchTerrain(heightfield, px, py);
+        }
+    }
+
+    rebuildBounds();
+}
+
+void PatchQuadtree::updatePatchTerrain(const TerrainEntry *heightfield, int px, int py)
+{
+    // heights of the patch vertices (clamped to the mesh, as GetMeshPos in graphics.hlsl)
+    float z[PATCH_VERTS * PATCH_VERTS];
+    for (int j = 0; j < PATCH_VERTS; ++j) {
+        const int my = std::min(py * PATCH_QUADS + j, ny - 1);
+        const TerrainEntry *row = heightfield + (my + 2) * (nx + 4) + 2;
+        for (int i = 0; i < PATCH_VERTS; ++i) {
+            z[j * PATCH_VERTS + i] = row[std::min(px * PATCH_QUADS + i, nx - 1)].B;
+        }
+    }
+
+    const int patch = py * npx + px;
+    terrain_min[patch] = *std::min_element(z, z + PATCH_VERTS * PATCH_VERTS);
+    terrain_max[patch] = *std::max_element(z, z + PATCH_VERTS * PATCH_VERTS);
+    surface_max[patch] = std::max(surface_max[patch], terrain_max[patch]);
+
+    // largest distance between the terrain and each lod's triangles
+    // (split along the tl-br diagonal, as in BuildPatchIndices)
+    const float spacing = std::max(W / std::max(1, nx - 1), L / std::max(1, ny - 1));
+    float *err = &lod_error[patch * NUM_PATCH_LODS];
+    err[0] = 0;
+
+    for (int l = 1; l < NUM_PATCH_LODS; ++l) {
+        const int s = 1 << l;
+        float e = 0;
+
+        for (int j = 0; j < PATCH_VERTS; ++j) {
+            const int b0 = std::min(j / s * s, PATCH_QUADS - s);
+            const float v = float(j - b0) / s;
+
+            for (int i = 0; i < PATCH_VERTS; ++i) {
+                const int a0 = std::min(i / s * s, PATCH_QUADS - s);
+                const float u = float(i - a0) / s;
+
+                const float bl = z[b0 * PATCH_VERTS + a0];
+                const float br = z[b0 * PATCH_VERTS + a0 + s];
+                const float tl = z[(b0 + s) * PATCH_VERTS + a0];
+                const float tr = z[(b0 + s) * PATCH_VERTS + a0 + s];
+
+                const float approx = (u + v <= 1) ? bl + u * (br - bl) + v * (tl - bl)
+                                                  : tr + (1 - u) * (tl - tr) + (1 - v) * (br - tr);
+                e = std::max(e, std::fabs(z[j * PATCH_VERTS + i] - approx));
+            }
+        }
+
+        err[l] = std::max(std::max(e, err[l-1]), WATER_SLOPE * s * spacing);
+    }
+}
+
+void PatchQuadtree::updateSurface(const HeightPyramid &pyramid)
+{
+    for (int py = 0; py < npy; ++py) {
+        const int my_min = py * PATCH_QUADS, my_max = std::min(my_min + PATCH_QUADS, ny - 1);
+        for (int px = 0; px < npx; ++px) {
+            const int mx_min = px * PATCH_QUADS, mx_max = std::min(mx_min + PATCH_QUADS, nx - 1);
+            const int patch = py * npx + px;
+            surface_max[patch] = std::max(terrain_max[patch],
+                                          pyramid.getMaxHeight(mx_min, mx_max, my_min, my_max) + WAVE_MARGIN);
+        }
+    }
+
+    rebuildBounds();
+}
+
+void PatchQuadtree::rebuildBounds()
+{
+    std::vector<Bounds> &base = levels[0];
+    for (int k = 0; k < npx * npy; ++k) {
+        base[k].z_min = terrain_min[k] - DRY_MARGIN;
+        base[k].z_max = surface_max[k];
+    }
+
+    for (size_t lev = 1; lev < levels.size(); ++lev) {
+        const std::vector<Bounds> &below = levels[lev - 1];
+        std::vector<Bounds> &here = levels[lev];
+        const int w_below = level_w[lev - 1], h_below = level_h[lev - 1];
+
+        for (int j = 0; j < level_h[lev]; ++j) {
+            const int j0 = 2*j, j1 = std::min(2*j + 1, h_below - 1);
+            for (int i = 0; i < level_w[lev]; ++i) {
+                const int i0 = 2*i, i1 = std::min(2*i + 1, w_below - 1);
+                const Bounds &a = below[j0 * w_below + i0], &b = below[j0 * w_below + i1];
+                const Bounds &c = below[j1 * w_below + i0], &d = below[j1 * w_below + i1];
+                Bounds &out = here[j * level_w[lev] + i];
+                out.z_min = std::min(std::min(a.z_min, b.z_min), std::min(c.z_min, d.z_min));
+                out.z_max = std::max(std::max(a.z_max, b.z_max), std::max(c.z_max, d.z_max));
+            }
+        }
+    }
+}
+
+// Box of node (i,j) of the given level, in (tex_x, tex_y, world_z) space.
+void PatchQuadtree::nodeBox(int level, int i, int j, float lo[3], float hi[3]) const
+{
+    const Bounds &b = levels[level][j * level_w[level] + i];
+    lo[0] = float(std::min((i << level) * PATCH_QUADS, nx - 1) + 2);
+    hi[0] = float(std::min(((i + 1) << level) * PATCH_QUADS, nx - 1) + 2);
+    lo[1] = float(std::min((j << level) * PATCH_QUADS, ny - 1) + 2);
+    hi[1] = float(std::min(((j + 1) << level) * PATCH_QUADS, ny - 1) + 2);
+    lo[2] = b.z_min;
+    hi[2] = b.z_max;
+}
+
+void PatchQuadtree::cullNode(const Frustum &frustum, int level, int i, int j, bool inside)
+{
+    if (!inside) {
+        float lo[3], hi[3];
+        nodeBox(level, i, j, lo, hi);
+        const Frustum::Result r = frustum.testBox(lo, hi);
+        if (r == Frustum::OUTSIDE) return;
+        inside = (r == Frustum::INSIDE);
+    }
+
+    if (level == 0) {
+        visible[j * npx + i] = 1;
+        return;
+    }
+
+    const int w_below = level_w[level - 1], h_below = level_h[level - 1];
+    for (int cj = 2*j; cj <= std::min(2*j + 1, h_below - 1); ++cj) {
+        for (int ci = 2*i; ci <= std::min(2*i + 1, w_below - 1); ++ci) {
+            cullNode(frustum, level - 1, ci, cj, inside);
+        }
+    }
+}
+
+void PatchQuadtree::select(const float tex_to_clip[16], float pixels_per_unit, float max_pixel_error,
+                           std::vector<DrawItem> &draw_items)
+{
+    draw_items.clear();
+    if (npx == 0) return;
+
+    std::fill(visible.begin(), visible.end(), 0);
+    cullNode(Frustum(tex_to_clip), int(levels.size()) - 1, 0, 0, false);
+
+    // Coarsest acceptable lod of each patch (including the culled ones, as
+    // their lods still decide the stitching of visible neighbours).
+    // w_clip is the distance along the view direction, so its smallest value
+    // over the patch box gives the largest projected error.
+    const float *r3 = tex_to_clip + 12;
+    for (int py = 0; py < npy; ++py) {
+        for (int px = 0; px < npx; ++px) {
+            const int patch = py * npx + px;
+            float lo[3], hi[3];
+            nodeBox(0, px, py, lo, hi);
+
+            float w_min = r3[3];
+            for (int k = 0; k < 3; ++k) w_min += r3[k] * (r3[k] >= 0 ? lo[k] : hi[k]);
+            w_min = std::max(w_min, MIN_DEPTH);
+
+            const float *err = &lod_error[patch * NUM_PATCH_LODS];
+            int l = 0;
+            while (l + 1 < NUM_PATCH_LODS && err[l + 1] * pixels_per_unit <= max_pixel_error * w_min) ++l;
+            lod[patch] = l;
+        }
+    }
+
+    // Neighbours may differ by at most one lod. Refining a patch can only
+    // force its neighbours to refine, so this settles within NUM_PATCH_LODS sweeps.
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int py = 0; py < npy; ++py) {
+            for (int px = 0; px < npx; ++px) {
+                int &l = lod[py * npx + px];
+                int limit = l;
+                if (px > 0) limit = std::min(limit, lod[py * npx + px - 1] + 1);
+                if (px < npx - 1) limit = std::min(limit, lod[py * npx + px + 1] + 1);
+                if (py > 0) limit = std::min(limit, lod[(py - 1) * npx + px] + 1);
+                if (py < npy - 1) limit = std::min(limit, lod[(py + 1) * npx + px] + 1);
+                if (limit < l) {
+                    l = limit;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    for (int py = 0; py < npy; ++py) {
+        for (int px = 0; px < npx; ++px) {
+            const int patch = py * npx + px;
+            if (!visible[patch]) continue;
+
+            const int l = lod[patch];
+            DrawItem item;
+            item.patch = patch;
+            item.lod = l;
+            item.stitch = 0;
+            if (px > 0 && lod[patch - 1] > l) item.stitch |= STITCH_X_MIN;
+            if (px < npx - 1 && lod[patch + 1] > l) item.stitch |= STITCH_X_MAX;
+            if (py > 0 && lod[patch - npx] > l) item.stitch |= STITCH_Y_MIN;
+            if (py < npy - 1 && lod[patch + npx] > l) item.stitch |= STITCH_Y_MAX;
+            draw_items.push_back(item);
+        }
+    }
+}
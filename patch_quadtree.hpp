@@ -0,0 +1,115 @@
+/*
+ * FILE:
+ *   patch_quadtree.hpp
+ *
+ * PURPOSE:
+ *   Chooses which patches of the water/terrain mesh (see mesh.hpp) to
+ *   draw each frame, and at what level of detail.
+ *
+ *   The patches are the leaves of a quadtree; every node stores a
+ *   bounding box, in the (tex_x, tex_y, world_z) space that the
+ *   vertex shaders transform with tex_to_clip. The tree is walked
+ *   from the top, dropping whole subtrees that are outside the view
+ *   frustum and accepting whole subtrees that are inside it.
+ *
+ *   Each patch then gets the coarsest lod whose error, projected to
+ *   the screen at the nearest point of the patch, is within the
+ *   given number of pixels. The error of a lod is the largest
+ *   vertical distance between the terrain and its coarser
+ *   triangulation, but at least WATER_SLOPE times the coarse grid
+ *   spacing, to allow for the water surface (which is not known on
+ *   the CPU). Lods are then lowered where needed so that neighbouring
+ *   patches differ by at most one level, which is what the stitched
+ *   index sets assume.
+ *
+ *   None of this touches Direct3D.
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef PATCH_QUADTREE_HPP
+#define PATCH_QUADTREE_HPP
+
+#include "height_pyramid.hpp"
+#include "terrain_heightfield.hpp"
+
+#include <vector>
+
+// Six planes (a, b, c, d), with a*x + b*y + c*z + d >= 0 inside, taken from a
+// row-major clip matrix (Direct3D convention, 0 <= z_clip <= w_clip).
+class Frustum {
+public:
+    enum Result { OUTSIDE, INTERSECTS, INSIDE };
+
+    explicit Frustum(const float clip_matrix[16]);
+
+    Result testBox(const float lo[3], const float hi[3]) const;
+
+private:
+    float planes[6][4];
+};
+
+class PatchQuadtree {
+public:
+    struct DrawItem {
+        int patch;     // py * getPatchesX() + px
+        int lod;
+        int stitch;    // STITCH_X_MIN etc.
+    };
+
+    PatchQuadtree();
+
+    // Sets up for an nx * ny mesh covering [-W/2, W/2] * [0, L].
+    // Call updateTerrain and updateSurface afterwards.
+    void resize(int nx, int ny, float W, float L);
+
+    // Recomputes the terrain bounds and lod errors of all patches touching the
+    // given range of the heightfield (indices include the ghost zones; max is
+    // exclusive). The heightfield is (nx+4) * (ny+4), i.e. g_terrain_heightfield.
+    void updateTerrain(const TerrainEntry *heightfield);
+    void updateTerrain(const TerrainEntry *heightfield, int ix_min, int ix_max, int iy_min, int iy_max);
+
+    // Takes the top of each patch's box from the terrain + water maxima.
+    void updateSurface(const HeightPyramid &pyramid);
+
+    // Fills in the patches to draw. tex_to_clip is row major (as the
+    // constant buffer); pixels_per_unit is the size on screen, in pixels,
+    // of one world unit at unit distance from the eye.
+    void select(const float tex_to_clip[16], float pixels_per_unit, float max_pixel_error,
+                std::vector<DrawItem> &draw_items);
+
+    int getPatchesX() const { return npx; }
+    int getPatchesY() const { return npy; }
+
+private:
+    struct Bounds {
+        float z_min, z_max;
+    };
+
+    void nodeBox(int level, int i, int j, float lo[3], float hi[3]) const;
+    void cullNode(const Frustum &frustum, int level, int i, int j, bool inside);
+    void updatePatchTerrain(const TerrainEntry *heightfield, int px, int py);
+    void rebuildBounds();
+
+private:
+    int nx, ny, npx, npy;
+    float W, L;
+
+    // per patch
+    std::vector<float> terrain_min, terrain_max, surface_max;
+    std::vector<float> lod_error;     // NUM_PATCH_LODS per patch, world units
+    std::vector<int> lod;
+    std::vector<unsigned char> visible;
+
+    // levels[0] is npx * npy; each level after that is half the size
+    // (rounded up), down to 1 * 1.
+    std::vector<std::vector<Bounds> > levels;
+    std::vector<int> level_w, level_h;
+};
+
+#endif
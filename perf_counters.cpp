@@ -0,0 +1,88 @@
+/*
+ * FILE:
+ *   perf_counters.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "perf_counters.hpp"
+#include "settings.hpp"
+
+#include <cstring>
+
+PerfCounters g_perf_counters;
+std::atomic<bool> g_perf_counters_enabled(false);
+
+namespace {
+    struct ZoneTimer {
+        const char *zone_name;
+        PerfTimer timer;
+    };
+
+    // GPU profiler zones (see engine.cpp) that feed the perf tab
+    const ZoneTimer ZONE_TIMERS[] = {
+        { "Timestep", PT_TIMESTEP },
+        { "Pass1", PT_PASS1 },
+        { "Pass1 (bootstrap)", PT_PASS1 },
+        { "Pass2", PT_PASS2 },
+        { "Pass3", PT_PASS3 },
+        { "Boundaries", PT_BOUNDARY },
+        { "BoundaryCopyBack", PT_BOUNDARY },
+        { "Render", PT_RENDER }
+    };
+
+    // average GPU time per call of the given timer, in ms
+    float GpuMsPer(PerfTimer t, long long calls)
+    {
+        return calls > 0 ? float(double(g_perf_counters.gpu_ns[t]) / 1.0e6 / double(calls)) : 0.0f;
+    }
+}
+
+int PerfTimerForZone(const char *zone_name)
+{
+    for (size_t i = 0; i < sizeof(ZONE_TIMERS) / sizeof(ZONE_TIMERS[0]); ++i) {
+        if (std::strcmp(zone_name, ZONE_TIMERS[i].zone_name) == 0) return ZONE_TIMERS[i].timer;
+    }
+    return -1;
+}
+
+void PublishPerfCounters(double elapsed_seconds)
+{
+    PerfCounters &pc = g_perf_counters;
+
+    // GPU results arrive a few frames late, so the per-step figures are
+    // averaged over the GPU's own count rather than pc.timesteps.
+    const long long gpu_steps = (long long)pc.gpu_count[PT_TIMESTEP];
+    SetSetting(SH_PERF_STEP_TIME, GpuMsPer(PT_TIMESTEP, gpu_steps));
+    SetSetting(SH_PERF_PASS1_TIME, GpuMsPer(PT_PASS1, gpu_steps));
+    SetSetting(SH_PERF_PASS2_TIME, GpuMsPer(PT_PASS2, gpu_steps));
+    SetSetting(SH_PERF_PASS3_TIME, GpuMsPer(PT_PASS3, gpu_steps));
+    SetSetting(SH_PERF_BOUNDARY_TIME, GpuMsPer(PT_BOUNDARY, gpu_steps));
+    SetSetting(SH_PERF_RENDER_TIME, GpuMsPer(PT_RENDER, (long long)pc.gpu_count[PT_RENDER]));
+
+    const double frames = pc.frames > 0 ? double(pc.frames) : 1.0;
+    if (elapsed_seconds > 0) {
+        SetSetting(SH_PERF_CELL_UPDATES, float(double(pc.cell_updates) / elapsed_seconds));
+        SetSetting(SH_PERF_WORKER_UTILISATION, float(double(pc.busy_ns) / 1.0e9 / elapsed_seconds));
+    }
+    SetSetting(SH_PERF_WET_FRACTION, pc.wet_fraction);
+    SetSetting(SH_PERF_TRIANGLES, float(double(pc.triangles) / frames));
+    SetSetting(SH_PERF_READBACK_TIME, float(double(pc.readback_ns) / 1.0e6 / frames));
+    SetSetting(SH_PERF_UPLOAD_BYTES, float(double(pc.upload_bytes) / frames));
+
+    SetSetting(SH_PERF_FRAME_P50, float(pc.frame_times.getPercentile(0.5) / 1.0e6));
+    SetSetting(SH_PERF_FRAME_P99, float(pc.frame_times.getPercentile(0.99) / 1.0e6));
+    SetSetting(SH_PERF_FRAME_MAX, float(pc.frame_times.getMax() / 1.0e6));
+    SetSetting(SH_PERF_STEP_WALL_P50, float(pc.step_times.getPercentile(0.5) / 1.0e6));
+    SetSetting(SH_PERF_STEP_WALL_P99, float(pc.step_times.getPercentile(0.99) / 1.0e6));
+    SetSetting(SH_PERF_STEP_WALL_MAX, float(pc.step_times.getMax() / 1.0e6));
+
+    const float wet_fraction = pc.wet_fraction;
+    pc = PerfCounters();   // (zeroes everything)
+    pc.wet_fraction = wet_fraction;
+}
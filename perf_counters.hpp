@@ -0,0 +1,88 @@
+/*
+ * FILE:
+ *   perf_counters.hpp
+ *
+ * PURPOSE:
+ *   Performance counters shown on the "perf" tab of the GUI. The
+ *   engine adds to these as it goes (plain integer adds, so they are
+ *   always on); every so often the main loop calls
+ *   PublishPerfCounters, which turns the totals into per-frame and
+ *   per-step figures, stores them in the corresponding S_LABEL
+ *   settings, and starts a new period.
+ *
+ *   The GPU pass timings come from GpuProfiler, which only issues
+ *   its timestamp queries while PerfCountersEnabled() (i.e. while the
+ *   perf tab is visible) or while the profiler is recording.
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef PERF_COUNTERS_HPP
+#define PERF_COUNTERS_HPP
+
+#include "latency_histogram.hpp"
+#include "profiler.hpp"
+
+#include <atomic>
+
+enum PerfTimer {
+    PT_TIMESTEP,     // the whole of one timestep
+    PT_PASS1,
+    PT_PASS2,
+    PT_PASS3,
+    PT_BOUNDARY,     // boundary shaders plus copy back
+    PT_RENDER,
+    NUM_PERF_TIMERS
+};
+
+struct PerfCounters {
+    // GPU time per PerfTimer, in nanoseconds (filled in by GpuProfiler)
+    unsigned long long gpu_ns[NUM_PERF_TIMERS];
+    unsigned long long gpu_count[NUM_PERF_TIMERS];
+
+    long long frames;
+    long long timesteps;
+    long long cell_updates;          // nx * ny per timestep
+    long long triangles;             // water + terrain triangles drawn
+    unsigned long long upload_bytes; // UpdateSubresource / Map(WRITE) traffic to the GPU
+    unsigned long long readback_ns;  // CPU time spent waiting for GPU -> CPU copies
+    unsigned long long busy_ns;      // time the simulation thread spent doing simulation work
+    float wet_fraction;              // from the most recent GetStats readback
+
+    LatencyHistogram frame_times;    // ns between presented frames
+    LatencyHistogram step_times;     // wall clock ns per timestep (for the GPU, the average over
+                                     // each frame, including waiting in the GetStats readback)
+};
+
+extern PerfCounters g_perf_counters;
+
+// Returns the PerfTimer for a GPU profiler zone name, or -1.
+int PerfTimerForZone(const char *zone_name);
+
+// The GUI turns this on while the perf tab is showing.
+extern std::atomic<bool> g_perf_counters_enabled;
+inline bool PerfCountersEnabled() { return g_perf_counters_enabled.load(std::memory_order_relaxed); }
+inline void SetPerfCountersEnabled(bool enabled) { g_perf_counters_enabled.store(enabled, std::memory_order_relaxed); }
+
+// Writes the counters accumulated over the last elapsed_seconds to the perf
+// labels (SH_PERF_*), then clears them. Does not allocate.
+void PublishPerfCounters(double elapsed_seconds);
+
+// Adds the lifetime of the object to g_perf_counters.busy_ns.
+class PerfBusyScope {
+public:
+    PerfBusyScope() : start(ProfilerTicks()) { }
+    ~PerfBusyScope() { g_perf_counters.busy_ns += ProfilerTicks() - start; }
+
+private:
+    PerfBusyScope(const PerfBusyScope &);
+    void operator=(const PerfBusyScope &);
+    unsigned long long start;
+};
+
+#endif
@@ -0,0 +1,134 @@
+/*
+ * FILE:
+ *   png_writer.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ * NOTES:
+ *   Source: the PNG specification (RFC 2083) and RFC 1950/1951 for
+ *   the zlib stream.
+ *
+ */
+
+#include "png_writer.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+    class Crc32Table {
+    public:
+        Crc32Table()
+        {
+            for (unsigned int n = 0; n < 256; ++n) {
+                unsigned int c = n;
+                for (int k = 0; k < 8; ++k) {
+                    c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                }
+                table[n] = c;
+            }
+        }
+
+        unsigned int update(unsigned int crc, const unsigned char *p, size_t n) const
+        {
+            for (size_t i = 0; i < n; ++i) {
+                crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+            }
+            return crc;
+        }
+
+    private:
+        unsigned int table[256];
+    };
+
+    const Crc32Table g_crc_table;
+
+    // PNG is big-endian
+    void PutLong(std::vector<unsigned char> &buf, unsigned int x)
+    {
+        buf.push_back((x >> 24) & 0xff);
+        buf.push_back((x >> 16) & 0xff);
+        buf.push_back((x >> 8) & 0xff);
+        buf.push_back(x & 0xff);
+    }
+
+    // appends length, type, data and CRC (which covers the type and data)
+    void PutChunk(std::vector<unsigned char> &out, const char *type, const std::vector<unsigned char> &data)
+    {
+        PutLong(out, unsigned(data.size()));
+        const size_t type_start = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data.begin(), data.end());
+        const unsigned int crc = g_crc_table.update(0xffffffffu, &out[type_start], out.size() - type_start) ^ 0xffffffffu;
+        PutLong(out, crc);
+    }
+}
+
+void WritePNG(const std::string &filename, int width, int height, const unsigned char *rgba)
+{
+    std::vector<unsigned char> ihdr;
+    PutLong(ihdr, width);
+    PutLong(ihdr, height);
+    ihdr.push_back(8);   // bit depth
+    ihdr.push_back(6);   // colour type: RGBA
+    ihdr.push_back(0);   // compression method
+    ihdr.push_back(0);   // filter method
+    ihdr.push_back(0);   // no interlace
+
+    // The raw image: each row is preceded by its filter type (0 = none).
+    const size_t row_bytes = size_t(width) * 4;
+    std::vector<unsigned char> raw;
+    raw.reserve((row_bytes + 1) * height);
+    for (int y = 0; y < height; ++y) {
+        raw.push_back(0);
+        raw.insert(raw.end(), rgba + y * row_bytes, rgba + (y + 1) * row_bytes);
+    }
+
+    // zlib stream made of stored (uncompressed) deflate blocks, at most 65535 bytes each
+    std::vector<unsigned char> idat;
+    idat.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+    idat.push_back(0x78);   // deflate, 32K window
+    idat.push_back(0x01);   // (header checksum)
+
+    unsigned int adler_a = 1, adler_b = 0;
+    size_t pos = 0;
+    do {
+        const size_t n = std::min(raw.size() - pos, size_t(65535));
+        idat.push_back(pos + n == raw.size() ? 1 : 0);   // final block?
+        idat.push_back(n & 0xff);
+        idat.push_back((n >> 8) & 0xff);
+        idat.push_back(~n & 0xff);
+        idat.push_back((~n >> 8) & 0xff);
+        idat.insert(idat.end(), raw.begin() + pos, raw.begin() + pos + n);
+
+        // 5552 is the most bytes that can be summed before the 32-bit sums could overflow
+        for (size_t i = pos; i < pos + n; ) {
+            const size_t end = std::min(i + 5552, pos + n);
+            for (; i < end; ++i) {
+                adler_a += raw[i];
+                adler_b += adler_a;
+            }
+            adler_a %= 65521;
+            adler_b %= 65521;
+        }
+        pos += n;
+    } while (pos < raw.size());
+
+    PutLong(idat, (adler_b << 16) | adler_a);
+
+    static const unsigned char signature[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+    std::vector<unsigned char> out(signature, signature + 8);
+    PutChunk(out, "IHDR", ihdr);
+    PutChunk(out, "IDAT", idat);
+    PutChunk(out, "IEND", std::vector<unsigned char>());
+
+    std::ofstream str(filename.c_str(), std::ios::out | std::ios::binary);
+    str.write(reinterpret_cast<const char*>(&out[0]), out.size());
+    if (!str) throw std::runtime_error("Could not write " + filename);
+}
@@ -0,0 +1,27 @@
+/*
+ * FILE:
+ *   png_writer.hpp
+ *
+ * PURPOSE:
+ *   Writes RGBA images as .PNG files. The image data is stored
+ *   uncompressed (zlib "stored" blocks), which is quick to write and
+ *   needs no compression library; any PNG reader can load it.
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef PNG_WRITER_HPP
+#define PNG_WRITER_HPP
+
+#include <string>
+
+// rgba: width * height pixels, 4 bytes each, top row first.
+// Throws std::runtime_error if the file cannot be written.
+void WritePNG(const std::string &filename, int width, int height, const unsigned char *rgba);
+
+#endif
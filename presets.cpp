@@ -0,0 +1,163 @@
+/*
+ * FILE:
+ *   presets.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * CREATED:
+ *   24-Oct-2011
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "presets.hpp"
+
+void SetupValley()
+{
+    SetSettingD("mesh_size_x", 300);
+    SetSettingD("mesh_size_y", 900);
+    SetSettingD("solid_walls", 0);
+    SetSettingD("inflow_width", 4);
+    SetSettingD("inflow_height", 1);
+    SetSettingD("gravity", 10);
+    SetSettingD("friction", 0.02);
+    SetSettingD("theta", 1.1);
+    SetSettingD("max_cfl_number", 0.2);
+    SetSettingD("time_acceleration", 1);
+    SetSettingD("clip_camera", 1);
+    SetSettingD("valley_length", 300);
+    SetSettingD("valley_width", 100);
+    SetSettingD("valley_wall_height", 6);
+    SetSettingD("gradient_top", 0.1);
+    SetSettingD("gradient_bottom", 0.02);
+    SetSettingD("valley_shape", 2);
+    SetSettingD("channel_depth_top", 2);
+    SetSettingD("channel_depth_bottom", 2);
+    SetSettingD("channel_width_top", 10);
+    SetSettingD("channel_width_bottom", 10);
+    SetSettingD("dam_on", 1);
+    SetSettingD("dam_height", 10);
+    SetSettingD("dam_position", 150);
+    SetSettingD("dam_middle_width", 4);
+    SetSettingD("dam_middle_height", -5);
+    SetSettingD("dam_thickness", 8);
+    SetSettingD("meander_wavelength", 100);
+    SetSettingD("meander_amplitude", 8);
+    SetSettingD("meander_fractal", 0.3);
+    SetSettingD("use_sea_level", 0);
+    SetSettingD("sea_level", 10);
+    SetSettingD("sa1", 0.3);
+    SetSettingD("sk1", 0.224);
+    SetSettingD("sk1_dir", 5.18);
+    SetSettingD("so1", 1);
+    SetSettingD("sa2", 0.25);
+    SetSettingD("sk2", 0.201);
+    SetSettingD("sk2_dir", 4.83);
+    SetSettingD("so2", 1.07);
+    SetSettingD("sa3", 0.1);
+    SetSettingD("sk3", 0.3);
+    SetSettingD("sk3_dir", 4.9);
+    SetSettingD("so3", 4);
+    SetSettingD("sa4", 0);
+    SetSettingD("sk4", 0);
+    SetSettingD("sk4_dir", 0);
+    SetSettingD("s04", 0);
+    SetSettingD("fov", 45);
+    SetSettingD("lod_pixel_error", 1);
+    SetSettingD("sun_alt", 25);
+    SetSettingD("sun_az", 300);
+    SetSettingD("ambient", 0.75);
+    SetSettingD("fresnel_coeff", 0.983);
+    SetSettingD("fresnel_exponent", 5);
+    SetSettingD("specular_intensity", 1);
+    SetSettingD("specular_exponent", 15);
+    SetSettingD("refractive_index", 1.33);
+    SetSettingD("attenuation_1", 0.08);
+    SetSettingD("attenuation_2", 0.08);
+    SetSettingD("deep_r", 0.05);
+    SetSettingD("deep_g", 0.1);
+    SetSettingD("deep_b", 0.2);
+}
+
+void SetupValleyHires()
+{
+    SetupValley();
+    SetSettingD("mesh_size_x", 600);
+    SetSettingD("mesh_size_y", 1200);
+    SetSettingD("inflow_width", 2);
+    SetSettingD("valley_length", 100);
+    SetSettingD("valley_width", 50);
+    SetSettingD("channel_width_top", 5);
+    SetSettingD("channel_width_bottom", 5);
+    SetSettingD("dam_position", 50);
+    SetSettingD("dam_height", 7);
+    SetSettingD("dam_middle_height", -3);
+    SetSettingD("dam_thickness", 4);
+}
+
+void SetupSea()
+{
+    SetupValley();
+    SetSettingD("mesh_size_x", 600);
+    SetSettingD("mesh_size_y", 300);
+    SetSettingD("inflow_width", 0);
+    SetSettingD("inflow_height", 0);
+    SetSettingD("valley_length", 300);
+    SetSettingD("valley_width", 600);
+    SetSettingD("valley_wall_height", 0);
+    SetSettingD("channel_depth_top", 0);
+    SetSettingD("channel_depth_bottom", 0);
+    SetSettingD("channel_width_top", 0);
+    SetSettingD("channel_width_bottom", 0);
+    SetSettingD("dam_on", 0);
+    SetSettingD("use_sea_level", 1);
+    SetSettingD("sea_level", 8);
+    SetSettingD("attenuation_2", 0.5);
+    SetSettingD("deep_r", 0.01);
+    SetSettingD("deep_g", 0.08);
+    SetSettingD("deep_b", 0.1);
+}
+
+void SetupFlatPlane()
+{
+    SetupValley();
+    SetSettingD("mesh_size_x", 400);
+    SetSettingD("mesh_size_y", 400);
+    SetSettingD("solid_walls", 1);
+    SetSettingD("inflow_width", 0);
+    SetSettingD("inflow_height", 0);
+    SetSettingD("valley_length", 200);
+    SetSettingD("valley_width", 200);
+    SetSettingD("valley_wall_height", 0);
+    SetSettingD("gradient_top", 0);
+    SetSettingD("gradient_bottom", 0);
+    SetSettingD("channel_depth_top", 0);
+    SetSettingD("channel_depth_bottom", 0);
+    SetSettingD("channel_width_top", 0);
+    SetSettingD("channel_width_bottom", 0);
+    SetSettingD("dam_on", 0);
+    SetSettingD("clip_camera", 0);
+}
+
+bool ApplyPreset(const std::string &name, ResetType &reset_type)
+{
+    if (name == "valley") {
+        SetupValley();
+        reset_type = R_VALLEY;
+    } else if (name == "valley_hires") {
+        SetupValleyHires();
+        reset_type = R_VALLEY;
+    } else if (name == "sea") {
+        SetupSea();
+        reset_type = R_SEA;
+    } else if (name == "flat") {
+        SetupFlatPlane();
+        reset_type = R_SQUARE;
+    } else {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,40 @@
+/*
+ * FILE:
+ *   presets.hpp
+ *
+ * PURPOSE:
+ *   The preset scenarios (valley, sea, flat plane etc). These are
+ *   shared between the GUI preset buttons and the batch runner.
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * CREATED:
+ *   24-Oct-2011
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef PRESETS_HPP
+#define PRESETS_HPP
+
+#include "settings.hpp"
+
+#include <string>
+
+// These write the preset values into g_settings. Settings not
+// mentioned by a preset are left unchanged.
+void SetupValley();
+void SetupValleyHires();
+void SetupSea();
+void SetupFlatPlane();
+
+// Applies a preset by name: "valley", "valley_hires", "sea" or "flat".
+// On success, reset_type is set to the reset type that goes with the
+// preset (as used by the GUI buttons) and true is returned.
+// Returns false (and changes nothing) if the name is not recognised.
+bool ApplyPreset(const std::string &name, ResetType &reset_type);
+
+#endif
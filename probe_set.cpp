@@ -0,0 +1,69 @@
+/*
+ * FILE:
+ *   probe_set.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "probe_set.hpp"
+
+#include <algorithm>
+
+namespace {
+    // Mesh point nearest to the given coordinate, where the mesh has n points
+    // spread over [lo, lo + size] (as in GetTerrainHeight).
+    int NearestMeshPoint(float x, float lo, float size, int n)
+    {
+        const float m = (x - lo) / size * (n - 1);
+        const int i = int(std::max(0.0f, m) + 0.5f);
+        return std::min(n - 1, i);
+    }
+}
+
+ProbeSet::ProbeSet()
+    : sample_time(-1), located_nx(0), located_ny(0), located_W(0), located_L(0)
+{ }
+
+int ProbeSet::add(float world_x, float world_y)
+{
+    Point p = { world_x, world_y };
+    points.push_back(p);
+
+    ProbeSample zero = { 0, 0, 0, 0 };
+    results.assign(points.size(), zero);
+    sample_time = -1;
+
+    located_nx = 0;   // force a relocate
+    return int(points.size()) - 1;
+}
+
+void ProbeSet::clear()
+{
+    points.clear();
+    cells.clear();
+    results.clear();
+    sample_time = -1;
+    located_nx = 0;
+}
+
+bool ProbeSet::locate(int nx, int ny, float W, float L)
+{
+    if (nx == located_nx && ny == located_ny && W == located_W && L == located_L) return false;
+
+    cells.resize(points.size());
+    for (size_t k = 0; k < points.size(); ++k) {
+        cells[k].i = NearestMeshPoint(points[k].x, -W/2, W, nx) + 2;
+        cells[k].j = NearestMeshPoint(points[k].y, 0, L, ny) + 2;
+    }
+
+    located_nx = nx;
+    located_ny = ny;
+    located_W = W;
+    located_L = L;
+    return true;
+}
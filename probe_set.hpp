@@ -0,0 +1,84 @@
+/*
+ * FILE:
+ *   probe_set.hpp
+ *
+ * PURPOSE:
+ *   A set of "virtual gauges": fixed points at which the water depth
+ *   and velocity are sampled every timestep. Points are registered
+ *   once; the solver then fills in one ProbeSample per point, in a
+ *   single contiguous array, each time it samples.
+ *
+ *   CpuSolver::sampleProbes samples directly from the solver state.
+ *   ShallowWaterEngine gathers all the probes in one small draw call
+ *   and reads them back with one Map (see ShallowWaterEngine::getProbes).
+ *
+ *   Probes sample the cell containing the point (no interpolation).
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef PROBE_SET_HPP
+#define PROBE_SET_HPP
+
+#include <vector>
+
+struct ProbeSample {
+    float depth;     // h (m)
+    float u, v;      // velocity (m s^-1)
+    float surface;   // w = B + h (m)
+};
+
+class ProbeSet {
+public:
+    // cell containing a probe; indices include the ghost zones, i.e. 2 <= i < nx+2
+    struct Cell {
+        int i, j;
+    };
+
+    ProbeSet();
+
+    // Registers a probe at the given world position, returns its index.
+    int add(float world_x, float world_y);
+    void clear();
+
+    int size() const { return int(points.size()); }
+    bool empty() const { return points.empty(); }
+    float getX(int probe) const { return points[probe].x; }
+    float getY(int probe) const { return points[probe].y; }
+
+    // Finds the cell of each probe on an nx * ny mesh covering [-W/2, W/2] * [0, L]
+    // (points outside are clamped onto the mesh). Returns true if the cells have
+    // changed since the last call, i.e. if probes were added or the mesh is different.
+    bool locate(int nx, int ny, float W, float L);
+    const Cell * getCells() const { return cells.empty() ? 0 : &cells[0]; }
+
+    // One sample per probe, in the order they were added. Written by the solver.
+    ProbeSample * getResults() { return results.empty() ? 0 : &results[0]; }
+    const ProbeSample * getResults() const { return results.empty() ? 0 : &results[0]; }
+
+    // Simulated time at which the current results were taken, or a negative
+    // value if there are no results yet (e.g. just after add).
+    float getSampleTime() const { return sample_time; }
+    void setSampleTime(float t) { sample_time = t; }
+
+private:
+    struct Point {
+        float x, y;
+    };
+
+    std::vector<Point> points;
+    std::vector<Cell> cells;
+    std::vector<ProbeSample> results;
+    float sample_time;
+
+    // mesh that "cells" was computed for (nx == 0 if not yet located)
+    int located_nx, located_ny;
+    float located_W, located_L;
+};
+
+#endif
@@ -0,0 +1,226 @@
+/*
+ * FILE:
+ *   profiler.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "profiler.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+#ifdef _MSC_VER
+#define PROFILER_THREAD_LOCAL __declspec(thread)
+#else
+#define PROFILER_THREAD_LOCAL __thread
+#endif
+
+std::atomic<bool> g_profiler_enabled(false);
+
+namespace {
+
+    // Each ring buffer holds the most recent RING_SIZE events of one thread.
+    const unsigned int RING_SIZE = 65536;   // must be a power of 2
+
+    struct Event {
+        const char *name;
+        unsigned long long start, end;
+    };
+
+    // Single producer (the owning thread), single consumer (WriteProfilerTrace).
+    // The producer writes the slot and then publishes it by incrementing head;
+    // the consumer copies a range of slots and then discards any that the
+    // producer may have overwritten in the meantime.
+    struct RingBuffer {
+        RingBuffer(int tid_) : head(0), tid(tid_), thread_name(0), events(RING_SIZE) { }
+
+        std::atomic<unsigned int> head;   // total number of events ever written
+        int tid;
+        std::atomic<const char *> thread_name;
+        std::vector<Event> events;
+    };
+
+    // All buffers ever created. Buffers are never freed (threads may exit
+    // while the trace still refers to their events).
+    std::mutex g_buffers_mutex;
+    std::vector<RingBuffer*> g_buffers;
+    RingBuffer *g_gpu_buffer;
+
+    PROFILER_THREAD_LOCAL RingBuffer *t_buffer;
+
+    RingBuffer * NewBuffer()
+    {
+        std::lock_guard<std::mutex> lock(g_buffers_mutex);
+        RingBuffer *buf = new RingBuffer(int(g_buffers.size()) + 1);
+        g_buffers.push_back(buf);
+        return buf;
+    }
+
+    RingBuffer & ThreadBuffer()
+    {
+        if (!t_buffer) t_buffer = NewBuffer();
+        return *t_buffer;
+    }
+
+    RingBuffer & GpuBuffer()
+    {
+        // Only the render thread records GPU events, so the GPU buffer still has a single producer.
+        {
+            std::lock_guard<std::mutex> lock(g_buffers_mutex);
+            if (g_gpu_buffer) return *g_gpu_buffer;
+        }
+        RingBuffer *buf = NewBuffer();
+        buf->thread_name = "GPU";
+        std::lock_guard<std::mutex> lock(g_buffers_mutex);
+        g_gpu_buffer = buf;
+        return *buf;
+    }
+
+    void Push(RingBuffer &buf, const char *name, unsigned long long start, unsigned long long end)
+    {
+        const unsigned int h = buf.head.load(std::memory_order_relaxed);
+        Event &ev = buf.events[h & (RING_SIZE - 1)];
+        ev.name = name;
+        ev.start = start;
+        ev.end = end;
+        buf.head.store(h + 1, std::memory_order_release);
+    }
+
+    // Copies the events that are currently in the buffer (oldest first).
+    void Snapshot(const RingBuffer &buf, std::vector<Event> &out)
+    {
+        const unsigned int head = buf.head.load(std::memory_order_acquire);
+        const unsigned int count = head < RING_SIZE ? head : RING_SIZE;
+        const unsigned int first = head - count;
+
+        out.resize(count);
+        for (unsigned int i = 0; i < count; ++i) {
+            out[i] = buf.events[(first + i) & (RING_SIZE - 1)];
+        }
+
+        // Anything the producer wrapped round onto while we were copying is unreliable.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const unsigned int new_head = buf.head.load(std::memory_order_relaxed);
+        const unsigned int overwritten = new_head - head;
+        if (overwritten >= count) {
+            out.clear();
+        } else if (overwritten > 0) {
+            out.erase(out.begin(), out.begin() + overwritten);
+        }
+    }
+
+    void WriteEscaped(std::FILE *fp, const char *s)
+    {
+        for (; *s; ++s) {
+            if (*s == '"' || *s == '\\') std::fputc('\\', fp);
+            if (static_cast<unsigned char>(*s) >= 32) std::fputc(*s, fp);
+        }
+    }
+
+    int ProcessId()
+    {
+#ifdef _WIN32
+        return int(GetCurrentProcessId());
+#else
+        return int(getpid());
+#endif
+    }
+}
+
+void SetProfilerEnabled(bool enabled)
+{
+    g_profiler_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+unsigned long long ProfilerTicks()
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);   // benign race; same value either way
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    const unsigned long long f = freq.QuadPart, t = now.QuadPart;
+    return (t / f) * 1000000000ull + (t % f) * 1000000000ull / f;
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)(ts.tv_sec) * 1000000000ull + (unsigned long long)(ts.tv_nsec);
+#endif
+}
+
+void ProfilerRecord(const char *name, unsigned long long start_ticks, unsigned long long end_ticks)
+{
+    Push(ThreadBuffer(), name, start_ticks, end_ticks);
+}
+
+void ProfilerRecordGpu(const char *name, unsigned long long start_ticks, unsigned long long end_ticks)
+{
+    Push(GpuBuffer(), name, start_ticks, end_ticks);
+}
+
+void SetProfilerThreadName(const char *name)
+{
+    ThreadBuffer().thread_name = name;
+}
+
+bool WriteProfilerTrace(const std::string &filename)
+{
+    std::vector<RingBuffer*> buffers;
+    {
+        std::lock_guard<std::mutex> lock(g_buffers_mutex);
+        buffers = g_buffers;
+    }
+
+    std::FILE *fp = std::fopen(filename.c_str(), "w");
+    if (!fp) return false;
+
+    const int pid = ProcessId();
+    bool first = true;
+
+    std::fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    std::vector<Event> events;
+    for (size_t b = 0; b < buffers.size(); ++b) {
+        const RingBuffer &buf = *buffers[b];
+
+        const char *thread_name = buf.thread_name;
+        if (thread_name) {
+            std::fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"",
+                         first ? "" : ",\n", pid, buf.tid);
+            WriteEscaped(fp, thread_name);
+            std::fprintf(fp, "\"}}");
+            first = false;
+        }
+
+        Snapshot(buf, events);
+        for (size_t i = 0; i < events.size(); ++i) {
+            const Event &ev = events[i];
+            const unsigned long long dur = ev.end > ev.start ? ev.end - ev.start : 0;
+            std::fprintf(fp, "%s{\"name\":\"", first ? "" : ",\n");
+            WriteEscaped(fp, ev.name);
+            std::fprintf(fp, "\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                         pid, buf.tid, ev.start / 1000.0, dur / 1000.0);
+            first = false;
+        }
+    }
+
+    std::fprintf(fp, "\n]}\n");
+    const bool ok = !std::ferror(fp);
+    std::fclose(fp);
+    return ok;
+}
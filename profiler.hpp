@@ -0,0 +1,79 @@
+/*
+ * FILE:
+ *   profiler.hpp
+ *
+ * PURPOSE:
+ *   Lightweight scoped timing markers. Each thread records into its
+ *   own fixed size ring buffer (no locks, no allocation once the
+ *   buffer exists); the buffers can be exported as a Chrome trace
+ *   JSON file (load it in chrome://tracing or ui.perfetto.dev).
+ *
+ *   Usage:  { PROFILE_SCOPE("Pass1"); ... }
+ *
+ *   When the profiler is disabled (the default) a PROFILE_SCOPE costs
+ *   one relaxed atomic load.
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <atomic>
+#include <string>
+
+extern std::atomic<bool> g_profiler_enabled;
+
+inline bool ProfilerEnabled() { return g_profiler_enabled.load(std::memory_order_relaxed); }
+void SetProfilerEnabled(bool enabled);
+
+// Current time in profiler ticks (nanoseconds, from an arbitrary origin).
+unsigned long long ProfilerTicks();
+
+// Records a completed event on the calling thread's buffer. "name" must
+// have static storage duration (normally a string literal).
+// Events are recorded even if the profiler is disabled; callers are expected
+// to check ProfilerEnabled() first.
+void ProfilerRecord(const char *name, unsigned long long start_ticks, unsigned long long end_ticks);
+
+// As ProfilerRecord, but the event goes on the (single) GPU track instead of
+// the calling thread's track. Times must already be converted to profiler ticks.
+void ProfilerRecordGpu(const char *name, unsigned long long start_ticks, unsigned long long end_ticks);
+
+// Gives the calling thread a name in the exported trace (name must be static).
+void SetProfilerThreadName(const char *name);
+
+// Writes everything currently in the ring buffers as Chrome trace JSON.
+// Returns false if the file could not be written.
+bool WriteProfilerTrace(const std::string &filename);
+
+
+class ProfileScope {
+public:
+    explicit ProfileScope(const char *name_)
+        : name(ProfilerEnabled() ? name_ : 0), start(name ? ProfilerTicks() : 0)
+    { }
+
+    ~ProfileScope()
+    {
+        if (name) ProfilerRecord(name, start, ProfilerTicks());
+    }
+
+private:
+    ProfileScope(const ProfileScope &);
+    void operator=(const ProfileScope &);
+
+    const char *name;
+    unsigned long long start;
+};
+
+#define PROFILE_SCOPE_CONCAT2(a, b) a ## b
+#define PROFILE_SCOPE_CONCAT(a, b) PROFILE_SCOPE_CONCAT2(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_SCOPE_CONCAT(profile_scope_, __LINE__)(name)
+
+#endif
@@ -0,0 +1,167 @@
+/*
+ * FILE:
+ *   scenario.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "presets.hpp"
+#include "scenario.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+    std::string Trim(const std::string &s)
+    {
+        const char *ws = " \t\r\n";
+        const std::string::size_type first = s.find_first_not_of(ws);
+        if (first == std::string::npos) return std::string();
+        const std::string::size_type last = s.find_last_not_of(ws);
+        return s.substr(first, last - first + 1);
+    }
+
+    void Error(const std::string &filename, int line_num, const std::string &msg)
+    {
+        std::ostringstream str;
+        str << filename << ":" << line_num << ": " << msg;
+        throw std::runtime_error(str.str());
+    }
+
+    double ParseNumber(const std::string &filename, int line_num, const std::string &value)
+    {
+        const char *begin = value.c_str();
+        char *end;
+        const double result = std::strtod(begin, &end);
+        if (end == begin || *end != 0) Error(filename, line_num, "expected a number, got '" + value + "'");
+        return result;
+    }
+
+    // comma separated numbers
+    void ParseList(const std::string &filename, int line_num, const std::string &value, std::vector<double> &result)
+    {
+        result.clear();
+        std::string::size_type start = 0;
+        while (true) {
+            const std::string::size_type comma = value.find(',', start);
+            result.push_back(ParseNumber(filename, line_num, Trim(value.substr(start, comma - start))));
+            if (comma == std::string::npos) break;
+            start = comma + 1;
+        }
+    }
+
+    bool ParseResetType(const std::string &value, ResetType &reset_type)
+    {
+        if (value == "valley") reset_type = R_VALLEY;
+        else if (value == "sea") reset_type = R_SEA;
+        else if (value == "square") reset_type = R_SQUARE;
+        else if (value == "none") reset_type = R_MESH;
+        else return false;
+        return true;
+    }
+}
+
+void LoadScenario(std::istream &str, const std::string &filename, Scenario &scenario)
+{
+    scenario = Scenario();
+    scenario.name = filename;
+
+    std::string line;
+    int line_num = 0;
+    while (std::getline(str, line)) {
+        ++line_num;
+
+        line = Trim(line);
+        if (line.empty() || line[0] == '#') continue;
+
+        const std::string::size_type eq = line.find('=');
+        if (eq == std::string::npos) Error(filename, line_num, "expected 'name = value'");
+
+        const std::string name = Trim(line.substr(0, eq));
+        const std::string value = Trim(line.substr(eq + 1));
+
+        if (name == "name") {
+            scenario.name = value;
+        } else if (name == "preset") {
+            if (value != "valley" && value != "valley_hires" && value != "sea" && value != "flat") {
+                Error(filename, line_num, "unknown preset '" + value + "'");
+            }
+            scenario.preset = value;
+        } else if (name == "reset") {
+            if (!ParseResetType(value, scenario.reset_type)) {
+                Error(filename, line_num, "unknown reset type '" + value + "'");
+            }
+        } else if (name == "duration") {
+            scenario.duration = float(ParseNumber(filename, line_num, value));
+        } else if (name == "output_interval") {
+            scenario.output_interval = float(ParseNumber(filename, line_num, value));
+        } else if (name == "brush_log") {
+            scenario.brush_log = value;
+        } else if (name == "render_interval") {
+            scenario.render_interval = float(ParseNumber(filename, line_num, value));
+        } else if (name == "render_size") {
+            std::vector<double> size;
+            ParseList(filename, line_num, value, size);
+            if (size.size() != 2 || size[0] < 1 || size[1] < 1 || size[0] > 16384 || size[1] > 16384) {
+                Error(filename, line_num, "expected 'render_size = width, height'");
+            }
+            scenario.render_width = int(size[0]);
+            scenario.render_height = int(size[1]);
+        } else if (name == "render_output") {
+            scenario.render_output = value;
+        } else if (name == "render_format") {
+            if (value != "png" && value != "raw") Error(filename, line_num, "unknown render format '" + value + "'");
+            scenario.render_raw = (value == "raw");
+        } else if (name == "camera") {
+            std::vector<double> cam;
+            ParseList(filename, line_num, value, cam);
+            if (cam.size() != 5) Error(filename, line_num, "expected 'camera = x, y, z, yaw, pitch'");
+            for (int i = 0; i < 5; ++i) scenario.camera[i] = float(cam[i]);
+        } else if (name == "probe") {
+            const std::string::size_type comma = value.find(',');
+            if (comma == std::string::npos) Error(filename, line_num, "expected 'probe = x, y'");
+            const float x = float(ParseNumber(filename, line_num, Trim(value.substr(0, comma))));
+            const float y = float(ParseNumber(filename, line_num, Trim(value.substr(comma + 1))));
+            scenario.probes.push_back(std::make_pair(x, y));
+        } else {
+            const Setting *setting = FindSetting(name.c_str());
+            if (!setting || setting->type == S_NEW_TAB || setting->type == S_LABEL) {
+                Error(filename, line_num, "unknown setting '" + name + "'");
+            }
+            scenario.settings.push_back(std::make_pair(name, ParseNumber(filename, line_num, value)));
+        }
+    }
+}
+
+void LoadScenarioFile(const std::string &filename, Scenario &scenario)
+{
+    std::ifstream str(filename.c_str());
+    if (!str) throw std::runtime_error("Could not open scenario file: " + filename);
+    LoadScenario(str, filename, scenario);
+}
+
+ResetType ApplyScenario(const Scenario &scenario)
+{
+    ResetSettings();
+
+    ResetType reset_type = R_VALLEY;
+    if (!scenario.preset.empty()) {
+        ApplyPreset(scenario.preset, reset_type);
+    }
+    if (scenario.reset_type != R_NONE) {
+        reset_type = scenario.reset_type;
+    }
+
+    for (size_t i = 0; i < scenario.settings.size(); ++i) {
+        SetSettingD(scenario.settings[i].first.c_str(), scenario.settings[i].second);
+    }
+
+    return reset_type;
+}
@@ -0,0 +1,89 @@
+/*
+ * FILE:
+ *   scenario.hpp
+ *
+ * PURPOSE:
+ *   Text scenario files, used by the batch runner.
+ *
+ *   A scenario file is a list of "name = value" lines. Blank lines
+ *   and lines starting with '#' are ignored. The following names are
+ *   special:
+ *
+ *     name = <text>              Name used when reporting (default: the file name)
+ *     preset = <preset>          valley, valley_hires, sea or flat (see presets.hpp)
+ *     reset = <reset type>       valley, sea, square or none (how the water is initialized;
+ *                                defaults to the preset's reset type, or valley)
+ *     duration = <seconds>       Simulated time to run for
+ *     output_interval = <secs>   Simulated time between stats reports (0 = end of run only)
+ *     probe = <x>, <y>           Adds a gauge at world position (x, y); its depth and
+ *                                velocity are reported along with the stats. May be repeated.
+ *     brush_log = <file>         Replays the brush strokes in the file (see brush_log.hpp)
+ *                                from the start of the run. The mesh settings must match.
+ *     render_interval = <secs>   Simulated time between rendered frames (0 = no frames;
+ *                                see soft_renderer.hpp). Frames show the terrain as it was
+ *                                at the start of the run (brush_log edits are not drawn).
+ *     render_size = <w>, <h>     Frame size in pixels (default 1280, 720)
+ *     render_output = <prefix>   Frames are written to <prefix>_00000.png etc.
+ *                                (default: the scenario name)
+ *     render_format = <format>   png (one file per frame) or raw (all frames appended
+ *                                to <prefix>.rgba, 8-bit RGBA, top row first)
+ *     camera = <x>, <y>, <z>, <yaw>, <pitch>
+ *                                Camera position (metres) and direction (radians)
+ *                                (default: the GUI's starting view of the valley)
+ *
+ *   Any other name must be the name of an entry in g_settings[], for
+ *   example "mesh_size_x = 512" or "friction = 0.05". These are applied
+ *   in order, after the preset.
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef SCENARIO_HPP
+#define SCENARIO_HPP
+
+#include "settings.hpp"
+
+#include <iosfwd>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct Scenario {
+    Scenario() : reset_type(R_NONE), duration(60), output_interval(0),
+                 render_interval(0), render_width(1280), render_height(720), render_raw(false)
+    {
+        camera[0] = -90; camera[1] = 280; camera[2] = 40;   // x, y, z
+        camera[3] = 2.7f; camera[4] = -0.2f;                // yaw, pitch
+    }
+
+    std::string name;
+    std::string preset;   // empty = none
+    ResetType reset_type; // R_NONE = use the preset's
+    float duration;
+    float output_interval;
+    std::vector<std::pair<std::string, double> > settings;
+    std::vector<std::pair<float, float> > probes;   // (x, y) world positions
+    std::string brush_log;   // empty = none
+
+    float render_interval;   // 0 = no rendering
+    int render_width, render_height;
+    std::string render_output;   // empty = use the name
+    bool render_raw;
+    float camera[5];
+};
+
+// These throw std::runtime_error if the file cannot be read or contains errors.
+// Setting names are checked against g_settings[] at load time.
+void LoadScenario(std::istream &str, const std::string &filename, Scenario &scenario);
+void LoadScenarioFile(const std::string &filename, Scenario &scenario);
+
+// Resets g_settings[] to defaults then applies the preset and the settings
+// from the scenario. Returns the reset type to use for the initial conditions.
+ResetType ApplyScenario(const Scenario &scenario);
+
+#endif
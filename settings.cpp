@@ -15,8 +15,10 @@
 
 #include "settings.hpp"
 
+#include <algorithm>
 #include <cstdlib>
 #include <cmath>
+#include <cstring>
 #include <map>
 #include <string>
 
@@ -57,11 +59,11 @@ Setting g_settings[] =
 
         { "theta", "", S_SLIDER, R_NONE, 1, 2 },
         { "max_cfl_number", "", S_SLIDER, R_NONE, 0, 0.6 },
-        { "timesteps_per_frame", "", S_SLIDER_INT, R_NONE, 1, 10 },
         { "time_acceleration", "", S_SLIDER, R_NONE, 1, 30 },
         {""},
 
         { "clip_camera", "", S_CHECKBOX, R_NONE, 0, 1 },
+        { "cpu_simulation", "", S_CHECKBOX, R_NONE, 0, 1 },
 
 
 
@@ -134,6 +136,7 @@ Setting g_settings[] =
         { "graphics", "", S_NEW_TAB },
 
         { "fov", "deg", S_SLIDER, R_NONE, 1, 150 },
+        { "lod_pixel_error", "px", S_SLIDER, R_NONE, 0, 10 },
         {""},
         { "sun_alt", "deg", S_SLIDER, R_NONE, 0, 90 },
         { "sun_az", "deg", S_SLIDER, R_NONE, 0, 360 },
@@ -151,6 +154,36 @@ Setting g_settings[] =
         { "deep_b", "", S_SLIDER, R_NONE, 0, 1 },
 
 
+        // PERF TAB (see perf_counters.hpp)
+
+        { "perf", "", S_NEW_TAB },
+
+        { "step_time", "ms", S_LABEL },
+        { "pass1_time", "ms", S_LABEL },
+        { "pass2_time", "ms", S_LABEL },
+        { "pass3_time", "ms", S_LABEL },
+        { "boundary_time", "ms", S_LABEL },
+        { "render_time", "ms", S_LABEL },
+        { "" },
+
+        { "cell_updates", "s^-1", S_LABEL },
+        { "wet_fraction", "", S_LABEL },
+        { "triangles", "", S_LABEL },
+        { "" },
+
+        { "readback_time", "ms", S_LABEL },
+        { "upload_bytes", "bytes", S_LABEL },
+        { "worker_utilisation", "", S_LABEL },
+        { "" },
+
+        { "frame_p50", "ms", S_LABEL },
+        { "frame_p99", "ms", S_LABEL },
+        { "frame_max", "ms", S_LABEL },
+        { "step_wall_p50", "ms", S_LABEL },
+        { "step_wall_p99", "ms", S_LABEL },
+        { "step_wall_max", "ms", S_LABEL },
+
+
         // NON TABBED WIDGETS
 
         { "", "", S_NEW_TAB },
@@ -189,7 +222,7 @@ Setting g_settings[] =
         {}   // Null terminator
     };
 
-ResetType g_reset_type;
+Setting * g_setting_handles[NUM_SETTING_HANDLES];
 
 namespace {
     void InitNameToSetting()
@@ -198,6 +231,39 @@ namespace {
             g_name_to_setting.insert(std::make_pair(p->name, p));
         }
     }
+
+    // names corresponding to each SettingHandle (in enum order; see SETTING_HANDLES)
+    const char * const g_setting_handle_names[NUM_SETTING_HANDLES] = {
+#define SETTING_HANDLE(handle, name) name,
+        SETTING_HANDLES(SETTING_HANDLE)
+#undef SETTING_HANDLE
+    };
+
+    // the initial contents of g_settings[].value (see ResetSettings)
+    std::vector<double> g_default_values;
+
+    // fills in g_default_values and g_setting_handles. This runs during static
+    // initialization; g_settings is defined earlier in this file, so is already
+    // set up by then. (Aborts if a handle's name is not in g_settings.)
+    struct InitSettingHandles {
+        InitSettingHandles()
+        {
+            for (Setting *p = &g_settings[0]; p->name; ++p) {
+                g_default_values.push_back(p->value);
+            }
+            
+            for (int i = 0; i < NUM_SETTING_HANDLES; ++i) {
+                g_setting_handles[i] = 0;
+                for (Setting *p = &g_settings[0]; p->name; ++p) {
+                    if (strcmp(p->name, g_setting_handle_names[i]) == 0) {
+                        g_setting_handles[i] = p;
+                        break;
+                    }
+                }
+                if (!g_setting_handles[i]) std::abort();
+            }
+        }
+    } g_init_setting_handles;
 }
 
 float GetSetting(const char *name)
@@ -221,3 +287,89 @@ void SetSetting(const char *name, float new_value)
     std::map<const char*, Setting*, CompareStr>::iterator it = g_name_to_setting.find(name);
     if (it != g_name_to_setting.end()) it->second->value = double(new_value);
 }
+
+Setting * FindSetting(const char *name)
+{
+    if (g_name_to_setting.empty()) InitNameToSetting();
+    std::map<const char*, Setting*, CompareStr>::iterator it = g_name_to_setting.find(name);
+    return it == g_name_to_setting.end() ? 0 : it->second;
+}
+
+void ResetSettings()
+{
+    for (size_t i = 0; i < g_default_values.size(); ++i) {
+        g_settings[i].value = g_default_values[i];
+    }
+}
+
+SettingsSnapshot::SettingsSnapshot()
+    : values(g_default_values.size())
+{
+    capture();
+}
+
+void SettingsSnapshot::capture()
+{
+    for (size_t i = 0; i < values.size(); ++i) {
+        values[i] = g_settings[i].value;
+    }
+}
+
+void GetSimSettings(SimSettings &s)
+{
+    s.nx = GetIntSetting(SH_MESH_SIZE_X);
+    s.ny = GetIntSetting(SH_MESH_SIZE_Y);
+    s.W = GetSetting(SH_VALLEY_WIDTH);
+    s.L = GetSetting(SH_VALLEY_LENGTH);
+    s.dx = s.W / (s.nx - 1);
+    s.dy = s.L / (s.ny - 1);
+    s.epsilon = std::min(0.5f, std::pow(std::max(s.dx, s.dy), 4.0f));
+    s.gravity = GetSetting(SH_GRAVITY);
+    s.friction = GetSetting(SH_FRICTION);
+    s.theta = GetSetting(SH_THETA);
+    s.max_cfl_number = GetSetting(SH_MAX_CFL_NUMBER);
+    s.time_acceleration = GetSetting(SH_TIME_ACCELERATION);
+    s.solid_walls = GetIntSetting(SH_SOLID_WALLS) != 0;
+    s.inflow_width = GetSetting(SH_INFLOW_WIDTH);
+    s.inflow_height = GetSetting(SH_INFLOW_HEIGHT);
+    s.use_sea_level = GetIntSetting(SH_USE_SEA_LEVEL) != 0;
+    s.sea_level = GetSetting(SH_SEA_LEVEL);
+
+    // the four sea wave settings are laid out identically (sa, sk, sk_dir, so)
+    for (int i = 0; i < 4; ++i) {
+        const int base = SH_SA1 + 4*i;
+        const float k = GetSetting(SettingHandle(base + 1));
+        const float kdir = GetSetting(SettingHandle(base + 2));
+        s.sa[i] = GetSetting(SettingHandle(base));
+        s.skx[i] = k * std::cos(kdir);
+        s.sky[i] = k * std::sin(kdir);
+        s.so[i] = GetSetting(SettingHandle(base + 3));
+    }
+}
+
+void GetRenderSettings(RenderSettings &s)
+{
+    s.nx = GetIntSetting(SH_MESH_SIZE_X);
+    s.ny = GetIntSetting(SH_MESH_SIZE_Y);
+    s.W = GetSetting(SH_VALLEY_WIDTH);
+    s.L = GetSetting(SH_VALLEY_LENGTH);
+    s.fov = GetSetting(SH_FOV);
+
+    const float sun_alt = GetSetting(SH_SUN_ALT) * float(PI) / 180.0f;
+    const float sun_az = GetSetting(SH_SUN_AZ) * float(PI) / 180.0f;
+    s.light_dir[0] = std::cos(sun_alt) * std::sin(sun_az);
+    s.light_dir[1] = std::cos(sun_alt) * std::cos(sun_az);
+    s.light_dir[2] = std::sin(sun_alt);
+    s.ambient = GetSetting(SH_AMBIENT);
+
+    s.fresnel_coeff = GetSetting(SH_FRESNEL_COEFF);
+    s.fresnel_exponent = GetSetting(SH_FRESNEL_EXPONENT);
+    s.specular_intensity = GetSetting(SH_SPECULAR_INTENSITY);
+    s.specular_exponent = GetSetting(SH_SPECULAR_EXPONENT);
+    s.refractive_index = GetSetting(SH_REFRACTIVE_INDEX);
+    s.attenuation_1 = GetSetting(SH_ATTENUATION_1);
+    s.attenuation_2 = GetSetting(SH_ATTENUATION_2);
+    s.deep_col[0] = GetSetting(SH_DEEP_R);
+    s.deep_col[1] = GetSetting(SH_DEEP_G);
+    s.deep_col[2] = GetSetting(SH_DEEP_B);
+}
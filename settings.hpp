@@ -60,12 +60,185 @@ struct Setting {
     double value;
 };
 
+// Handles for fast (O(1)) access to individual settings. Use these
+// instead of the string versions of GetSetting/SetSetting in any code
+// that runs every frame or every timestep.
+// SETTING_HANDLES lists each handle with the name of its entry in g_settings;
+// both the enum and the name table in settings.cpp are generated from it.
+#define SETTING_HANDLES(SETTING_HANDLE)                                  \
+    /* settings tab */                                                  \
+    SETTING_HANDLE(SH_MESH_SIZE_X,             "mesh_size_x")           \
+    SETTING_HANDLE(SH_MESH_SIZE_Y,             "mesh_size_y")           \
+    SETTING_HANDLE(SH_SOLID_WALLS,             "solid_walls")           \
+    SETTING_HANDLE(SH_INFLOW_WIDTH,            "inflow_width")          \
+    SETTING_HANDLE(SH_INFLOW_HEIGHT,           "inflow_height")         \
+    SETTING_HANDLE(SH_GRAVITY,                 "gravity")               \
+    SETTING_HANDLE(SH_FRICTION,                "friction")              \
+    SETTING_HANDLE(SH_THETA,                   "theta")                 \
+    SETTING_HANDLE(SH_MAX_CFL_NUMBER,          "max_cfl_number")        \
+    SETTING_HANDLE(SH_TIME_ACCELERATION,       "time_acceleration")     \
+    SETTING_HANDLE(SH_CLIP_CAMERA,             "clip_camera")           \
+    SETTING_HANDLE(SH_CPU_SIMULATION,          "cpu_simulation")        \
+                                                                        \
+    /* terrain tab */                                                   \
+    SETTING_HANDLE(SH_VALLEY_LENGTH,           "valley_length")         \
+    SETTING_HANDLE(SH_VALLEY_WIDTH,            "valley_width")          \
+    SETTING_HANDLE(SH_VALLEY_WALL_HEIGHT,      "valley_wall_height")    \
+    SETTING_HANDLE(SH_GRADIENT_TOP,            "gradient_top")          \
+    SETTING_HANDLE(SH_GRADIENT_BOTTOM,         "gradient_bottom")       \
+    SETTING_HANDLE(SH_VALLEY_SHAPE,            "valley_shape")          \
+    SETTING_HANDLE(SH_CHANNEL_DEPTH_TOP,       "channel_depth_top")     \
+    SETTING_HANDLE(SH_CHANNEL_DEPTH_BOTTOM,    "channel_depth_bottom")  \
+    SETTING_HANDLE(SH_CHANNEL_WIDTH_TOP,       "channel_width_top")     \
+    SETTING_HANDLE(SH_CHANNEL_WIDTH_BOTTOM,    "channel_width_bottom")  \
+    SETTING_HANDLE(SH_DAM_ON,                  "dam_on")                \
+    SETTING_HANDLE(SH_DAM_HEIGHT,              "dam_height")            \
+    SETTING_HANDLE(SH_DAM_POSITION,            "dam_position")          \
+    SETTING_HANDLE(SH_DAM_MIDDLE_WIDTH,        "dam_middle_width")      \
+    SETTING_HANDLE(SH_DAM_MIDDLE_HEIGHT,       "dam_middle_height")     \
+    SETTING_HANDLE(SH_DAM_THICKNESS,           "dam_thickness")         \
+    SETTING_HANDLE(SH_MEANDER_WAVELENGTH,      "meander_wavelength")    \
+    SETTING_HANDLE(SH_MEANDER_AMPLITUDE,       "meander_amplitude")     \
+    SETTING_HANDLE(SH_MEANDER_FRACTAL,         "meander_fractal")       \
+                                                                        \
+    /* sea tab */                                                       \
+    SETTING_HANDLE(SH_USE_SEA_LEVEL,           "use_sea_level")         \
+    SETTING_HANDLE(SH_SEA_LEVEL,               "sea_level")             \
+    SETTING_HANDLE(SH_SA1,                     "sa1")                   \
+    SETTING_HANDLE(SH_SK1,                     "sk1")                   \
+    SETTING_HANDLE(SH_SK1_DIR,                 "sk1_dir")               \
+    SETTING_HANDLE(SH_SO1,                     "so1")                   \
+    SETTING_HANDLE(SH_SA2,                     "sa2")                   \
+    SETTING_HANDLE(SH_SK2,                     "sk2")                   \
+    SETTING_HANDLE(SH_SK2_DIR,                 "sk2_dir")               \
+    SETTING_HANDLE(SH_SO2,                     "so2")                   \
+    SETTING_HANDLE(SH_SA3,                     "sa3")                   \
+    SETTING_HANDLE(SH_SK3,                     "sk3")                   \
+    SETTING_HANDLE(SH_SK3_DIR,                 "sk3_dir")               \
+    SETTING_HANDLE(SH_SO3,                     "so3")                   \
+    SETTING_HANDLE(SH_SA4,                     "sa4")                   \
+    SETTING_HANDLE(SH_SK4,                     "sk4")                   \
+    SETTING_HANDLE(SH_SK4_DIR,                 "sk4_dir")               \
+    SETTING_HANDLE(SH_SO4,                     "so4")                   \
+                                                                        \
+    /* graphics tab */                                                  \
+    SETTING_HANDLE(SH_FOV,                     "fov")                   \
+    SETTING_HANDLE(SH_LOD_PIXEL_ERROR,         "lod_pixel_error")       \
+    SETTING_HANDLE(SH_SUN_ALT,                 "sun_alt")               \
+    SETTING_HANDLE(SH_SUN_AZ,                  "sun_az")                \
+    SETTING_HANDLE(SH_AMBIENT,                 "ambient")               \
+    SETTING_HANDLE(SH_FRESNEL_COEFF,           "fresnel_coeff")         \
+    SETTING_HANDLE(SH_FRESNEL_EXPONENT,        "fresnel_exponent")      \
+    SETTING_HANDLE(SH_SPECULAR_INTENSITY,      "specular_intensity")    \
+    SETTING_HANDLE(SH_SPECULAR_EXPONENT,       "specular_exponent")     \
+    SETTING_HANDLE(SH_REFRACTIVE_INDEX,        "refractive_index")      \
+    SETTING_HANDLE(SH_ATTENUATION_1,           "attenuation_1")         \
+    SETTING_HANDLE(SH_ATTENUATION_2,           "attenuation_2")         \
+    SETTING_HANDLE(SH_DEEP_R,                  "deep_r")                \
+    SETTING_HANDLE(SH_DEEP_G,                  "deep_g")                \
+    SETTING_HANDLE(SH_DEEP_B,                  "deep_b")                \
+                                                                        \
+    /* perf tab (per-frame/per-step averages; see perf_counters.hpp) */ \
+    SETTING_HANDLE(SH_PERF_STEP_TIME,          "step_time")             \
+    SETTING_HANDLE(SH_PERF_PASS1_TIME,         "pass1_time")            \
+    SETTING_HANDLE(SH_PERF_PASS2_TIME,         "pass2_time")            \
+    SETTING_HANDLE(SH_PERF_PASS3_TIME,         "pass3_time")            \
+    SETTING_HANDLE(SH_PERF_BOUNDARY_TIME,      "boundary_time")         \
+    SETTING_HANDLE(SH_PERF_RENDER_TIME,        "render_time")           \
+    SETTING_HANDLE(SH_PERF_CELL_UPDATES,       "cell_updates")          \
+    SETTING_HANDLE(SH_PERF_WET_FRACTION,       "wet_fraction")          \
+    SETTING_HANDLE(SH_PERF_TRIANGLES,          "triangles")             \
+    SETTING_HANDLE(SH_PERF_READBACK_TIME,      "readback_time")         \
+    SETTING_HANDLE(SH_PERF_UPLOAD_BYTES,       "upload_bytes")          \
+    SETTING_HANDLE(SH_PERF_WORKER_UTILISATION, "worker_utilisation")    \
+    SETTING_HANDLE(SH_PERF_FRAME_P50,          "frame_p50")             \
+    SETTING_HANDLE(SH_PERF_FRAME_P99,          "frame_p99")             \
+    SETTING_HANDLE(SH_PERF_FRAME_MAX,          "frame_max")             \
+    SETTING_HANDLE(SH_PERF_STEP_WALL_P50,      "step_wall_p50")         \
+    SETTING_HANDLE(SH_PERF_STEP_WALL_P99,      "step_wall_p99")         \
+    SETTING_HANDLE(SH_PERF_STEP_WALL_MAX,      "step_wall_max")         \
+                                                                        \
+    /* non tabbed widgets */                                            \
+    SETTING_HANDLE(SH_LEFT_MOUSE_ACTION,       "left_mouse_action")     \
+    SETTING_HANDLE(SH_LEFT_MOUSE_RADIUS,       "left_mouse_radius")     \
+    SETTING_HANDLE(SH_LEFT_MOUSE_STRENGTH,     "left_mouse_strength")   \
+    SETTING_HANDLE(SH_MASS,                    "mass")                  \
+    SETTING_HANDLE(SH_X_MOMENTUM,              "x_momentum")            \
+    SETTING_HANDLE(SH_Y_MOMENTUM,              "y_momentum")            \
+    SETTING_HANDLE(SH_KINETIC_ENERGY,          "kinetic_energy")        \
+    SETTING_HANDLE(SH_POTENTIAL_ENERGY,        "potential_energy")      \
+    SETTING_HANDLE(SH_TOTAL_ENERGY,            "total_energy")          \
+    SETTING_HANDLE(SH_MAX_SPEED,               "max_speed")             \
+    SETTING_HANDLE(SH_MAX_DEPTH,               "max_depth")             \
+    SETTING_HANDLE(SH_MAX_FROUDE_NUMBER,       "max_froude_number")     \
+    SETTING_HANDLE(SH_FPS,                     "fps")                   \
+    SETTING_HANDLE(SH_TIMESTEP,                "timestep")              \
+    SETTING_HANDLE(SH_CFL_NUMBER,              "cfl_number")            \
+    SETTING_HANDLE(SH_TIME_RATIO,              "time_ratio")            \
+    SETTING_HANDLE(SH_X,                       "x")                     \
+    SETTING_HANDLE(SH_Y,                       "y")                     \
+    SETTING_HANDLE(SH_Z,                       "z")                     \
+    SETTING_HANDLE(SH_DEPTH,                   "depth")                 \
+    SETTING_HANDLE(SH_U,                       "u")                     \
+    SETTING_HANDLE(SH_V,                       "v")                     \
+    SETTING_HANDLE(SH_FROUDE,                  "froude")
+
+enum SettingHandle {
+#define SETTING_HANDLE(handle, name) handle,
+    SETTING_HANDLES(SETTING_HANDLE)
+#undef SETTING_HANDLE
+    NUM_SETTING_HANDLES
+};
+
+// maps each SettingHandle to its entry in g_settings. Filled in during static
+// initialization (in settings.cpp), so it is safe to use from main() onwards.
+extern Setting * g_setting_handles[NUM_SETTING_HANDLES];
+
+// Immutable snapshot of everything the simulation needs from the settings.
+// The engine takes a new one whenever the settings change (see
+// settings_queue.hpp), so the simulation code itself never has to look up
+// a setting.
+struct SimSettings {
+    int nx, ny;               // mesh size, excluding ghost zones
+    float W, L;               // valley width, length (m)
+    float dx, dy;             // cell size (m)
+    float epsilon;            // "epsilon" for the velocity desingularization, see CalcEpsilon
+    float gravity;
+    float friction;
+    float theta;
+    float max_cfl_number;
+    float time_acceleration;
+    bool solid_walls;
+    float inflow_width, inflow_height;
+    bool use_sea_level;
+    float sea_level;
+
+    // sea wave settings. (skx, sky) is the wave vector, computed from sk and sk_dir.
+    float sa[4], skx[4], sky[4], so[4];
+};
+
+void GetSimSettings(SimSettings &out);
+
+// Likewise for the graphics settings used by the software renderer
+// (the same values ShallowWaterEngine::fillConstantBuffers sends to the shaders).
+struct RenderSettings {
+    int nx, ny;
+    float W, L;
+    float fov;                // x field of view, degrees
+    float light_dir[3];       // towards the sun, world space
+    float ambient;
+    float fresnel_coeff, fresnel_exponent;
+    float specular_intensity, specular_exponent;
+    float refractive_index;
+    float attenuation_1, attenuation_2;
+    float deep_col[3];
+};
+
+void GetRenderSettings(RenderSettings &out);
+
 // global array of settings, 'null terminated'
 extern Setting g_settings[];
 
-// flag to communicate when the settings have changed
-extern ResetType g_reset_type;
-
 // helper functions
 float GetSetting(const char * name);
 inline float GetSetting(const std::string &s) { return GetSetting(s.c_str()); }
@@ -74,4 +247,31 @@ int GetIntSetting(const char *name);
 void SetSetting(const char *name, float new_value);
 inline void SetSettingD(const char *name, double val) { SetSetting(name, float(val)); }
 
+// returns null if there is no setting with the given name
+Setting * FindSetting(const char *name);
+
+// puts every setting back to its initial (startup) value
+void ResetSettings();
+
+// fast versions of the above
+inline float GetSetting(SettingHandle h) { return float(g_setting_handles[h]->value); }
+inline int GetIntSetting(SettingHandle h) { return int(GetSetting(h) + 0.5f); }
+inline void SetSetting(SettingHandle h, float new_value) { g_setting_handles[h]->value = double(new_value); }
+
+// A copy of the values of all the settings, for work done on another
+// thread (see terrain_build.hpp), which must not read g_settings while
+// the main thread may be changing it.
+class SettingsSnapshot {
+public:
+    SettingsSnapshot();   // copies the current values
+    void capture();       // copies them again (without allocating)
+
+    void set(int index, double value) { values[index] = value; }   // index into g_settings
+    float get(SettingHandle h) const { return float(values[g_setting_handles[h] - g_settings]); }
+    int getInt(SettingHandle h) const { return int(get(h) + 0.5f); }
+
+private:
+    std::vector<double> values;
+};
+
 #endif
@@ -0,0 +1,145 @@
+/*
+ * FILE:
+ *   settings_queue.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "settings_queue.hpp"
+
+#include <algorithm>
+
+namespace {
+    // time a terrain or mesh setting must be left alone before it is applied
+    const unsigned int DEBOUNCE_MS = 250;
+
+    // the R_NONE settings that are part of SimSettings
+    const SettingHandle SIM_HANDLES[] = {
+        SH_SOLID_WALLS, SH_INFLOW_WIDTH, SH_INFLOW_HEIGHT,
+        SH_GRAVITY, SH_FRICTION, SH_THETA, SH_MAX_CFL_NUMBER, SH_TIME_ACCELERATION,
+        SH_USE_SEA_LEVEL, SH_SEA_LEVEL,
+        SH_SA1, SH_SK1, SH_SK1_DIR, SH_SO1,
+        SH_SA2, SH_SK2, SH_SK2_DIR, SH_SO2,
+        SH_SA3, SH_SK3, SH_SK3_DIR, SH_SO3,
+        SH_SA4, SH_SK4, SH_SK4_DIR, SH_SO4
+    };
+    const int NUM_SIM_HANDLES = sizeof(SIM_HANDLES) / sizeof(SIM_HANDLES[0]);
+}
+
+SettingsQueue g_settings_queue;
+
+SettingsCost ClassifySetting(const Setting &setting)
+{
+    if (setting.reset_type >= R_MESH) return SC_REMESH;
+    if (setting.reset_type == R_TERRAIN) return SC_TERRAIN;
+
+    for (int i = 0; i < NUM_SIM_HANDLES; ++i) {
+        if (g_setting_handles[SIM_HANDLES[i]] == &setting) return SC_SIMULATION;
+    }
+    return SC_CONSTANTS;
+}
+
+SettingsQueue::SettingsQueue()
+    : rebuilding(false), pending_reset(R_NONE), expensive_edited(false), last_expensive_edit_ms(0)
+{
+    // more than are ever pending at once (other than just after a preset),
+    // so that set() and update() do not allocate
+    edits.reserve(16);
+    rebuild_edits.reserve(16);
+}
+
+void SettingsQueue::set(int index, double value)
+{
+    if (ClassifySetting(g_settings[index]) >= SC_TERRAIN) expensive_edited = true;
+
+    for (std::vector<PendingEdit>::iterator it = edits.begin(); it != edits.end(); ++it) {
+        if (it->index == index) {
+            it->value = value;
+            return;
+        }
+    }
+
+    PendingEdit edit;
+    edit.index = index;
+    edit.value = value;
+    edits.push_back(edit);
+}
+
+void SettingsQueue::reset(ResetType reset_type)
+{
+    pending_reset = std::max(pending_reset, reset_type);
+}
+
+void SettingsQueue::clear()
+{
+    edits.clear();
+    expensive_edited = false;
+}
+
+SettingsChange SettingsQueue::update(unsigned int now_ms)
+{
+    if (expensive_edited) {
+        last_expensive_edit_ms = now_ms;
+        expensive_edited = false;
+    }
+
+    // (unsigned subtraction, so this survives the timer wrapping round)
+    const bool settled = !rebuilding
+        && (pending_reset != R_NONE || now_ms - last_expensive_edit_ms >= DEBOUNCE_MS);
+
+    SettingsChange change;
+    change.reset_type = R_NONE;
+    change.simulation = false;
+    if (settled) {
+        change.reset_type = pending_reset;
+        pending_reset = R_NONE;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < edits.size(); ++i) {
+        Setting &setting = g_settings[edits[i].index];
+        const SettingsCost cost = ClassifySetting(setting);
+
+        if (cost >= SC_TERRAIN && !settled) {
+            edits[kept++] = edits[i];   // hold back until the slider settles
+            continue;
+        }
+
+        if (setting.value == edits[i].value) continue;
+
+        if (cost >= SC_TERRAIN) {
+            rebuild_edits.push_back(edits[i]);   // written when the rebuild is ready
+            change.reset_type = std::max(change.reset_type, setting.reset_type);
+        } else {
+            setting.value = edits[i].value;
+            if (cost == SC_SIMULATION) change.simulation = true;
+        }
+    }
+    edits.resize(kept);
+
+    if (change.reset_type != R_NONE) rebuilding = true;
+
+    return change;
+}
+
+void SettingsQueue::getRebuildSettings(SettingsSnapshot &out) const
+{
+    out.capture();
+    for (size_t i = 0; i < rebuild_edits.size(); ++i) {
+        out.set(rebuild_edits[i].index, rebuild_edits[i].value);
+    }
+}
+
+void SettingsQueue::commitRebuild()
+{
+    for (size_t i = 0; i < rebuild_edits.size(); ++i) {
+        g_settings[rebuild_edits[i].index].value = rebuild_edits[i].value;
+    }
+    rebuild_edits.clear();
+    rebuilding = false;
+}
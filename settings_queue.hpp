@@ -0,0 +1,103 @@
+/*
+ * FILE:
+ *   settings_queue.hpp
+ *
+ * PURPOSE:
+ *   Collects the settings edits made through the GUI, and applies them
+ *   once per frame, at a point where the main loop can act on them.
+ *
+ *   Each setting is classified by what it costs to change (see
+ *   SettingsCost). Cheap edits are written to g_settings at the next
+ *   update(). Edits that need the terrain or the mesh rebuilt are held
+ *   back until the slider has been left alone for a short while, so
+ *   that dragging a slider does one rebuild at the end instead of one
+ *   per mouse movement. Several edits to the same setting within that
+ *   time only keep the last value, and an edit that puts a setting
+ *   back to its current value costs nothing.
+ *
+ *   A reset (the reset button, or a preset) applies any held edits
+ *   straight away.
+ *
+ *   Terrain and mesh edits do not reach g_settings until the rebuild
+ *   they cause is ready to be switched in (see terrain_build.hpp), as
+ *   the rest of the demo must go on seeing the settings that match
+ *   the terrain it has. While a rebuild is in progress, any further
+ *   terrain or mesh edits, and resets, wait for it to finish.
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef SETTINGS_QUEUE_HPP
+#define SETTINGS_QUEUE_HPP
+
+#include "settings.hpp"
+
+#include <vector>
+
+// What has to be redone when a setting changes, cheapest first.
+enum SettingsCost {
+    SC_CONSTANTS,    // nothing; read every frame (e.g. by fillConstantBuffers)
+    SC_SIMULATION,   // solver and boundary parameters: the SimSettings must be re-read
+    SC_TERRAIN,      // terrain rebuild (R_TERRAIN)
+    SC_REMESH        // mesh rebuild (R_MESH and above)
+};
+
+SettingsCost ClassifySetting(const Setting &setting);
+
+// The result of SettingsQueue::update.
+struct SettingsChange {
+    ResetType reset_type;   // terrain or mesh rebuild to start (see getRebuildSettings), or R_NONE
+    bool simulation;        // SimSettings need to be re-read
+};
+
+class SettingsQueue {
+public:
+    SettingsQueue();
+
+    // Sets g_settings[index] to value, at the next update().
+    void set(int index, double value);
+
+    // Requests a reset of at least the given type at the next update().
+    // Any held edits are applied then too.
+    void reset(ResetType reset_type);
+
+    // Drops any edits not yet applied (e.g. before loading a preset).
+    void clear();
+
+    // Call once per frame. Writes the edits that are due into g_settings,
+    // and says what needs to be done about them.
+    SettingsChange update(unsigned int now_ms);
+
+    // The settings for the rebuild started by update(): g_settings, plus
+    // the terrain and mesh edits that are waiting for it.
+    void getRebuildSettings(SettingsSnapshot &out) const;
+
+    // Call when the rebuild is switched in. Writes its edits into g_settings.
+    void commitRebuild();
+
+    // Whether a rebuild is in progress, or a reset is waiting to start one.
+    bool isRebuildPending() const { return rebuilding || pending_reset != R_NONE; }
+
+private:
+    struct PendingEdit {
+        int index;
+        double value;
+    };
+    std::vector<PendingEdit> edits;
+    std::vector<PendingEdit> rebuild_edits;   // waiting for commitRebuild
+    bool rebuilding;
+
+    ResetType pending_reset;
+    bool expensive_edited;                  // expensive edit since the last update()
+    unsigned int last_expensive_edit_ms;
+};
+
+// The queue for the GUI's edits.
+extern SettingsQueue g_settings_queue;
+
+#endif
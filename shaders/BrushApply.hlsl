@@ -0,0 +1,30 @@
+// see kp07.hlsl for details of this file
+
+#include "kp07.hlsl"
+
+// BrushApply shader
+// Raises the water level w by the same amount as the terrain brush raises BA
+// (see terrain_brush.hpp), so that the depth does not change.
+// Only the brush footprint is drawn.
+
+// input: txState (t0) -- a copy of the state, at least within the footprint
+//        txBrush (t4) -- the precomputed BA weights of the brush, centred on the brush
+// output: new state
+
+cbuffer BrushConstBuffer : register( b1 )
+{
+    int brush_left, brush_top;   // grid index corresponding to txBrush(0,0)
+    float brush_displacement;
+};
+
+Texture2D<float> txBrush : register( t4 );
+
+float4 BrushApply( VS_OUTPUT input ) : SV_Target
+{
+    const int3 idx = GetTexIdx(input);
+    const int3 brush_idx = int3(idx.x - brush_left, idx.y - brush_top, 0);
+
+    float4 state = txState.Load(idx);
+    state.r += brush_displacement * txBrush.Load(brush_idx);
+    return state;
+}
@@ -0,0 +1,33 @@
+// see kp07.hlsl for details of this file
+
+#include "kp07.hlsl"
+
+// ProbeGather shader
+// Samples the state at a list of probe cells (see probe_set.hpp), so that
+// all probes can be read back to the CPU with a single copy.
+
+// The output is a (nx+4) * R texture, filled in row major order (one pixel
+// per probe). txProbeCell is the same size, and gives the (integer) cell
+// index of each probe. Unused pixels point at a valid cell and are ignored.
+
+// input: txState (t0), txBottom (t1), txProbeCell (t4)
+// output: {h, u, v, w} for each probe.
+
+Texture2D<float2> txProbeCell : register( t4 );
+
+float4 ProbeGather( VS_OUTPUT input ) : SV_Target
+{
+    const float2 cell = txProbeCell.Load(GetTexIdx(input));
+    const int3 idx = int3(cell.x, cell.y, 0);
+
+    const float4 state = txState.Load(idx);
+    const float w = state.r;
+    const float B = txBottom.Load(idx).b;
+
+    const float h = max(0, w - B);
+
+    float u, v;
+    CalcUV_Scalar(h, state.g, state.b, u, v);
+
+    return float4(h, u, v, w);
+}
@@ -0,0 +1,24 @@
+// see kp07.hlsl for details of this file
+
+#include "kp07.hlsl"
+
+// TerrainUpdate shader
+// Moves the water level w by the change in BA between the old and new
+// terrain, so that the depth does not change (the whole-grid version of
+// BrushApply). Used when the terrain settings change.
+
+// input: txState (t0) -- current state
+//        txBottom (t1) -- the old bottom
+//        txNewBottom (t4) -- the new bottom
+// output: new state
+
+Texture2D<float3> txNewBottom : register( t4 );
+
+float4 TerrainUpdate( VS_OUTPUT input ) : SV_Target
+{
+    const int3 idx = GetTexIdx(input);
+
+    float4 state = txState.Load(idx);
+    state.r += txNewBottom.Load(idx).b - txBottom.Load(idx).b;
+    return state;
+}
@@ -10,7 +10,8 @@ WATER_PS_INPUT WaterVertexShader( VS_INPUT input )
     WATER_PS_INPUT output;
 
     // lookup the terrain level
-    const int3 idx = int3(input.pos.x, input.pos.y, 0);
+    const int2 pos = GetMeshPos(input);
+    const int3 idx = int3(pos.x, pos.y, 0);
     const float3 ground_tex = txHeightfield.Load(idx);
     const float B = ground_tex.r;
     const float3 ground_normal = normalize(float3(-ground_tex.g, -ground_tex.b, 1));
@@ -27,7 +28,7 @@ WATER_PS_INPUT WaterVertexShader( VS_INPUT input )
     // compute position in clip space
     const float dmin = 0.05f;
     const float vert_bias = (output.water_depth < dmin ? 2*(output.water_depth - dmin) : 0);
-    const float4 pos_in = float4( input.pos.x, input.pos.y, w + vert_bias, 1 );
+    const float4 pos_in = float4( pos.x, pos.y, w + vert_bias, 1 );
     output.pos = mul( tex_to_clip, pos_in );
 
     // now compute the normal
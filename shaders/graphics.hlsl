@@ -93,8 +93,12 @@ cbuffer MyConstBuffer : register( b0 )
 
 // Structure definitions
 
+// the water/terrain meshes are drawn as instanced patches (see mesh.hpp)
+#define PATCH_VERTS 65
+
 struct VS_INPUT {
-    int2 pos : INT_POSITION;       // texture indices
+    uint vertex_id : SV_VertexID;      // vertex within the patch: j * PATCH_VERTS + i
+    int2 patch_origin : PATCH_ORIGIN;  // texture indices of vertex (0,0) of the patch
 };
 
 struct TERRAIN_PS_INPUT {
@@ -118,6 +122,15 @@ struct SKYBOX_PS_INPUT {
 };
 
 
+// Texture indices of a mesh vertex (clamped to the edge of the mesh)
+int2 GetMeshPos(VS_INPUT input)
+{
+    const int id = int(input.vertex_id);
+    const int2 pos = input.patch_origin + int2(id % PATCH_VERTS, id / PATCH_VERTS);
+    return min(pos, int2(nx_plus_1, ny_plus_1));
+}
+
+
 // lighting function for terrain.
 
 float3 TerrainColour(float3 tex_colour, float3 terrain_normal)
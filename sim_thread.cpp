@@ -0,0 +1,214 @@
+/*
+ * FILE:
+ *   sim_thread.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "profiler.hpp"
+#include "sim_thread.hpp"
+
+#include <algorithm>
+
+namespace {
+    // Brush strokes arrive at most once per frame, so this is plenty.
+    const unsigned int BRUSH_QUEUE_SIZE = 256;
+
+    // Room for a few frames' worth of step times, even at small mesh sizes.
+    const unsigned int STEP_TIME_QUEUE_SIZE = 4096;
+
+    // Re-measure the wall clock time per step this often (as main.cpp does
+    // for the GPU version).
+    const int STEPS_PER_RESET = 10;
+
+    // Initial wall clock dt, as main.cpp uses after a reset.
+    const float INITIAL_DT = 0.001f;
+
+    // Copying out the state is not free (about 23 MB at 1200x1200), so a step
+    // is only published if the render thread has taken the last one, or that
+    // is older than this. (The render thread takes at most one per frame.)
+    const unsigned long long MAX_PUBLISH_INTERVAL_NS = 4000000;
+}
+
+SimThread::SimThread(const SimSettings &settings_,
+                     const BottomEntry *bottom,
+                     float inlet_x,
+                     const float *initial_state,
+                     float total_time,
+                     int num_threads)
+    : nx(settings_.nx), ny(settings_.ny), settings(settings_), steps(0), terrain_changes(0), brushes_taken(0),
+      brush_events(BRUSH_QUEUE_SIZE), step_times(STEP_TIME_QUEUE_SIZE),
+      new_terrain(0), terrain_changes_sent(0), brushes_sent(0), quit(false), busy_ns(0)
+{
+    pool.reset(new WorkerPool(num_threads));
+    solver.reset(new CpuSolver(settings, bottom, inlet_x, initial_state));
+    solver->setWorkerPool(pool.get());
+    solver->setTotalTime(total_time);
+
+    solver->resetTimestep(INITIAL_DT * settings.time_acceleration, stats);
+
+    // so that getCurrentFrame is valid from the start
+    publishFrame(INITIAL_DT);
+    frames.update();
+
+    thread = std::thread(&SimThread::threadMain, this);
+}
+
+SimThread::~SimThread()
+{
+    stop();
+    delete new_terrain.exchange(0);
+}
+
+void SimThread::stop()
+{
+    if (!thread.joinable()) return;
+    quit = true;
+    thread.join();
+    frames.update();
+
+    // a terrain change the thread did not get round to still applies to the final state
+    long long brushes_to_skip;
+    if (applyTerrainChange(brushes_to_skip)) {
+        publishFrame(frames.getReadBuffer().wall_dt);
+        frames.update();
+    }
+}
+
+void SimThread::setSettings(const SimSettings &s)
+{
+    new_settings.getWriteBuffer() = s;
+    new_settings.publish();
+}
+
+bool SimThread::addBrushEvent(const BrushEvent &ev)
+{
+    if (!brush_events.push(ev)) return false;
+    ++brushes_sent;
+    return true;
+}
+
+void SimThread::setTerrain(const BottomEntry *bottom, float inlet_x)
+{
+    TerrainChange *change = new TerrainChange;
+    change->bottom.assign(bottom, bottom + (nx+4) * (ny+4));
+    change->inlet_x = inlet_x;
+    change->serial = ++terrain_changes_sent;
+    change->brushes_before = brushes_sent;
+
+    // (the thread never keeps a change once it has taken it, so an old one left
+    // here has not been applied, and can just be dropped)
+    delete new_terrain.exchange(change);
+}
+
+void SimThread::takeStepTimes(LatencyHistogram &out)
+{
+    unsigned int ns;
+    while (step_times.pop(ns)) out.record(ns);
+}
+
+const SimFrame * SimThread::getLatestFrame()
+{
+    if (!frames.update()) return 0;
+    if (frames.getReadBuffer().terrain_changes != terrain_changes_sent) return 0;   // old terrain
+    return &frames.getReadBuffer();
+}
+
+void SimThread::publishFrame(float wall_dt)
+{
+    SimFrame &frame = frames.getWriteBuffer();
+    const CellState *state = solver->getState();
+    frame.state.assign(state, state + (nx+4) * (ny+4));
+    frame.stats = stats;
+    frame.total_time = solver->getTotalTime();
+    frame.timestep = solver->getTimestep();
+    frame.wall_dt = wall_dt;
+    frame.steps = steps;
+    frame.terrain_changes = terrain_changes;
+    frames.publish();
+}
+
+// Applies the latest setTerrain, if there is one the thread has not seen yet,
+// and sets brushes_to_skip to the number of queued brush events that came before it.
+bool SimThread::applyTerrainChange(long long &brushes_to_skip)
+{
+    brushes_to_skip = 0;
+    boost::scoped_ptr<TerrainChange> change(new_terrain.exchange(0));
+    if (!change) return false;
+
+    solver->updateTerrain(&change->bottom[0], change->inlet_x);
+    terrain_changes = change->serial;   // (any changes in between were replaced by this one)
+    brushes_to_skip = std::max(0LL, change->brushes_before - brushes_taken);
+    return true;
+}
+
+void SimThread::threadMain()
+{
+    SetProfilerThreadName("Simulation");
+
+    BrushBatch batch(nx, ny, settings.W, settings.L);
+    BrushEvent ev;
+
+    float wall_dt = INITIAL_DT;
+    unsigned long long period_start = ProfilerTicks();
+    int period_steps = 0;
+
+    unsigned long long last_publish = period_start;
+    bool published = true;
+
+    while (!quit) {
+        const unsigned long long start = ProfilerTicks();
+
+        {
+            PROFILE_SCOPE("SimStep");
+
+            if (new_settings.update()) {
+                settings = new_settings.getReadBuffer();
+                solver->setSettings(settings);
+            }
+
+            // (events are always pushed before a later setTerrain, so all those
+            // to be skipped are in the queue by now)
+            long long brushes_to_skip;
+            applyTerrainChange(brushes_to_skip);
+
+            batch.clear();
+            while (brush_events.pop(ev)) {
+                ++brushes_taken;
+                if (brushes_to_skip > 0) --brushes_to_skip;
+                else batch.add(ev);
+            }
+            if (!batch.empty()) solver->applyBrushBatch(batch);
+
+            solver->timestep();
+            ++steps;
+
+            if (++period_steps == STEPS_PER_RESET) {
+                const unsigned long long now = ProfilerTicks();
+                wall_dt = float(double(now - period_start) * 1e-9 / STEPS_PER_RESET);
+                solver->resetTimestep(wall_dt * settings.time_acceleration, stats);
+                period_start = now;
+                period_steps = 0;
+            }
+
+            const unsigned long long now = ProfilerTicks();
+            published = !frames.isPending() || now - last_publish >= MAX_PUBLISH_INTERVAL_NS;
+            if (published) {
+                publishFrame(wall_dt);
+                last_publish = now;
+            }
+        }
+
+        const unsigned long long step_ns = ProfilerTicks() - start;
+        busy_ns += step_ns;
+        step_times.push((unsigned int)std::min(step_ns, 0xffffffffull));
+    }
+
+    // so that stop() leaves the final state in getCurrentFrame
+    if (!published) publishFrame(wall_dt);
+}
@@ -0,0 +1,154 @@
+/*
+ * FILE:
+ *   sim_thread.hpp
+ *
+ * PURPOSE:
+ *   Runs a CpuSolver continuously on a dedicated thread (with a
+ *   WorkerPool for the passes themselves), so that the simulation
+ *   rate no longer depends on the frame rate, nor the frame rate on
+ *   the simulation.
+ *
+ *   Nothing here ever blocks either thread:
+ *    - completed states are handed to the render thread through a
+ *      TripleBuffer (the render thread just picks up the newest one,
+ *      if there is one, each frame). Steps are not all copied out:
+ *      only when the last one has been picked up, or a few ms old;
+ *    - new settings go the other way through another TripleBuffer;
+ *    - brush strokes are queued through an SpscQueue, and applied
+ *      (as one BrushBatch) at the start of the next timestep;
+ *    - a new terrain is swapped in through an atomic pointer, also at
+ *      the start of the next timestep. Until then getLatestFrame skips
+ *      the frames (still on the old terrain), so the render thread
+ *      never sees a state that does not match its g_bottom.
+ *
+ *   The timestep is chosen as in the main loop of the GPU version:
+ *   every 10 steps, the wall clock time per step (times
+ *   time_acceleration, and subject to the CFL limit) becomes the new
+ *   timestep, so simulated time keeps pace with real time.
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef SIM_THREAD_HPP
+#define SIM_THREAD_HPP
+
+#include "brush_log.hpp"
+#include "cpu_solver.hpp"
+#include "latency_histogram.hpp"
+#include "settings.hpp"
+#include "spsc_queue.hpp"
+#include "triple_buffer.hpp"
+#include "worker_pool.hpp"
+
+#include "boost/scoped_ptr.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// One completed timestep, as seen by the render thread.
+struct SimFrame {
+    std::vector<CellState> state;   // (nx+4) * (ny+4), including ghost zones
+    SimStats stats;                 // from the most recent resetTimestep
+    float total_time;               // simulated time at the end of the step
+    float timestep;                 // simulated seconds per step
+    float wall_dt;                  // real seconds per step (before time_acceleration)
+    long long steps;                // timesteps done since the thread started
+    int terrain_changes;            // setTerrain calls applied before this step
+};
+
+class SimThread {
+public:
+    // bottom and initial_state as for CpuSolver (they are copied).
+    // num_threads is the size of the worker pool, including the simulation thread itself.
+    SimThread(const SimSettings &settings,
+              const BottomEntry *bottom,
+              float inlet_x,
+              const float *initial_state,
+              float total_time,
+              int num_threads);
+    ~SimThread();   // stops the thread
+
+    int getNX() const { return nx; }
+    int getNY() const { return ny; }
+
+    // The following are for the render thread only.
+
+    // Takes effect from the next timestep. nx and ny must not change.
+    void setSettings(const SimSettings &settings);
+
+    // Queues a brush stroke (ev.time is ignored). Returns false, dropping
+    // the stroke, if the simulation thread has fallen too far behind.
+    bool addBrushEvent(const BrushEvent &ev);
+
+    // Switches to a new terrain (of the same size), keeping the water depth
+    // unchanged (see CpuSolver::updateTerrain). bottom is copied. Takes effect
+    // from the next timestep; a change not yet picked up is replaced. Brush
+    // strokes queued before the call, but not yet applied, are dropped (they
+    // were made on the old terrain, which bottom replaces).
+    void setTerrain(const BottomEntry *bottom, float inlet_x);
+
+    // Returns the newest completed frame, or null if there has not been one
+    // since the last call. The frame stays valid until the next call.
+    const SimFrame * getLatestFrame();
+
+    // The frame most recently returned by getLatestFrame (or the initial
+    // state, if none). Still valid after stop().
+    const SimFrame & getCurrentFrame() const { return frames.getReadBuffer(); }
+
+    // Nanoseconds the simulation thread has spent working since the last call.
+    unsigned long long takeBusyNs() { return busy_ns.exchange(0); }
+
+    // Adds the wall clock time of each timestep since the last call to the
+    // histogram. (Steps are dropped if this is not called for a while.)
+    void takeStepTimes(LatencyHistogram &out);
+
+    // Waits for the current timestep to finish, then stops the thread,
+    // and makes the final state available through getCurrentFrame.
+    void stop();
+
+private:
+    SimThread(const SimThread &);
+    void operator=(const SimThread &);
+
+    void threadMain();
+    void publishFrame(float wall_dt);
+    bool applyTerrainChange(long long &brushes_to_skip);
+
+    struct TerrainChange {
+        std::vector<BottomEntry> bottom;
+        float inlet_x;
+        int serial;   // terrain_changes_sent, including this one
+        long long brushes_before;   // brushes_sent at the time
+    };
+
+private:
+    const int nx, ny;
+    // owned by the simulation thread once it has started
+    SimSettings settings;
+    SimStats stats;
+    boost::scoped_ptr<WorkerPool> pool;
+    boost::scoped_ptr<CpuSolver> solver;
+    long long steps;
+    int terrain_changes;
+    long long brushes_taken;   // brush events popped so far
+
+    TripleBuffer<SimFrame> frames;
+    TripleBuffer<SimSettings> new_settings;
+    SpscQueue<BrushEvent> brush_events;
+    SpscQueue<unsigned int> step_times;   // ns
+    std::atomic<TerrainChange*> new_terrain;
+    int terrain_changes_sent;   // render thread only
+    long long brushes_sent;     // render thread only
+
+    std::atomic<bool> quit;
+    std::atomic<unsigned long long> busy_ns;
+    std::thread thread;
+};
+
+#endif
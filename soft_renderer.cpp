@@ -0,0 +1,819 @@
+/*
+ * FILE:
+ *   soft_renderer.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "soft_renderer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+namespace {
+    const float PI = 4.0f * std::atan(1.0f);
+
+    const int TILE_SIZE = 64;          // pixels
+    const int SUBPIXEL_BITS = 8;
+    const int SUBPIXEL = 1 << SUBPIXEL_BITS;
+    const float GUARD_BAND = 8192;     // pixels beyond each edge of the screen before triangles are clipped
+    const int VERTEX_JOB_ROWS = 16;
+    const int SETUP_JOB_ROWS = 8;      // quad rows per triangle setup job
+
+    // width of the entire grass BMP in metres (as in ShallowWaterEngine::fillConstantBuffers)
+    const float GRASS_SIZE = 15.0f;
+
+    // water vertices shallower than this are pushed down (as WaterVertexShader)
+    const float DMIN = 0.05f;
+
+    // A triangle of the mesh: water triangles first, so that they win depth ties
+    // (the engine draws the water first, with a LESS depth test). The quad index
+    // is (b * (nx-1) + a) for the quad whose bottom left vertex is (a, b); half 0 is
+    // (tl, br, bl) and half 1 is (tl, tr, br), as in BuildPatchIndices.
+    const unsigned int TERRAIN_PRIM = 0x80000000u;
+    const unsigned int NO_PRIM = 0xffffffffu;
+
+    unsigned int MakePrim(bool terrain, int quad, int half)
+    {
+        return (terrain ? TERRAIN_PRIM : 0) | (unsigned(quad) << 1) | unsigned(half);
+    }
+
+    // row major 4x4 matrices
+    void MatMul(const float a[16], const float b[16], float out[16])
+    {
+        for (int r = 0; r < 4; ++r) {
+            for (int c = 0; c < 4; ++c) {
+                out[4*r + c] = a[4*r] * b[c] + a[4*r + 1] * b[4 + c] + a[4*r + 2] * b[8 + c] + a[4*r + 3] * b[12 + c];
+            }
+        }
+    }
+
+    float Dot(const float a[3], const float b[3])
+    {
+        return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+    }
+
+    void Normalize(float v[3])
+    {
+        const float len = std::sqrt(Dot(v, v));
+        if (len > 0) {
+            v[0] /= len;
+            v[1] /= len;
+            v[2] /= len;
+        }
+    }
+
+    float Saturate(float x)
+    {
+        return x < 0 ? 0 : x > 1 ? 1 : x;
+    }
+
+    unsigned char ToByte(float x)
+    {
+        return (unsigned char)(Saturate(x) * 255.0f + 0.5f);
+    }
+
+    // simplified gamma correction (as WaterPixelShader)
+    float ToLinear(float srgb) { return std::pow(std::abs(srgb), 2.2f); }
+    float FromLinear(float lin) { return std::pow(std::abs(lin), 1.0f / 2.2f); }
+
+    // HLSL refract(): returns zero on total internal reflection
+    void Refract(const float i[3], const float n[3], float eta, float out[3])
+    {
+        const float cosi = -Dot(i, n);
+        const float cost2 = 1 - eta * eta * (1 - cosi * cosi);
+        const float k = eta * cosi - std::sqrt(std::abs(cost2));
+        for (int c = 0; c < 3; ++c) {
+            out[c] = cost2 > 0 ? eta * i[c] + k * n[c] : 0;
+        }
+    }
+
+    // Bilinear filtering of one level of a texture; texel centres are at
+    // half-integer coordinates, as in Direct3D. wrap = false clamps to the edge.
+    void SampleBilinear(const MipChains &tex, int image, int level, float u, float v, bool wrap, float out[3])
+    {
+        const int w = GetMipSize(tex.width, level);
+        const int h = GetMipSize(tex.height, level);
+        const unsigned char *texels = &tex.images[image][GetMipOffset(tex.width, tex.height, level)];
+
+        const float fx = u * w - 0.5f, fy = v * h - 0.5f;
+        const float x_floor = std::floor(fx), y_floor = std::floor(fy);
+        const float tx = fx - x_floor, ty = fy - y_floor;
+
+        int x0 = int(x_floor), y0 = int(y_floor), x1, y1;
+        if (wrap) {
+            x0 = ((x0 % w) + w) % w;
+            y0 = ((y0 % h) + h) % h;
+            x1 = (x0 + 1) % w;
+            y1 = (y0 + 1) % h;
+        } else {
+            x1 = std::min(std::max(x0 + 1, 0), w - 1);
+            y1 = std::min(std::max(y0 + 1, 0), h - 1);
+            x0 = std::min(std::max(x0, 0), w - 1);
+            y0 = std::min(std::max(y0, 0), h - 1);
+        }
+
+        const unsigned char *p00 = texels + (y0 * w + x0) * 4;
+        const unsigned char *p10 = texels + (y0 * w + x1) * 4;
+        const unsigned char *p01 = texels + (y1 * w + x0) * 4;
+        const unsigned char *p11 = texels + (y1 * w + x1) * 4;
+        for (int c = 0; c < 3; ++c) {
+            const float top = p00[c] + (p10[c] - p00[c]) * tx;
+            const float bottom = p01[c] + (p11[c] - p01[c]) * tx;
+            out[c] = (top + (bottom - top) * ty) * (1.0f / 255.0f);
+        }
+    }
+
+    // lod = log2(texels per pixel)
+    void SampleTrilinear(const MipChains &tex, float u, float v, float lod, float out[3])
+    {
+        if (lod <= 0) {
+            SampleBilinear(tex, 0, 0, u, v, true, out);
+            return;
+        }
+        const int level = int(lod);
+        if (level >= tex.num_levels - 1) {
+            SampleBilinear(tex, 0, tex.num_levels - 1, u, v, true, out);
+            return;
+        }
+
+        float next[3];
+        SampleBilinear(tex, 0, level, u, v, true, out);
+        SampleBilinear(tex, 0, level + 1, u, v, true, next);
+        const float t = lod - level;
+        for (int c = 0; c < 3; ++c) out[c] += (next[c] - out[c]) * t;
+    }
+
+    // Direct3D cube map lookup. The faces are +X, -X, +Y, -Y, +Z (-Z is black).
+    void SampleCube(const MipChains &tex, const float dir[3], float out[3])
+    {
+        const float ax = std::abs(dir[0]), ay = std::abs(dir[1]), az = std::abs(dir[2]);
+        int face;
+        float sc, tc, ma;
+        if (ax >= ay && ax >= az) {
+            face = dir[0] > 0 ? 0 : 1;
+            sc = dir[0] > 0 ? -dir[2] : dir[2];
+            tc = -dir[1];
+            ma = ax;
+        } else if (ay >= az) {
+            face = dir[1] > 0 ? 2 : 3;
+            sc = dir[0];
+            tc = dir[1] > 0 ? dir[2] : -dir[2];
+            ma = ay;
+        } else {
+            face = dir[2] > 0 ? 4 : 5;
+            sc = dir[2] > 0 ? dir[0] : -dir[0];
+            tc = -dir[1];
+            ma = az;
+        }
+
+        if (face >= int(tex.images.size()) || ma == 0) {
+            out[0] = out[1] = out[2] = 0;
+            return;
+        }
+        SampleBilinear(tex, face, 0, 0.5f * (sc / ma + 1), 0.5f * (tc / ma + 1), false, out);
+    }
+
+    // Plane distances used for clipping; >= 0 is inside
+    enum ClipPlane { CLIP_NEAR, CLIP_LEFT, CLIP_RIGHT, CLIP_BOTTOM, CLIP_TOP, NUM_CLIP_PLANES };
+
+    // a lexicographic order, so that an edge shared by two triangles is
+    // always clipped in the same direction (and gives the same point)
+    template<class V>
+    bool VertexLess(const V &a, const V &b)
+    {
+        return a.x != b.x ? a.x < b.x
+            : a.y != b.y ? a.y < b.y
+            : a.z != b.z ? a.z < b.z
+            : a.w < b.w;
+    }
+
+    int FloorDiv(int a, int b)   // b > 0
+    {
+        return a >= 0 ? a / b : -((-a + b - 1) / b);
+    }
+
+    // Runs job(0) ... job(num_jobs - 1) on up to num_threads threads.
+    template<class Job>
+    struct JobWorker {
+        Job *job;
+        std::atomic<int> *next;
+        int num_jobs;
+        void operator()() const
+        {
+            for (int i = (*next)++; i < num_jobs; i = (*next)++) (*job)(i);
+        }
+    };
+
+    template<class Job>
+    void RunJobs(Job &job, int num_jobs, int num_threads)
+    {
+        std::atomic<int> next(0);
+        const JobWorker<Job> worker = { &job, &next, num_jobs };
+
+        std::vector<std::thread> threads;
+        for (int i = 1; i < std::min(num_threads, num_jobs); ++i) {
+            threads.push_back(std::thread(worker));
+        }
+        worker();
+        for (size_t i = 0; i < threads.size(); ++i) threads[i].join();
+    }
+}
+
+struct SoftRenderer::VertexJob {
+    SoftRenderer *r;
+    int ny;
+    void operator()(int i) const
+    {
+        r->vertexRows(i * VERTEX_JOB_ROWS, std::min((i+1) * VERTEX_JOB_ROWS, ny));
+    }
+};
+
+struct SoftRenderer::SetupJob {
+    SoftRenderer *r;
+    int quad_rows;
+    void operator()(int i) const
+    {
+        r->setupRows(r->bins[i], i * SETUP_JOB_ROWS, std::min((i+1) * SETUP_JOB_ROWS, quad_rows));
+    }
+};
+
+struct SoftRenderer::TileJob {
+    SoftRenderer *r;
+    void operator()(int i) const
+    {
+        float depth[TILE_SIZE * TILE_SIZE];
+        unsigned int prims[TILE_SIZE * TILE_SIZE];
+        r->drawTile(i, depth, prims);
+    }
+};
+
+SoftRenderer::SoftRenderer(const RenderSettings &settings_, const MipChains &grass_, const MipChains &skybox_,
+                           int num_threads_)
+    : settings(settings_), grass(grass_), skybox(skybox_), num_threads(num_threads_),
+      heightfield(0), state(0), fb_width(0), fb_height(0), tiles_x(0), tiles_y(0)
+{
+    if (num_threads <= 0) num_threads = std::max(1, int(std::thread::hardware_concurrency()));
+}
+
+void SoftRenderer::setSettings(const RenderSettings &s)
+{
+    settings = s;
+}
+
+int SoftRenderer::getTrianglesDrawn() const
+{
+    size_t n = 0;
+    for (size_t i = 0; i < bins.size(); ++i) n += bins[i].tris.size();
+    return int(n);
+}
+
+void SoftRenderer::render(const SoftCamera &camera, const TerrainEntry *heightfield_, const CellState *state_,
+                          int width, int height)
+{
+    heightfield = heightfield_;
+    state = state_;
+    fb_width = width;
+    fb_height = height;
+    framebuffer.resize(width * height * 4);
+    tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+    setupCamera(camera);
+
+    const int nx = settings.nx, ny = settings.ny;
+    water_pos.resize(nx * ny);
+    terrain_pos.resize(nx * ny);
+    water_attribs.resize(nx * ny);
+    water_hidden.resize(nx * ny);
+    terrain_normals.resize(nx * ny * 3);
+
+    VertexJob vertex_job = { this, ny };
+    RunJobs(vertex_job, (ny + VERTEX_JOB_ROWS - 1) / VERTEX_JOB_ROWS, num_threads);
+
+    const int quad_rows = ny - 1;
+    const int num_setup_jobs = (quad_rows + SETUP_JOB_ROWS - 1) / SETUP_JOB_ROWS;
+    bins.resize(num_setup_jobs);
+    for (int i = 0; i < num_setup_jobs; ++i) {
+        bins[i].tris.clear();
+        bins[i].tiles.resize(tiles_x * tiles_y);
+        for (size_t t = 0; t < bins[i].tiles.size(); ++t) bins[i].tiles[t].clear();
+    }
+    SetupJob setup_job = { this, quad_rows };
+    RunJobs(setup_job, num_setup_jobs, num_threads);
+
+    TileJob tile_job = { this };
+    RunJobs(tile_job, tiles_x * tiles_y, num_threads);
+}
+
+// The same transformations as ShallowWaterEngine::moveCamera and fillConstantBuffers
+void SoftRenderer::setupCamera(const SoftCamera &camera)
+{
+    const int nx = settings.nx, ny = settings.ny;
+    const float W = settings.W, L = settings.L;
+    const float dx = W / (nx - 1), dy = L / (ny - 1);
+
+    near_plane = 1;
+    far_plane = 2 * std::max(W, L);
+
+    const float fov_r = settings.fov * PI / 180.0f;
+    xpersp = 1.0f / std::tan(fov_r * 0.5f);
+    ypersp = float(fb_width) / float(fb_height) * xpersp;
+
+    const float cy = std::cos(camera.yaw), sy = std::sin(camera.yaw);
+    const float cp = std::cos(camera.pitch), sp = std::sin(camera.pitch);
+
+    const float tex_to_world[16] = { dx, 0,  0, -W/2 - 2*dx,
+                                     0,  dy, 0, -2*dy,
+                                     0,  0,  1, 0,
+                                     0,  0,  0, 1 };
+    const float translate_camera_pos[16] = { 1, 0, 0, -camera.x,
+                                             0, 1, 0, -camera.y,
+                                             0, 0, 1, -camera.z,
+                                             0, 0, 0, 1 };
+    const float rotate_around_z[16] = { cy, -sy, 0, 0,
+                                        sy, cy,  0, 0,
+                                        0,  0,   1, 0,
+                                        0,  0,   0, 1 };
+    const float rotate_around_x[16] = { 1, 0,   0,  0,
+                                        0, cp,  sp, 0,
+                                        0, -sp, cp, 0,
+                                        0, 0,   0,  1 };
+    const float swap_y_and_z[16] = { 1, 0, 0, 0,
+                                     0, 0, 1, 0,
+                                     0, 1, 0, 0,
+                                     0, 0, 0, 1 };
+    const float f = far_plane, n = near_plane;
+    const float perspective[16] = { xpersp, 0,      0,           0,
+                                    0,      ypersp, 0,           0,
+                                    0,      0,      f / (f - n), -n * f / (f - n),
+                                    0,      0,      1,           0 };
+
+    float rotation[16], view[16], view_to_clip[16], tmp[16];
+    MatMul(swap_y_and_z, rotate_around_x, tmp);
+    MatMul(tmp, rotate_around_z, rotation);
+    MatMul(rotation, translate_camera_pos, tmp);
+    MatMul(tmp, tex_to_world, view);
+    MatMul(perspective, view, view_to_clip);
+    std::copy(view_to_clip, view_to_clip + 16, tex_to_clip);
+
+    // the rotation is orthogonal, so its inverse is its transpose
+    for (int r = 0; r < 3; ++r) {
+        for (int c = 0; c < 3; ++c) {
+            view_to_world[3*r + c] = rotation[4*c + r];
+        }
+    }
+
+    eye_mult[0] = -dx;
+    eye_mult[1] = -dy;
+    eye_mult[2] = -1;
+    eye_trans[0] = W/2 + 2*dx + camera.x;
+    eye_trans[1] = 2*dy + camera.y;
+    eye_trans[2] = camera.z;
+
+    world_mult[0] = dx;
+    world_mult[1] = dy;
+    world_trans[0] = -W/2 - 2*dx;
+    world_trans[1] = -2*dy;
+
+    terrain_tex_scale[0] = dx / GRASS_SIZE;
+    terrain_tex_scale[1] = dy / GRASS_SIZE;
+
+    for (int c = 0; c < 3; ++c) deep_col_linear[c] = ToLinear(settings.deep_col[c]);
+
+    // a pixel at distance d covers d / (0.5 * xpersp * fb_width) metres
+    grass_lod_scale = grass.width / GRASS_SIZE / (0.5f * xpersp * fb_width);
+}
+
+// Vertex shaders: TerrainVertexShader and WaterVertexShader, for mesh rows [row_begin, row_end).
+void SoftRenderer::vertexRows(int row_begin, int row_end)
+{
+    const int nx = settings.nx, ny = settings.ny;
+    const int pitch = nx + 4;
+    const float one_over_dx = (nx - 1) / settings.W;
+    const float one_over_dy = (ny - 1) / settings.L;
+    const float *m = tex_to_clip;
+
+    for (int j = row_begin; j < row_end; ++j) {
+        for (int i = 0; i < nx; ++i) {
+            const int v = j * nx + i;
+            const int k = (j+2) * pitch + (i+2);
+            const float px = float(i + 2), py = float(j + 2);
+
+            // terrain
+            const TerrainEntry &te = heightfield[k];
+            float ground_normal[3] = { -te.dBdx, -te.dBdy, 1.0f };
+            Normalize(ground_normal);
+
+            ClipPos &tp = terrain_pos[v];
+            tp.x = m[0] * px + m[1] * py + m[2] * te.B + m[3];
+            tp.y = m[4] * px + m[5] * py + m[6] * te.B + m[7];
+            tp.z = m[8] * px + m[9] * py + m[10] * te.B + m[11];
+            tp.w = m[12] * px + m[13] * py + m[14] * te.B + m[15];
+            std::copy(ground_normal, ground_normal + 3, &terrain_normals[3*v]);
+
+            // water. (no "gap" at the edge of the box)
+            float w = state[k].w;
+            if (i == 0 || j == 0 || i == nx - 1 || j == ny - 1) w = te.B;
+
+            WaterAttribs &wa = water_attribs[v];
+            wa.depth = w - te.B;
+            const float vert_bias = (wa.depth < DMIN ? 2 * (wa.depth - DMIN) : 0);
+            const float z = w + vert_bias;
+
+            ClipPos &wp = water_pos[v];
+            wp.x = m[0] * px + m[1] * py + m[2] * z + m[3];
+            wp.y = m[4] * px + m[5] * py + m[6] * z + m[7];
+            wp.z = m[8] * px + m[9] * py + m[10] * z + m[11];
+            wp.w = m[12] * px + m[13] * py + m[14] * z + m[15];
+
+            water_hidden[v] = z < te.B;
+
+            // normal, as Pass1
+            wa.normal[0] = (state[k-1].w - state[k+1].w) * one_over_dx;
+            wa.normal[1] = (state[k-pitch].w - state[k+pitch].w) * one_over_dy;
+            wa.normal[2] = 2;
+            Normalize(wa.normal);
+
+            // eye vector (from vertex towards camera)
+            wa.eye[0] = eye_mult[0] * px + eye_trans[0];
+            wa.eye[1] = eye_mult[1] * py + eye_trans[1];
+            wa.eye[2] = eye_mult[2] * z + eye_trans[2];
+            Normalize(wa.eye);
+
+            wa.world_x = world_mult[0] * px + world_trans[0];
+            wa.world_y = world_mult[1] * py + world_trans[1];
+            std::copy(ground_normal, ground_normal + 3, wa.terrain_normal);
+        }
+    }
+}
+
+// Triangle setup for quad rows [row_begin, row_end): the water and then the terrain
+void SoftRenderer::setupRows(Bins &out, int row_begin, int row_end)
+{
+    const int nx = settings.nx;
+
+    for (int pass = 0; pass < 2; ++pass) {
+        const bool terrain = (pass == 1);
+        const ClipPos *pos = terrain ? &terrain_pos[0] : &water_pos[0];
+
+        for (int b = row_begin; b < row_end; ++b) {
+            for (int a = 0; a < nx - 1; ++a) {
+                const int bl = b * nx + a, br = bl + 1;
+                const int tl = bl + nx, tr = tl + 1;
+                const int quad = b * (nx - 1) + a;
+
+                // a water triangle whose vertices are all below the terrain is hidden
+                // by the terrain triangle under it
+                const bool shared_hidden = !terrain && water_hidden[tl] && water_hidden[br];
+                if (!(shared_hidden && water_hidden[bl])) {
+                    setupTriangle(out, pos[tl], pos[br], pos[bl], MakePrim(terrain, quad, 0));
+                }
+                if (!(shared_hidden && water_hidden[tr])) {
+                    setupTriangle(out, pos[tl], pos[tr], pos[br], MakePrim(terrain, quad, 1));
+                }
+            }
+        }
+    }
+}
+
+void SoftRenderer::setupTriangle(Bins &out, const ClipPos &v0, const ClipPos &v1, const ClipPos &v2, unsigned int prim)
+{
+    const ClipPos * v[3] = { &v0, &v1, &v2 };
+
+    // trivial reject: all vertices outside the same frustum plane
+    unsigned int outside = ~0u;
+    for (int i = 0; i < 3; ++i) {
+        const ClipPos &p = *v[i];
+        outside &= (p.x < -p.w ? 1 : 0) | (p.x > p.w ? 2 : 0) | (p.y < -p.w ? 4 : 0) | (p.y > p.w ? 8 : 0)
+            | (p.z < 0 ? 16 : 0) | (p.z > p.w ? 32 : 0);
+    }
+    if (outside) return;
+
+    // planes that need clipping against
+    const float gx = 1 + 2 * GUARD_BAND / fb_width;
+    const float gy = 1 + 2 * GUARD_BAND / fb_height;
+    unsigned int crossed = 0;
+    for (int i = 0; i < 3; ++i) {
+        const ClipPos &p = *v[i];
+        crossed |= (p.z < 0 ? 1 << CLIP_NEAR : 0)
+            | (p.x < -gx * p.w ? 1 << CLIP_LEFT : 0) | (p.x > gx * p.w ? 1 << CLIP_RIGHT : 0)
+            | (p.y < -gy * p.w ? 1 << CLIP_BOTTOM : 0) | (p.y > gy * p.w ? 1 << CLIP_TOP : 0);
+    }
+    if (crossed == 0) {
+        binTriangle(out, v, prim);
+        return;
+    }
+
+    // Sutherland-Hodgman; each plane adds at most one vertex
+    ClipPos poly[2][3 + NUM_CLIP_PLANES];
+    int n = 3;
+    for (int i = 0; i < 3; ++i) poly[0][i] = *v[i];
+    int cur = 0;
+
+    for (int plane = 0; plane < NUM_CLIP_PLANES && n >= 3; ++plane) {
+        if (!(crossed & (1 << plane))) continue;
+
+        float dist[3 + NUM_CLIP_PLANES];
+        for (int i = 0; i < n; ++i) {
+            const ClipPos &p = poly[cur][i];
+            switch (plane) {
+            case CLIP_NEAR: dist[i] = p.z; break;
+            case CLIP_LEFT: dist[i] = p.x + gx * p.w; break;
+            case CLIP_RIGHT: dist[i] = gx * p.w - p.x; break;
+            case CLIP_BOTTOM: dist[i] = p.y + gy * p.w; break;
+            default: dist[i] = gy * p.w - p.y; break;
+            }
+        }
+
+        int m = 0;
+        for (int i = 0; i < n; ++i) {
+            const int j = (i + 1) % n;
+            if (dist[i] >= 0) poly[1-cur][m++] = poly[cur][i];
+            if ((dist[i] >= 0) != (dist[j] >= 0)) {
+                int a = i, b = j;
+                if (VertexLess(poly[cur][b], poly[cur][a])) std::swap(a, b);
+                const ClipPos &pa = poly[cur][a], &pb = poly[cur][b];
+                const float t = dist[a] / (dist[a] - dist[b]);
+                ClipPos &q = poly[1-cur][m++];
+                q.x = pa.x + t * (pb.x - pa.x);
+                q.y = pa.y + t * (pb.y - pa.y);
+                q.z = pa.z + t * (pb.z - pa.z);
+                q.w = pa.w + t * (pb.w - pa.w);
+            }
+        }
+        n = m;
+        cur = 1 - cur;
+    }
+
+    for (int i = 1; i + 1 < n; ++i) {
+        const ClipPos * fan[3] = { &poly[cur][0], &poly[cur][i], &poly[cur][i+1] };
+        binTriangle(out, fan, prim);
+    }
+}
+
+// Projects to the screen (w > 0 by now), culls back faces and empty
+// triangles, and adds the triangle to the tiles it covers.
+void SoftRenderer::binTriangle(Bins &out, const ClipPos * const v[3], unsigned int prim)
+{
+    ScreenTri tri;
+    for (int i = 0; i < 3; ++i) {
+        const float inv_w = 1.0f / v[i]->w;
+        const float sx = (v[i]->x * inv_w * 0.5f + 0.5f) * fb_width;
+        const float sy = (0.5f - v[i]->y * inv_w * 0.5f) * fb_height;
+        tri.x[i] = int(std::floor(sx * SUBPIXEL + 0.5f));
+        tri.y[i] = int(std::floor(sy * SUBPIXEL + 0.5f));
+        tri.inv_w[i] = inv_w;
+    }
+
+    // Direct3D's default is to cull anticlockwise triangles
+    const long long area = (long long)(tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0])
+        - (long long)(tri.y[1] - tri.y[0]) * (tri.x[2] - tri.x[0]);
+    if (area <= 0) return;
+
+    // pixels whose centres are inside the bounding box
+    const int half = SUBPIXEL / 2;
+    const int x_lo = std::min(std::min(tri.x[0], tri.x[1]), tri.x[2]);
+    const int x_hi = std::max(std::max(tri.x[0], tri.x[1]), tri.x[2]);
+    const int y_lo = std::min(std::min(tri.y[0], tri.y[1]), tri.y[2]);
+    const int y_hi = std::max(std::max(tri.y[0], tri.y[1]), tri.y[2]);
+    tri.x_min = std::max(FloorDiv(x_lo - half + SUBPIXEL - 1, SUBPIXEL), 0);
+    tri.x_max = std::min(FloorDiv(x_hi - half, SUBPIXEL), fb_width - 1);
+    tri.y_min = std::max(FloorDiv(y_lo - half + SUBPIXEL - 1, SUBPIXEL), 0);
+    tri.y_max = std::min(FloorDiv(y_hi - half, SUBPIXEL), fb_height - 1);
+    if (tri.x_min > tri.x_max || tri.y_min > tri.y_max) return;
+
+    tri.prim = prim;
+    const int index = int(out.tris.size());
+    out.tris.push_back(tri);
+
+    for (int ty = tri.y_min / TILE_SIZE; ty <= tri.y_max / TILE_SIZE; ++ty) {
+        for (int tx = tri.x_min / TILE_SIZE; tx <= tri.x_max / TILE_SIZE; ++tx) {
+            out.tiles[ty * tiles_x + tx].push_back(index);
+        }
+    }
+}
+
+void SoftRenderer::drawTile(int tile, float *depth, unsigned int *prims)
+{
+    const int x0 = (tile % tiles_x) * TILE_SIZE, y0 = (tile / tiles_x) * TILE_SIZE;
+    const int x1 = std::min(x0 + TILE_SIZE, fb_width), y1 = std::min(y0 + TILE_SIZE, fb_height);
+    const float min_inv_w = 1.0f / far_plane;
+
+    // depth is stored as 1/w (0 = infinitely far); greater is nearer
+    std::fill(depth, depth + TILE_SIZE * TILE_SIZE, 0.0f);
+    std::fill(prims, prims + TILE_SIZE * TILE_SIZE, NO_PRIM);
+
+    for (size_t job = 0; job < bins.size(); ++job) {
+        const std::vector<int> &list = bins[job].tiles[tile];
+
+        for (size_t t = 0; t < list.size(); ++t) {
+            const ScreenTri &tri = bins[job].tris[list[t]];
+
+            // edge functions, E_k > 0 inside the edge opposite vertex k.
+            // Pixels exactly on an edge are drawn only for top and left edges.
+            long long A[3], B[3], C[3];
+            for (int k = 0; k < 3; ++k) {
+                const int a = (k + 1) % 3, b = (k + 2) % 3;
+                const long long dx = tri.x[b] - tri.x[a], dy = tri.y[b] - tri.y[a];
+                A[k] = -dy;
+                B[k] = dx;
+                C[k] = dy * tri.x[a] - dx * tri.y[a];
+                const bool top_left = (dy == 0 && dx > 0) || dy < 0;
+                if (!top_left) C[k] -= 1;
+            }
+
+            // 1/w is linear in screen space: a plane in pixel coordinates
+            const double ax = (tri.x[1] - tri.x[0]) / double(SUBPIXEL), ay = (tri.y[1] - tri.y[0]) / double(SUBPIXEL);
+            const double bx = (tri.x[2] - tri.x[0]) / double(SUBPIXEL), by = (tri.y[2] - tri.y[0]) / double(SUBPIXEL);
+            const double det = ax * by - ay * bx;
+            const double d1 = tri.inv_w[1] - tri.inv_w[0], d2 = tri.inv_w[2] - tri.inv_w[0];
+            const double plane_x = (d1 * by - d2 * ay) / det;
+            const double plane_y = (d2 * ax - d1 * bx) / det;
+            const double origin_x = tri.x[0] / double(SUBPIXEL) - 0.5, origin_y = tri.y[0] / double(SUBPIXEL) - 0.5;
+
+            const int xs = std::max(tri.x_min, x0), xe = std::min(tri.x_max, x1 - 1);
+            const int ys = std::max(tri.y_min, y0), ye = std::min(tri.y_max, y1 - 1);
+
+            for (int y = ys; y <= ye; ++y) {
+                const long long px = (long long)xs * SUBPIXEL + SUBPIXEL / 2;
+                const long long py = (long long)y * SUBPIXEL + SUBPIXEL / 2;
+                long long e0 = A[0] * px + B[0] * py + C[0];
+                long long e1 = A[1] * px + B[1] * py + C[1];
+                long long e2 = A[2] * px + B[2] * py + C[2];
+                const long long step0 = A[0] * SUBPIXEL, step1 = A[1] * SUBPIXEL, step2 = A[2] * SUBPIXEL;
+
+                float inv_w = float(tri.inv_w[0] + plane_x * (xs - origin_x) + plane_y * (y - origin_y));
+                const float inv_w_step = float(plane_x);
+
+                float *depth_row = depth + (y - y0) * TILE_SIZE - x0;
+                unsigned int *prim_row = prims + (y - y0) * TILE_SIZE - x0;
+
+                for (int x = xs; x <= xe; ++x) {
+                    if ((e0 | e1 | e2) >= 0 && inv_w >= min_inv_w) {
+                        const float d = depth_row[x];
+                        if (inv_w > d || (inv_w == d && tri.prim < prim_row[x])) {
+                            depth_row[x] = inv_w;
+                            prim_row[x] = tri.prim;
+                        }
+                    }
+                    e0 += step0;
+                    e1 += step1;
+                    e2 += step2;
+                    inv_w += inv_w_step;
+                }
+            }
+        }
+    }
+
+    // shade every pixel once
+    for (int y = y0; y < y1; ++y) {
+        unsigned char *out = &framebuffer[(y * fb_width + x0) * 4];
+        for (int x = x0; x < x1; ++x, out += 4) {
+            const unsigned int prim = prims[(y - y0) * TILE_SIZE + (x - x0)];
+            if (prim == NO_PRIM) {
+                shadeSky(x, y, out);
+            } else {
+                shadePixel(x, y, prim, out);
+            }
+        }
+    }
+}
+
+// Pixel shaders: TerrainPixelShader and WaterPixelShader
+void SoftRenderer::shadePixel(int px, int py, unsigned int prim, unsigned char *out) const
+{
+    const int nx = settings.nx;
+    const bool terrain = (prim & TERRAIN_PRIM) != 0;
+    const int quad = int((prim & ~TERRAIN_PRIM) >> 1);
+    const int a = quad % (nx - 1), b = quad / (nx - 1);
+
+    // vertex indices, and their (i, j) mesh positions
+    int vi[3], mi[3], mj[3];
+    if ((prim & 1) == 0) {
+        vi[0] = (b+1) * nx + a;      mi[0] = a;     mj[0] = b + 1;   // tl
+        vi[1] = b * nx + a + 1;      mi[1] = a + 1; mj[1] = b;       // br
+        vi[2] = b * nx + a;          mi[2] = a;     mj[2] = b;       // bl
+    } else {
+        vi[0] = (b+1) * nx + a;      mi[0] = a;     mj[0] = b + 1;   // tl
+        vi[1] = (b+1) * nx + a + 1;  mi[1] = a + 1; mj[1] = b + 1;   // tr
+        vi[2] = b * nx + a + 1;      mi[2] = a + 1; mj[2] = b;       // br
+    }
+
+    // Perspective correct barycentrics, from the homogeneous (x, y, w) of the
+    // vertices: lambda_k is proportional to (v_(k+1) x v_(k+2)) . (sx, sy, 1).
+    const ClipPos *pos = terrain ? &terrain_pos[0] : &water_pos[0];
+    const float sx = (px + 0.5f) / fb_width * 2 - 1;
+    const float sy = 1 - (py + 0.5f) / fb_height * 2;
+    float lambda[3];
+    float sum = 0;
+    for (int k = 0; k < 3; ++k) {
+        const ClipPos &p = pos[vi[(k+1) % 3]], &q = pos[vi[(k+2) % 3]];
+        lambda[k] = (p.y * q.w - p.w * q.y) * sx + (p.w * q.x - p.x * q.w) * sy + (p.x * q.y - p.y * q.x);
+        sum += lambda[k];
+    }
+    for (int k = 0; k < 3; ++k) lambda[k] /= sum;
+
+    const float dist = lambda[0] * pos[vi[0]].w + lambda[1] * pos[vi[1]].w + lambda[2] * pos[vi[2]].w;
+    const float grass_lod = std::log(std::max(grass_lod_scale * dist, 1.0f)) / std::log(2.0f);
+
+    float col[3];
+
+    if (terrain) {
+        float normal[3] = { 0, 0, 0 };
+        float u = 0, v = 0;
+        for (int k = 0; k < 3; ++k) {
+            const float *n = &terrain_normals[3 * vi[k]];
+            for (int c = 0; c < 3; ++c) normal[c] += lambda[k] * n[c];
+            u += lambda[k] * mi[k];
+            v += lambda[k] * mj[k];
+        }
+
+        SampleTrilinear(grass, terrain_tex_scale[0] * u, terrain_tex_scale[1] * v, grass_lod, col);
+        const float light = Saturate(Dot(settings.light_dir, normal)) + settings.ambient;
+        for (int c = 0; c < 3; ++c) col[c] *= light;
+
+    } else {
+        WaterAttribs in;
+        std::fill(reinterpret_cast<float*>(&in), reinterpret_cast<float*>(&in + 1), 0.0f);
+        for (int k = 0; k < 3; ++k) {
+            const float *src = reinterpret_cast<const float*>(&water_attribs[vi[k]]);
+            float *dst = reinterpret_cast<float*>(&in);
+            for (size_t c = 0; c < sizeof(WaterAttribs) / sizeof(float); ++c) dst[c] += lambda[k] * src[c];
+        }
+
+        // approximate Fresnel factor
+        // (this is the percentage that reflects, as opposed to transmits)
+        const float fresnel = (1 - settings.fresnel_coeff)
+            + settings.fresnel_coeff * std::pow(std::max(0.0f, 1 - Dot(in.eye, in.normal)), settings.fresnel_exponent);
+
+        // reflected light
+        const float e_dot_n = Dot(in.eye, in.normal);
+        float reflection_dir[3];
+        for (int c = 0; c < 3; ++c) reflection_dir[c] = 2 * e_dot_n * in.normal[c] - in.eye[c];
+        float reflect_col[3];
+        SampleCube(skybox, reflection_dir, reflect_col);
+
+        // specular
+        const float spec = settings.specular_intensity
+            * std::pow(std::max(0.0f, Dot(reflection_dir, settings.light_dir)), settings.specular_exponent);
+        for (int c = 0; c < 3; ++c) reflect_col[c] += spec;
+
+        // refracted light
+        const float minus_eye[3] = { -in.eye[0], -in.eye[1], -in.eye[2] };
+        float refract_dir[3];
+        Refract(minus_eye, in.normal, 1.0f / settings.refractive_index, refract_dir);
+
+        float refract_col[3];
+        float attenuation_factor;
+        if (refract_dir[2] > 0) {
+            // refracted ray goes up into the sky
+            SampleCube(skybox, refract_dir, refract_col);
+            attenuation_factor = 0.8f;
+        } else {
+            // refracted ray hits the grass
+            const float ray_dist = refract_dir[2] < 0 ? -in.depth / refract_dir[2] : 0;
+            const float base_x = in.world_x + ray_dist * refract_dir[0];
+            const float base_y = in.world_y + ray_dist * refract_dir[1];
+            SampleTrilinear(grass, (base_x + settings.W / 2) / GRASS_SIZE, base_y / GRASS_SIZE, grass_lod, refract_col);
+            const float light = Saturate(Dot(settings.light_dir, in.terrain_normal)) + settings.ambient;
+            for (int c = 0; c < 3; ++c) refract_col[c] *= light;
+            attenuation_factor = (1 - settings.attenuation_1) * std::exp(-settings.attenuation_2 * ray_dist);
+        }
+
+        // combine reflection & refraction
+        for (int c = 0; c < 3; ++c) {
+            const float under = deep_col_linear[c] + (ToLinear(refract_col[c]) - deep_col_linear[c]) * attenuation_factor;
+            col[c] = FromLinear(under + (ToLinear(reflect_col[c]) - under) * fresnel);
+        }
+    }
+
+    out[0] = ToByte(col[0]);
+    out[1] = ToByte(col[1]);
+    out[2] = ToByte(col[2]);
+    out[3] = 255;
+}
+
+// SkyboxPixelShader: the direction of the pixel, in world space
+void SoftRenderer::shadeSky(int px, int py, unsigned char *out) const
+{
+    const float view[3] = { ((px + 0.5f) / fb_width * 2 - 1) / xpersp,
+                            (1 - (py + 0.5f) / fb_height * 2) / ypersp,
+                            1 };
+    float dir[3];
+    for (int r = 0; r < 3; ++r) dir[r] = Dot(&view_to_world[3*r], view);
+
+    float col[3];
+    SampleCube(skybox, dir, col);
+    out[0] = ToByte(col[0]);
+    out[1] = ToByte(col[1]);
+    out[2] = ToByte(col[2]);
+    out[3] = 255;
+}
@@ -0,0 +1,150 @@
+/*
+ * FILE:
+ *   soft_renderer.hpp
+ *
+ * PURPOSE:
+ *   Software (CPU) version of ShallowWaterEngine::render, for making
+ *   frames on machines with no GPU (see batch_main.cpp). It draws the
+ *   same scene -- terrain, water and skybox -- with the same lighting
+ *   as the shaders in graphics.hlsl (Terrain/Water/Skybox vertex and
+ *   pixel shaders), into an RGBA framebuffer in memory.
+ *
+ *   The whole mesh is drawn at full detail. Each frame has three
+ *   stages, each spread across the worker threads:
+ *
+ *    1. Vertices: clip space position and shading inputs for every
+ *       mesh vertex, for the water and the terrain.
+ *
+ *    2. Triangles: culled, clipped against the near plane (and a
+ *       guard band around the screen), snapped to fixed point and
+ *       sorted into the screen tiles they touch.
+ *
+ *    3. Tiles: the triangles of each tile are rasterized into a
+ *       "visibility buffer" holding the nearest triangle at each
+ *       pixel, and then every pixel is shaded once. Pixels that no
+ *       triangle covers get the skybox.
+ *
+ *   Coverage follows the Direct3D rules (top-left fill rule, back
+ *   faces culled, nearest wins with ties going to the water), so
+ *   there are no cracks or double hits along shared edges.
+ *   Attributes are interpolated with perspective-correct
+ *   barycentrics taken from the original (unclipped) triangle.
+ *
+ *   Texture filtering is simpler than the GPU's: trilinear with the
+ *   mip level chosen by distance (for the grass), and bilinear on
+ *   the top level (for the skybox).
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef SOFT_RENDERER_HPP
+#define SOFT_RENDERER_HPP
+
+#include "cpu_solver.hpp"
+#include "mip_cache.hpp"
+#include "settings.hpp"
+#include "terrain_heightfield.hpp"
+
+#include <vector>
+
+// Camera position (world space) and direction, as for ShallowWaterEngine::moveCamera.
+struct SoftCamera {
+    float x, y, z;
+    float yaw, pitch;     // radians
+};
+
+class SoftRenderer {
+public:
+    // grass and skybox are as loaded by LoadMipChains (see ShallowWaterEngine::loadGraphics
+    // and loadSkybox); the skybox has five images: east, west, north, south, up.
+    // num_threads <= 0 means one per hardware thread.
+    SoftRenderer(const RenderSettings &settings, const MipChains &grass, const MipChains &skybox,
+                 int num_threads = 0);
+
+    // Settings may be changed between frames (including the mesh size).
+    void setSettings(const RenderSettings &settings);
+
+    // Draws one frame. heightfield is (nx+4) * (ny+4) entries, as g_terrain_heightfield;
+    // state is as CpuSolver::getState.
+    void render(const SoftCamera &camera, const TerrainEntry *heightfield, const CellState *state,
+                int width, int height);
+
+    // The last frame: RGBA, 8 bits per channel, top row first.
+    const unsigned char * getPixels() const { return &framebuffer[0]; }
+    int getWidth() const { return fb_width; }
+    int getHeight() const { return fb_height; }
+
+    // Triangles that reached the rasterizer in the last frame (after culling and clipping).
+    int getTrianglesDrawn() const;
+
+private:
+    struct ClipPos {
+        float x, y, z, w;
+    };
+    struct WaterAttribs {
+        float normal[3];
+        float eye[3];
+        float depth;
+        float world_x, world_y;
+        float terrain_normal[3];
+    };
+    struct ScreenTri {
+        int x[3], y[3];          // fixed point (1/256 pixel), clockwise on screen
+        float inv_w[3];
+        int x_min, x_max, y_min, y_max;   // pixels covered (inclusive)
+        unsigned int prim;       // which triangle of the mesh (see soft_renderer.cpp)
+    };
+
+    // Output of one triangle setup job
+    struct Bins {
+        std::vector<ScreenTri> tris;
+        std::vector<std::vector<int> > tiles;    // per tile: indices into tris
+    };
+
+    // the jobs run by the worker threads, for each stage
+    struct VertexJob;
+    struct SetupJob;
+    struct TileJob;
+
+    void setupCamera(const SoftCamera &camera);
+    void vertexRows(int row_begin, int row_end);
+    void setupRows(Bins &out, int row_begin, int row_end);
+    void setupTriangle(Bins &out, const ClipPos &v0, const ClipPos &v1, const ClipPos &v2, unsigned int prim);
+    void binTriangle(Bins &out, const ClipPos * const v[3], unsigned int prim);
+    void drawTile(int tile, float *depth, unsigned int *prims);
+    void shadePixel(int px, int py, unsigned int prim, unsigned char *out) const;
+    void shadeSky(int px, int py, unsigned char *out) const;
+
+private:
+    RenderSettings settings;
+    MipChains grass, skybox;
+    int num_threads;
+
+    // per frame
+    const TerrainEntry *heightfield;
+    const CellState *state;
+    int fb_width, fb_height;
+    int tiles_x, tiles_y;
+    float tex_to_clip[16];       // row major, as in the constant buffer
+    float view_to_world[9];      // camera rotation (row major)
+    float xpersp, ypersp, near_plane, far_plane;
+    float eye_mult[3], eye_trans[3];
+    float world_mult[2], world_trans[2];
+    float terrain_tex_scale[2];
+    float deep_col_linear[3];
+    float grass_lod_scale;       // grass texels per pixel, per unit of distance
+
+    std::vector<ClipPos> water_pos, terrain_pos;
+    std::vector<WaterAttribs> water_attribs;
+    std::vector<unsigned char> water_hidden;   // water surface is below the terrain
+    std::vector<float> terrain_normals;    // 3 per vertex
+    std::vector<Bins> bins;                // one per setup job
+    std::vector<unsigned char> framebuffer;
+};
+
+#endif
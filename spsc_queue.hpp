@@ -0,0 +1,59 @@
+/*
+ * FILE:
+ *   spsc_queue.hpp
+ *
+ * PURPOSE:
+ *   Fixed capacity, lock-free queue with a single producer thread and
+ *   a single consumer thread (e.g. brush strokes from the GUI thread
+ *   to the simulation thread). Never allocates after construction;
+ *   push fails, rather than waiting, when the queue is full.
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef SPSC_QUEUE_HPP
+#define SPSC_QUEUE_HPP
+
+#include <atomic>
+#include <vector>
+
+template<class T>
+class SpscQueue {
+public:
+    explicit SpscQueue(unsigned int capacity) : items(capacity), head(0), tail(0) { }
+
+    // Producer. Returns false if the queue is full.
+    bool push(const T &item)
+    {
+        const unsigned int t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == items.size()) return false;
+        items[t % items.size()] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer. Returns false if the queue is empty.
+    bool pop(T &item)
+    {
+        const unsigned int h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        item = items[h % items.size()];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    SpscQueue(const SpscQueue &);
+    void operator=(const SpscQueue &);
+
+    std::vector<T> items;
+    std::atomic<unsigned int> head;   // next to pop (only written by the consumer)
+    std::atomic<unsigned int> tail;   // next to push (only written by the producer)
+};
+
+#endif
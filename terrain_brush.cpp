@@ -0,0 +1,149 @@
+/*
+ * FILE:
+ *   terrain_brush.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "terrain_brush.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    float GaussianBrush(float x, float y, float r)
+    {
+        const float sigma = 1.0f / 3.0f;
+        float z = (x*x + y*y) / (r*r);
+        if (z > 1) return 0;
+        else return 2 * std::exp(-z/(2*sigma*sigma));
+    }
+}
+
+TerrainBrush::TerrainBrush()
+    : radius(0), W(0), L(0), nx(0), ny(0), rx(0), ry(0)
+{ }
+
+bool TerrainBrush::setup(float radius_, int nx_, int ny_, float W_, float L_)
+{
+    if (radius_ == radius && nx_ == nx && ny_ == ny && W_ == W && L_ == L) return false;
+
+    radius = radius_;
+    nx = nx_;
+    ny = ny_;
+    W = W_;
+    L = L_;
+
+    const float dx = W / (nx-1);
+    const float dy = L / (ny-1);
+
+    // corners more than rx-1 cells from the centre are outside the radius
+    rx = int(radius / dx) + 1;
+    ry = int(radius / dy) + 1;
+
+    // brush value at each corner; corner (a, b) is at (a*dx, b*dy) from the centre,
+    // for a in [-rx-1, rx], b in [-ry-1, ry].
+    const int cw = 2*rx + 2;
+    std::vector<float> corner(cw * (2*ry + 2));
+    for (int b = -ry-1; b <= ry; ++b) {
+        for (int a = -rx-1; a <= rx; ++a) {
+            corner[(b + ry + 1) * cw + a + rx + 1] = GaussianBrush(a * dx, b * dy, radius);
+        }
+    }
+
+    // cell at offset (di, dj) has its (+x, +y) corner at (di, dj) and its (-x, -y) corner at (di-1, dj-1).
+    weights.resize((2*rx + 1) * (2*ry + 1));
+    ba_weights.resize(weights.size());
+    for (int dj = -ry; dj <= ry; ++dj) {
+        const float *plus_row = &corner[(dj + ry + 1) * cw + rx + 1];
+        const float *minus_row = &corner[(dj + ry) * cw + rx + 1];
+
+        for (int di = -rx; di <= rx; ++di) {
+            const float plus_plus = plus_row[di];
+            const float plus_minus = minus_row[di];
+            const float minus_plus = plus_row[di - 1];
+            const float minus_minus = minus_row[di - 1];
+
+            // (have to be careful about the exact definitions of BX, BY, BA -- see terrain_heightfield.cpp)
+            const int k = (dj + ry) * (2*rx + 1) + di + rx;
+            Weights &wt = weights[k];
+            wt.BX = (plus_plus + plus_minus) / 2;
+            wt.BY = (plus_plus + minus_plus) / 2;
+            wt.BA = (plus_plus + plus_minus + minus_plus + minus_minus) / 4;
+            wt.dBdx = (plus_plus + plus_minus - minus_plus - minus_minus) / (2*dx);
+            wt.dBdy = (plus_plus + minus_plus - plus_minus - minus_minus) / (2*dy);
+            ba_weights[k] = wt.BA;
+        }
+    }
+
+    return true;
+}
+
+void TerrainBrush::locate(float world_x, float world_y, int &cx, int &cy) const
+{
+    // world to grid index, as in ShallowWaterEngine::applyMouseShader.
+    // The corners of cell i are at index i +/- 0.5, so the nearest corner to
+    // the point is floor(index) + 0.5.
+    const float ix = (world_x + W/2) * (nx-1) / W + 2.5f;
+    const float iy = world_y * (ny-1) / L + 2.5f;
+    cx = int(std::floor(ix));
+    cy = int(std::floor(iy));
+}
+
+void TerrainBrush::getBox(int cx, int cy, int &ix_min, int &ix_max, int &iy_min, int &iy_max) const
+{
+    ix_min = std::max(0, std::min(nx+4, cx - rx));
+    ix_max = std::max(0, std::min(nx+4, cx + rx + 1));
+    iy_min = std::max(0, std::min(ny+4, cy - ry));
+    iy_max = std::max(0, std::min(ny+4, cy + ry + 1));
+}
+
+void TerrainBrush::applyToBottom(BottomEntry *bottom, int cx, int cy, float displacement) const
+{
+    int ix_min, ix_max, iy_min, iy_max;
+    getBox(cx, cy, ix_min, ix_max, iy_min, iy_max);
+
+    for (int iy = iy_min; iy < iy_max; ++iy) {
+        BottomEntry *row = bottom + iy * (nx+4);
+        for (int ix = ix_min; ix < ix_max; ++ix) {
+            const Weights &wt = getWeights(ix - cx, iy - cy);
+            row[ix].BX += wt.BX * displacement;
+            row[ix].BY += wt.BY * displacement;
+            row[ix].BA += wt.BA * displacement;
+        }
+    }
+}
+
+void TerrainBrush::applyToTerrain(TerrainEntry *terrain, int cx, int cy, float displacement) const
+{
+    int ix_min, ix_max, iy_min, iy_max;
+    getBox(cx, cy, ix_min, ix_max, iy_min, iy_max);
+
+    for (int iy = iy_min; iy < iy_max; ++iy) {
+        TerrainEntry *row = terrain + iy * (nx+4);
+        for (int ix = ix_min; ix < ix_max; ++ix) {
+            const Weights &wt = getWeights(ix - cx, iy - cy);
+            row[ix].B += wt.BA * displacement;
+            row[ix].dBdx += wt.dBdx * displacement;
+            row[ix].dBdy += wt.dBdy * displacement;
+        }
+    }
+}
+
+void TerrainBrush::applyToW(float *w, int stride, int cx, int cy, float displacement) const
+{
+    int ix_min, ix_max, iy_min, iy_max;
+    getBox(cx, cy, ix_min, ix_max, iy_min, iy_max);
+
+    for (int iy = iy_min; iy < iy_max; ++iy) {
+        float *row = w + iy * (nx+4) * stride;
+        for (int ix = ix_min; ix < ix_max; ++ix) {
+            row[ix * stride] += getWeights(ix - cx, iy - cy).BA * displacement;
+        }
+    }
+}
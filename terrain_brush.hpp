@@ -0,0 +1,83 @@
+/*
+ * FILE:
+ *   terrain_brush.hpp
+ *
+ * PURPOSE:
+ *   The "raise/lower terrain" brush, as a precomputed kernel.
+ *
+ *   The brush is a Gaussian of the given radius, centred on the cell
+ *   corner nearest to the mouse. Since the centre is always on a
+ *   corner, the change to each of BX, BY, BA, dB/dx and dB/dy of the
+ *   cells around it depends only on the cell's offset from the
+ *   centre; these weights are worked out once per radius (and mesh
+ *   spacing) and then just scaled by the displacement each time the
+ *   brush is applied.
+ *
+ *   The water level w is raised by the same amount as BA, so that
+ *   the depth does not change. ShallowWaterEngine does that part on
+ *   the GPU (BrushApply.hlsl, using getBAWeights); CpuSolver uses
+ *   applyToW.
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef TERRAIN_BRUSH_HPP
+#define TERRAIN_BRUSH_HPP
+
+#include "terrain_heightfield.hpp"
+
+#include <vector>
+
+class TerrainBrush {
+public:
+    // change per unit displacement of one cell
+    struct Weights {
+        float BX, BY, BA;
+        float dBdx, dBdy;
+    };
+
+    TerrainBrush();
+
+    // Sets the brush radius (world units) and the mesh (nx * ny covering
+    // [-W/2, W/2] * [0, L]). Recomputes the kernel if any of these have
+    // changed, and returns true in that case.
+    bool setup(float radius, int nx, int ny, float W, float L);
+
+    // Grid cell (including ghost zones) whose (+x, +y) corner is the
+    // brush centre for the given world point.
+    void locate(float world_x, float world_y, int &cx, int &cy) const;
+
+    // The cells affected by a brush centred at (cx, cy), clipped to the
+    // (nx+4) * (ny+4) grid. Max is exclusive.
+    void getBox(int cx, int cy, int &ix_min, int &ix_max, int &iy_min, int &iy_max) const;
+
+    // Kernel half-size in cells: the kernel covers offsets -getRadiusX() .. getRadiusX() etc.
+    int getRadiusX() const { return rx; }
+    int getRadiusY() const { return ry; }
+
+    // Weights for the cell at offset (di, dj) from the centre cell.
+    const Weights & getWeights(int di, int dj) const { return weights[(dj + ry) * (2*rx + 1) + di + rx]; }
+
+    // The BA weights only, as a (2*rx+1) * (2*ry+1) row-major array.
+    const float * getBAWeights() const { return &ba_weights[0]; }
+
+    // Apply the brush to (nx+4) * (ny+4) arrays (g_bottom, g_terrain_heightfield or the
+    // CpuSolver state). For applyToW, stride is the number of floats from one cell to the next.
+    void applyToBottom(BottomEntry *bottom, int cx, int cy, float displacement) const;
+    void applyToTerrain(TerrainEntry *terrain, int cx, int cy, float displacement) const;
+    void applyToW(float *w, int stride, int cx, int cy, float displacement) const;
+
+private:
+    float radius, W, L;
+    int nx, ny;
+    int rx, ry;
+    std::vector<Weights> weights;
+    std::vector<float> ba_weights;
+};
+
+#endif
@@ -0,0 +1,63 @@
+/*
+ * FILE:
+ *   terrain_build.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "initial_conditions.hpp"
+#include "profiler.hpp"
+#include "terrain_build.hpp"
+
+#include <stdexcept>
+
+TerrainBuild::TerrainBuild(ResetType reset_type_, const SettingsSnapshot &settings_)
+    : reset_type(reset_type_), settings(settings_),
+      nx(settings_.getInt(SH_MESH_SIZE_X)), ny(settings_.getInt(SH_MESH_SIZE_Y)),
+      inlet_x(0), ready(false)
+{
+    // (started last, as it uses all of the above)
+    thread = std::thread(&TerrainBuild::threadMain, this);
+}
+
+TerrainBuild::~TerrainBuild()
+{
+    if (thread.joinable()) thread.join();
+}
+
+void TerrainBuild::wait()
+{
+    if (thread.joinable()) thread.join();
+    if (!error.empty()) throw std::runtime_error(error);
+}
+
+void TerrainBuild::threadMain()
+{
+    SetProfilerThreadName("TerrainBuild");
+    PROFILE_SCOPE("TerrainBuild");
+
+    try {
+        heightfield.reset(new TerrainEntry[(nx+4) * (ny+4)]);
+        bottom.reset(new BottomEntry[(nx+4) * (ny+4)]);
+        ComputeTerrainHeightfield(settings, &heightfield[0], &bottom[0], inlet_x);
+
+        if (reset_type >= R_MESH) {
+            initial_state.resize((nx+4) * (ny+4) * 4);
+            ComputeInitialConditions(settings, &heightfield[0], &bottom[0], reset_type, &initial_state[0]);
+        }
+
+        quadtree.resize(nx, ny, settings.get(SH_VALLEY_WIDTH), settings.get(SH_VALLEY_LENGTH));
+        quadtree.updateTerrain(&heightfield[0]);
+
+    } catch (std::exception &e) {
+        error = e.what();
+        if (error.empty()) error = "Terrain build failed";
+    }
+
+    ready.store(true, std::memory_order_release);
+}
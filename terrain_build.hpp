@@ -0,0 +1,93 @@
+/*
+ * FILE:
+ *   terrain_build.hpp
+ *
+ * PURPOSE:
+ *   Prepares a new terrain, and for a remesh the initial water state
+ *   as well, on a thread of its own, so that the demo can carry on
+ *   running the old simulation in the meantime. Building the
+ *   heightfield, the initial conditions and the patch bounds is all
+ *   CPU work that takes up to a second or so for the larger meshes.
+ *
+ *   Nothing here touches g_settings, the terrain globals or Direct3D
+ *   (the device is single threaded). When the build is ready, the
+ *   engine swaps the results in and uploads them, all in one frame
+ *   (see ShallowWaterEngine::finishRebuild).
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef TERRAIN_BUILD_HPP
+#define TERRAIN_BUILD_HPP
+
+#include "patch_quadtree.hpp"
+#include "settings.hpp"
+#include "terrain_heightfield.hpp"
+
+#include "boost/scoped_array.hpp"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+class TerrainBuild {
+public:
+    // Starts building, for the given settings, on a new thread.
+    // The initial water state is only built if reset_type >= R_MESH.
+    TerrainBuild(ResetType reset_type, const SettingsSnapshot &settings);
+    ~TerrainBuild();   // waits for the thread
+
+    // Whether the thread has finished (does not wait).
+    bool isReady() const { return ready.load(std::memory_order_acquire); }
+
+    // Waits for the thread to finish. Throws if the build failed.
+    // Call this before using any of the results below.
+    void wait();
+
+    ResetType getResetType() const { return reset_type; }
+    const SettingsSnapshot & getSettings() const { return settings; }
+    int getNX() const { return nx; }
+    int getNY() const { return ny; }
+
+    // The new heightfield and bottom, (nx+4) * (ny+4), to be swapped with
+    // g_terrain_heightfield and g_bottom; and the matching g_inlet_x.
+    boost::scoped_array<TerrainEntry> & getHeightfield() { return heightfield; }
+    boost::scoped_array<BottomEntry> & getBottom() { return bottom; }
+    float getInletX() const { return inlet_x; }
+
+    // The initial state, {w, hu, hv, 0} for (nx+4) * (ny+4) cells
+    // (see ComputeInitialConditions); empty if reset_type < R_MESH.
+    const std::vector<float> & getInitialState() const { return initial_state; }
+
+    // Patch bounds and lod errors for the new terrain.
+    const PatchQuadtree & getQuadtree() const { return quadtree; }
+
+private:
+    TerrainBuild(const TerrainBuild &);
+    void operator=(const TerrainBuild &);
+
+    void threadMain();
+
+private:
+    const ResetType reset_type;
+    const SettingsSnapshot settings;
+    const int nx, ny;
+
+    boost::scoped_array<TerrainEntry> heightfield;
+    boost::scoped_array<BottomEntry> bottom;
+    float inlet_x;
+    std::vector<float> initial_state;
+    PatchQuadtree quadtree;
+    std::string error;   // what() of any exception thrown by the build
+
+    std::atomic<bool> ready;
+    std::thread thread;
+};
+
+#endif
@@ -60,35 +60,40 @@ namespace {
     bool dam_on;
     float D_H, D_Y, D_MW, D_MH, D_T;
     float M_lambda, M_A, M_P;
+    float cell_dx, cell_dy;
 
     const int NUM_OCTAVES = 8;
 
-    void InitHeight()
+    void InitHeight(const SettingsSnapshot &settings)
     {
         InitPerlin();
 
-        L = GetSetting("valley_length");
-        W = GetSetting("valley_width");
-        H = GetSetting("valley_wall_height");
-        m_top = GetSetting("gradient_top");
-        m_bottom = GetSetting("gradient_bottom");
-        shape = GetSetting("valley_shape");
+        L = settings.get(SH_VALLEY_LENGTH);
+        W = settings.get(SH_VALLEY_WIDTH);
+        H = settings.get(SH_VALLEY_WALL_HEIGHT);
+        m_top = settings.get(SH_GRADIENT_TOP);
+        m_bottom = settings.get(SH_GRADIENT_BOTTOM);
+        shape = settings.get(SH_VALLEY_SHAPE);
         
-        C_D_top = GetSetting("channel_depth_top");
-        C_D_bottom = GetSetting("channel_depth_bottom");
-        C_W_top = GetSetting("channel_width_top");
-        C_W_bottom = GetSetting("channel_width_bottom");
-
-        dam_on = GetIntSetting("dam_on") != 0;
-        D_H = GetSetting("dam_height");
-        D_Y = GetSetting("dam_position");
-        D_MW = GetSetting("dam_middle_width");
-        D_MH = GetSetting("dam_middle_height");
-        D_T = GetSetting("dam_thickness");
+        C_D_top = settings.get(SH_CHANNEL_DEPTH_TOP);
+        C_D_bottom = settings.get(SH_CHANNEL_DEPTH_BOTTOM);
+        C_W_top = settings.get(SH_CHANNEL_WIDTH_TOP);
+        C_W_bottom = settings.get(SH_CHANNEL_WIDTH_BOTTOM);
+
+        dam_on = settings.getInt(SH_DAM_ON) != 0;
+        D_H = settings.get(SH_DAM_HEIGHT);
+        D_Y = settings.get(SH_DAM_POSITION);
+        D_MW = settings.get(SH_DAM_MIDDLE_WIDTH);
+        D_MH = settings.get(SH_DAM_MIDDLE_HEIGHT);
+        D_T = settings.get(SH_DAM_THICKNESS);
         
-        M_lambda = GetSetting("meander_wavelength");
-        M_A = GetSetting("meander_amplitude");
-        M_P = GetSetting("meander_fractal");
+        M_lambda = settings.get(SH_MEANDER_WAVELENGTH);
+        M_A = settings.get(SH_MEANDER_AMPLITUDE);
+        M_P = settings.get(SH_MEANDER_FRACTAL);
+
+        // cell sizes (used for reflecting outside of the domain)
+        cell_dx = W / (settings.get(SH_MESH_SIZE_X)-1);
+        cell_dy = L / (settings.get(SH_MESH_SIZE_Y)-1);
     }
 
     float z0, dz0_dy;
@@ -104,7 +109,7 @@ namespace {
         //y = std::max(0.0f, std::min(L, y));
 
         // reflect outside of domain
-        const float dy = L / (GetSetting("mesh_size_y")-1);
+        const float dy = cell_dy;
         if (y < -dy/2) y = -dy - y;
         if (y > L+dy/2) y = 2*L + dy - y;
 
@@ -161,7 +166,7 @@ namespace {
     void GetHeight(float x, float &B)
     {
         // reflect outside of domain
-        const float dx = W / (GetSetting("mesh_size_x")-1);
+        const float dx = cell_dx;
         if (x < -W/2 - dx/2) x = -W - dx - x;
         if (x > W/2 + dx/2) x = W + dx - x;
 
@@ -209,7 +214,7 @@ namespace {
     void GetHeightDeriv(float x, float &dB_dx, float &dB_dy)
     {
         // reflect outside of domain
-        const float dx = W / (GetSetting("mesh_size_x")-1);
+        const float dx = cell_dx;
         if (x < -W/2 - dx/2) x = -W - dx - x;
         if (x > W/2 + dx/2) x = W + dx - x;
 
@@ -280,17 +285,26 @@ boost::scoped_array<BottomEntry> g_bottom;
 float g_inlet_x;
 
 void UpdateTerrainHeightfield()
+{
+    const int nx = GetIntSetting(SH_MESH_SIZE_X);
+    const int ny = GetIntSetting(SH_MESH_SIZE_Y);
+
+    g_terrain_heightfield.reset(new TerrainEntry[(nx+4) * (ny+4)]);
+    g_bottom.reset(new BottomEntry[(nx+4) * (ny+4)]);
+
+    ComputeTerrainHeightfield(SettingsSnapshot(), &g_terrain_heightfield[0], &g_bottom[0], g_inlet_x);
+}
+
+void ComputeTerrainHeightfield(const SettingsSnapshot &settings,
+                               TerrainEntry *heightfield, BottomEntry *bottom, float &inlet_x)
 {
     using namespace std;
 
-    const int nx = GetIntSetting("mesh_size_x");
-    const int ny = GetIntSetting("mesh_size_y");
+    const int nx = settings.getInt(SH_MESH_SIZE_X);
+    const int ny = settings.getInt(SH_MESH_SIZE_Y);
     const int pitch = nx+4;
     
-    g_terrain_heightfield.reset(new TerrainEntry[pitch * (ny+4)]);
-    g_bottom.reset(new BottomEntry[pitch * (ny+4)]);
-    
-    InitHeight();
+    InitHeight(settings);
 
     // Calculate B at each mesh point (cell centre)
     for (int j = 0; j < ny + 4; ++j) {
@@ -301,7 +315,7 @@ void UpdateTerrainHeightfield()
         for (int i = 0; i < nx + 4; ++i) {
             const float x = float(i-2) / float(nx-1) * W - (W/2);
             
-            TerrainEntry &out = g_terrain_heightfield[j * pitch + i];
+            TerrainEntry &out = heightfield[j * pitch + i];
             GetHeightDeriv(x, out.dBdx, out.dBdy);
         }
     }
@@ -323,24 +337,24 @@ void UpdateTerrainHeightfield()
 
             if (i < nx+4) {   // (i)
                 if (j < ny+4) {   // (i,j)
-                    g_bottom[j*pitch + i].BA = 0.25f * h;
+                    bottom[j*pitch + i].BA = 0.25f * h;
                 }
                 if (j > 0) {   // (i,j-1)
-                    g_bottom[(j-1)*pitch + i].BA += 0.25f * h;
-                    g_bottom[(j-1)*pitch + i].BY = 0.5f * h;
+                    bottom[(j-1)*pitch + i].BA += 0.25f * h;
+                    bottom[(j-1)*pitch + i].BY = 0.5f * h;
                 }
             }
 
             if (i > 0) {  // (i-1)
                 if (j < ny+4) {   // (i-1,j)
-                    g_bottom[j*pitch + i-1].BA += 0.25f * h;
-                    g_bottom[j*pitch + i-1].BX = 0.5f * h;
+                    bottom[j*pitch + i-1].BA += 0.25f * h;
+                    bottom[j*pitch + i-1].BX = 0.5f * h;
                 }
 
                 if (j > 0) {  // (i-1,j-1)
-                    g_bottom[(j-1)*pitch + i-1].BA += 0.25f * h;
-                    g_bottom[(j-1)*pitch + i-1].BX += 0.5f * h;
-                    g_bottom[(j-1)*pitch + i-1].BY += 0.5f * h;
+                    bottom[(j-1)*pitch + i-1].BA += 0.25f * h;
+                    bottom[(j-1)*pitch + i-1].BX += 0.5f * h;
+                    bottom[(j-1)*pitch + i-1].BY += 0.5f * h;
                 }
             }
         }
@@ -350,22 +364,24 @@ void UpdateTerrainHeightfield()
     // This prevents water "showing through" in steep areas.
     for (int j = 0; j < ny + 4; ++j) {
         for (int i = 0; i < nx + 4; ++i) {
-            g_terrain_heightfield[j * pitch + i].B = g_bottom[j * pitch + i].BA;
+            heightfield[j * pitch + i].B = bottom[j * pitch + i].BA;
         }
     }
 
-    g_inlet_x = GetSetting("meander_amplitude") * 
-        Perlin(GetSetting("meander_wavelength"), GetSetting("meander_fractal"), NUM_OCTAVES, L);
+    inlet_x = M_A * Perlin(M_lambda, M_P, NUM_OCTAVES, L);
 }
 
 float GetTerrainHeight(float x, float y)
 {
-    const int width = GetIntSetting("mesh_size_x");
-    const int height = GetIntSetting("mesh_size_y");    
-    
-    const float L = GetSetting("valley_length");
-    const float W = GetSetting("valley_width");
+    return GetTerrainHeight(&g_terrain_heightfield[0],
+                            GetIntSetting(SH_MESH_SIZE_X), GetIntSetting(SH_MESH_SIZE_Y),
+                            GetSetting(SH_VALLEY_WIDTH), GetSetting(SH_VALLEY_LENGTH),
+                            x, y);
+}
 
+float GetTerrainHeight(const TerrainEntry *heightfield, int width, int height, float W, float L,
+                       float x, float y)
+{
     // convert x,y to [0,width-1], [0,height-1] scale
     x = (x + W/2) / W * (width-1);
     y = y / L * (height-1);
@@ -390,11 +406,11 @@ float GetTerrainHeight(float x, float y)
     const int pitch = width + 4;
     
     const float result_y_down = Lerp(xfrac,
-                                     g_terrain_heightfield[ydown * pitch + xdown].B,
-                                     g_terrain_heightfield[ydown * pitch + xup].B);
+                                     heightfield[ydown * pitch + xdown].B,
+                                     heightfield[ydown * pitch + xup].B);
     const float result_y_up = Lerp(xfrac,
-                                   g_terrain_heightfield[yup * pitch + xdown].B,
-                                   g_terrain_heightfield[yup * pitch + xup].B);
+                                   heightfield[yup * pitch + xdown].B,
+                                   heightfield[yup * pitch + xup].B);
 
     return Lerp(yfrac, result_y_down, result_y_up);
 }
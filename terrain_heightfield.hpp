@@ -22,8 +22,7 @@
 
 #include "boost/scoped_array.hpp"
 
-void UpdateTerrainHeightfield();
-float GetTerrainHeight(float x, float y);  // does interpolation / clamping
+class SettingsSnapshot;
 
 struct TerrainEntry {
     float B, dBdx, dBdy;
@@ -33,6 +32,20 @@ struct BottomEntry {
     float BY, BX, BA;
 };
 
+void UpdateTerrainHeightfield();
+float GetTerrainHeight(float x, float y);  // does interpolation / clamping
+
+// As UpdateTerrainHeightfield, but for the given settings, and writing into the
+// given arrays ((nx+4) * (ny+4) each) instead of the globals below. This may be
+// called from any thread, but only from one thread at a time.
+void ComputeTerrainHeightfield(const SettingsSnapshot &settings,
+                               TerrainEntry *heightfield, BottomEntry *bottom, float &inlet_x);
+
+// As GetTerrainHeight, for the given heightfield, of an nx * ny mesh
+// covering [-W/2, W/2] * [0, L].
+float GetTerrainHeight(const TerrainEntry *heightfield, int nx, int ny, float W, float L,
+                       float x, float y);
+
 // used to initialize the heightfield texture (used by the terrain vertex shader).
 // includes ghost zones.
 // TODO: this should probably be baked into the terrain mesh instead.
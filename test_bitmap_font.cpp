@@ -0,0 +1,138 @@
+/*
+ * FILE:
+ *   test_bitmap_font.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "tests.hpp"
+
+#include "coercri/gfx/bitmap_font.hpp"
+#include "coercri/gfx/gfx_context.hpp"
+#include "coercri/gfx/kern_table.hpp"
+#include "coercri/gfx/rectangle.hpp"
+
+#include "boost/shared_ptr.hpp"
+
+#include <string>
+#include <vector>
+
+namespace {
+    const int WIDTH = 800, HEIGHT = 32;
+
+    // Keeps the alpha of every pixel plotted, and leaves the glyphs to the
+    // default GfxContext::drawGlyphs.
+    class RecordingContext : public Coercri::GfxContext {
+    public:
+        RecordingContext() : alpha(WIDTH * HEIGHT, 0), plotted(0), outside(0) { }
+
+        void setClipRectangle(const Coercri::Rectangle &) { }
+        void clearClipRectangle() { }
+        Coercri::Rectangle getClipRectangle() const { return Coercri::Rectangle(0, 0, WIDTH, HEIGHT); }
+        int getWidth() const { return WIDTH; }
+        int getHeight() const { return HEIGHT; }
+        void clearScreen(Coercri::Color) { }
+        void drawGraphic(int, int, const Coercri::Graphic &) { }
+
+        void plotPixel(int x, int y, Coercri::Color col)
+        {
+            ++plotted;
+            if (x < 0 || x >= WIDTH || y < 0 || y >= HEIGHT) ++outside;
+            else alpha[y * WIDTH + x] = col.a;
+        }
+
+        std::vector<int> alpha;
+        int plotted, outside;
+    };
+
+    // Only "A" followed by "V" is kerned
+    class TestKernTable : public Coercri::KernTable {
+    public:
+        int getKern(char first, char second) const { return first == 'A' && second == 'V' ? -2 : 0; }
+    };
+
+    // A and V are solid blocks, each of its own alpha, with different offsets.
+    //   A: 3x4 at (0,1), advance 4, alpha 100
+    //   V: 2x3 at (1,0), advance 3, alpha 200
+    //   space: advance 5
+    boost::shared_ptr<Coercri::BitmapFont> MakeFont()
+    {
+        boost::shared_ptr<Coercri::KernTable> kern(new TestKernTable);
+        boost::shared_ptr<Coercri::BitmapFont> font(new Coercri::BitmapFont(kern, 6));
+        font->setupCharacter('A', 3, 4, 0, 1, 4);
+        font->setupCharacter('V', 2, 3, 1, 0, 3);
+        font->setupCharacter(' ', 0, 0, 0, 0, 5);
+        for (int y = 0; y < 4; ++y) {
+            for (int x = 0; x < 3; ++x) {
+                font->plotPixel('A', x, y, 100);
+                font->plotPixel('V', x, y, 200);   // (outside V's 2x3 is ignored)
+            }
+        }
+        return font;
+    }
+
+    void FillExpected(std::vector<int> &alpha, int x, int y, int w, int h, int a)
+    {
+        for (int j = 0; j < h; ++j) {
+            for (int i = 0; i < w; ++i) {
+                alpha[(y + j) * WIDTH + x + i] = a;
+            }
+        }
+    }
+}
+
+TEST(GlyphQuadsAreKernedAndOffset)
+{
+    boost::shared_ptr<Coercri::BitmapFont> font = MakeFont();
+    RecordingContext gc;
+    font->drawText(gc, 10, 20, "AV A", Coercri::Color(255, 255, 255));
+
+    // pen positions: A at 0, V at 4 - 2 = 2, space at 5, A at 10
+    std::vector<int> expected(WIDTH * HEIGHT, 0);
+    FillExpected(expected, 10 + 0, 20 + 1, 3, 4, 100);
+    FillExpected(expected, 10 + 2 + 1, 20 + 0, 2, 3, 200);
+    FillExpected(expected, 10 + 10, 20 + 1, 3, 4, 100);
+
+    CHECK(gc.outside == 0);
+    CHECK(gc.plotted == 12 + 6 + 12);
+    CHECK(gc.alpha == expected);
+    CHECK(font->getTextWidth("AV A") == 14);
+}
+
+TEST(GlyphAlphaIsScaledByColour)
+{
+    boost::shared_ptr<Coercri::BitmapFont> font = MakeFont();
+    RecordingContext gc;
+    font->drawText(gc, 0, 0, "VA", Coercri::Color(0, 0, 0, 51));
+
+    // (no kerning between V and A)
+    std::vector<int> expected(WIDTH * HEIGHT, 0);
+    FillExpected(expected, 1, 0, 2, 3, 200 * 51 / 255);
+    FillExpected(expected, 3, 1, 3, 4, 100 * 51 / 255);
+    CHECK(gc.alpha == expected);
+}
+
+TEST(LongTextIsDrawnInFull)
+{
+    // more characters than BitmapFont::drawText lays out at a time
+    boost::shared_ptr<Coercri::BitmapFont> font = MakeFont();
+    const int n = 150;
+    const std::string text(n, 'A');
+
+    // (twice, through the same context and its reused pixel buffer)
+    RecordingContext gc;
+    font->drawText(gc, 0, 0, text, Coercri::Color(255, 255, 255));
+    font->drawText(gc, 0, 0, text, Coercri::Color(255, 255, 255));
+
+    std::vector<int> expected(WIDTH * HEIGHT, 0);
+    for (int k = 0; k < n; ++k) FillExpected(expected, 4 * k, 1, 3, 4, 100);
+
+    CHECK(gc.outside == 0);
+    CHECK(gc.plotted == 2 * n * 12);
+    CHECK(gc.alpha == expected);
+}
@@ -0,0 +1,169 @@
+/*
+ * FILE:
+ *   test_cpu_solver.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "cpu_solver.hpp"
+#include "initial_conditions.hpp"
+#include "presets.hpp"
+#include "settings.hpp"
+#include "terrain_heightfield.hpp"
+#include "tests.hpp"
+#include "worker_pool.hpp"
+
+#include "boost/scoped_ptr.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace {
+    // (the inlet is off the mesh)
+    const float NO_INLET = 1000;
+
+    // The valley preset's terrain (which is far from flat), at the given mesh size
+    void MakeValley(int nx, int ny, SimSettings &ss, std::vector<TerrainEntry> &heightfield,
+                    std::vector<BottomEntry> &bottom, float &inlet_x)
+    {
+        SetupValley();
+        SetSetting(SH_MESH_SIZE_X, float(nx));
+        SetSetting(SH_MESH_SIZE_Y, float(ny));
+        GetSimSettings(ss);
+
+        heightfield.resize((nx + 4) * (ny + 4));
+        bottom.resize((nx + 4) * (ny + 4));
+        ComputeTerrainHeightfield(SettingsSnapshot(), &heightfield[0], &bottom[0], inlet_x);
+    }
+
+    // No water can enter or leave: solid walls all round, no inflow, no sea.
+    void CloseBoundaries(SimSettings &ss)
+    {
+        ss.solid_walls = true;
+        ss.inflow_width = 0;
+        ss.use_sea_level = false;
+        for (int i = 0; i < 4; ++i) ss.sa[i] = 0;
+    }
+
+    // Runs the solver for the given number of steps, re-measuring the timestep
+    // as main.cpp does (every 10 steps).
+    void Run(CpuSolver &solver, int steps)
+    {
+        SimStats stats;
+        for (int i = 0; i < steps; ++i) {
+            if (i % 10 == 0) solver.resetTimestep(0.1f, stats);
+            solver.timestep();
+        }
+    }
+
+    // Total water volume over the interior cells
+    double Volume(const CpuSolver &solver, const SimSettings &ss)
+    {
+        const CellState *state = solver.getState();
+        const BottomEntry *bottom = solver.getBottom();
+        double volume = 0;
+        for (int j = 2; j < ss.ny + 2; ++j) {
+            for (int i = 2; i < ss.nx + 2; ++i) {
+                const int k = j * (ss.nx + 4) + i;
+                volume += state[k].w - bottom[k].BA;
+            }
+        }
+        return volume * ss.dx * ss.dy;
+    }
+}
+
+TEST(LakeAtRestStaysStill)
+{
+    SimSettings ss;
+    std::vector<TerrainEntry> heightfield;
+    std::vector<BottomEntry> bottom;
+    float inlet_x;
+    MakeValley(96, 128, ss, heightfield, bottom, inlet_x);
+    CloseBoundaries(ss);
+
+    // a flat surface above the highest point of the terrain, with no velocity
+    float top = bottom[0].BA;
+    for (size_t k = 0; k < bottom.size(); ++k) top = std::max(top, bottom[k].BA);
+    const float level = top + 2;
+    std::vector<float> initial(bottom.size() * 4, 0.0f);
+    for (size_t k = 0; k < bottom.size(); ++k) initial[4*k] = level;
+
+    CpuSolver solver(ss, &bottom[0], NO_INLET, &initial[0]);
+    Run(solver, 200);
+    CHECK(solver.getTotalTime() > 1);
+
+    // the slopes of the bottom balance the pressure differences, up to float
+    // rounding (g h^2 / 2 is several thousand here, so hu of 1e-3 is noise)
+    float max_dw = 0, max_momentum = 0;
+    const CellState *state = solver.getState();
+    for (int j = 2; j < ss.ny + 2; ++j) {
+        for (int i = 2; i < ss.nx + 2; ++i) {
+            const CellState &s = state[j * (ss.nx + 4) + i];
+            max_dw = std::max(max_dw, std::abs(s.w - level));
+            max_momentum = std::max(max_momentum, std::max(std::abs(s.hu), std::abs(s.hv)));
+        }
+    }
+    CHECK(max_dw < 1e-4f);
+    CHECK(max_momentum < 1e-3f);
+}
+
+TEST(MassIsConservedInClosedBox)
+{
+    SimSettings ss;
+    std::vector<TerrainEntry> heightfield;
+    std::vector<BottomEntry> bottom;
+    float inlet_x;
+    MakeValley(96, 128, ss, heightfield, bottom, inlet_x);
+    CloseBoundaries(ss);
+
+    // the valley preset's dam break, with wet and dry areas
+    std::vector<float> initial(bottom.size() * 4);
+    ComputeInitialConditions(SettingsSnapshot(), &heightfield[0], &bottom[0], R_VALLEY, &initial[0]);
+
+    CpuSolver solver(ss, &bottom[0], NO_INLET, &initial[0]);
+    const double volume_before = Volume(solver, ss);
+    Run(solver, 300);
+    const double volume_after = Volume(solver, ss);
+
+    CHECK(volume_before > 0);
+    CHECK(std::abs(volume_after - volume_before) < 1e-4 * volume_before);
+}
+
+TEST(WorkerPoolSizeDoesNotChangeResults)
+{
+    SimSettings ss;
+    std::vector<TerrainEntry> heightfield;
+    std::vector<BottomEntry> bottom;
+    float inlet_x;
+
+    // (an odd size, so that the rows do not divide evenly between the threads;
+    // and the preset's own boundaries and inflow)
+    MakeValley(90, 113, ss, heightfield, bottom, inlet_x);
+    std::vector<float> initial(bottom.size() * 4);
+    ComputeInitialConditions(SettingsSnapshot(), &heightfield[0], &bottom[0], R_VALLEY, &initial[0]);
+    const int n = (ss.nx + 4) * (ss.ny + 4);
+
+    std::vector<CellState> reference;
+    for (int threads = 0; threads <= 5; ++threads) {
+        boost::scoped_ptr<WorkerPool> pool;
+        CpuSolver solver(ss, &bottom[0], inlet_x, &initial[0]);
+        if (threads > 0) {
+            pool.reset(new WorkerPool(threads));
+            solver.setWorkerPool(pool.get());
+        }
+        Run(solver, 100);
+
+        if (threads == 0) {
+            reference.assign(solver.getState(), solver.getState() + n);
+        } else {
+            CHECK(std::memcmp(solver.getState(), &reference[0], n * sizeof(CellState)) == 0);
+        }
+    }
+}
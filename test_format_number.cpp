@@ -0,0 +1,126 @@
+/*
+ * FILE:
+ *   test_format_number.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "format_number.hpp"
+#include "tests.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+namespace {
+    // (a fixed sequence, the same on every platform)
+    struct Random {
+        unsigned long long seed;
+        unsigned long long operator()()
+        {
+            seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+            return seed;
+        }
+    };
+
+    // Whether FormatNumber gives exactly what printf "%g" does
+    bool SameAsPrintf(double value)
+    {
+        char expected[64], buf[FORMAT_NUMBER_SIZE];
+        std::sprintf(expected, "%g", value);
+        const int len = FormatNumber(value, buf);
+        return len == int(std::strlen(buf)) && std::strcmp(buf, expected) == 0;
+    }
+
+    // Checks value and -value
+    int CountMismatches(double value)
+    {
+        return (SameAsPrintf(value) ? 0 : 1) + (SameAsPrintf(-value) ? 0 : 1);
+    }
+}
+
+TEST(FormatNumberSpecialValues)
+{
+    const double values[] = {
+        0.0,
+        std::numeric_limits<double>::denorm_min(),
+        1e-310,
+        std::numeric_limits<double>::min(),
+        1e-300, 1e300,   // (the ends of the range not left to the C library)
+        std::numeric_limits<double>::max(),
+        std::numeric_limits<double>::infinity(),
+        std::numeric_limits<double>::quiet_NaN()
+    };
+    int mismatches = 0;
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+        mismatches += CountMismatches(values[i]);
+    }
+    CHECK(mismatches == 0);
+}
+
+TEST(FormatNumberPowersOfTen)
+{
+    // each power of ten, and the doubles either side of it: the boundaries
+    // between the fixed and scientific forms, and where log10 rounds
+    int mismatches = 0;
+    for (int e = -320; e <= 308; ++e) {
+        const double p = std::pow(10.0, e);
+        mismatches += CountMismatches(p);
+        mismatches += CountMismatches(std::nextafter(p, 0.0));
+        mismatches += CountMismatches(std::nextafter(p, 2 * p));
+    }
+    CHECK(mismatches == 0);
+}
+
+TEST(FormatNumberRoundingBoundaries)
+{
+    int mismatches = 0;
+
+    // values that round up to a new power of ten, or only just do not
+    const double boundaries[] = {
+        9.999995, 9.999994999, 99999.95, 999999.5, 999999.4999,
+        9.999995e-5, 9.9999949e-5, 0.0001, 9.999995e15, 9.999995e-15
+    };
+    for (size_t i = 0; i < sizeof(boundaries) / sizeof(boundaries[0]); ++i) {
+        mismatches += CountMismatches(boundaries[i]);
+    }
+
+    // ties, with seven significant digits ending in 5: exact in binary for the
+    // integers and halves, and as near as a double can be for the rest
+    Random random = { 3 };
+    for (int i = 0; i < 20000; ++i) {
+        const double digits = double(100000 + random() % 900000) * 10 + 5;   // 1000005 .. 9999995
+        const int e = int(random() % 40) - 20;
+        mismatches += CountMismatches(digits * std::pow(10.0, e - 6));
+        mismatches += CountMismatches(digits / 10);
+    }
+    CHECK(mismatches == 0);
+}
+
+TEST(FormatNumberRandomValues)
+{
+    int mismatches = 0;
+    Random random = { 12345 };
+
+    // any bit pattern, so every exponent (and some denormals and NaNs)
+    for (int i = 0; i < 100000; ++i) {
+        const unsigned long long bits = random();
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        mismatches += SameAsPrintf(value) ? 0 : 1;
+    }
+
+    // the sort of values the GUI shows: a few digits, within a few powers of ten
+    for (int i = 0; i < 100000; ++i) {
+        const double digits = double(random() % 100000000);
+        const int e = int(random() % 24) - 12;
+        mismatches += CountMismatches(digits * std::pow(10.0, e));
+    }
+    CHECK(mismatches == 0);
+}
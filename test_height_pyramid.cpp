@@ -0,0 +1,155 @@
+/*
+ * FILE:
+ *   test_height_pyramid.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "height_pyramid.hpp"
+#include "presets.hpp"
+#include "settings.hpp"
+#include "terrain_heightfield.hpp"
+#include "tests.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    const int NX = 160, NY = 240;
+
+    // (a fixed sequence, the same on every platform)
+    struct Random {
+        unsigned int seed;
+        float operator()(float lo, float hi)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            return lo + (hi - lo) * float(seed >> 8) / float(1 << 24);
+        }
+    };
+
+    // The valley preset, with a pattern of water over it
+    void SetupPyramid(HeightPyramid &pyramid)
+    {
+        SetupValley();
+        SetSetting(SH_MESH_SIZE_X, NX);
+        SetSetting(SH_MESH_SIZE_Y, NY);
+        UpdateTerrainHeightfield();
+
+        pyramid.resize(NX, NY, GetSetting(SH_VALLEY_WIDTH), GetSetting(SH_VALLEY_LENGTH));
+        pyramid.updateTerrain(&g_terrain_heightfield[0]);
+
+        HeightPyramid::WaterBlock *water = pyramid.getWater();
+        for (int j = 0; j < pyramid.getBlocksY(); ++j) {
+            for (int i = 0; i < pyramid.getBlocksX(); ++i) {
+                const HeightPyramid::WaterBlock block = { float((i * 3 + j * 5) % 7) * 0.5f, 0, 0 };
+                water[j * pyramid.getBlocksX() + i] = block;
+            }
+        }
+        pyramid.rebuild();
+    }
+
+    // Largest t at which the ray is still over the mesh (0 if it never is)
+    float ExitDistance(float ox, float oy, float dx, float dy, float W, float L)
+    {
+        float t0 = 0, t1 = 1e9f;
+        const float o[2] = { ox, oy }, d[2] = { dx, dy };
+        const float lo[2] = { -W/2, 0 }, hi[2] = { W/2, L };
+        for (int k = 0; k < 2; ++k) {
+            if (d[k] == 0) continue;
+            float ta = (lo[k] - o[k]) / d[k], tb = (hi[k] - o[k]) / d[k];
+            if (ta > tb) std::swap(ta, tb);
+            t0 = std::max(t0, ta);
+            t1 = std::min(t1, tb);
+        }
+        return t0 <= t1 ? t1 : 0;
+    }
+
+    // The straightforward version of castRay: steps along the whole ray, a small
+    // fraction of a mesh cell at a time, then bisects the first crossing.
+    bool MarchRay(const HeightPyramid &pyramid, float ox, float oy, float oz, float dx, float dy, float dz,
+                  float t_min, float t_max, float step, float &t_hit)
+    {
+        struct Gap {
+            const HeightPyramid &pyramid;
+            float ox, oy, oz, dx, dy, dz;
+            float operator()(float t) const { return pyramid.getSurfaceHeight(ox + dx * t, oy + dy * t) - (oz + dz * t); }
+        } gap = { pyramid, ox, oy, oz, dx, dy, dz };
+
+        if (gap(t_min) >= 0) {
+            t_hit = t_min;
+            return true;
+        }
+        for (float ta = t_min; ta < t_max; ta += step) {
+            float tb = std::min(ta + step, t_max);
+            if (gap(tb) >= 0) {
+                for (int b = 0; b < 20; ++b) {
+                    const float tm = 0.5f * (ta + tb);
+                    if (gap(tm) >= 0) tb = tm; else ta = tm;
+                }
+                t_hit = tb;
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+TEST(CastRayMatchesBruteForceMarch)
+{
+    HeightPyramid pyramid;
+    SetupPyramid(pyramid);
+
+    const float W = GetSetting(SH_VALLEY_WIDTH), L = GetSetting(SH_VALLEY_LENGTH);
+    const float cell = std::min(W / (NX - 1), L / (NY - 1));
+
+    Random random = { 12345 };
+    int hits = 0, misses = 0, wrong_hit = 0, wrong_t = 0;
+    for (int r = 0; r < 300; ++r) {
+        // from above the valley, looking down at anything from steeply to
+        // nearly horizontally (the latter often pass right over it)
+        const float ox = random(-W/2, W/2), oy = random(0, L);
+        const float oz = pyramid.getSurfaceHeight(ox, oy) + random(1, 40);
+        const float angle = random(0, 6.2831853f);
+        const float dx = std::cos(angle), dy = std::sin(angle), dz = -random(0.02f, 2);
+
+        const float t_max = ExitDistance(ox, oy, dx, dy, W, L);
+        // (the horizontal distance per unit t is 1. The water is constant over
+        // each block, so the surface has steps at the block edges, and a ray
+        // can clip the corner of one over a very short distance)
+        const float step = cell / 256;
+
+        float t_fast = 0, t_slow = 0;
+        const bool hit_fast = pyramid.castRay(ox, oy, oz, dx, dy, dz, 0, t_max, t_fast);
+        const bool hit_slow = MarchRay(pyramid, ox, oy, oz, dx, dy, dz, 0, t_max, step, t_slow);
+
+        if (hit_fast != hit_slow) ++wrong_hit;
+        else if (hit_fast && std::abs(t_fast - t_slow) > 0.1f * cell) ++wrong_t;
+        if (hit_slow) ++hits; else ++misses;
+    }
+
+    CHECK(wrong_hit == 0);
+    CHECK(wrong_t == 0);
+    CHECK(hits > 100 && misses > 10);   // (so that both cases are covered)
+}
+
+TEST(CastRayMissesAboveSurface)
+{
+    HeightPyramid pyramid;
+    SetupPyramid(pyramid);
+    const float W = GetSetting(SH_VALLEY_WIDTH), L = GetSetting(SH_VALLEY_LENGTH);
+
+    // level (or rising) rays above the highest point never hit
+    const float top = pyramid.getMaxHeight(0, NX - 1, 0, NY - 1);
+    float t;
+    CHECK(!pyramid.castRay(-W/2, 0, top + 1, W, L, 0, 0, 1, t));
+    CHECK(!pyramid.castRay(-W/2, L, top + 1, W, -L, 0.1f, 0, 1, t));
+
+    // and one that starts below it hits at once
+    const float z = pyramid.getSurfaceHeight(0, L/2) - 1;
+    CHECK(pyramid.castRay(0, L/2, z, 1, 0, 0, 0, 10, t) && t == 0);
+}
@@ -0,0 +1,199 @@
+/*
+ * FILE:
+ *   test_patch_quadtree.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "mesh.hpp"
+#include "patch_quadtree.hpp"
+#include "tests.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <set>
+#include <vector>
+
+namespace {
+    // 8 * 8 patches, with a grid spacing of 1 (so that the lod errors of flat
+    // patches are just WATER_SLOPE * 2^lod, see patch_quadtree.cpp)
+    const int NX = 512, NY = 512;
+    const float W = float(NX - 1), L = float(NY - 1);
+
+    // Flat terrain at height 0, except for a rough patch at (ROUGH_PX, ROUGH_PY),
+    // which cannot be drawn at any lod but 0.
+    const int ROUGH_PX = 6, ROUGH_PY = 3;
+
+    void MakeTerrain(std::vector<TerrainEntry> &heightfield)
+    {
+        const TerrainEntry flat = { 0, 0, 0 };
+        heightfield.assign((NX + 4) * (NY + 4), flat);
+        for (int j = ROUGH_PY * PATCH_QUADS; j <= (ROUGH_PY + 1) * PATCH_QUADS; ++j) {
+            for (int i = ROUGH_PX * PATCH_QUADS; i <= (ROUGH_PX + 1) * PATCH_QUADS; ++i) {
+                heightfield[(j + 2) * (NX + 4) + i + 2].B = float((i * 7 + j * 13) % 5) * 20;
+            }
+        }
+    }
+
+    // A tex_to_clip matrix (row major, as select expects) for a camera at
+    // (cx, cy, cz) in texture space, looking along +x (dir = 1) or -x (dir = -1).
+    // Screen x is texture y, screen y is height; the view is +/- 1/f either way.
+    void LookAlongX(float cx, float cy, float cz, float dir, float f, float m[16])
+    {
+        const float near_z = 0.1f, far_z = 10000.0f;
+        const float k = far_z / (far_z - near_z);
+        const float rows[16] = {
+            0,       dir * f, 0, -dir * f * cy,      // x_clip
+            0,       0,       f, -f * cz,            // y_clip
+            dir * k, 0,       0, -k * (dir * cx + near_z),   // z_clip = k * (depth - near)
+            dir,     0,       0, -dir * cx           // w_clip = depth
+        };
+        std::copy(rows, rows + 16, m);
+    }
+
+    // texture space x range of patch column px (as PatchQuadtree::nodeBox)
+    float PatchXMin(int px) { return float(std::min(px * PATCH_QUADS, NX - 1) + 2); }
+    float PatchXMax(int px) { return float(std::min((px + 1) * PATCH_QUADS, NX - 1) + 2); }
+    float PatchYMid(int py) { return 0.5f * float(std::min(py * PATCH_QUADS, NY - 1) + std::min((py + 1) * PATCH_QUADS, NY - 1)) + 2; }
+
+    void SetupQuadtree(PatchQuadtree &quadtree)
+    {
+        std::vector<TerrainEntry> heightfield;
+        MakeTerrain(heightfield);
+        quadtree.resize(NX, NY, W, L);
+        quadtree.updateTerrain(&heightfield[0]);
+    }
+
+    // Selects from far enough back (at x = -300) that every patch is in view,
+    // and near enough that the lods range from about 3 to 5.
+    void SelectWholeMesh(PatchQuadtree &quadtree, float max_pixel_error,
+                         std::vector<PatchQuadtree::DrawItem> &items, std::vector<int> &lod_of_patch)
+    {
+        float m[16];
+        LookAlongX(-300, NY / 2 + 2, 10, 1, 0.5f, m);
+        quadtree.select(m, 200, max_pixel_error, items);
+
+        lod_of_patch.assign(quadtree.getPatchesX() * quadtree.getPatchesY(), -1);
+        for (size_t k = 0; k < items.size(); ++k) {
+            lod_of_patch[items[k].patch] = items[k].lod;
+        }
+    }
+}
+
+TEST(PatchesBehindCameraAreCulled)
+{
+    PatchQuadtree quadtree;
+    SetupQuadtree(quadtree);
+    const int npx = quadtree.getPatchesX(), npy = quadtree.getPatchesY();
+    CHECK(npx == 8 && npy == 8);
+
+    // from the middle of the mesh, looking each way along x
+    const float cx = 4.5f * PATCH_QUADS, cy = NY / 2 + 2, cz = 1;
+    for (int dir = -1; dir <= 1; dir += 2) {
+        float m[16];
+        LookAlongX(cx, cy, cz, float(dir), 0.5f, m);
+
+        std::vector<PatchQuadtree::DrawItem> items;
+        quadtree.select(m, 200, 1, items);
+
+        std::vector<int> drawn(npx * npy, 0);
+        for (size_t k = 0; k < items.size(); ++k) drawn[items[k].patch] = 1;
+
+        for (int py = 0; py < npy; ++py) {
+            for (int px = 0; px < npx; ++px) {
+                // depth of the nearest and furthest points of the patch
+                const float d0 = dir * (PatchXMin(px) - cx), d1 = dir * (PatchXMax(px) - cx);
+                const float d_near = std::min(d0, d1), d_far = std::max(d0, d1);
+
+                if (d_far <= 0) {
+                    // wholly behind the camera
+                    CHECK(!drawn[py * npx + px]);
+                } else if (d_near > 0 && 0.5f * std::abs(PatchYMid(py) - cy) < d_near && cz < 0.5f * d_near) {
+                    // the middle of its near edge is in view
+                    CHECK(drawn[py * npx + px]);
+                }
+            }
+        }
+        CHECK(!items.empty());
+        CHECK(int(items.size()) < npx * npy);
+    }
+}
+
+TEST(NeighbouringLodsDifferByAtMostOne)
+{
+    PatchQuadtree quadtree;
+    SetupQuadtree(quadtree);
+    const int npx = quadtree.getPatchesX(), npy = quadtree.getPatchesY();
+
+    std::vector<PatchQuadtree::DrawItem> items;
+    std::vector<int> lod;
+    SelectWholeMesh(quadtree, 1, items, lod);
+    CHECK(int(items.size()) == npx * npy);
+
+    std::set<int> lods_used;
+    for (int py = 0; py < npy; ++py) {
+        for (int px = 0; px < npx; ++px) {
+            const int l = lod[py * npx + px];
+            lods_used.insert(l);
+            if (px + 1 < npx) CHECK(std::abs(l - lod[py * npx + px + 1]) <= 1);
+            if (py + 1 < npy) CHECK(std::abs(l - lod[(py + 1) * npx + px]) <= 1);
+        }
+    }
+
+    // (so that the limit has actually had to be applied)
+    CHECK(lod[ROUGH_PY * npx + ROUGH_PX] == 0);
+    CHECK(lods_used.size() >= 4);
+}
+
+TEST(StitchMasksMatchNeighbours)
+{
+    PatchQuadtree quadtree;
+    SetupQuadtree(quadtree);
+    const int npx = quadtree.getPatchesX(), npy = quadtree.getPatchesY();
+
+    std::vector<PatchQuadtree::DrawItem> items;
+    std::vector<int> lod;
+    SelectWholeMesh(quadtree, 1, items, lod);
+
+    int stitched = 0;
+    for (size_t k = 0; k < items.size(); ++k) {
+        const PatchQuadtree::DrawItem &item = items[k];
+        const int px = item.patch % npx, py = item.patch / npx;
+
+        // an edge is stitched exactly when the neighbour across it is coarser
+        const bool x_min = px > 0 && lod[item.patch - 1] > item.lod;
+        const bool x_max = px < npx - 1 && lod[item.patch + 1] > item.lod;
+        const bool y_min = py > 0 && lod[item.patch - npx] > item.lod;
+        const bool y_max = py < npy - 1 && lod[item.patch + npx] > item.lod;
+
+        CHECK(((item.stitch & STITCH_X_MIN) != 0) == x_min);
+        CHECK(((item.stitch & STITCH_X_MAX) != 0) == x_max);
+        CHECK(((item.stitch & STITCH_Y_MIN) != 0) == y_min);
+        CHECK(((item.stitch & STITCH_Y_MAX) != 0) == y_max);
+        CHECK(item.stitch >= 0 && item.stitch < NUM_STITCH_MASKS);
+        if (item.stitch) ++stitched;
+    }
+    CHECK(stitched > 0);
+}
+
+TEST(ZeroPixelErrorSelectsLodZero)
+{
+    PatchQuadtree quadtree;
+    SetupQuadtree(quadtree);
+    const int npx = quadtree.getPatchesX(), npy = quadtree.getPatchesY();
+
+    std::vector<PatchQuadtree::DrawItem> items;
+    std::vector<int> lod;
+    SelectWholeMesh(quadtree, 0, items, lod);
+
+    CHECK(int(items.size()) == npx * npy);
+    for (size_t k = 0; k < items.size(); ++k) {
+        CHECK(items[k].lod == 0);
+        CHECK(items[k].stitch == 0);
+    }
+}
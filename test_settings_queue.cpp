@@ -0,0 +1,126 @@
+/*
+ * FILE:
+ *   test_settings_queue.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "presets.hpp"
+#include "settings.hpp"
+#include "settings_queue.hpp"
+#include "tests.hpp"
+
+namespace {
+    // index into g_settings, as SettingsQueue::set takes
+    int SettingIndex(SettingHandle h)
+    {
+        return int(g_setting_handles[h] - g_settings);
+    }
+}
+
+TEST(SettingsQueueAppliesCheapEditsAtOnce)
+{
+    SetupValley();
+    SettingsQueue queue;
+    const float gravity = GetSetting(SH_GRAVITY), fov = GetSetting(SH_FOV);
+
+    queue.set(SettingIndex(SH_GRAVITY), gravity + 1);
+    queue.set(SettingIndex(SH_FOV), fov + 1);
+    CHECK(GetSetting(SH_GRAVITY) == gravity);   // (not until update)
+
+    const SettingsChange change = queue.update(1000);
+    CHECK(change.reset_type == R_NONE);
+    CHECK(change.simulation);
+    CHECK(GetSetting(SH_GRAVITY) == gravity + 1);
+    CHECK(GetSetting(SH_FOV) == fov + 1);
+    CHECK(!queue.isRebuildPending());
+
+    // a constants-only edit does not need the SimSettings re-read
+    queue.set(SettingIndex(SH_FOV), fov);
+    CHECK(!queue.update(1001).simulation);
+    CHECK(GetSetting(SH_FOV) == fov);
+
+    SetupValley();
+}
+
+TEST(SettingsQueueDebouncesTerrainEdits)
+{
+    SetupValley();
+    SettingsQueue queue;
+    const int wall = SettingIndex(SH_VALLEY_WALL_HEIGHT);
+    const float wall_height = GetSetting(SH_VALLEY_WALL_HEIGHT);
+
+    // a slider being dragged: only the last value is used, once it settles
+    queue.set(wall, wall_height + 1);
+    CHECK(queue.update(1000).reset_type == R_NONE);
+    queue.set(wall, wall_height + 2);
+    CHECK(queue.update(1100).reset_type == R_NONE);
+    CHECK(queue.update(1349).reset_type == R_NONE);
+    CHECK(!queue.isRebuildPending());
+    CHECK(queue.update(1350).reset_type == R_TERRAIN);
+    CHECK(queue.isRebuildPending());
+
+    // g_settings keeps the old value until the rebuild is switched in
+    CHECK(GetSetting(SH_VALLEY_WALL_HEIGHT) == wall_height);
+    SettingsSnapshot snapshot;
+    queue.getRebuildSettings(snapshot);
+    CHECK(snapshot.get(SH_VALLEY_WALL_HEIGHT) == wall_height + 2);
+
+    queue.commitRebuild();
+    CHECK(GetSetting(SH_VALLEY_WALL_HEIGHT) == wall_height + 2);
+    CHECK(!queue.isRebuildPending());
+
+    // setting it to the value it already has starts nothing
+    queue.set(wall, wall_height + 2);
+    CHECK(queue.update(2000).reset_type == R_NONE);
+    CHECK(queue.update(3000).reset_type == R_NONE);
+    CHECK(!queue.isRebuildPending());
+
+    SetupValley();
+}
+
+TEST(SettingsQueueHoldsEditsDuringRebuild)
+{
+    SetupValley();
+    SettingsQueue queue;
+    const float wall_height = GetSetting(SH_VALLEY_WALL_HEIGHT);
+    const float channel_depth = GetSetting(SH_CHANNEL_DEPTH_TOP);
+    const int mesh_size = GetIntSetting(SH_MESH_SIZE_X);
+
+    // a reset starts at once, with no debounce
+    queue.set(SettingIndex(SH_VALLEY_WALL_HEIGHT), wall_height + 1);
+    queue.reset(R_MESH);
+    CHECK(queue.update(1000).reset_type == R_MESH);
+
+    // edits made while it is building wait for the next one, in order:
+    // the later edit to a setting wins, and a remesh edit makes it a remesh
+    queue.set(SettingIndex(SH_CHANNEL_DEPTH_TOP), channel_depth + 1);
+    queue.set(SettingIndex(SH_MESH_SIZE_X), mesh_size + 4);
+    queue.set(SettingIndex(SH_CHANNEL_DEPTH_TOP), channel_depth + 2);
+    CHECK(queue.update(2000).reset_type == R_NONE);
+    CHECK(queue.update(5000).reset_type == R_NONE);
+
+    SettingsSnapshot snapshot;
+    queue.getRebuildSettings(snapshot);
+    CHECK(snapshot.get(SH_VALLEY_WALL_HEIGHT) == wall_height + 1);
+    CHECK(snapshot.get(SH_CHANNEL_DEPTH_TOP) == channel_depth);
+
+    queue.commitRebuild();
+    CHECK(GetSetting(SH_VALLEY_WALL_HEIGHT) == wall_height + 1);
+    CHECK(GetSetting(SH_CHANNEL_DEPTH_TOP) == channel_depth);
+
+    CHECK(queue.update(5001).reset_type == R_MESH);
+    queue.getRebuildSettings(snapshot);
+    CHECK(snapshot.get(SH_CHANNEL_DEPTH_TOP) == channel_depth + 2);
+    CHECK(snapshot.getInt(SH_MESH_SIZE_X) == mesh_size + 4);
+    queue.commitRebuild();
+    CHECK(GetSetting(SH_CHANNEL_DEPTH_TOP) == channel_depth + 2);
+    CHECK(GetIntSetting(SH_MESH_SIZE_X) == mesh_size + 4);
+
+    SetupValley();
+}
@@ -0,0 +1,111 @@
+/*
+ * FILE:
+ *   test_terrain_build.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "initial_conditions.hpp"
+#include "patch_quadtree.hpp"
+#include "presets.hpp"
+#include "settings.hpp"
+#include "terrain_build.hpp"
+#include "terrain_heightfield.hpp"
+#include "tests.hpp"
+
+#include <cstring>
+#include <set>
+#include <vector>
+
+namespace {
+    // Looks straight down on the whole mesh (orthographic, so every patch is
+    // at depth 1), so the lods chosen depend only on the lod errors.
+    void TopDown(int nx, int ny, float m[16])
+    {
+        const float rows[16] = {
+            2.0f / (nx + 4), 0,               0, -1,
+            0,               2.0f / (ny + 4), 0, -1,
+            0,               0,               0, 0.5f,
+            0,               0,               0, 1
+        };
+        std::memcpy(m, rows, sizeof(rows));
+    }
+
+    // Whether the two quadtrees make the same choices at a range of pixel errors.
+    // Also counts the distinct lods chosen, so that the comparison means something.
+    bool SameSelections(PatchQuadtree &a, PatchQuadtree &b, int nx, int ny, int &lods_used)
+    {
+        float m[16];
+        TopDown(nx, ny, m);
+
+        std::set<int> lods;
+        bool same = true;
+        for (float err = 0.5f; err <= 64; err *= 2) {
+            std::vector<PatchQuadtree::DrawItem> items_a, items_b;
+            a.select(m, 1, err, items_a);
+            b.select(m, 1, err, items_b);
+
+            same = same && items_a.size() == items_b.size();
+            for (size_t k = 0; same && k < items_a.size(); ++k) {
+                same = items_a[k].patch == items_b[k].patch
+                    && items_a[k].lod == items_b[k].lod
+                    && items_a[k].stitch == items_b[k].stitch;
+                lods.insert(items_a[k].lod);
+            }
+        }
+        lods_used = int(lods.size());
+        return same;
+    }
+}
+
+TEST(TerrainBuildMatchesSynchronousBuild)
+{
+    SetupValley();
+    SetSetting(SH_MESH_SIZE_X, 160);
+    SetSetting(SH_MESH_SIZE_Y, 120);
+    const int nx = 160, ny = 120, n = (nx + 4) * (ny + 4);
+
+    TerrainBuild build(R_VALLEY, SettingsSnapshot());
+
+    // (the build has its own copy of the settings, so this must make no difference)
+    const float wall_height = GetSetting(SH_VALLEY_WALL_HEIGHT);
+    SetSetting(SH_VALLEY_WALL_HEIGHT, wall_height + 10);
+    build.wait();
+    SetSetting(SH_VALLEY_WALL_HEIGHT, wall_height);
+
+    // the synchronous build, as it was done before TerrainBuild
+    UpdateTerrainHeightfield();
+    std::vector<float> initial_state(n * 4);
+    ComputeInitialConditions(R_VALLEY, &initial_state[0]);
+    PatchQuadtree quadtree;
+    quadtree.resize(nx, ny, GetSetting(SH_VALLEY_WIDTH), GetSetting(SH_VALLEY_LENGTH));
+    quadtree.updateTerrain(&g_terrain_heightfield[0]);
+
+    CHECK(build.isReady());
+    CHECK(build.getNX() == nx && build.getNY() == ny);
+    CHECK(std::memcmp(&build.getHeightfield()[0], &g_terrain_heightfield[0], n * sizeof(TerrainEntry)) == 0);
+    CHECK(std::memcmp(&build.getBottom()[0], &g_bottom[0], n * sizeof(BottomEntry)) == 0);
+    CHECK(build.getInletX() == g_inlet_x);
+    CHECK(build.getInitialState().size() == initial_state.size());
+    CHECK(std::memcmp(&build.getInitialState()[0], &initial_state[0], n * 4 * sizeof(float)) == 0);
+
+    // (select is not const, so use a copy)
+    PatchQuadtree built_quadtree = build.getQuadtree();
+    int lods_used = 0;
+    CHECK(SameSelections(built_quadtree, quadtree, nx, ny, lods_used));
+    CHECK(lods_used > 2);
+}
+
+TEST(TerrainOnlyBuildHasNoInitialState)
+{
+    SetupValley();
+    TerrainBuild build(R_TERRAIN, SettingsSnapshot());
+    build.wait();
+    CHECK(build.getInitialState().empty());
+    CHECK(build.getHeightfield() && build.getBottom());
+}
@@ -0,0 +1,224 @@
+/*
+ * FILE:
+ *   test_terrain_update.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "brush_log.hpp"
+#include "cpu_solver.hpp"
+#include "initial_conditions.hpp"
+#include "presets.hpp"
+#include "settings.hpp"
+#include "sim_thread.hpp"
+#include "terrain_heightfield.hpp"
+#include "tests.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+namespace {
+    // A still lake of depth LAKE_DEPTH on a flat bottom at the given height,
+    // in a closed box (solid walls, no inflow, no sea), so that nothing moves
+    // unless a brush stroke disturbs it.
+    const int LAKE_N = 64;
+    const float LAKE_DEPTH = 1.0f;
+
+    void MakeLakeSettings(SimSettings &ss)
+    {
+        GetSimSettings(ss);
+        ss.nx = ss.ny = LAKE_N;
+        ss.W = ss.L = float(LAKE_N - 1);
+        ss.dx = ss.dy = 1;
+        ss.solid_walls = true;
+        ss.inflow_width = 0;
+        ss.use_sea_level = false;
+        for (int i = 0; i < 4; ++i) ss.sa[i] = 0;
+
+        // (a tiny timestep, so that the water hardly moves between the strokes
+        // and the end of the test)
+        ss.time_acceleration = 1e-6f;
+    }
+
+    void MakeFlatBottom(float height, std::vector<BottomEntry> &bottom)
+    {
+        const BottomEntry b = { height, height, height };
+        bottom.assign((LAKE_N + 4) * (LAKE_N + 4), b);
+    }
+
+    void MakeLake(const std::vector<BottomEntry> &bottom, std::vector<float> &state)
+    {
+        state.assign(bottom.size() * 4, 0.0f);
+        for (size_t k = 0; k < bottom.size(); ++k) state[4*k] = bottom[k].BA + LAKE_DEPTH;
+    }
+
+    // (the inlet is off the mesh)
+    const float NO_INLET = 1000;
+
+    BrushEvent RaiseTerrain(float x, float y)
+    {
+        BrushEvent ev = { 0, LM_RAISE_TERRAIN, x, y, 5, 1, 1 };
+        return ev;
+    }
+
+    // The change to BA that ev makes, per cell
+    void GetBump(const SimSettings &ss, const BrushEvent &ev, std::vector<float> &bump)
+    {
+        BrushBatch batch(ss.nx, ss.ny, ss.W, ss.L);
+        batch.add(ev);
+        bump.resize((ss.nx + 4) * (ss.ny + 4));
+        for (size_t k = 0; k < bump.size(); ++k) bump[k] = batch.getBottomDelta()[k].BA;
+    }
+
+    float MaxDepthError(const SimFrame &frame, const std::vector<BottomEntry> &bottom)
+    {
+        float err = 0;
+        for (size_t k = 0; k < bottom.size(); ++k) {
+            err = std::max(err, std::abs(frame.state[k].w - bottom[k].BA - LAKE_DEPTH));
+        }
+        return err;
+    }
+}
+
+TEST(UpdateTerrainKeepsWaterDepth)
+{
+    SetupValley();
+    SetSetting(SH_MESH_SIZE_X, 128);
+    SetSetting(SH_MESH_SIZE_Y, 128);
+    SimSettings ss;
+    GetSimSettings(ss);
+    const int n = (ss.nx + 4) * (ss.ny + 4);
+
+    std::vector<TerrainEntry> terrain1(n), terrain2(n);
+    std::vector<BottomEntry> bottom1(n), bottom2(n);
+    float inlet1, inlet2;
+    SettingsSnapshot settings1;
+    ComputeTerrainHeightfield(settings1, &terrain1[0], &bottom1[0], inlet1);
+    std::vector<float> initial(n * 4);
+    ComputeInitialConditions(settings1, &terrain1[0], &bottom1[0], R_VALLEY, &initial[0]);
+
+    SetSetting(SH_VALLEY_WALL_HEIGHT, GetSetting(SH_VALLEY_WALL_HEIGHT) + 3);
+    SetSetting(SH_CHANNEL_DEPTH_TOP, GetSetting(SH_CHANNEL_DEPTH_TOP) + 2);
+    SetSetting(SH_MEANDER_AMPLITUDE, GetSetting(SH_MEANDER_AMPLITUDE) + 5);
+    SettingsSnapshot settings2;
+    ComputeTerrainHeightfield(settings2, &terrain2[0], &bottom2[0], inlet2);
+    SetupValley();
+
+    CpuSolver solver(ss, &bottom1[0], inlet1, &initial[0]);
+    for (int i = 0; i < 20; ++i) solver.timestep();
+    const std::vector<CellState> before(solver.getState(), solver.getState() + n);
+
+    solver.updateTerrain(&bottom2[0], inlet2);
+
+    float max_depth_change = 0, max_dBA = 0;
+    bool same_momentum = true, new_bottom = true;
+    for (int k = 0; k < n; ++k) {
+        const CellState &after = solver.getState()[k];
+        const float depth_before = before[k].w - bottom1[k].BA;
+        const float depth_after = after.w - bottom2[k].BA;
+        max_depth_change = std::max(max_depth_change, std::abs(depth_after - depth_before));
+        max_dBA = std::max(max_dBA, std::abs(bottom2[k].BA - bottom1[k].BA));
+        same_momentum = same_momentum && after.hu == before[k].hu && after.hv == before[k].hv;
+        new_bottom = new_bottom && solver.getBottom()[k].BA == bottom2[k].BA;
+    }
+    CHECK(max_depth_change < 1e-4f);
+    CHECK(max_dBA > 1);   // (so that the terrain really did change)
+    CHECK(same_momentum);
+    CHECK(new_bottom);
+
+    solver.timestep();
+    bool finite = true;
+    for (int k = 0; k < n; ++k) finite = finite && std::abs(solver.getState()[k].w) < 1e6f;
+    CHECK(finite);
+}
+
+TEST(SetTerrainSkipsStaleFrames)
+{
+    SimSettings ss;
+    MakeLakeSettings(ss);
+    std::vector<BottomEntry> bottom1, bottom2;
+    MakeFlatBottom(0, bottom1);
+    MakeFlatBottom(0.5f, bottom2);
+    std::vector<float> initial;
+    MakeLake(bottom1, initial);
+
+    SimThread thread(ss, &bottom1[0], NO_INLET, &initial[0], 0, 2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    // Every frame from now on must be of the new terrain (w raised by 0.5)
+    thread.setTerrain(&bottom2[0], NO_INLET);
+    int new_frames = 0;
+    for (int i = 0; i < 2000 && new_frames < 5; ++i) {
+        const SimFrame *frame = thread.getLatestFrame();
+        if (frame) {
+            CHECK(frame->terrain_changes == 1);
+            CHECK(MaxDepthError(*frame, bottom2) < 1e-4f);
+            ++new_frames;
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    CHECK(new_frames == 5);
+
+    // A change the thread has not picked up by the time it stops still applies
+    thread.setTerrain(&bottom1[0], NO_INLET);
+    thread.stop();
+    CHECK(thread.getCurrentFrame().terrain_changes == 2);
+    CHECK(MaxDepthError(thread.getCurrentFrame(), bottom1) < 1e-4f);
+}
+
+TEST(SetTerrainDropsEarlierBrushes)
+{
+    SimSettings ss;
+    MakeLakeSettings(ss);
+    std::vector<BottomEntry> bottom1, bottom2;
+    MakeFlatBottom(0, bottom1);
+    MakeFlatBottom(0.5f, bottom2);
+    std::vector<float> initial;
+    MakeLake(bottom1, initial);
+
+    const BrushEvent stroke_a = RaiseTerrain(-15, 20), stroke_b = RaiseTerrain(15, 40);
+    std::vector<float> bump_a, bump_b;
+    GetBump(ss, stroke_a, bump_a);
+    GetBump(ss, stroke_b, bump_b);
+    const int centre_b = int(std::max_element(bump_b.begin(), bump_b.end()) - bump_b.begin());
+    CHECK(bump_b[centre_b] > 0.5f);
+
+    SimThread thread(ss, &bottom1[0], NO_INLET, &initial[0], 0, 2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    // Stroke a is either dropped, or applied to the old terrain and then
+    // replaced along with it; stroke b is applied to the new terrain.
+    // Either way, only stroke b shows in the end.
+    CHECK(thread.addBrushEvent(stroke_a));
+    thread.setTerrain(&bottom2[0], NO_INLET);
+    CHECK(thread.addBrushEvent(stroke_b));
+
+    for (int i = 0; i < 5000; ++i) {
+        const SimFrame *frame = thread.getLatestFrame();
+        if (frame && frame->state[centre_b].w > bottom2[centre_b].BA + LAKE_DEPTH + 0.5f * bump_b[centre_b]) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    thread.stop();
+
+    // The water depth is unchanged everywhere, so w follows the new bottom plus stroke b
+    const SimFrame &frame = thread.getCurrentFrame();
+    CHECK(frame.terrain_changes == 1);
+    float max_error = 0;
+    bool separate = true;   // (the two strokes do not overlap)
+    for (size_t k = 0; k < bottom2.size(); ++k) {
+        const float expected_w = bottom2[k].BA + bump_b[k] + LAKE_DEPTH;
+        max_error = std::max(max_error, std::abs(frame.state[k].w - expected_w));
+        separate = separate && (bump_a[k] == 0 || bump_b[k] == 0);
+    }
+    CHECK(max_error < 1e-3f);
+    CHECK(separate);
+}
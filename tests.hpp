@@ -0,0 +1,45 @@
+/*
+ * FILE:
+ *   tests.hpp
+ *
+ * PURPOSE:
+ *   Minimal support for the headless checks (shallow_water_tests).
+ *   Each test_*.cpp file defines its tests with TEST(name) { ... },
+ *   using CHECK(condition) for the things that must hold; a failed
+ *   CHECK is reported (with its file and line) and the test carries
+ *   on. tests_main.cpp runs every test, or just the ones named on
+ *   the command line.
+ *
+ *   Like the batch runner and the benchmark, the tests need no
+ *   window, GUI or D3D.
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef TESTS_HPP
+#define TESTS_HPP
+
+typedef void (*TestFunction)();
+
+// Adds a test to the list run by tests_main.cpp (see TEST).
+struct RegisterTest {
+    RegisterTest(const char *name, TestFunction func);
+};
+
+// Reports a failed CHECK.
+void CheckFailed(const char *file, int line, const char *condition);
+
+#define TEST(name) \
+    static void name(); \
+    static RegisterTest name##_registration(#name, name); \
+    static void name()
+
+#define CHECK(condition) \
+    do { if (!(condition)) CheckFailed(__FILE__, __LINE__, #condition); } while (0)
+
+#endif
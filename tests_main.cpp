@@ -0,0 +1,83 @@
+/*
+ * FILE:
+ *   tests_main.cpp
+ *
+ * PURPOSE:
+ *   Runs the headless checks (see tests.hpp). Returns non-zero if
+ *   any of them fail.
+ *
+ *   Usage: shallow_water_tests [<test name>...]
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "tests.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <vector>
+
+namespace {
+    struct Test {
+        const char *name;
+        TestFunction func;
+    };
+
+    // (a function static, so that it is set up before the first RegisterTest,
+    // whichever file that is in)
+    std::vector<Test> & GetTests()
+    {
+        static std::vector<Test> tests;
+        return tests;
+    }
+
+    int g_failed_checks = 0;
+}
+
+RegisterTest::RegisterTest(const char *name, TestFunction func)
+{
+    Test t = { name, func };
+    GetTests().push_back(t);
+}
+
+void CheckFailed(const char *file, int line, const char *condition)
+{
+    std::fprintf(stderr, "%s(%d): CHECK(%s) failed\n", file, line, condition);
+    ++g_failed_checks;
+}
+
+int main(int argc, char **argv)
+{
+    const std::vector<Test> &tests = GetTests();
+    int run = 0, failed = 0;
+
+    for (size_t i = 0; i < tests.size(); ++i) {
+        bool wanted = (argc == 1);
+        for (int a = 1; a < argc; ++a) {
+            if (std::strcmp(argv[a], tests[i].name) == 0) wanted = true;
+        }
+        if (!wanted) continue;
+
+        const int failed_before = g_failed_checks;
+        try {
+            tests[i].func();
+        } catch (std::exception &e) {
+            std::fprintf(stderr, "%s: exception: %s\n", tests[i].name, e.what());
+            ++g_failed_checks;
+        }
+
+        const bool ok = (g_failed_checks == failed_before);
+        std::printf("%-40s %s\n", tests[i].name, ok ? "ok" : "FAILED");
+        ++run;
+        if (!ok) ++failed;
+    }
+
+    std::printf("%d test(s) run, %d failed\n", run, failed);
+    return (failed > 0 || run == 0) ? 1 : 0;
+}
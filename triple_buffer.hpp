@@ -0,0 +1,70 @@
+/*
+ * FILE:
+ *   triple_buffer.hpp
+ *
+ * PURPOSE:
+ *   Lock-free handoff of the latest value of something from one
+ *   thread (the writer) to another (the reader), e.g. completed
+ *   simulation states from the simulation thread to the render
+ *   thread. Neither side ever waits for the other: the writer
+ *   always has a buffer of its own to fill, and the reader always
+ *   has the most recently published buffer to look at. Values that
+ *   are published but never read are simply overwritten.
+ *
+ *   The three buffers are reused, so a T holding vectors only
+ *   allocates the first few times round.
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef TRIPLE_BUFFER_HPP
+#define TRIPLE_BUFFER_HPP
+
+#include <atomic>
+
+template<class T>
+class TripleBuffer {
+public:
+    TripleBuffer() : back(0), middle(1), front(2) { }
+
+    // Writer: fill in getWriteBuffer(), then publish() it.
+    T & getWriteBuffer() { return buffers[back]; }
+    void publish()
+    {
+        back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & ~FRESH;
+    }
+
+    // Writer: true if the reader has not picked up the last published buffer yet
+    // (so that publishing another would just overwrite it).
+    bool isPending() const { return (middle.load(std::memory_order_relaxed) & FRESH) != 0; }
+
+    // Reader: update() switches to the most recently published buffer, if
+    // there is a new one (returning false if not). getReadBuffer() stays
+    // valid until the next update().
+    bool update()
+    {
+        if ((middle.load(std::memory_order_relaxed) & FRESH) == 0) return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & ~FRESH;
+        return true;
+    }
+    const T & getReadBuffer() const { return buffers[front]; }
+
+private:
+    TripleBuffer(const TripleBuffer &);
+    void operator=(const TripleBuffer &);
+
+    // set in 'middle' when it holds a buffer the reader has not seen
+    enum { FRESH = 4 };
+
+    T buffers[3];
+    int back;                  // writer's buffer
+    std::atomic<int> middle;   // last published buffer (| FRESH)
+    int front;                 // reader's buffer
+};
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ * FILE:
+ *   value_label.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "format_number.hpp"
+#include "value_label.hpp"
+
+#include "coercri/gfx/rectangle.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    // Widths of the characters FormatNumber produces, and the kerning between
+    // each pair, measured through the font the first time they are needed.
+    // (All the labels share the one global font, so one table is enough.)
+    const char GLYPHS[] = "0123456789.-+e";
+    const int NUM_GLYPHS = sizeof(GLYPHS) - 1;
+
+    struct GlyphWidths {
+        const gcn::Font *font;
+        int width[NUM_GLYPHS];
+        int kern[NUM_GLYPHS][NUM_GLYPHS];
+    };
+    GlyphWidths g_glyph_widths = { 0 };
+
+    int GlyphIndex(char c)
+    {
+        if (c >= '0' && c <= '9') return c - '0';
+        const char *p = std::strchr(GLYPHS + 10, c);
+        return p && c ? int(p - GLYPHS) : -1;
+    }
+
+    void MeasureGlyphs(const gcn::Font *font)
+    {
+        g_glyph_widths.font = font;
+        for (int i = 0; i < NUM_GLYPHS; ++i) {
+            g_glyph_widths.width[i] = font->getWidth(std::string(1, GLYPHS[i]));
+        }
+        for (int i = 0; i < NUM_GLYPHS; ++i) {
+            for (int j = 0; j < NUM_GLYPHS; ++j) {
+                std::string pair(1, GLYPHS[i]);
+                pair += GLYPHS[j];
+                g_glyph_widths.kern[i][j] = font->getWidth(pair)
+                    - g_glyph_widths.width[i] - g_glyph_widths.width[j];
+            }
+        }
+    }
+}
+
+ValueLabel::ValueLabel()
+    : value(0), has_value(false), dirty_region(0), dirty_root(0)
+{
+    caption.reserve(FORMAT_NUMBER_SIZE);
+    setHeight(getFont()->getHeight());
+}
+
+void ValueLabel::setValue(double new_value)
+{
+    if (has_value && new_value == value) return;
+    value = new_value;
+    has_value = true;
+
+    char buf[FORMAT_NUMBER_SIZE];
+    const int len = FormatNumber(new_value, buf);
+    if (caption.compare(buf) == 0) return;   // same digits
+
+    caption.assign(buf, len);
+
+    const int old_w = getWidth();
+    const int w = measureCaption();
+    if (w != old_w) setWidth(w);
+
+    invalidate(std::max(w, old_w));
+}
+
+void ValueLabel::setDirtyRegion(Coercri::Region *region, const gcn::Widget *root)
+{
+    dirty_region = region;
+    dirty_root = root;
+}
+
+void ValueLabel::invalidate(int width)
+{
+    if (!dirty_region) return;
+
+    const gcn::Widget *top = this;
+    while (top->getParent()) top = top->getParent();
+    if (top != dirty_root) return;
+
+    int x, y;
+    getAbsolutePosition(x, y);
+    dirty_region->addRectangle(Coercri::Rectangle(x, y, width, getHeight()));
+}
+
+int ValueLabel::measureCaption() const
+{
+    const gcn::Font *font = getFont();
+    if (g_glyph_widths.font != font) MeasureGlyphs(font);
+
+    int w = 0;
+    int prev = -1;
+    for (std::string::const_iterator it = caption.begin(); it != caption.end(); ++it) {
+        const int g = GlyphIndex(*it);
+        if (g < 0) return font->getWidth(caption);   // "inf" or "nan"
+        w += g_glyph_widths.width[g];
+        if (prev >= 0) w += g_glyph_widths.kern[prev][g];
+        prev = g;
+    }
+    return w;
+}
+
+void ValueLabel::draw(gcn::Graphics *graphics)
+{
+    graphics->setFont(getFont());
+    graphics->setColor(getForegroundColor());
+    graphics->drawText(caption, 0, getHeight() / 2 - getFont()->getHeight() / 2);
+}
@@ -0,0 +1,63 @@
+/*
+ * FILE:
+ *   value_label.hpp
+ *
+ * PURPOSE:
+ *   Label widget for the numbers in the GUI (slider values and the
+ *   live statistics), which are updated every few frames.
+ *
+ *   gcn::Label would need a std::string for every update, and
+ *   re-measures the text through the font each time. ValueLabel
+ *   instead formats into a fixed buffer, does nothing at all if the
+ *   value or the text has not changed, and measures the text from a
+ *   table of glyph widths cached from the font. So updating a label
+ *   never allocates, and costs about the same however many labels
+ *   there are.
+ *
+ *   The label can also record where it has changed in a Region, so
+ *   that only those parts of the GUI need to be redrawn.
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef VALUE_LABEL_HPP
+#define VALUE_LABEL_HPP
+
+#include "coercri/gfx/region.hpp"
+
+#include "guichan.hpp"
+
+#include <string>
+
+class ValueLabel : public gcn::Widget {
+public:
+    ValueLabel();
+
+    // Changes the text to the given value. The width follows the text,
+    // but is only reset when it changes.
+    void setValue(double value);
+
+    // Text changes will add the label's (absolute) rectangle to the region,
+    // while the label is inside root, i.e. not on a hidden tab.
+    void setDirtyRegion(Coercri::Region *region, const gcn::Widget *root);
+
+    void draw(gcn::Graphics *graphics);
+
+private:
+    int measureCaption() const;
+    void invalidate(int width);
+
+    double value;
+    bool has_value;
+    std::string caption;   // capacity reserved up front, so assigning to it does not allocate
+
+    Coercri::Region *dirty_region;
+    const gcn::Widget *dirty_root;
+};
+
+#endif
@@ -0,0 +1,87 @@
+/*
+ * FILE:
+ *   worker_pool.cpp
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#include "worker_pool.hpp"
+
+#include <algorithm>
+
+WorkerPool::WorkerPool(int num_threads)
+    : generation(0), busy_threads(0), quit(false), job(0), num_tasks(0), next_task(0)
+{
+    if (num_threads <= 0) num_threads = std::max(1, int(std::thread::hardware_concurrency()));
+
+    for (int i = 1; i < num_threads; ++i) {
+        threads.push_back(std::thread(&WorkerPool::threadMain, this));
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    start_cv.notify_all();
+    for (size_t i = 0; i < threads.size(); ++i) threads[i].join();
+}
+
+void WorkerPool::run(Job &j, int n)
+{
+    if (threads.empty() || n <= 1) {
+        for (int i = 0; i < n; ++i) j.run(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &j;
+        num_tasks = n;
+        next_task = 0;
+        busy_threads = int(threads.size());
+        ++generation;
+    }
+    start_cv.notify_all();
+
+    doTasks();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (busy_threads > 0) done_cv.wait(lock);
+    job = 0;
+}
+
+void WorkerPool::threadMain()
+{
+    unsigned int seen_generation = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (generation == seen_generation && !quit) start_cv.wait(lock);
+            if (quit) return;
+            seen_generation = generation;
+        }
+
+        doTasks();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busy_threads == 0) done_cv.notify_one();
+        }
+    }
+}
+
+void WorkerPool::doTasks()
+{
+    for (int i = next_task++; i < num_tasks; i = next_task++) {
+        job->run(i);
+    }
+}
@@ -0,0 +1,71 @@
+/*
+ * FILE:
+ *   worker_pool.hpp
+ *
+ * PURPOSE:
+ *   A fixed set of worker threads for splitting one piece of work
+ *   (e.g. one pass of the CPU solver) into tasks. The threads are
+ *   created once and sleep between calls to run(), so it is cheap
+ *   enough to use several times per timestep.
+ *
+ *   The thread calling run() takes part in the work, so a pool of
+ *   N threads has N-1 threads of its own. Only one thread may call
+ *   run() at a time.
+ *
+ * AUTHOR:
+ *   Stephen Thompson <stephen@solarflare.org.uk>
+ *
+ * COPYRIGHT:
+ *   Copyright (C) 2012, Stephen Thompson. All rights reserved.
+ *
+ */
+
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkerPool {
+public:
+    class Job {
+    public:
+        virtual ~Job() { }
+        virtual void run(int task) = 0;
+    };
+
+    // num_threads <= 0 means one per hardware thread.
+    explicit WorkerPool(int num_threads);
+    ~WorkerPool();
+
+    int getNumThreads() const { return int(threads.size()) + 1; }
+
+    // Calls job.run(0) ... job.run(num_tasks - 1), in any order and on any of
+    // the threads, and returns when they have all finished.
+    void run(Job &job, int num_tasks);
+
+private:
+    WorkerPool(const WorkerPool &);
+    void operator=(const WorkerPool &);
+
+    void threadMain();
+    void doTasks();
+
+private:
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    std::condition_variable start_cv, done_cv;
+    unsigned int generation;    // incremented by each run()
+    int busy_threads;           // pool threads still working on this generation
+    bool quit;
+
+    Job *job;
+    int num_tasks;
+    std::atomic<int> next_task;
+};
+
+#endif